@@ -41,6 +41,15 @@ class PNaClABIErrorReporter {
     ErrorCount++;
     return Errors;
   }
+  // Adds the error messages of Other to this reporter, and resets
+  // Other. Used to collect errors found by reporters local to a thread
+  // in a deterministic order.
+  void mergeErrors(PNaClABIErrorReporter &Other) {
+    Other.Errors.flush();
+    ErrorCount += Other.ErrorCount;
+    Errors << Other.ErrorString;
+    Other.reset();
+  }
   // Reset the error count and error messages.
   void reset() {
     ErrorCount = 0;
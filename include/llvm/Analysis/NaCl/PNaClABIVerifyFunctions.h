@@ -58,8 +58,23 @@ class PNaClABIVerifyFunctions : public FunctionPass {
   bool runOnFunction(Function &F);
   virtual void print(raw_ostream &O, const Module *M) const;
 
+  // Verifies the body of F, adding the errors found to Reporter rather
+  // than the reporter of the pass. Only reads F and the state set up by
+  // doInitialization, so that functions can be verified on several
+  // threads, each with a reporter of its own.
+  void verifyFunction(const Function &F, const DataLayout *DL,
+                      PNaClABIErrorReporter &Reporter) const;
+
+  // Verifies a single instruction of a function body, adding the
+  // errors found to Reporter. The instruction must be in a basic block
+  // of its function. Instruction metadata is not checked. Used by
+  // bitcode readers to check instructions as they are constructed.
+  void verifyInstruction(const Instruction *Inst, const DataLayout *DL,
+                         PNaClABIErrorReporter &Reporter) const;
+
 private:
-  const char *checkInstruction(const DataLayout *DL, const Instruction *Inst);
+  const char *checkInstruction(const DataLayout *DL,
+                               const Instruction *Inst) const;
   PNaClABIErrorReporter *Reporter;
   bool ReporterIsOwned;
   OwningPtr<NaCl::AtomicIntrinsics> AtomicIntrinsics;
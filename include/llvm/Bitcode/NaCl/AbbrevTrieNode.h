@@ -19,14 +19,21 @@
 // that appear at any index, and use these constants to decide if a trie
 // node applies to the record.
 //
+// Once the tries are built, they can be flattened into an
+// AbbrevLookupTable, which stores the nodes, edges and abbreviations of
+// all tries in contiguous (sorted) arrays. This makes matching records
+// much cheaper than walking the tries themselves.
+//
 //===----------------------------------------------------------------------===//
 
 #ifndef LLVM_BITCODE_NACL_ABBREV_TRIE_NODE_H
 #define LLVM_BITCODE_NACL_ABBREV_TRIE_NODE_H
 
+#include "llvm/ADT/ArrayRef.h"
 #include "llvm/Bitcode/NaCl/NaClBitcodeParser.h"
 #include <map>
 #include <set>
+#include <vector>
 
 namespace llvm {
 
@@ -130,6 +137,67 @@ void NaClBuildAbbrevLookupMap(AbbrevLookupSizeMap &LookupMap,
                               const SmallVectorImpl<NaClBitCodeAbbrev*> &Abbrevs,
                               size_t InitialIndex = 0);
 
+// A read-only copy of the abbreviation lookup tries in a lookup map,
+// for matching records once all abbreviations are known. Nodes, edges
+// (sorted by index and value), and abbreviations are stored in
+// contiguous arrays, so matching a record does binary searches over
+// small arrays rather than walking nested maps.
+class AbbrevLookupTable {
+  AbbrevLookupTable(const AbbrevLookupTable&) LLVM_DELETED_FUNCTION;
+  void operator=(const AbbrevLookupTable&) LLVM_DELETED_FUNCTION;
+
+public:
+  AbbrevLookupTable() {}
+
+  // Replaces the contents of the table with the tries in LookupMap.
+  void Build(const AbbrevLookupSizeMap &LookupMap);
+
+  // Returns the abbreviations that may apply to the given record
+  // (i.e. the abbreviations of the trie node AbbrevTrieNode::MatchRecord
+  // would return), in the same order.
+  ArrayRef<AbbrevIndexPair>
+  MatchRecord(const NaClBitcodeRecordData &Record) const;
+
+private:
+  // Edges leaving a node, that test the record value at Index.
+  struct IndexGroup {
+    size_t Index;
+    unsigned FirstEdge;
+    unsigned EndEdge;
+  };
+
+  // Edge followed if the record value is Value.
+  struct Edge {
+    uint64_t Value;
+    unsigned Target;
+  };
+
+  struct Node {
+    unsigned FirstGroup;
+    unsigned EndGroup;
+    unsigned FirstAbbrev;
+    unsigned EndAbbrev;
+  };
+
+  // Marks record sizes with no trie.
+  static const unsigned NoNode = ~0U;
+
+  // The root node for each (capped) record size.
+  std::vector<unsigned> Roots;
+  std::vector<Node> Nodes;
+  std::vector<IndexGroup> Groups;
+  std::vector<Edge> Edges;
+  std::vector<AbbrevIndexPair> Abbrevs;
+
+  // Adds the given trie node (and its successors) to the table, and
+  // returns its index.
+  unsigned AddNode(const AbbrevTrieNode *TrieNode);
+
+  static bool EdgeValueLess(const Edge &E, uint64_t Value) {
+    return E.Value < Value;
+  }
+};
+
 }
 
 #endif
@@ -47,7 +47,7 @@ public:
   virtual ~NaClAnalyzerBlockDistElement();
 
   virtual NaClBitcodeDistElement*
-  CreateElement(NaClBitcodeDistValue Value) const;
+  CreateElement(NaClBitcodeDistValue Value, BumpPtrAllocator &Allocator) const;
 
   virtual double GetImportance(NaClBitcodeDistValue Value) const;
 
@@ -256,11 +256,38 @@ static inline bool operator>(const NaClBitCodeAbbrevOp &Op1,
   return Op1.Compare(Op2) > 0;
 }
 
+/// NaClBitCodeAbbrevDecodeOp - One step of reading a record with an
+/// abbreviation. Decode operations are abbreviation operands with their
+/// encodings resolved ahead of time, and with each array operand merged
+/// with its element encoding, so that readers need not interpret the
+/// operands again for each record.
+struct NaClBitCodeAbbrevDecodeOp {
+  enum OpKind {
+    Literal,  // Value is the operand.
+    Fixed,    // A NumBits-wide fixed field.
+    VBR,      // A VBR field with NumBits-wide chunks.
+    Char6     // A 6-bit char6 field.
+  };
+  // The kind of the operand, or of its elements if IsArray.
+  OpKind Kind;
+  // True if the operand is an array, whose elements are of the given kind.
+  bool IsArray;
+  unsigned NumBits;
+  uint64_t Value;
+};
+
+template <> struct isPodLike<NaClBitCodeAbbrevDecodeOp> {
+  static const bool value=true;
+};
+
 /// NaClBitCodeAbbrev - This class represents an abbreviation record.  An
 /// abbreviation allows a complex record that has redundancy to be stored in a
 /// specialized format instead of the fully-general, fully-vbr, format.
 class NaClBitCodeAbbrev {
   SmallVector<NaClBitCodeAbbrevOp, 8> OperandList;
+  // The decode operations of the abbreviation, if compiled (see
+  // CompileDecodeOps).
+  SmallVector<NaClBitCodeAbbrevDecodeOp, 8> DecodeOps;
   unsigned char RefCount; // Number of things using this.
   ~NaClBitCodeAbbrev() {}
 public:
@@ -278,6 +305,25 @@ public:
 
   void Add(const NaClBitCodeAbbrevOp &OpInfo) {
     OperandList.push_back(OpInfo);
+    DecodeOps.clear();
+  }
+
+  /// CompileDecodeOps - Compiles the operands of the abbreviation into
+  /// decode operations, for readers. Abbreviations that readers can't
+  /// decode with them (e.g. ones that start with an array, or that use
+  /// blobs) are left without decode operations.
+  void CompileDecodeOps();
+
+  /// hasDecodeOps - Returns true if the abbreviation has been compiled
+  /// into decode operations.
+  bool hasDecodeOps() const { return !DecodeOps.empty(); }
+
+  /// getDecodeOps - Returns the decode operations of the abbreviation,
+  /// which start with the record code. The abbreviation must have been
+  /// compiled.
+  const SmallVectorImpl<NaClBitCodeAbbrevDecodeOp> &getDecodeOps() const {
+    assert(hasDecodeOps() && "Abbreviation not compiled");
+    return DecodeOps;
   }
 
   // Returns a simplified version of the abbreviation. Used
@@ -325,6 +371,7 @@ public:
          I != IEnd; ++I) {
       AbbrevCopy->Add(NaClBitCodeAbbrevOp(getOperandInfo(I)));
     }
+    AbbrevCopy->DecodeOps = DecodeOps;
     return AbbrevCopy;
   }
 };
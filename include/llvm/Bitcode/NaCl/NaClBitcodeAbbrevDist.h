@@ -47,7 +47,7 @@ public:
   virtual ~NaClBitcodeAbbrevDistElement();
 
   virtual NaClBitcodeDistElement *CreateElement(
-      NaClBitcodeDistValue Value) const;
+      NaClBitcodeDistValue Value, BumpPtrAllocator &Allocator) const;
 
   virtual void GetValueList(const NaClBitcodeRecord &Record,
                             ValueListType &ValueList) const;
@@ -110,7 +110,7 @@ public:
   }
 
   virtual NaClBitcodeDistElement*
-  CreateElement(NaClBitcodeDistValue Value) const;
+  CreateElement(NaClBitcodeDistValue Value, BumpPtrAllocator &Allocator) const;
 
 private:
   // The block id associated with the abbreviations in this
@@ -49,6 +49,8 @@ public:
   // Note: No AddBlock method override because abbrevations only
   // apply to records.
 
+  virtual void Merge(const NaClBitcodeDistElement &Element);
+
   // Returns the number of times an abbreviation was used to represent
   // the value.
   unsigned GetNumAbbrevs() const {
@@ -49,6 +49,8 @@ public:
 
   virtual void AddBlock(const NaClBitcodeBlock &Block);
 
+  virtual void Merge(const NaClBitcodeDistElement &Element);
+
   // Returns the total number of bits used to represent all instances
   // of this value.
   uint64_t GetTotalBits() const {
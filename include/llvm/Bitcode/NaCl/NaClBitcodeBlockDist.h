@@ -39,7 +39,7 @@ public:
   virtual ~NaClBitcodeBlockDistElement();
 
   virtual NaClBitcodeDistElement *CreateElement(
-      NaClBitcodeDistValue Value) const;
+      NaClBitcodeDistValue Value, BumpPtrAllocator &Allocator) const;
 
   // Sorts by %file, rather than number of instances.
   virtual double GetImportance(NaClBitcodeDistValue value) const;
@@ -42,7 +42,7 @@ public:
   virtual ~NaClBitcodeCodeDistElement();
 
   virtual NaClBitcodeDistElement *CreateElement(
-      NaClBitcodeDistValue Value) const;
+      NaClBitcodeDistValue Value, BumpPtrAllocator &Allocator) const;
 
   virtual void GetValueList(const NaClBitcodeRecord &Record,
                             ValueListType &ValueList) const;
@@ -137,6 +137,16 @@
 // and cached.  This cache is flushed whenever the distribution map is
 // updated, so that a new sorted distribuition will be generated.
 //
+// Distribution maps are looked up far more often than they are
+// iterated, and large bitcode files create many (small) elements.
+// Hence, elements are kept in an open addressing hash table, and are
+// allocated from an allocator owned by the distribution map. The
+// elements are destructed, and their memory freed in one shot, when
+// the distribution map is destructed. Iterating over a distribution
+// map visits elements in increasing order of their values. The
+// corresponding (value ordered) list is built when needed, and cached
+// until a new value is added to the distribution map.
+//
 // Printing of distribution maps are stylized, so that virtuals can
 // easily fill in the necessary data.
 //
@@ -146,7 +156,9 @@
 //    CreateElement
 //       Creates a new instance of the distribution element, to
 //       be put into the corresponding distribution map when a new
-//       value is added to the distribution map.
+//       value is added to the distribution map. The instance must
+//       be allocated from the given allocator (i.e. using
+//       "new (Allocator)"), since it is never deleted.
 //
 // In addition, if the distribution element is based on record values,
 // the virtual method GetValueList must be defined, to extract values
@@ -155,12 +167,13 @@
 #ifndef LLVM_BITCODE_NACL_NACLBITCODEDIST_H
 #define LLVM_BITCODE_NACL_NACLBITCODEDIST_H
 
+#include "llvm/ADT/DenseMapInfo.h"
 #include "llvm/Bitcode/NaCl/NaClBitcodeParser.h"
+#include "llvm/Support/Allocator.h"
 #include "llvm/Support/Casting.h"
 #include "llvm/Support/Format.h"
 #include "llvm/Support/raw_ostream.h"
 
-#include <map>
 #include <vector>
 
 namespace llvm {
@@ -218,8 +231,12 @@ private:
   }
 
 public:
-  /// Type defining the mapping used to define the distribution.
-  typedef std::map<NaClBitcodeDistValue, NaClBitcodeDistElement*> MappedElement;
+  /// Type defining a (value, element) pair of the distribution map.
+  typedef std::pair<NaClBitcodeDistValue, NaClBitcodeDistElement*> MappedPair;
+
+  /// Type defining the (value ordered) list of pairs used to iterate
+  /// over the distribution map.
+  typedef std::vector<MappedPair> MappedElement;
 
   typedef MappedElement::const_iterator const_iterator;
 
@@ -244,29 +261,30 @@ public:
                   const NaClBitcodeDistElement *Sentinel,
                   NaClBitcodeDistKind Kind=RD_Dist)
       : Kind(Kind), StorageKind(StorageKind), Sentinel(Sentinel),
-        TableMap(), CachedDistribution(0), Total(0) {
+        Allocator(&OwnAllocator), NumElements(0), CachedDistribution(0),
+        Total(0) {
   }
 
   virtual ~NaClBitcodeDist();
 
   /// Number of elements in the distribution map.
   size_t size() const {
-    return TableMap.size();
+    return NumElements;
   }
 
   /// Iterator at beginning of distribution map.
   const_iterator begin() const {
-    return TableMap.begin();
+    return GetSortedElements().begin();
   }
 
   /// Iterator at end of distribution map.
   const_iterator end() const {
-    return TableMap.end();
+    return GetSortedElements().end();
   }
 
   /// Returns true if the distribution map is empty.
   bool empty() const {
-    return TableMap.empty();
+    return NumElements == 0;
   }
 
   /// Returns the element associated with the given distribution
@@ -276,14 +294,18 @@ public:
   /// Returns the element associated with the given distribution
   /// value.
   NaClBitcodeDistElement *at(NaClBitcodeDistValue Value) const {
-    return TableMap.at(Value);
+    NaClBitcodeDistElement *Element =
+        Buckets.empty() ? 0 : Buckets[FindBucket(Value)].second;
+    assert(Element && "No element for distribution value");
+    return Element;
   }
 
-  // Creates a new instance of this element for the given value. Used
-  // by class NaClBitcodeDist to create instances. Default method
-  // simply dispatches to the CreateElement method of the sentinel.
+  // Creates a new instance of this element for the given value, using
+  // the given allocator. Used by class NaClBitcodeDist to create
+  // instances. Default method simply dispatches to the CreateElement
+  // method of the sentinel.
   virtual NaClBitcodeDistElement *CreateElement(
-      NaClBitcodeDistValue Value) const;
+      NaClBitcodeDistValue Value, BumpPtrAllocator &Allocator) const;
 
   /// Interrogates the block record, and returns the corresponding
   /// values that are being tracked by the distribution map.  Default
@@ -309,6 +331,12 @@ public:
   /// Note: Requires that GetStorageKind() == BlockStorage.
   virtual void AddBlock(const NaClBitcodeBlock &Block);
 
+  /// Adds the contents of the given distribution map to this
+  /// distribution map. Both maps must hold the same kind of
+  /// elements. Used to combine distribution maps that were built
+  /// separately (for example, on different threads).
+  void Merge(const NaClBitcodeDist &Dist);
+
   /// Builds the distribution associated with the distribution map.
   /// Warning: The distribution is cached, and hence, only valid while
   /// it's contents is not changed.
@@ -339,13 +367,55 @@ protected:
   void Sort() const;
 
 private:
+  /// Returns the index of the bucket holding the given value, or the
+  /// (empty) bucket where the value should be inserted. Assumes that
+  /// there is at least one empty bucket.
+  size_t FindBucket(NaClBitcodeDistValue Value) const {
+    size_t Mask = Buckets.size() - 1;
+    size_t Index = DenseMapInfo<NaClBitcodeDistValue>::getHashValue(Value);
+    while (true) {
+      Index &= Mask;
+      const MappedPair &Bucket = Buckets[Index];
+      if (Bucket.second == 0 || Bucket.first == Value)
+        return Index;
+      ++Index;
+    }
+  }
+
+  /// Creates, and adds, the element for the given value. Assumes the
+  /// value isn't already in the distribution map.
+  NaClBitcodeDistElement *AddElement(NaClBitcodeDistValue Value);
+
+  /// Returns the (value ordered) list of elements in the distribution
+  /// map.
+  const MappedElement &GetSortedElements() const {
+    if (SortedElements.size() != NumElements) SortElements();
+    return SortedElements;
+  }
+
+  /// Rebuilds the (value ordered) list of elements in the
+  /// distribution map.
+  void SortElements() const;
+
   // Defines whether values in distribution map are from blocks or records.
   const StorageSelector StorageKind;
   // Sentinel element used to do generic operations for distribution.
   const NaClBitcodeDistElement *Sentinel;
-  // Map from the distribution value to the corresponding distribution
-  // element.
-  MappedElement TableMap;
+  // Allocator for the elements of the distribution map. Distribution
+  // maps nested in the elements share the allocator of the top-level
+  // distribution map, rather than each starting a slab of its own.
+  BumpPtrAllocator *Allocator;
+  // The allocator used if this is a top-level distribution map. It only
+  // allocates a slab once an element is added.
+  BumpPtrAllocator OwnAllocator;
+  // Open addressing hash table from the distribution value to the
+  // corresponding distribution element. Empty buckets have a null
+  // element. The number of buckets is zero, or a power of two.
+  MappedElement Buckets;
+  // The number of elements in the distribution map.
+  size_t NumElements;
+  // The cached (value ordered) list of elements in the distribution map.
+  mutable MappedElement SortedElements;
   // Pointer to the cached distribution.
   mutable Distribution *CachedDistribution;
   // The total number of instances in the map.
@@ -419,15 +489,21 @@ public:
   // Adds an instance of the given block to this element.
   virtual void AddBlock(const NaClBitcodeBlock &Block);
 
+  // Adds the instances of the given element, which must be of the
+  // same kind as this element, to this element. Nested distributions
+  // are merged as well.
+  virtual void Merge(const NaClBitcodeDistElement &Element);
+
   // Returns the number of instances associated with this element.
   unsigned GetNumInstances() const {
     return NumInstances;
   }
 
-  // Creates a new instance of this element for the given value. Used
-  // by class NaClBitcodeDist to create instances.
+  // Creates a new instance of this element for the given value, using
+  // the given allocator. Used by class NaClBitcodeDist to create
+  // instances.
   virtual NaClBitcodeDistElement *CreateElement(
-      NaClBitcodeDistValue Value) const = 0;
+      NaClBitcodeDistValue Value, BumpPtrAllocator &Allocator) const = 0;
 
   /// Interrogates the block record, and returns the corresponding
   /// values that are being tracked by the distribution map. Must be
@@ -496,10 +572,11 @@ private:
 
 inline NaClBitcodeDistElement *NaClBitcodeDist::
 GetElement(NaClBitcodeDistValue Value) {
-  if (TableMap.find(Value) == TableMap.end()) {
-    TableMap[Value] = CreateElement(Value);
+  if (!Buckets.empty()) {
+    if (NaClBitcodeDistElement *Element = Buckets[FindBucket(Value)].second)
+      return Element;
   }
-  return TableMap[Value];
+  return AddElement(Value);
 }
 
 }
@@ -432,6 +432,14 @@ public:
   /// Can be called multiple times to parse multiple blocks.
   bool Parse();
 
+  /// Reads the (top-level) block with the given block ID, whose
+  /// block record starts at bit EntryBit of the stream, and whose
+  /// contents start at bit BodyBit (i.e. just after the block ID).
+  /// Allows top-level parsers to read blocks out of order (for
+  /// example, blocks skipped by another parser). Returns true if
+  /// unable to parse.
+  bool ParseAt(unsigned BlockID, uint64_t EntryBit, uint64_t BodyBit);
+
   // Called once the bitstream reader has entered the corresponding
   // subblock.  Argument NumWords is set to the number of words in the
   // corresponding subblock.
@@ -519,11 +527,15 @@ public:
   /// Skips the current block, assuming the parser is at the beginning
   /// of the block. That is, Record.GetEntryKind() equals
   /// NaClBitstreamEntry::SubBlock. Returns false if
-  /// successful. Otherwise returns 1.
+  /// successful. Otherwise returns 1. Like parsed blocks, the bits of
+  /// the skipped block are not counted as local bits of this block.
   bool SkipBlock() {
     if (Record.GetEntryKind() != NaClBitstreamEntry::SubBlock)
       return Error("SkipBlock on non-block record");
-    return Record.GetCursor().SkipBlock();
+    if (Record.GetCursor().SkipBlock())
+      return true;
+    Block.LocalStartBit += Record.GetNumBits();
+    return false;
   }
 
 protected:
@@ -44,7 +44,7 @@ public:
   virtual ~NaClBitcodeSizeDistElement();
 
   virtual NaClBitcodeDistElement *CreateElement(
-      NaClBitcodeDistValue Value) const;
+      NaClBitcodeDistValue Value, BumpPtrAllocator &Allocator) const;
 
   virtual void GetValueList(const NaClBitcodeRecord &Record,
                             ValueListType &ValueList) const;
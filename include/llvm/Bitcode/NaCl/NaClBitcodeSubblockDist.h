@@ -38,7 +38,7 @@ public:
   virtual ~NaClBitcodeSubblockDistElement();
 
   virtual NaClBitcodeDistElement *CreateElement(
-      NaClBitcodeDistValue Value) const;
+      NaClBitcodeDistValue Value, BumpPtrAllocator &Allocator) const;
 
   virtual const char *GetTitle() const;
 
@@ -64,7 +64,7 @@ public:
   virtual ~NaClBitcodeValueDistElement();
 
   virtual NaClBitcodeDistElement *CreateElement(
-      NaClBitcodeDistValue Value) const;
+      NaClBitcodeDistValue Value, BumpPtrAllocator &Allocator) const;
 
   /// Returns the number of instances, normalized over the
   /// range of values, using a uniform distribution.
@@ -146,7 +146,7 @@ public:
   virtual ~NaClBitcodeValueIndexDistElement();
 
   virtual NaClBitcodeDistElement *CreateElement(
-      NaClBitcodeDistValue Value) const;
+      NaClBitcodeDistValue Value, BumpPtrAllocator &Allocator) const;
 
   virtual void GetValueList(const NaClBitcodeRecord &Record,
                             ValueListType &ValueList) const;
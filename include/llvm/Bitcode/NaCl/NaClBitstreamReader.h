@@ -20,6 +20,7 @@
 #include "llvm/ADT/SmallVector.h"
 #include "llvm/Bitcode/NaCl/NaClLLVMBitCodes.h"
 #include "llvm/Support/Endian.h"
+#include "llvm/Support/MathExtras.h"
 #include "llvm/Support/StreamableMemoryObject.h"
 #include <climits>
 #include <vector>
@@ -49,10 +50,17 @@ private:
   /// \brief Holds the offset of the first byte after the header.
   size_t InitialAddress;
 
+  /// MemoryStart/MemorySize - The bitcode bytes, if they are all in memory
+  /// (i.e. not streamed). Cursors read these directly rather than through
+  /// the BitcodeBytes interface.
+  const unsigned char *MemoryStart;
+  size_t MemorySize;
+
   NaClBitstreamReader(const NaClBitstreamReader&) LLVM_DELETED_FUNCTION;
   void operator=(const NaClBitstreamReader&) LLVM_DELETED_FUNCTION;
 public:
-  NaClBitstreamReader() : InitialAddress(0) {}
+  NaClBitstreamReader()
+      : InitialAddress(0), MemoryStart(0), MemorySize(0) {}
 
   NaClBitstreamReader(const unsigned char *Start, const unsigned char *End) {
     InitialAddress = 0;
@@ -61,7 +69,7 @@ public:
 
   NaClBitstreamReader(StreamableMemoryObject *Bytes,
                       size_t MyInitialAddress=0)
-      : InitialAddress(MyInitialAddress)
+      : InitialAddress(MyInitialAddress), MemoryStart(0), MemorySize(0)
   {
     BitcodeBytes.reset(Bytes);
   }
@@ -69,10 +77,19 @@ public:
   void init(const unsigned char *Start, const unsigned char *End) {
     assert(((End-Start) & 3) == 0 &&"Bitcode stream not a multiple of 4 bytes");
     BitcodeBytes.reset(getNonStreamedMemoryObject(Start, End));
+    MemoryStart = Start;
+    MemorySize = End - Start;
   }
 
   StreamableMemoryObject &getBitcodeBytes() { return *BitcodeBytes; }
 
+  /// getMemoryBytes - Return the bitcode bytes and set Size to their
+  /// number, if they are all in memory. Return null if they are streamed.
+  const unsigned char *getMemoryBytes(size_t &Size) const {
+    Size = MemorySize;
+    return MemoryStart;
+  }
+
   ~NaClBitstreamReader() {
     // Free the BlockInfoRecords.
     while (!BlockInfoRecords.empty()) {
@@ -122,6 +139,12 @@ public:
     BlockInfoRecords.back().BlockID = BlockID;
     return BlockInfoRecords.back();
   }
+
+  /// CopyBlockInfoRecords - Install a copy of the block info records of
+  /// Src into this (not yet used) bitstream. The abbreviations are
+  /// copied rather than shared, so that the two readers can be used by
+  /// different threads.
+  void CopyBlockInfoRecords(const NaClBitstreamReader &Src);
 };
 
   
@@ -213,18 +236,30 @@ class NaClBitstreamCursor {
   NaClBitstreamReader *BitStream;
   size_t NextChar;
 
+  /// MemoryBytes/MemorySize - The bitcode bytes of BitStream, if they are
+  /// all in memory, in which case words are loaded from them directly.
+  /// MemoryBytes is null if the bitcode is streamed.
+  const unsigned char *MemoryBytes;
+  size_t MemorySize;
+
   /// CurWord/word_t - This is the current data we have pulled from the stream
-  /// but have not returned to the client.  This is specifically and
-  /// intentionally defined to follow the word size of the host machine for
-  /// efficiency.  We use word_t in places that are aware of this to make it
-  /// perfectly explicit what is going on.
-  typedef uint32_t word_t;
+  /// but have not returned to the client.  Words are refilled 64 bits at a
+  /// time from in-memory bitcode, and 32 bits at a time from streamed
+  /// bitcode (so that no more is requested from the stream than before).
+  /// NextChar always stays a multiple of 4.
+  typedef uint64_t word_t;
   word_t CurWord;
 
   /// BitsInCurWord - This is the number of bits in CurWord that are valid. This
-  /// is always from [0...31/63] inclusive (depending on word size).
+  /// is always from [0...64] inclusive.
   unsigned BitsInCurWord;
 
+  /// VBRContinuationMasks - For each VBR chunk width N, the bits of a
+  /// 64-bit word holding the continuation bits of consecutive N-bit
+  /// chunks, i.e. bits N-1, 2N-1, ... Used to find the end of a VBR value
+  /// without looping over its chunks.
+  static const uint64_t VBRContinuationMasks[33];
+
   // CurCodeSize - This is the declared size of code values used for the current
   // block, in bits.
   NaClBitcodeSelectorAbbrev CurCodeSize;
@@ -243,15 +278,22 @@ class NaClBitstreamCursor {
   /// BlockScope - This tracks the codesize of parent blocks.
   SmallVector<Block, 8> BlockScope;
 
+  void setBitStream(NaClBitstreamReader *R) {
+    BitStream = R;
+    MemoryBytes = R ? R->getMemoryBytes(MemorySize) : 0;
+  }
+
 public:
-  NaClBitstreamCursor() : BitStream(0), NextChar(0) {
+  NaClBitstreamCursor()
+      : BitStream(0), NextChar(0), MemoryBytes(0), MemorySize(0) {
   }
   NaClBitstreamCursor(const NaClBitstreamCursor &RHS)
-      : BitStream(0), NextChar(0) {
+      : BitStream(0), NextChar(0), MemoryBytes(0), MemorySize(0) {
     operator=(RHS);
   }
 
-  explicit NaClBitstreamCursor(NaClBitstreamReader &R) : BitStream(&R) {
+  explicit NaClBitstreamCursor(NaClBitstreamReader &R) {
+    setBitStream(&R);
     NextChar = R.getInitialAddress();
     CurWord = 0;
     BitsInCurWord = 0;
@@ -260,7 +302,7 @@ public:
   void init(NaClBitstreamReader &R) {
     freeState();
 
-    BitStream = &R;
+    setBitStream(&R);
     NextChar = R.getInitialAddress();
     CurWord = 0;
     BitsInCurWord = 0;
@@ -272,9 +314,17 @@ public:
 
   void operator=(const NaClBitstreamCursor &RHS);
 
+  /// initFrom - Make this cursor read from R, starting at the position,
+  /// block scope and abbreviations of cursor Pos. R must hold the same
+  /// bits as the bitstream of Pos. Abbreviations are copied rather than
+  /// shared, so that the two cursors can be used by different threads.
+  void initFrom(NaClBitstreamReader &R, const NaClBitstreamCursor &Pos);
+
   void freeState();
   
   bool isEndPos(size_t pos) {
+    if (MemoryBytes)
+      return pos >= MemorySize;
     return BitStream->getBitcodeBytes().isObjectEnd(static_cast<uint64_t>(pos));
   }
 
@@ -359,8 +409,8 @@ public:
 
   /// JumpToBit - Reset the stream to the specified bit number.
   void JumpToBit(uint64_t BitNo) {
-    uintptr_t ByteNo = uintptr_t(BitNo/8) & ~(sizeof(word_t)-1);
-    unsigned WordBitNo = unsigned(BitNo & (sizeof(word_t)*8-1));
+    uintptr_t ByteNo = uintptr_t(BitNo/8) & ~uintptr_t(3);
+    unsigned WordBitNo = unsigned(BitNo & 31);
     assert(canSkipToPos(ByteNo) && "Invalid location");
 
     // Move the cursor to the right word.
@@ -369,12 +419,8 @@ public:
     CurWord = 0;
 
     // Skip over any bits that are already consumed.
-    if (WordBitNo) {
-      if (sizeof(word_t) > 4)
-        Read64(WordBitNo);
-      else
-        Read(WordBitNo);
-    }
+    if (WordBitNo)
+      Read(WordBitNo);
   }
 
   uint32_t Read(unsigned NumBits) {
@@ -396,36 +442,17 @@ public:
       return 0;
     }
 
+    // The bits left in CurWord are the low bits of the field.
     uint32_t R = uint32_t(CurWord);
-
-    // Read the next word from the stream.
-    uint8_t Array[sizeof(word_t)] = {0};
-    
-    BitStream->getBitcodeBytes().readBytes(NextChar, sizeof(Array), Array);
-    
-    // Handle big-endian byte-swapping if necessary.
-    support::detail::packed_endian_specific_integral
-      <word_t, support::little, support::unaligned> EndianValue;
-    memcpy(&EndianValue, Array, sizeof(Array));
-    
-    CurWord = EndianValue;
-
-    NextChar += sizeof(word_t);
-
-    // Extract NumBits-BitsInCurWord from what we just read.
-    unsigned BitsLeft = NumBits-BitsInCurWord;
-
-    // Be careful here, BitsLeft is in the range [1..32]/[1..64] inclusive.
-    R |= uint32_t((CurWord & (word_t(~0ULL) >> (sizeof(word_t)*8-BitsLeft)))
-                    << BitsInCurWord);
-
-    // BitsLeft bits have just been used up from CurWord.  BitsLeft is in the
-    // range [1..32]/[1..64] so be careful how we shift.
-    if (BitsLeft != sizeof(word_t)*8)
-      CurWord >>= BitsLeft;
-    else
-      CurWord = 0;
-    BitsInCurWord = sizeof(word_t)*8-BitsLeft;
+    unsigned BitsRead = BitsInCurWord;
+    fillCurWord();
+
+    // Extract NumBits-BitsRead from what we just read. BitsLeft is in the
+    // range [1..32], and fillCurWord reads at least 32 bits.
+    unsigned BitsLeft = NumBits-BitsRead;
+    R |= uint32_t(CurWord & (~0ULL >> (64-BitsLeft))) << BitsRead;
+    CurWord >>= BitsLeft;
+    BitsInCurWord -= BitsLeft;
     return R;
   }
 
@@ -437,26 +464,39 @@ public:
   }
 
   uint32_t ReadVBR(unsigned NumBits) {
-    uint32_t Piece = Read(NumBits);
-    if ((Piece & (1U << (NumBits-1))) == 0)
-      return Piece;
-
-    uint32_t Result = 0;
-    unsigned NextBit = 0;
-    while (1) {
-      Result |= (Piece & ((1U << (NumBits-1))-1)) << NextBit;
-
-      if ((Piece & (1U << (NumBits-1))) == 0)
-        return Result;
-
-      NextBit += NumBits-1;
-      Piece = Read(NumBits);
-    }
+    return uint32_t(ReadVBR64(NumBits));
   }
 
   // ReadVBR64 - Read a VBR that may have a value up to 64-bits in size.  The
   // chunk size of the VBR must still be <= 32 bits though.
   uint64_t ReadVBR64(unsigned NumBits) {
+    assert(NumBits && NumBits <= 32 && "Invalid VBR chunk size");
+    // Fast path: if the whole value is in CurWord, find its last chunk
+    // (the first one with a clear continuation bit) with a mask, instead
+    // of reading the chunks one at a time.
+    if (BitsInCurWord >= NumBits) {
+      uint64_t Ends = ~CurWord & VBRContinuationMasks[NumBits] &
+          (~0ULL >> (64-BitsInCurWord));
+      if (Ends) {
+        unsigned Bits = countTrailingZeros(Ends) + 1;
+        uint64_t Word = CurWord;
+        // Shift in two steps, since Bits may be 64.
+        CurWord = (CurWord >> (Bits-1)) >> 1;
+        BitsInCurWord -= Bits;
+        // Most values fit in one chunk.
+        if (Bits == NumBits)
+          return Word & ((1ULL << (NumBits-1))-1);
+        uint64_t PayloadMask = (1ULL << (NumBits-1))-1;
+        uint64_t Result = 0;
+        for (unsigned Shift = 0; Bits; Bits -= NumBits) {
+          Result |= (Word & PayloadMask) << Shift;
+          Word >>= NumBits;
+          Shift += NumBits-1;
+        }
+        return Result;
+      }
+    }
+
     uint32_t Piece = Read(NumBits);
     if ((Piece & (1U << (NumBits-1))) == 0)
       return uint64_t(Piece);
@@ -475,18 +515,46 @@ public:
   }
 
 private:
-  void SkipToFourByteBoundary() {
-    // If word_t is 64-bits and if we've read less than 32 bits, just dump
-    // the bits we have up to the next 32-bit boundary.
-    if (sizeof(word_t) > 4 &&
-        BitsInCurWord >= 32) {
-      CurWord >>= BitsInCurWord-32;
-      BitsInCurWord = 32;
+  /// fillCurWord - Replace CurWord with the next word of the bitstream,
+  /// which must not be at its end. In-memory bitcode is read 64 bits at a
+  /// time, with a single unaligned load.
+  void fillCurWord() {
+    if (MemoryBytes) {
+      size_t BytesLeft = MemorySize - NextChar;
+      if (BytesLeft >= sizeof(word_t)) {
+        CurWord = support::endian::read<word_t, support::little,
+                                        support::unaligned>(
+            MemoryBytes + NextChar);
+        NextChar += sizeof(word_t);
+        BitsInCurWord = sizeof(word_t)*8;
+        return;
+      }
+      // The tail of the bitcode, zero-padded to a multiple of 4 bytes.
+      uint8_t Array[sizeof(word_t)] = {0};
+      memcpy(Array, MemoryBytes + NextChar, BytesLeft);
+      CurWord = support::endian::read<word_t, support::little,
+                                      support::unaligned>(Array);
+      BytesLeft = (BytesLeft + 3) & ~size_t(3);
+      NextChar += BytesLeft;
+      BitsInCurWord = unsigned(BytesLeft)*8;
       return;
     }
-    
-    BitsInCurWord = 0;
-    CurWord = 0;
+
+    // Read the next 32-bit word from the stream.
+    uint8_t Array[4] = {0};
+    BitStream->getBitcodeBytes().readBytes(NextChar, sizeof(Array), Array);
+    CurWord = support::endian::read<uint32_t, support::little,
+                                    support::unaligned>(Array);
+    NextChar += sizeof(Array);
+    BitsInCurWord = 32;
+  }
+
+  void SkipToFourByteBoundary() {
+    // NextChar is always a multiple of 4, so just dump the bits we have up
+    // to the next 32-bit boundary.
+    unsigned BitsToSkip = BitsInCurWord % 32;
+    CurWord >>= BitsToSkip;
+    BitsInCurWord -= BitsToSkip;
   }
 public:
 
@@ -564,6 +632,24 @@ private:
   void readAbbreviatedField(const NaClBitCodeAbbrevOp &Op,
                             SmallVectorImpl<uint64_t> &Vals);
   void skipAbbreviatedField(const NaClBitCodeAbbrevOp &Op);
+  void readArray(const NaClBitCodeAbbrevDecodeOp &Op, unsigned NumElts,
+                 SmallVectorImpl<uint64_t> &Vals);
+  void skipArray(const NaClBitCodeAbbrevDecodeOp &Op, unsigned NumElts);
+
+  /// readDecodeOpValue - Read the value of a (non-array) decode operation.
+  uint64_t readDecodeOpValue(const NaClBitCodeAbbrevDecodeOp &Op) {
+    switch (Op.Kind) {
+    case NaClBitCodeAbbrevDecodeOp::Literal:
+      return Op.Value;
+    case NaClBitCodeAbbrevDecodeOp::Fixed:
+      return Read(Op.NumBits);
+    case NaClBitCodeAbbrevDecodeOp::VBR:
+      return ReadVBR64(Op.NumBits);
+    case NaClBitCodeAbbrevDecodeOp::Char6:
+      return NaClBitCodeAbbrevOp::DecodeChar6(Read(6));
+    }
+    llvm_unreachable("Invalid decode operation");
+  }
   
 public:
 
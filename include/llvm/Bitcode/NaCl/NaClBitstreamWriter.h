@@ -18,6 +18,7 @@
 #include "llvm/ADT/SmallVector.h"
 #include "llvm/ADT/StringRef.h"
 #include "llvm/Bitcode/NaCl/NaClBitCodes.h"
+#include "llvm/Support/raw_ostream.h"
 #include <vector>
 
 namespace llvm {
@@ -31,6 +32,14 @@ class NaClBitstreamWriter {
   /// CurValue - The current value.  Only bits < CurBit are valid.
   uint32_t CurValue;
 
+  /// FlushedBytes - The number of bytes of the stream that FlushWordsTo
+  /// removed from the start of Out.
+  unsigned FlushedBytes;
+
+  /// FlushedBackpatches - The (byte offset, word) backpatches of words
+  /// that were flushed before they were backpatched.
+  std::vector<std::pair<unsigned, unsigned> > FlushedBackpatches;
+
   /// CurCodeSize - This is the declared size of code values used for the
   /// current block, in bits.
   NaClBitcodeSelectorAbbrev CurCodeSize;
@@ -88,6 +97,11 @@ public:
   // BackpatchWord - Backpatch a 32-bit word in the output with the specified
   // value.
   void BackpatchWord(unsigned ByteNo, unsigned NewWord) {
+    if (ByteNo < FlushedBytes) {
+      FlushedBackpatches.push_back(std::make_pair(ByteNo, NewWord));
+      return;
+    }
+    ByteNo -= FlushedBytes;
     Out[ByteNo++] = (unsigned char)(NewWord >>  0);
     Out[ByteNo++] = (unsigned char)(NewWord >>  8);
     Out[ByteNo++] = (unsigned char)(NewWord >> 16);
@@ -109,7 +123,7 @@ private:
   }
 
   unsigned GetBufferOffset() const {
-    return Out.size();
+    return FlushedBytes + Out.size();
   }
 
   unsigned GetWordIndex() const {
@@ -120,7 +134,24 @@ private:
 
 public:
   explicit NaClBitstreamWriter(SmallVectorImpl<char> &O)
-      : Out(O), CurBit(0), CurValue(0), CurCodeSize() {}
+      : Out(O), CurBit(0), CurValue(0), FlushedBytes(0), CurCodeSize() {}
+
+  /// \brief Creates a writer for blocks that will be appended to the
+  /// current block of Parent, using EmitWords. It uses the code size of
+  /// Parent's current block, and copies of Parent's blockinfo
+  /// abbreviations, so that it can be used on another thread than Parent.
+  NaClBitstreamWriter(SmallVectorImpl<char> &O,
+                      const NaClBitstreamWriter &Parent)
+      : Out(O), CurBit(0), CurValue(0), FlushedBytes(0),
+        CurCodeSize(Parent.CurCodeSize) {
+    BlockInfoRecords.resize(Parent.BlockInfoRecords.size());
+    for (size_t i = 0, e = BlockInfoRecords.size(); i != e; ++i) {
+      const BlockInfo &Info = Parent.BlockInfoRecords[i];
+      BlockInfoRecords[i].BlockID = Info.BlockID;
+      for (size_t j = 0, je = Info.Abbrevs.size(); j != je; ++j)
+        BlockInfoRecords[i].Abbrevs.push_back(Info.Abbrevs[j]->Copy());
+    }
+  }
 
   ~NaClBitstreamWriter() {
     assert(CurBit == 0 && "Unflused data remaining");
@@ -180,6 +211,32 @@ public:
     }
   }
 
+  /// \brief Emits the words written by a writer created for this
+  /// writer's current block. The stream must be at a word boundary, as it
+  /// is after a block.
+  void EmitWords(const SmallVectorImpl<char> &Words) {
+    assert(CurBit == 0 && "Not 32-bit aligned");
+    assert((Words.size() & 3) == 0 && "Not a whole number of words");
+    Out.append(Words.begin(), Words.end());
+  }
+
+  /// \brief Writes the words written so far to OS, and removes them from
+  /// the buffer, so that it only holds what was written since. Words that
+  /// are backpatched after they are flushed (such as the sizes of blocks
+  /// that are still open) are recorded in getFlushedBackpatches, for the
+  /// caller to patch in OS.
+  void FlushWordsTo(raw_ostream &OS) {
+    OS.write(Out.data(), Out.size());
+    FlushedBytes += Out.size();
+    Out.clear();
+  }
+
+  /// \brief Returns the (byte offset, word) backpatches of flushed words.
+  const std::vector<std::pair<unsigned, unsigned> > &
+  getFlushedBackpatches() const {
+    return FlushedBackpatches;
+  }
+
   void EmitVBR(uint32_t Val, unsigned NumBits) {
     assert(NumBits <= 32 && "Too many bits to emit!");
     assert(NumBits > 1 && "Too few bits to emit!");
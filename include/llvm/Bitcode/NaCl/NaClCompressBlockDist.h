@@ -38,7 +38,7 @@ public:
   virtual ~NaClCompressBlockDistElement();
 
   virtual NaClBitcodeDistElement*
-  CreateElement(NaClBitcodeDistValue Value) const;
+  CreateElement(NaClBitcodeDistValue Value, BumpPtrAllocator &Allocator) const;
 
   virtual const SmallVectorImpl<NaClBitcodeDist*> *
   GetNestedDistributions() const;
@@ -35,7 +35,7 @@ public:
   virtual ~NaClCompressCodeDistElement();
 
   virtual NaClBitcodeDistElement *CreateElement(
-      NaClBitcodeDistValue Value) const;
+      NaClBitcodeDistValue Value, BumpPtrAllocator &Allocator) const;
 
   virtual void AddRecord(const NaClBitcodeRecord &Record);
 
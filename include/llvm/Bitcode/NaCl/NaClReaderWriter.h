@@ -21,12 +21,15 @@
 #include <string>
 
 namespace llvm {
+  class Function;
   class MemoryBuffer;
   class LLVMContext;
   class Module;
   class raw_ostream;
+  class raw_fd_ostream;
   class NaClBitcodeHeader;
   class NaClBitstreamWriter;
+  class PNaClABIErrorReporter;
   class StreamingMemoryObject;
 
   /// Defines the data layout used for PNaCl bitcode files. We set the
@@ -74,6 +77,45 @@ namespace llvm {
                                        std::string *ErrMsg = 0,
                                        bool AcceptSupportedOnly = true);
 
+  /// getNaClStreamedBitcodeModuleCopy - Create a copy of module Src in
+  /// Context, without parsing the module-level blocks of the bitcode
+  /// again. Src must have been created by getNaClStreamedBitcodeModule,
+  /// and Streamer must stream the same bitcode file as the streamer of
+  /// Src. Types, global variables and function declarations are copied
+  /// from Src, while function bodies are lazily materialized from
+  /// Streamer. Global variables are copied as external declarations,
+  /// since the copy is only intended for reading function bodies. Src
+  /// must not be modified or materialized (by another thread) while
+  /// the copy is being created. On error, this returns null, and fills
+  /// in *ErrMsg with an error description if ErrMsg is non-null.
+  Module *getNaClStreamedBitcodeModuleCopy(const Module *Src,
+                                           StreamingMemoryObject *Streamer,
+                                           LLVMContext &Context,
+                                           std::string *ErrMsg = 0);
+
+  /// getNaClFunctionBodyBitSize - Returns the size (in bits) of the
+  /// bitcode block defining the body of function F, which can be used
+  /// to estimate the cost of materializing and compiling F. The module
+  /// of F must have been created by getNaClLazyBitcodeModule,
+  /// getNaClStreamedBitcodeModule or getNaClStreamedBitcodeModuleCopy.
+  /// For streamed modules, this blocks until the body of F has been
+  /// streamed in. Returns 0 if F has no body that is still to be
+  /// materialized, or if the body can't be found.
+  uint64_t getNaClFunctionBodyBitSize(Function *F);
+
+  /// setNaClFunctionABIVerification - Makes the reader of module M
+  /// check the PNaCl ABI rules of function bodies (see
+  /// PNaClABIVerifyFunctions) while it constructs their instructions,
+  /// rather than in a separate walk over each materialized function.
+  /// Violations are added to Reporter, whose fatal errors are checked
+  /// after each function body is read, as the PNaClABIVerifyFunctions
+  /// pass does. Instruction metadata isn't checked, since PNaCl
+  /// function blocks can't attach any. A null Reporter turns the checks
+  /// off. M must have been created by getNaClLazyBitcodeModule,
+  /// getNaClStreamedBitcodeModule or getNaClStreamedBitcodeModuleCopy.
+  void setNaClFunctionABIVerification(Module *M,
+                                      PNaClABIErrorReporter *Reporter);
+
   /// NaClParseBitcodeFile - Read the specified bitcode file,
   /// returning the module.  If an error occurs, this returns null and
   /// fills in *ErrMsg if it is non-null.  This method *never* takes
@@ -100,6 +142,13 @@ namespace llvm {
   void NaClWriteBitcodeToFile(const Module *M, raw_ostream &Out,
                               bool AcceptSupportedOnly = true);
 
+  /// NaClWriteBitcodeToSeekableFile - Same as NaClWriteBitcodeToFile, but
+  /// if Out supports seeking, function blocks are written to Out as soon as
+  /// they are generated, so that the whole bitcode file isn't buffered in
+  /// memory. Block sizes are then patched by seeking back in Out.
+  void NaClWriteBitcodeToSeekableFile(const Module *M, raw_fd_ostream &Out,
+                                      bool AcceptSupportedOnly = true);
+
   /// isNaClBitcode - Return true if the given bytes are the magic bytes for
   /// PNaCl bitcode wire format.
   ///
@@ -274,6 +274,7 @@ void initializeExpandArithWithOverflowPass(PassRegistry&);
 void initializeExpandByValPass(PassRegistry&);
 void initializeExpandConstantExprPass(PassRegistry&);
 void initializeExpandCtorsPass(PassRegistry&);
+void initializeExpandFunctionBodiesPass(PassRegistry&);
 void initializeExpandGetElementPtrPass(PassRegistry&);
 void initializeExpandIndirectBrPass(PassRegistry&);
 void initializeExpandShuffleVectorPass(PassRegistry&);
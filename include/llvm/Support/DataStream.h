@@ -17,7 +17,11 @@
 #ifndef LLVM_SUPPORT_DATASTREAM_H
 #define LLVM_SUPPORT_DATASTREAM_H
 
+#include "llvm/Support/Compiler.h"
+#include "llvm/Support/DataTypes.h"
+#include "llvm/Support/TimeValue.h"
 #include <string>
+#include <vector>
 
 namespace llvm {
 
@@ -33,6 +37,46 @@ public:
 DataStreamer *getDataFileStreamer(const std::string &Filename,
                                   std::string *Err);
 
+/// ThrottledDataStreamer - Replays the bytes of another streamer no faster
+/// than a given bandwidth, in chunks of a given size, as if they were
+/// downloaded. This is useful to measure the latency of streaming
+/// consumers on local files.
+class ThrottledDataStreamer : public DataStreamer {
+public:
+  /// Takes ownership of Source. A chunk of ChunkSize bytes is delivered
+  /// every ChunkSize / BytesPerSecond seconds, starting when the first
+  /// bytes are requested.
+  ThrottledDataStreamer(DataStreamer *Source, uint64_t BytesPerSecond,
+                        size_t ChunkSize);
+  virtual ~ThrottledDataStreamer();
+
+  virtual size_t GetBytes(unsigned char *buf, size_t len) LLVM_OVERRIDE;
+
+  /// The time at which the first bytes were requested.
+  sys::TimeValue getStartTime() const { return StartTime; }
+  /// The time at which the last byte was delivered, or zero if the end of
+  /// the stream hasn't been reached.
+  sys::TimeValue getLastByteTime() const { return LastByteTime; }
+  /// The total time spent in GetBytes waiting for chunks to arrive.
+  sys::TimeValue getWaitTime() const { return WaitTime; }
+
+private:
+  DataStreamer *Source;
+  uint64_t BytesPerSecond;
+  std::vector<unsigned char> Chunk;
+  size_t ChunkPos;
+  size_t ChunkEnd;
+  uint64_t BytesFetched;
+  bool Started;
+  bool SourceDone;
+  sys::TimeValue StartTime;
+  sys::TimeValue LastByteTime;
+  sys::TimeValue WaitTime;
+
+  ThrottledDataStreamer(const ThrottledDataStreamer&) LLVM_DELETED_FUNCTION;
+  void operator=(const ThrottledDataStreamer&) LLVM_DELETED_FUNCTION;
+};
+
 }
 
 #endif  // LLVM_SUPPORT_DATASTREAM_H_
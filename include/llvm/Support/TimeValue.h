@@ -380,6 +380,9 @@ inline TimeValue operator - (const TimeValue &tv1, const TimeValue &tv2) {
   return difference;
 }
 
+/// Suspends the calling thread for at least the given amount of time.
+void sleepFor(const TimeValue &Duration);
+
 }
 }
 
@@ -319,6 +319,10 @@ class raw_fd_ostream : public raw_ostream {
   /// possible.
   bool UseAtomicWrites;
 
+  /// SupportsSeeking - True if the file descriptor can be repositioned, and
+  /// writes go where it is repositioned to (it isn't in append mode).
+  bool SupportsSeeking;
+
   uint64_t pos;
 
   /// write_impl - See raw_ostream::write_impl.
@@ -363,6 +367,11 @@ public:
   /// position to the offset specified from the beginning of the file.
   uint64_t seek(uint64_t off);
 
+  /// supportsSeeking - Return true if seek can reposition the stream, e.g.
+  /// because it writes to a regular file rather than to a pipe, and the file
+  /// wasn't opened for appending.
+  bool supportsSeeking() const { return SupportsSeeking; }
+
   /// SetUseAtomicWrite - Set the stream to attempt to use atomic writes for
   /// individual output routines where possible.
   ///
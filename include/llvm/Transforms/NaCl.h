@@ -11,6 +11,7 @@
 #define LLVM_TRANSFORMS_NACL_H
 
 #include "llvm/CodeGen/Passes.h"
+#include "llvm/Target/TargetMachine.h"
 
 namespace llvm {
 
@@ -19,7 +20,9 @@ class Function;
 class FunctionPass;
 class FunctionType;
 class Instruction;
+class Module;
 class ModulePass;
+class TargetLibraryInfo;
 class Use;
 class Value;
 
@@ -30,6 +33,7 @@ BasicBlockPass *createFixVectorLoadStoreAlignmentPass();
 BasicBlockPass *createPromoteI1OpsPass();
 FunctionPass *createBackendCanonicalizePass();
 FunctionPass *createExpandConstantExprPass();
+FunctionPass *createExpandFunctionBodiesPass();
 FunctionPass *createExpandStructRegsPass();
 FunctionPass *createInsertDivideCheckPass();
 FunctionPass *createPromoteIntegersPass();
@@ -60,6 +64,24 @@ ModulePass *createStripMetadataPass();
 void PNaClABISimplifyAddPreOptPasses(PassManagerBase &PM);
 void PNaClABISimplifyAddPostOptPasses(PassManagerBase &PM);
 
+// Adds the passes that translate ABI-verified PNaCl functions with TM,
+// writing the code to Out: the lowering of PNaCl's IR for the code
+// generator, TLI (which PM takes ownership of), and the code generator.
+// Returns true if TM can't emit files of type FileType.
+bool PNaClTranslationAddCodeGenPasses(PassManagerBase &PM, TargetMachine &TM,
+                                      TargetLibraryInfo *TLI,
+                                      formatted_raw_ostream &Out,
+                                      TargetMachine::CodeGenFileType FileType);
+
+// Gives all functions and global variables of M names and external
+// linkage, so that the objects translated from the parts of a split
+// module can refer to each other's symbols.
+void PNaClExternalizeSplitModule(Module *M);
+
+// Turns the global variables of M into declarations, so that only one of
+// the objects translated from a split module defines them.
+void PNaClRemoveGlobalInitializers(Module *M);
+
 Instruction *PhiSafeInsertPt(Use *U);
 void PhiSafeReplaceUses(Use *U, Value *NewVal);
 
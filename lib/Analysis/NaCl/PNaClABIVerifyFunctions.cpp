@@ -194,8 +194,9 @@ static bool hasAllowedLockFreeByteSize(const CallInst *Call) {
 //
 // This returns an error string if the instruction is rejected, or
 // NULL if the instruction is allowed.
-const char *PNaClABIVerifyFunctions::checkInstruction(const DataLayout *DL,
-                                                      const Instruction *Inst) {
+const char *
+PNaClABIVerifyFunctions::checkInstruction(const DataLayout *DL,
+                                          const Instruction *Inst) const {
   // If the instruction has a single pointer operand, PtrOperandIndex is
   // set to its operand index.
   unsigned PtrOperandIndex = -1;
@@ -499,7 +500,14 @@ const char *PNaClABIVerifyFunctions::checkInstruction(const DataLayout *DL,
 }
 
 bool PNaClABIVerifyFunctions::runOnFunction(Function &F) {
-  const DataLayout *DL = &getAnalysis<DataLayout>();
+  verifyFunction(F, &getAnalysis<DataLayout>(), *Reporter);
+  Reporter->checkForFatalErrors();
+  return false;
+}
+
+void PNaClABIVerifyFunctions::verifyFunction(
+    const Function &F, const DataLayout *DL,
+    PNaClABIErrorReporter &Reporter) const {
   SmallVector<StringRef, 8> MDNames;
   F.getContext().getMDKindNames(MDNames);
 
@@ -507,27 +515,7 @@ bool PNaClABIVerifyFunctions::runOnFunction(Function &F) {
            FI != FE; ++FI) {
     for (BasicBlock::const_iterator BBI = FI->begin(), BBE = FI->end();
              BBI != BBE; ++BBI) {
-      const Instruction *Inst = BBI;
-      // Check the instruction opcode first.  This simplifies testing,
-      // because some instruction opcodes must be rejected out of hand
-      // (regardless of the instruction's result type) and the tests
-      // check the reason for rejection.
-      const char *Error = checkInstruction(DL, BBI);
-      // Check the instruction's result type.
-      bool BadResult = false;
-      if (!Error && !(PNaClABITypeChecker::isValidScalarType(Inst->getType()) ||
-                      PNaClABITypeChecker::isValidVectorType(Inst->getType()) ||
-                      isNormalizedPtr(Inst) ||
-                      isa<AllocaInst>(Inst))) {
-        Error = "bad result type";
-        BadResult = true;
-      }
-      if (Error) {
-        Reporter->addError()
-            << "Function " << F.getName() << " disallowed: " << Error << ": "
-            << (BadResult ? PNaClABITypeChecker::getTypeName(BBI->getType())
-                          : "") << " " << *BBI << "\n";
-      }
+      verifyInstruction(BBI, DL, Reporter);
 
       // Check instruction attachment metadata.
       SmallVector<std::pair<unsigned, MDNode*>, 4> MDForInst;
@@ -535,7 +523,7 @@ bool PNaClABIVerifyFunctions::runOnFunction(Function &F) {
 
       for (unsigned i = 0, e = MDForInst.size(); i != e; i++) {
         if (!PNaClABIProps::isWhitelistedMetadata(MDForInst[i].first)) {
-          Reporter->addError()
+          Reporter.addError()
               << "Function " << F.getName()
               << " has disallowed instruction metadata: "
               << getMDNodeString(MDForInst[i].first, MDNames) << "\n";
@@ -543,9 +531,32 @@ bool PNaClABIVerifyFunctions::runOnFunction(Function &F) {
       }
     }
   }
+}
 
-  Reporter->checkForFatalErrors();
-  return false;
+void PNaClABIVerifyFunctions::verifyInstruction(
+    const Instruction *Inst, const DataLayout *DL,
+    PNaClABIErrorReporter &Reporter) const {
+  // Check the instruction opcode first.  This simplifies testing,
+  // because some instruction opcodes must be rejected out of hand
+  // (regardless of the instruction's result type) and the tests
+  // check the reason for rejection.
+  const char *Error = checkInstruction(DL, Inst);
+  // Check the instruction's result type.
+  bool BadResult = false;
+  if (!Error && !(PNaClABITypeChecker::isValidScalarType(Inst->getType()) ||
+                  PNaClABITypeChecker::isValidVectorType(Inst->getType()) ||
+                  isNormalizedPtr(Inst) ||
+                  isa<AllocaInst>(Inst))) {
+    Error = "bad result type";
+    BadResult = true;
+  }
+  if (Error) {
+    Reporter.addError()
+        << "Function " << Inst->getParent()->getParent()->getName()
+        << " disallowed: " << Error << ": "
+        << (BadResult ? PNaClABITypeChecker::getTypeName(Inst->getType())
+                      : "") << " " << *Inst << "\n";
+  }
 }
 
 // This method exists so that the passes can easily be run with opt -analyze.
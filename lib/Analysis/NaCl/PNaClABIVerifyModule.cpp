@@ -204,7 +204,9 @@ void PNaClABIVerifyModule::checkFunction(const Function *F,
     // Unfortunately this means we simply don't check this property
     // when translating a pexe in the browser.
     // TODO(mseaborn): Enforce this property in the bitcode reader.
-    if (!StreamingMode && F->isDeclaration()) {
+    // Functions of lazily read modules whose bodies haven't been
+    // materialized yet are defined.
+    if (!StreamingMode && F->isDeclaration() && !F->isMaterializable()) {
       Reporter->addError() << "Function " << Name
                            << " is declared but not defined (disallowed)\n";
     }
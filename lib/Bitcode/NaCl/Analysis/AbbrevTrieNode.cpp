@@ -10,6 +10,7 @@
 
 #include "llvm/Bitcode/NaCl/AbbrevTrieNode.h"
 #include "llvm/Bitcode/NaCl/NaClBitcodeValueDist.h"
+#include <algorithm>
 
 using namespace llvm;
 
@@ -293,3 +294,93 @@ void llvm::NaClBuildAbbrevLookupMap(
     AddAbbrevPairToLookupMap(LookupMap, Pair);
   }
 }
+
+void AbbrevLookupTable::Build(const AbbrevLookupSizeMap &LookupMap) {
+  Roots.clear();
+  Nodes.clear();
+  Groups.clear();
+  Edges.clear();
+  Abbrevs.clear();
+  for (AbbrevLookupSizeMap::const_iterator
+           Iter = LookupMap.begin(), IterEnd = LookupMap.end();
+       Iter != IterEnd; ++Iter) {
+    if (Iter->second == 0) continue;
+    if (Roots.size() <= Iter->first)
+      Roots.resize(Iter->first + 1, NoNode);
+    Roots[Iter->first] = AddNode(Iter->second);
+  }
+}
+
+unsigned AbbrevLookupTable::AddNode(const AbbrevTrieNode *TrieNode) {
+  unsigned NodeIndex = Nodes.size();
+  Nodes.push_back(Node());
+
+  const std::set<AbbrevIndexPair> &NodeAbbrevs = TrieNode->GetAbbreviations();
+  Nodes[NodeIndex].FirstAbbrev = Abbrevs.size();
+  Abbrevs.insert(Abbrevs.end(), NodeAbbrevs.begin(), NodeAbbrevs.end());
+  Nodes[NodeIndex].EndAbbrev = Abbrevs.size();
+
+  // Labels are sorted by index, and then by value. Reserve the groups
+  // and edges of this node before adding successors, so that they stay
+  // contiguous.
+  AbbrevTrieNode::SuccessorLabels Labels;
+  TrieNode->GetSuccessorLabels(Labels);
+  unsigned FirstGroup = Groups.size();
+  unsigned FirstEdge = Edges.size();
+  for (size_t i = 0, e = Labels.size(); i != e; ++i) {
+    if (i == 0 || Labels[i].first != Labels[i-1].first) {
+      IndexGroup Group;
+      Group.Index = Labels[i].first;
+      Group.FirstEdge = Group.EndEdge = FirstEdge + i;
+      Groups.push_back(Group);
+    }
+    ++Groups.back().EndEdge;
+  }
+  Edges.resize(FirstEdge + Labels.size());
+  Nodes[NodeIndex].FirstGroup = FirstGroup;
+  Nodes[NodeIndex].EndGroup = Groups.size();
+
+  for (size_t i = 0, e = Labels.size(); i != e; ++i) {
+    const AbbrevTrieNode *Successor =
+        TrieNode->GetSuccessor(Labels[i].first, Labels[i].second);
+    unsigned Target = Successor ? AddNode(Successor) : NoNode;
+    Edges[FirstEdge + i].Value = Labels[i].second;
+    Edges[FirstEdge + i].Target = Target;
+  }
+  return NodeIndex;
+}
+
+ArrayRef<AbbrevIndexPair>
+AbbrevLookupTable::MatchRecord(const NaClBitcodeRecordData &Record) const {
+  size_t Size = Record.Values.size() + 1;
+  if (Size > NaClValueIndexCutoff) Size = NaClValueIndexCutoff + 1;
+  if (Size >= Roots.size() || Roots[Size] == NoNode)
+    return ArrayRef<AbbrevIndexPair>();
+
+  unsigned NodeIndex = Roots[Size];
+  while (true) {
+    const Node &N = Nodes[NodeIndex];
+    unsigned Next = NoNode;
+    for (unsigned G = N.FirstGroup; G != N.EndGroup; ++G) {
+      const IndexGroup &Group = Groups[G];
+      if (Group.Index > Record.Values.size())
+        break;
+      uint64_t Value =
+          Group.Index == 0 ? Record.Code : Record.Values[Group.Index-1];
+      const Edge *Begin = &Edges[0] + Group.FirstEdge;
+      const Edge *End = &Edges[0] + Group.EndEdge;
+      const Edge *Pos = std::lower_bound(Begin, End, Value, EdgeValueLess);
+      if (Pos != End && Pos->Value == Value && Pos->Target != NoNode) {
+        Next = Pos->Target;
+        break;
+      }
+    }
+    if (Next == NoNode) {
+      if (N.FirstAbbrev == N.EndAbbrev)
+        return ArrayRef<AbbrevIndexPair>();
+      return ArrayRef<AbbrevIndexPair>(&Abbrevs[N.FirstAbbrev],
+                                       N.EndAbbrev - N.FirstAbbrev);
+    }
+    NodeIndex = Next;
+  }
+}
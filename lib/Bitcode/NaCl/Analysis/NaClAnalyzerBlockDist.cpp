@@ -16,8 +16,8 @@ using namespace llvm;
 NaClAnalyzerBlockDistElement::~NaClAnalyzerBlockDistElement() {}
 
 NaClBitcodeDistElement* NaClAnalyzerBlockDistElement::
-CreateElement(NaClBitcodeDistValue Value) const {
-  return new NaClAnalyzerBlockDistElement(Value, OrderBlocksByID);
+CreateElement(NaClBitcodeDistValue Value, BumpPtrAllocator &Allocator) const {
+  return new (Allocator) NaClAnalyzerBlockDistElement(Value, OrderBlocksByID);
 }
 
 double NaClAnalyzerBlockDistElement::
@@ -16,8 +16,8 @@ using namespace llvm;
 NaClBitcodeAbbrevDistElement::~NaClBitcodeAbbrevDistElement() {}
 
 NaClBitcodeDistElement *NaClBitcodeAbbrevDistElement::CreateElement(
-    NaClBitcodeDistValue Value) const {
-  return new NaClBitcodeAbbrevDistElement();
+    NaClBitcodeDistValue Value, BumpPtrAllocator &Allocator) const {
+  return new (Allocator) NaClBitcodeAbbrevDistElement();
 }
 
 void NaClBitcodeAbbrevDistElement::
@@ -56,6 +56,6 @@ NaClBitcodeAbbrevDistElement NaClBitcodeAbbrevDistElement::Sentinel;
 NaClBitcodeAbbrevDist::~NaClBitcodeAbbrevDist() {}
 
 NaClBitcodeDistElement* NaClBitcodeAbbrevDist::
-CreateElement(NaClBitcodeDistValue Value) const {
-  return new NaClBitcodeAbbrevDistElement(BlockID);
+CreateElement(NaClBitcodeDistValue Value, BumpPtrAllocator &Allocator) const {
+  return new (Allocator) NaClBitcodeAbbrevDistElement(BlockID);
 }
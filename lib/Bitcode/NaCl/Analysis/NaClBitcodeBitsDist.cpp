@@ -25,6 +25,13 @@ void NaClBitcodeBitsDistElement::AddBlock(const NaClBitcodeBlock &Block) {
   TotalBits += Block.GetLocalNumBits();
 }
 
+void NaClBitcodeBitsDistElement::
+Merge(const NaClBitcodeDistElement &Element) {
+  NaClBitcodeDistElement::Merge(Element);
+  TotalBits +=
+      static_cast<const NaClBitcodeBitsDistElement&>(Element).TotalBits;
+}
+
 void NaClBitcodeBitsDistElement::PrintStatsHeader(raw_ostream &Stream) const {
   NaClBitcodeDistElement::PrintStatsHeader(Stream);
   Stream << "    # Bits    Bits/Elmt";
@@ -44,8 +44,8 @@ NaClBitcodeBlockDistElement NaClBitcodeBlockDist::DefaultSentinal;
 NaClBitcodeBlockDistElement::~NaClBitcodeBlockDistElement() {}
 
 NaClBitcodeDistElement *NaClBitcodeBlockDistElement::
-CreateElement(NaClBitcodeDistValue Value) const {
-  return new NaClBitcodeBlockDistElement();
+CreateElement(NaClBitcodeDistValue Value, BumpPtrAllocator &Allocator) const {
+  return new (Allocator) NaClBitcodeBlockDistElement();
 }
 
 double NaClBitcodeBlockDistElement::
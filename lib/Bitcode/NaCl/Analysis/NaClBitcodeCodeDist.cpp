@@ -175,8 +175,8 @@ static const char *GetCodeName(unsigned CodeID, unsigned BlockID) {
 NaClBitcodeCodeDistElement::~NaClBitcodeCodeDistElement() {}
 
 NaClBitcodeDistElement *NaClBitcodeCodeDistElement::CreateElement(
-    NaClBitcodeDistValue Value) const {
-  return new NaClBitcodeCodeDistElement();
+    NaClBitcodeDistValue Value, BumpPtrAllocator &Allocator) const {
+  return new (Allocator) NaClBitcodeCodeDistElement();
 }
 
 void NaClBitcodeCodeDistElement::
@@ -14,15 +14,60 @@ using namespace llvm;
 
 NaClBitcodeDist::~NaClBitcodeDist() {
   RemoveCachedDistribution();
-  for (const_iterator Iter = begin(), IterEnd = end();
+  // Note: The memory of the elements is freed when the allocator is
+  // destructed.
+  for (MappedElement::iterator Iter = Buckets.begin(), IterEnd = Buckets.end();
        Iter != IterEnd; ++Iter) {
-    delete Iter->second;
+    if (Iter->second)
+      Iter->second->~NaClBitcodeDistElement();
   }
 }
 
 NaClBitcodeDistElement *NaClBitcodeDist::CreateElement(
-    NaClBitcodeDistValue Value) const {
-  return Sentinel->CreateElement(Value);
+    NaClBitcodeDistValue Value, BumpPtrAllocator &Allocator) const {
+  return Sentinel->CreateElement(Value, Allocator);
+}
+
+NaClBitcodeDistElement *NaClBitcodeDist::
+AddElement(NaClBitcodeDistValue Value) {
+  // Keep the load factor of the hash table at most 3/4.
+  if ((NumElements + 1) * 4 > Buckets.size() * 3) {
+    MappedElement OldBuckets;
+    OldBuckets.swap(Buckets);
+    Buckets.resize(OldBuckets.empty() ? 16 : OldBuckets.size() * 2,
+                   MappedPair(0, 0));
+    for (MappedElement::const_iterator
+             Iter = OldBuckets.begin(), IterEnd = OldBuckets.end();
+         Iter != IterEnd; ++Iter) {
+      if (Iter->second)
+        Buckets[FindBucket(Iter->first)] = *Iter;
+    }
+  }
+  NaClBitcodeDistElement *Element = CreateElement(Value, *Allocator);
+  // The nested distribution maps of the element go away with this map,
+  // so they can allocate their elements from the same allocator.
+  if (const SmallVectorImpl<NaClBitcodeDist*> *Dists =
+          Element->GetNestedDistributions()) {
+    for (size_t I = 0, E = Dists->size(); I < E; ++I) {
+      assert((*Dists)[I]->empty() && "Nested distribution already in use");
+      (*Dists)[I]->Allocator = Allocator;
+    }
+  }
+  Buckets[FindBucket(Value)] = MappedPair(Value, Element);
+  ++NumElements;
+  return Element;
+}
+
+void NaClBitcodeDist::SortElements() const {
+  SortedElements.clear();
+  SortedElements.reserve(NumElements);
+  for (MappedElement::const_iterator
+           Iter = Buckets.begin(), IterEnd = Buckets.end();
+       Iter != IterEnd; ++Iter) {
+    if (Iter->second)
+      SortedElements.push_back(*Iter);
+  }
+  std::sort(SortedElements.begin(), SortedElements.end());
 }
 
 void NaClBitcodeDist::GetValueList(const NaClBitcodeRecord &Record,
@@ -58,6 +103,18 @@ void NaClBitcodeDist::AddBlock(const NaClBitcodeBlock &Block) {
   Element->AddBlock(Block);
 }
 
+void NaClBitcodeDist::Merge(const NaClBitcodeDist &Dist) {
+  assert(StorageKind == Dist.StorageKind);
+  if (Dist.empty())
+    return;
+  RemoveCachedDistribution();
+  Total += Dist.Total;
+  for (const_iterator Iter = Dist.begin(), IterEnd = Dist.end();
+       Iter != IterEnd; ++Iter) {
+    GetElement(Iter->first)->Merge(*Iter->second);
+  }
+}
+
 void NaClBitcodeDist::Print(raw_ostream &Stream,
                             const std::string &Indent) const {
   const Distribution *Dist = GetDistribution();
@@ -113,6 +170,19 @@ void NaClBitcodeDistElement::AddBlock(const NaClBitcodeBlock &Block) {
   ++NumInstances;
 }
 
+void NaClBitcodeDistElement::Merge(const NaClBitcodeDistElement &Element) {
+  assert(getKind() == Element.getKind());
+  NumInstances += Element.NumInstances;
+  const SmallVectorImpl<NaClBitcodeDist*> *Dists = GetNestedDistributions();
+  if (Dists == 0)
+    return;
+  const SmallVectorImpl<NaClBitcodeDist*> *ElementDists =
+      Element.GetNestedDistributions();
+  assert(ElementDists && Dists->size() == ElementDists->size());
+  for (size_t I = 0, E = Dists->size(); I < E; ++I)
+    (*Dists)[I]->Merge(*(*ElementDists)[I]);
+}
+
 void NaClBitcodeDistElement::GetValueList(const NaClBitcodeRecord &Record,
                                           ValueListType &ValueList) const {
   // By default, assume no record values are defined.
@@ -16,8 +16,8 @@ using namespace llvm;
 NaClBitcodeSizeDistElement::~NaClBitcodeSizeDistElement() {}
 
 NaClBitcodeDistElement *NaClBitcodeSizeDistElement::CreateElement(
-    NaClBitcodeDistValue Value) const {
-  return new NaClBitcodeSizeDistElement();
+    NaClBitcodeDistValue Value, BumpPtrAllocator &Allocator) const {
+  return new (Allocator) NaClBitcodeSizeDistElement();
 }
 
 void NaClBitcodeSizeDistElement::
@@ -19,8 +19,8 @@ NaClBitcodeSubblockDistElement NaClBitcodeSubblockDist::DefaultSentinal;
 NaClBitcodeSubblockDistElement::~NaClBitcodeSubblockDistElement() {}
 
 NaClBitcodeDistElement *NaClBitcodeSubblockDistElement::
-CreateElement(NaClBitcodeDistValue Value) const {
-  return new NaClBitcodeSubblockDistElement();
+CreateElement(NaClBitcodeDistValue Value, BumpPtrAllocator &Allocator) const {
+  return new (Allocator) NaClBitcodeSubblockDistElement();
 }
 
 const char *NaClBitcodeSubblockDistElement::GetTitle() const {
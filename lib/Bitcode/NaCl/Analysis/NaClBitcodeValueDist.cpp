@@ -60,7 +60,7 @@ NaClValueRangeType llvm::GetNaClValueRange(NaClValueRangeIndexType RangeIndex) {
   if (Index >= ValueCutoffsSize)
     return NaClValueRangeType(ValueCutoffs[ValueCutoffsSize-1], MaxValue);
   else if (Index == 0)
-    return NaClValueRangeType(ValueDistSingletonCutoff, ValueCutoffs[0]);
+    return NaClValueRangeType(ValueDistSingletonCutoff, ValueCutoffs[0]-1);
   else
     return NaClValueRangeType(ValueCutoffs[Index-1], ValueCutoffs[Index]-1);
 }
@@ -70,8 +70,8 @@ NaClBitcodeValueDistElement NaClBitcodeValueDistElement::Sentinel;
 NaClBitcodeValueDistElement::~NaClBitcodeValueDistElement() {}
 
 NaClBitcodeDistElement *NaClBitcodeValueDistElement::CreateElement(
-      NaClBitcodeDistValue Value) const {
-  return new NaClBitcodeValueDistElement();
+      NaClBitcodeDistValue Value, BumpPtrAllocator &Allocator) const {
+  return new (Allocator) NaClBitcodeValueDistElement();
 }
 
 double NaClBitcodeValueDistElement::
@@ -155,8 +155,8 @@ NaClBitcodeValueIndexDistElement NaClBitcodeValueIndexDistElement::Sentinel;
 NaClBitcodeValueIndexDistElement::~NaClBitcodeValueIndexDistElement() {}
 
 NaClBitcodeDistElement *NaClBitcodeValueIndexDistElement::CreateElement(
-    NaClBitcodeDistValue Value) const {
-  return new NaClBitcodeValueIndexDistElement(Value);
+    NaClBitcodeDistValue Value, BumpPtrAllocator &Allocator) const {
+  return new (Allocator) NaClBitcodeValueIndexDistElement(Value);
 }
 
 void NaClBitcodeValueIndexDistElement::
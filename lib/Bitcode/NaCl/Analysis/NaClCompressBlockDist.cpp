@@ -16,8 +16,8 @@ using namespace llvm;
 NaClCompressBlockDistElement::~NaClCompressBlockDistElement() {}
 
 NaClBitcodeDistElement* NaClCompressBlockDistElement::
-CreateElement(NaClBitcodeDistValue Value) const {
-  return new NaClCompressBlockDistElement(Value);
+CreateElement(NaClBitcodeDistValue Value, BumpPtrAllocator &Allocator) const {
+  return new (Allocator) NaClCompressBlockDistElement(Value);
 }
 
 const SmallVectorImpl<NaClBitcodeDist*> *NaClCompressBlockDistElement::
@@ -15,8 +15,8 @@ using namespace llvm;
 NaClCompressCodeDistElement::~NaClCompressCodeDistElement() {}
 
 NaClBitcodeDistElement *NaClCompressCodeDistElement::CreateElement(
-    NaClBitcodeDistValue Value) const {
-  return new NaClCompressCodeDistElement();
+    NaClBitcodeDistValue Value, BumpPtrAllocator &Allocator) const {
+  return new (Allocator) NaClCompressCodeDistElement();
 }
 
 void NaClCompressCodeDistElement::AddRecord(const NaClBitcodeRecord &Record) {
@@ -79,6 +79,58 @@ void NaClBitCodeAbbrev::Print(raw_ostream &Stream, bool AddNewLine) const {
   if (AddNewLine) Stream << "\n";
 }
 
+// Sets the kind and width of the decode operation for the (non-array)
+// encoding operand Op. Returns false if it has no decode operation.
+static bool SetDecodeOpEncoding(NaClBitCodeAbbrevDecodeOp &DecodeOp,
+                                const NaClBitCodeAbbrevOp &Op) {
+  switch (Op.getEncoding()) {
+  case NaClBitCodeAbbrevOp::Fixed:
+    DecodeOp.Kind = NaClBitCodeAbbrevDecodeOp::Fixed;
+    DecodeOp.NumBits = Op.getEncodingData();
+    return DecodeOp.NumBits >= 1 && DecodeOp.NumBits <= 32;
+  case NaClBitCodeAbbrevOp::VBR:
+    DecodeOp.Kind = NaClBitCodeAbbrevDecodeOp::VBR;
+    DecodeOp.NumBits = Op.getEncodingData();
+    return DecodeOp.NumBits >= 1 && DecodeOp.NumBits <= 32;
+  case NaClBitCodeAbbrevOp::Char6:
+    DecodeOp.Kind = NaClBitCodeAbbrevDecodeOp::Char6;
+    DecodeOp.NumBits = 6;
+    return true;
+  default:
+    return false;
+  }
+}
+
+void NaClBitCodeAbbrev::CompileDecodeOps() {
+  DecodeOps.clear();
+  // The record code can't be part of an array.
+  if (OperandList.empty() || OperandList[0].isArrayOp())
+    return;
+  for (unsigned i = 0, e = OperandList.size(); i != e; ++i) {
+    const NaClBitCodeAbbrevOp &Op = OperandList[i];
+    NaClBitCodeAbbrevDecodeOp DecodeOp;
+    DecodeOp.IsArray = false;
+    DecodeOp.NumBits = 0;
+    DecodeOp.Value = 0;
+    if (Op.isLiteral()) {
+      DecodeOp.Kind = NaClBitCodeAbbrevDecodeOp::Literal;
+      DecodeOp.Value = Op.getLiteralValue();
+    } else if (Op.isArrayOp()) {
+      // The element encoding must be the last operand.
+      if (i+2 != e || OperandList[i+1].isLiteral() ||
+          !SetDecodeOpEncoding(DecodeOp, OperandList[++i])) {
+        DecodeOps.clear();
+        return;
+      }
+      DecodeOp.IsArray = true;
+    } else if (!SetDecodeOpEncoding(DecodeOp, Op)) {
+      DecodeOps.clear();
+      return;
+    }
+    DecodeOps.push_back(DecodeOp);
+  }
+}
+
 NaClBitCodeAbbrev *NaClBitCodeAbbrev::Simplify() const {
   NaClBitCodeAbbrev *Abbrev = new NaClBitCodeAbbrev();
   for (unsigned i = 0; i < OperandList.size(); ++i) {
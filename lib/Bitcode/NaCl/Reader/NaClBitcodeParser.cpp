@@ -94,6 +94,15 @@ bool NaClBitcodeParser::Parse() {
   return ParseBlock(Record.GetEntryID());
 }
 
+bool NaClBitcodeParser::ParseAt(unsigned BlockID, uint64_t EntryBit,
+                                uint64_t BodyBit) {
+  Record.SetStartBit(EntryBit);
+  Record.Entry.Kind = NaClBitstreamEntry::SubBlock;
+  Record.Entry.ID = BlockID;
+  Record.GetCursor().JumpToBit(BodyBit);
+  return ParseBlock(BlockID);
+}
+
 bool NaClBitcodeParser::ParseBlockInfoInternal() {
   // BLOCKINFO is a special part of the stream. Let the bitstream
   // reader process this block.
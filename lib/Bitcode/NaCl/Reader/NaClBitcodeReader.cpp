@@ -28,7 +28,11 @@
 #include "llvm/Support/DataStream.h"
 #include "llvm/Support/MathExtras.h"
 #include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Process.h"
 #include "llvm/Support/raw_ostream.h"
+#if LLVM_ON_UNIX
+#include <sys/mman.h>
+#endif
 using namespace llvm;
 
 
@@ -38,6 +42,41 @@ llvm::PNaClAllowLocalSymbolTables(
     cl::desc("Allow (function) local symbol tables in PNaCl bitcode files"),
     cl::init(false));
 
+#if LLVM_ON_UNIX
+// Rounds Ptr down (or up, if RoundUp) to a page boundary.
+static const unsigned char *PageAlign(const unsigned char *Ptr,
+                                      bool RoundUp) {
+  static const uintptr_t PageSize = sys::process::get_self()->page_size();
+  uintptr_t Addr = reinterpret_cast<uintptr_t>(Ptr);
+  if (RoundUp)
+    Addr += PageSize - 1;
+  return reinterpret_cast<const unsigned char *>(Addr & ~(PageSize - 1));
+}
+#endif
+
+// Tells the OS that the pages of the memory-mapped bitcode in [Start, End)
+// will be read sequentially, so that it reads ahead aggressively.
+static void AdviseSequentialRead(const unsigned char *Start,
+                                 const unsigned char *End) {
+#if LLVM_ON_UNIX && defined(MADV_SEQUENTIAL)
+  const unsigned char *Begin = PageAlign(Start, false);
+  ::madvise(const_cast<unsigned char *>(Begin), End - Begin, MADV_SEQUENTIAL);
+#endif
+}
+
+// Releases the pages of the memory-mapped bitcode that lie entirely in
+// [Start, End). The mapping is a read-only one of the bitcode file, so the
+// pages are simply read again from the file should they be touched again.
+static void ReleasePages(const unsigned char *Start,
+                         const unsigned char *End) {
+#if LLVM_ON_UNIX && defined(MADV_DONTNEED)
+  const unsigned char *Begin = PageAlign(Start, true);
+  End = PageAlign(End, false);
+  if (Begin < End)
+    ::madvise(const_cast<unsigned char *>(Begin), End - Begin, MADV_DONTNEED);
+#endif
+}
+
 void NaClBitcodeReader::FreeState() {
   if (BufferOwned)
     delete Buffer;
@@ -47,6 +86,7 @@ void NaClBitcodeReader::FreeState() {
 
   std::vector<Function*>().swap(FunctionsWithBodies);
   DeferredFunctionInfo.clear();
+  FunctionBodyBitSize.clear();
 }
 
 //===----------------------------------------------------------------------===//
@@ -595,6 +635,7 @@ bool NaClBitcodeReader::RememberAndSkipFunctionBody() {
   // Skip over the function block for now.
   if (Stream.SkipBlock())
     return Error("Malformed block record");
+  FunctionBodyBitSize[Fn] = Stream.GetCurrentBitNo() - CurBit;
   DEBUG(dbgs() << "<- RememberAndSkipFunctionBody\n");
   return false;
 }
@@ -870,6 +911,187 @@ bool NaClBitcodeReader::ParseBitcodeInto(Module *M) {
   }
 }
 
+// Returns the type in Context corresponding to type Ty of another
+// context. Returns 0 if the type can't be copied.
+Type *NaClBitcodeReader::CopyType(Type *Ty, DenseMap<Type*, Type*> &TypeMap) {
+  if (Type *NewTy = TypeMap.lookup(Ty))
+    return NewTy;
+
+  Type *NewTy = 0;
+  switch (Ty->getTypeID()) {
+  case Type::VoidTyID:
+    NewTy = Type::getVoidTy(Context);
+    break;
+  case Type::FloatTyID:
+    NewTy = Type::getFloatTy(Context);
+    break;
+  case Type::DoubleTyID:
+    NewTy = Type::getDoubleTy(Context);
+    break;
+  case Type::IntegerTyID:
+    NewTy = IntegerType::get(Context, cast<IntegerType>(Ty)->getBitWidth());
+    break;
+  case Type::PointerTyID: {
+    PointerType *PtrTy = cast<PointerType>(Ty);
+    Type *ElemTy = CopyType(PtrTy->getElementType(), TypeMap);
+    if (ElemTy == 0) return 0;
+    NewTy = PointerType::get(ElemTy, PtrTy->getAddressSpace());
+    break;
+  }
+  case Type::VectorTyID: {
+    VectorType *VecTy = cast<VectorType>(Ty);
+    Type *ElemTy = CopyType(VecTy->getElementType(), TypeMap);
+    if (ElemTy == 0) return 0;
+    NewTy = VectorType::get(ElemTy, VecTy->getNumElements());
+    break;
+  }
+  case Type::ArrayTyID: {
+    ArrayType *ArrTy = cast<ArrayType>(Ty);
+    Type *ElemTy = CopyType(ArrTy->getElementType(), TypeMap);
+    if (ElemTy == 0) return 0;
+    NewTy = ArrayType::get(ElemTy, ArrTy->getNumElements());
+    break;
+  }
+  case Type::FunctionTyID: {
+    FunctionType *FTy = cast<FunctionType>(Ty);
+    Type *ReturnTy = CopyType(FTy->getReturnType(), TypeMap);
+    if (ReturnTy == 0) return 0;
+    SmallVector<Type*, 8> ArgTys;
+    for (unsigned i = 0, e = FTy->getNumParams(); i != e; ++i) {
+      Type *ArgTy = CopyType(FTy->getParamType(i), TypeMap);
+      if (ArgTy == 0) return 0;
+      ArgTys.push_back(ArgTy);
+    }
+    NewTy = FunctionType::get(ReturnTy, ArgTys, FTy->isVarArg());
+    break;
+  }
+  case Type::StructTyID: {
+    StructType *STy = cast<StructType>(Ty);
+    if (!STy->isLiteral()) {
+      // Named structs are only used as (opaque) placeholders for
+      // forward type references, and may be recursive.
+      StructType *NewSTy = StructType::create(Context);
+      TypeMap[Ty] = NewSTy;
+      if (STy->isOpaque())
+        return NewSTy;
+      NewTy = NewSTy;
+    }
+    SmallVector<Type*, 8> ElemTys;
+    for (unsigned i = 0, e = STy->getNumElements(); i != e; ++i) {
+      Type *ElemTy = CopyType(STy->getElementType(i), TypeMap);
+      if (ElemTy == 0) return 0;
+      ElemTys.push_back(ElemTy);
+    }
+    if (NewTy)
+      cast<StructType>(NewTy)->setBody(ElemTys, STy->isPacked());
+    else
+      NewTy = StructType::get(Context, ElemTys, STy->isPacked());
+    break;
+  }
+  default:
+    return 0;
+  }
+  TypeMap[Ty] = NewTy;
+  return NewTy;
+}
+
+// Returns a copy of attribute set Attrs, defined in Context.
+static AttributeSet CopyAttributes(LLVMContext &Context, AttributeSet Attrs) {
+  SmallVector<AttributeSet, 4> Slots;
+  for (unsigned i = 0, e = Attrs.getNumSlots(); i != e; ++i) {
+    unsigned Index = Attrs.getSlotIndex(i);
+    AttrBuilder B(Attrs, Index);
+    Slots.push_back(AttributeSet::get(Context, Index, B));
+  }
+  return AttributeSet::get(Context, Slots);
+}
+
+bool NaClBitcodeReader::CopyBitcodeInto(Module *M,
+                                        const NaClBitcodeReader &Src) {
+  if (!LazyStreamer || !Src.LazyStreamer)
+    return Error("Only streamed bitcode modules can be copied");
+  if (!Src.TheModule || !Src.SeenFirstFunctionBody)
+    return Error("Module-level blocks of source module not yet parsed");
+  if (!Src.TheModule->alias_empty())
+    return Error("Can't copy modules with aliases");
+
+  M->setDataLayout(Src.TheModule->getDataLayout());
+  M->setTargetTriple(Src.TheModule->getTargetTriple());
+  TheModule = M;
+
+  // Read the header from our own stream, and then continue reading
+  // where the source reader stopped.
+  if (InitLazyStream())
+    return true;
+  StreamFile->CopyBlockInfoRecords(*Src.StreamFile);
+  Stream.initFrom(*StreamFile, Src.Stream);
+  NextUnreadBit = Src.NextUnreadBit;
+  SeenValueSymbolTable = Src.SeenValueSymbolTable;
+  SeenFirstFunctionBody = Src.SeenFirstFunctionBody;
+
+  DenseMap<Type*, Type*> TypeMap;
+  for (std::vector<Type*>::const_iterator I = Src.TypeList.begin(),
+           E = Src.TypeList.end(); I != E; ++I) {
+    Type *Ty = *I ? CopyType(*I, TypeMap) : 0;
+    if (*I && Ty == 0)
+      return Error("Unable to copy type table");
+    TypeList.push_back(Ty);
+  }
+
+  DenseMap<const Value*, Value*> ValueMap;
+  for (Module::const_global_iterator I = Src.TheModule->global_begin(),
+           E = Src.TheModule->global_end(); I != E; ++I) {
+    Type *Ty = CopyType(I->getType()->getElementType(), TypeMap);
+    if (Ty == 0)
+      return Error("Unable to copy global variable type");
+    // The initializer isn't copied, so the copy must be an external
+    // declaration to be valid.
+    GlobalVariable *GV = new GlobalVariable(
+        *M, Ty, I->isConstant(), GlobalValue::ExternalLinkage, 0,
+        I->getName(), 0, I->getThreadLocalMode(),
+        I->getType()->getAddressSpace());
+    GV->setAlignment(I->getAlignment());
+    ValueMap[I] = GV;
+  }
+  for (Module::const_iterator I = Src.TheModule->begin(),
+           E = Src.TheModule->end(); I != E; ++I) {
+    Type *Ty = CopyType(I->getFunctionType(), TypeMap);
+    if (Ty == 0)
+      return Error("Unable to copy function type");
+    Function *Func = Function::Create(cast<FunctionType>(Ty), I->getLinkage(),
+                                      I->getName(), M);
+    Func->setCallingConv(I->getCallingConv());
+    Func->setAttributes(CopyAttributes(Context, I->getAttributes()));
+    Func->setAlignment(I->getAlignment());
+    ValueMap[I] = Func;
+  }
+
+  for (unsigned i = 0, e = Src.ValueList.size(); i != e; ++i) {
+    Value *V = ValueMap.lookup(Src.ValueList[i]);
+    if (V == 0)
+      return Error("Unable to copy module-level value list");
+    ValueList.push_back(V);
+  }
+  for (std::vector<Function*>::const_iterator
+           I = Src.FunctionsWithBodies.begin(),
+           E = Src.FunctionsWithBodies.end(); I != E; ++I)
+    FunctionsWithBodies.push_back(cast<Function>(ValueMap[*I]));
+  for (DenseMap<Function*, uint64_t>::const_iterator
+           I = Src.DeferredFunctionInfo.begin(),
+           E = Src.DeferredFunctionInfo.end(); I != E; ++I)
+    DeferredFunctionInfo[cast<Function>(ValueMap[I->first])] = I->second;
+  for (DenseMap<Function*, uint64_t>::const_iterator
+           I = Src.FunctionBodyBitSize.begin(),
+           E = Src.FunctionBodyBitSize.end(); I != E; ++I)
+    FunctionBodyBitSize[cast<Function>(ValueMap[I->first])] = I->second;
+  for (UpgradedIntrinsicMap::const_iterator I = Src.UpgradedIntrinsics.begin(),
+           E = Src.UpgradedIntrinsics.end(); I != E; ++I)
+    UpgradedIntrinsics.push_back(
+        std::make_pair(cast<Function>(ValueMap[I->first]),
+                       cast<Function>(ValueMap[I->second])));
+  return false;
+}
+
 // Returns true if error occured installing I into BB.
 bool NaClBitcodeReader::InstallInstruction(
     BasicBlock *BB, Instruction *I) {
@@ -880,6 +1102,7 @@ bool NaClBitcodeReader::InstallInstruction(
     return Error("Invalid instruction with no BB");
   }
   BB->getInstList().push_back(I);
+  VerifyInstruction(I);
   return false;
 }
 
@@ -1427,6 +1650,7 @@ OutOfRecordLoop:
       if (Cast->getParent() == 0) {
         BasicBlock *BB = BBInfo.BB;
         BB->getInstList().insert(BB->getTerminator(), Cast);
+        VerifyInstruction(Cast);
       }
     }
     PhiCasts.clear();
@@ -1450,6 +1674,10 @@ OutOfRecordLoop:
   // Trim the value list down to the size it was before we parsed this function.
   ValueList.shrinkTo(ModuleValueListSize);
   FunctionBBs.clear();
+  // Like the PNaClABIVerifyFunctions pass, stop on fatal ABI errors
+  // once the function has been checked.
+  if (ABIReporter)
+    ABIReporter->checkForFatalErrors();
   DEBUG(dbgs() << "-> ParseFunctionBody\n");
   return false;
 }
@@ -1467,6 +1695,17 @@ bool NaClBitcodeReader::FindFunctionInStream(Function *F,
   return false;
 }
 
+uint64_t NaClBitcodeReader::getFunctionBodyBitSize(Function *F) {
+  DenseMap<Function*, uint64_t>::iterator DFII = DeferredFunctionInfo.find(F);
+  if (DFII == DeferredFunctionInfo.end())
+    return 0;
+  // If its position is recorded as 0, its body is somewhere in the stream
+  // but we haven't seen it yet.
+  if (DFII->second == 0 && FindFunctionInStream(F, DFII))
+    return 0;
+  return FunctionBodyBitSize.lookup(F);
+}
+
 //===----------------------------------------------------------------------===//
 // GVMaterializer implementation
 //===----------------------------------------------------------------------===//
@@ -1510,6 +1749,13 @@ error_code NaClBitcodeReader::Materialize(GlobalValue *GV) {
     return make_error_code(errc::invalid_argument);
   }
 
+  if (ReleaseParsedPages) {
+    size_t Size;
+    const unsigned char *Bytes = StreamFile->getMemoryBytes(Size);
+    ReleasePages(Bytes + DFII->second / CHAR_BIT,
+                 Bytes + Stream.GetCurrentBitNo() / CHAR_BIT);
+  }
+
   // Upgrade any old intrinsic calls in the function.
   for (UpgradedIntrinsicMap::iterator I = UpgradedIntrinsics.begin(),
        E = UpgradedIntrinsics.end(); I != E; ++I) {
@@ -1601,8 +1847,15 @@ bool NaClBitcodeReader::InitStreamFromBuffer() {
   if (Header.Read(BufPtr, BufEnd))
     return Error(Header.Unsupported());
 
+  // The bitstream is read straight from the buffer. If the buffer is a
+  // memory-mapped file, function bodies are (mostly) read in order, and
+  // the pages holding them are released as they are parsed.
   StreamFile.reset(new NaClBitstreamReader(BufPtr, BufEnd));
   Stream.init(*StreamFile);
+  if (Buffer->getBufferKind() == MemoryBuffer::MemoryBuffer_MMap) {
+    ReleaseParsedPages = true;
+    AdviseSequentialRead(BufPtr, BufEnd);
+  }
 
   if (AcceptHeader())
     return Error(Header.Unsupported());
@@ -1669,6 +1922,66 @@ Module *llvm::getNaClStreamedBitcodeModule(const std::string &name,
   return M;
 }
 
+Module *llvm::getNaClStreamedBitcodeModuleCopy(const Module *Src,
+                                               StreamingMemoryObject *Streamer,
+                                               LLVMContext &Context,
+                                               std::string *ErrMsg) {
+  // Note: Modules created by getNaClStreamedBitcodeModule are always
+  // attached to a NaClBitcodeReader.
+  const NaClBitcodeReader *SrcReader =
+      static_cast<const NaClBitcodeReader*>(Src->getMaterializer());
+  Module *M = new Module(Src->getModuleIdentifier(), Context);
+  NaClBitcodeReader *R =
+      new NaClBitcodeReader(Streamer, Context, /* AcceptSupportedOnly */ false);
+  M->setMaterializer(R);
+  if (SrcReader == 0) {
+    if (ErrMsg)
+      *ErrMsg = "Module is not attached to a bitcode reader";
+    delete M;  // Also deletes R.
+    return 0;
+  }
+  if (R->CopyBitcodeInto(M, *SrcReader)) {
+    if (ErrMsg)
+      *ErrMsg = R->getErrorString();
+    delete M;  // Also deletes R.
+    return 0;
+  }
+  R->setBufferOwned(false); // no buffer to delete
+
+  return M;
+}
+
+void NaClBitcodeReader::setABIVerification(PNaClABIErrorReporter *Reporter) {
+  ABIReporter = Reporter;
+  if (Reporter == 0) {
+    ABIVerifier.reset();
+    ABIDataLayout.reset();
+    return;
+  }
+  ABIDataLayout.reset(new DataLayout(TheModule));
+  ABIVerifier.reset(new PNaClABIVerifyFunctions(Reporter));
+  ABIVerifier->doInitialization(*TheModule);
+}
+
+uint64_t llvm::getNaClFunctionBodyBitSize(Function *F) {
+  // Note: Modules created by the NaCl bitcode readers are always
+  // attached to a NaClBitcodeReader.
+  NaClBitcodeReader *R =
+      static_cast<NaClBitcodeReader*>(F->getParent()->getMaterializer());
+  if (R == 0)
+    return 0;
+  return R->getFunctionBodyBitSize(F);
+}
+
+void llvm::setNaClFunctionABIVerification(Module *M,
+                                          PNaClABIErrorReporter *Reporter) {
+  // Note: Modules created by the NaCl bitcode readers are always
+  // attached to a NaClBitcodeReader.
+  NaClBitcodeReader *R = static_cast<NaClBitcodeReader*>(M->getMaterializer());
+  if (R)
+    R->setABIVerification(Reporter);
+}
+
 /// NaClParseBitcodeFile - Read the specified bitcode file, returning the module.
 /// If an error occurs, return null and fill in *ErrMsg if non-null.
 Module *llvm::NaClParseBitcodeFile(MemoryBuffer *Buffer, LLVMContext& Context,
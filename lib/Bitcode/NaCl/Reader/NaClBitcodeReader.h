@@ -16,11 +16,14 @@
 #define NACL_BITCODE_READER_H
 
 #include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/OwningPtr.h"
+#include "llvm/Analysis/NaCl/PNaClABIVerifyFunctions.h"
 #include "llvm/Analysis/NaCl/PNaClAllowedIntrinsics.h"
 #include "llvm/Bitcode/NaCl/NaClBitcodeHeader.h"
 #include "llvm/Bitcode/NaCl/NaClBitstreamReader.h"
 #include "llvm/Bitcode/NaCl/NaClLLVMBitCodes.h"
 #include "llvm/GVMaterializer.h"
+#include "llvm/IR/DataLayout.h"
 #include "llvm/IR/DerivedTypes.h"
 #include "llvm/IR/Instruction.h"
 #include "llvm/IR/OperandTraits.h"
@@ -145,6 +148,9 @@ class NaClBitcodeReader : public GVMaterializer {
   PNaClAllowedIntrinsics AllowedIntrinsics;
   MemoryBuffer *Buffer;
   bool BufferOwned;
+  /// \brief True if Buffer is a memory-mapped file, whose pages can be
+  /// released once the function bodies in them have been parsed.
+  bool ReleaseParsedPages;
   OwningPtr<NaClBitstreamReader> StreamFile;
   NaClBitstreamCursor Stream;
   StreamingMemoryObject *LazyStreamer;
@@ -190,33 +196,47 @@ class NaClBitcodeReader : public GVMaterializer {
   /// stream.
   DenseMap<Function*, uint64_t> DeferredFunctionInfo;
 
+  /// The size (in bits) of each function body block found in the stream.
+  DenseMap<Function*, uint64_t> FunctionBodyBitSize;
+
   /// \brief True if we should only accept supported bitcode format.
   bool AcceptSupportedBitcodeOnly;
 
   /// \brief Integer type use for PNaCl conversion of pointers.
   Type *IntPtrType;
 
+  /// \brief If non-null, the PNaCl ABI rules of function bodies are
+  /// checked as their instructions are constructed, and violations are
+  /// reported to ABIReporter.
+  PNaClABIErrorReporter *ABIReporter;
+  /// \brief The verifier (and data layout) used to check instructions
+  /// when ABIReporter is non-null.
+  OwningPtr<PNaClABIVerifyFunctions> ABIVerifier;
+  OwningPtr<DataLayout> ABIDataLayout;
+
 public:
   explicit NaClBitcodeReader(MemoryBuffer *buffer, LLVMContext &C,
                              bool AcceptSupportedOnly = true)
       : Context(C), TheModule(0), AllowedIntrinsics(&C),
-        Buffer(buffer), BufferOwned(false),
+        Buffer(buffer), BufferOwned(false), ReleaseParsedPages(false),
         LazyStreamer(0), NextUnreadBit(0), SeenValueSymbolTable(false),
         ValueList(C),
         SeenFirstFunctionBody(false),
         AcceptSupportedBitcodeOnly(AcceptSupportedOnly),
-        IntPtrType(IntegerType::get(C, PNaClIntPtrTypeBitSize)) {
+        IntPtrType(IntegerType::get(C, PNaClIntPtrTypeBitSize)),
+        ABIReporter(0) {
   }
   explicit NaClBitcodeReader(StreamingMemoryObject *streamer,
                              LLVMContext &C,
                              bool AcceptSupportedOnly = true)
       : Context(C), TheModule(0), AllowedIntrinsics(&C),
-        Buffer(0), BufferOwned(false),
+        Buffer(0), BufferOwned(false), ReleaseParsedPages(false),
         LazyStreamer(streamer), NextUnreadBit(0), SeenValueSymbolTable(false),
         ValueList(C),
         SeenFirstFunctionBody(false),
         AcceptSupportedBitcodeOnly(AcceptSupportedOnly),
-        IntPtrType(IntegerType::get(C, PNaClIntPtrTypeBitSize)) {
+        IntPtrType(IntegerType::get(C, PNaClIntPtrTypeBitSize)),
+        ABIReporter(0) {
   }
   ~NaClBitcodeReader() {
     FreeState();
@@ -244,6 +264,23 @@ public:
   /// @returns true if an error occurred.
   bool ParseBitcodeInto(Module *M);
 
+  /// \brief Fills M with a copy of the module that Src is attached to,
+  /// and sets up this reader to materialize the function bodies of M
+  /// without reparsing the module-level blocks. See
+  /// getNaClStreamedBitcodeModuleCopy for details.
+  /// @returns true if an error occurred.
+  bool CopyBitcodeInto(Module *M, const NaClBitcodeReader &Src);
+
+  /// \brief Returns the size (in bits) of the body block of F, finding
+  /// it in the stream if necessary. Returns 0 if F has no body to
+  /// materialize, or the body can't be found.
+  uint64_t getFunctionBodyBitSize(Function *F);
+
+  /// \brief Checks the PNaCl ABI rules of function bodies as they are
+  /// parsed, reporting violations to Reporter. A null Reporter turns
+  /// the checks off. See setNaClFunctionABIVerification for details.
+  void setABIVerification(PNaClABIErrorReporter *Reporter);
+
 private:
   // Returns false if Header is acceptable.
   bool AcceptHeader() const {
@@ -324,6 +361,13 @@ private:
   /// \brief Install instruction I into basic block BB.
   bool InstallInstruction(BasicBlock *BB, Instruction *I);
 
+  /// \brief Checks the PNaCl ABI rules of instruction I, which has
+  /// been installed in its basic block, if requested.
+  void VerifyInstruction(const Instruction *I) {
+    if (ABIReporter)
+      ABIVerifier->verifyInstruction(I, ABIDataLayout.get(), *ABIReporter);
+  }
+
   FunctionType *AddPointerTypesToIntrinsicType(StringRef Name,
                                                FunctionType *FTy);
   void AddPointerTypesToIntrinsicParams();
@@ -336,6 +380,7 @@ private:
   bool RememberAndSkipFunctionBody();
   bool ParseFunctionBody(Function *F);
   bool GlobalCleanup();
+  Type *CopyType(Type *Ty, DenseMap<Type*, Type*> &TypeMap);
   bool InitStream();
   bool InitStreamFromBuffer();
   bool InitLazyStream();
@@ -12,14 +12,69 @@
 
 using namespace llvm;
 
+/// Replaces each abbreviation in Abbrevs with a (private) copy.
+static void CopyAbbrevs(std::vector<NaClBitCodeAbbrev*> &Abbrevs) {
+  for (size_t i = 0, e = Abbrevs.size(); i != e; ++i)
+    Abbrevs[i] = Abbrevs[i]->Copy();
+}
+
+//===----------------------------------------------------------------------===//
+//  NaClBitstreamReader implementation
+//===----------------------------------------------------------------------===//
+
+void NaClBitstreamReader::CopyBlockInfoRecords(const NaClBitstreamReader &Src) {
+  assert(!hasBlockInfoRecords() && "Block info records already defined");
+  BlockInfoRecords = Src.BlockInfoRecords;
+  for (size_t i = 0, e = BlockInfoRecords.size(); i != e; ++i)
+    CopyAbbrevs(BlockInfoRecords[i].Abbrevs);
+}
+
 //===----------------------------------------------------------------------===//
 //  NaClBitstreamCursor implementation
 //===----------------------------------------------------------------------===//
 
+// No masks for chunk sizes 0 and 1, which can't hold a continuation bit
+// and a payload; ReadVBR64 takes its slow path for those.
+const uint64_t NaClBitstreamCursor::VBRContinuationMasks[33] = {
+  0x0000000000000000ULL, // 0
+  0x0000000000000000ULL, // 1
+  0xaaaaaaaaaaaaaaaaULL, // 2
+  0x4924924924924924ULL, // 3
+  0x8888888888888888ULL, // 4
+  0x0842108421084210ULL, // 5
+  0x0820820820820820ULL, // 6
+  0x4081020408102040ULL, // 7
+  0x8080808080808080ULL, // 8
+  0x4020100804020100ULL, // 9
+  0x0802008020080200ULL, // 10
+  0x0040080100200400ULL, // 11
+  0x0800800800800800ULL, // 12
+  0x0008004002001000ULL, // 13
+  0x0080020008002000ULL, // 14
+  0x0800100020004000ULL, // 15
+  0x8000800080008000ULL, // 16
+  0x0004000200010000ULL, // 17
+  0x0020000800020000ULL, // 18
+  0x0100002000040000ULL, // 19
+  0x0800008000080000ULL, // 20
+  0x4000020000100000ULL, // 21
+  0x0000080000200000ULL, // 22
+  0x0000200000400000ULL, // 23
+  0x0000800000800000ULL, // 24
+  0x0002000001000000ULL, // 25
+  0x0008000002000000ULL, // 26
+  0x0020000004000000ULL, // 27
+  0x0080000008000000ULL, // 28
+  0x0200000010000000ULL, // 29
+  0x0800000020000000ULL, // 30
+  0x2000000040000000ULL, // 31
+  0x8000000080000000ULL  // 32
+};
+
 void NaClBitstreamCursor::operator=(const NaClBitstreamCursor &RHS) {
   freeState();
 
-  BitStream = RHS.BitStream;
+  setBitStream(RHS.BitStream);
   NextChar = RHS.NextChar;
   CurWord = RHS.CurWord;
   BitsInCurWord = RHS.BitsInCurWord;
@@ -39,6 +94,24 @@ void NaClBitstreamCursor::operator=(const NaClBitstreamCursor &RHS) {
   }
 }
 
+void NaClBitstreamCursor::initFrom(NaClBitstreamReader &R,
+                                   const NaClBitstreamCursor &Pos) {
+  freeState();
+
+  setBitStream(&R);
+  NextChar = Pos.NextChar;
+  CurWord = Pos.CurWord;
+  BitsInCurWord = Pos.BitsInCurWord;
+  CurCodeSize = Pos.CurCodeSize;
+
+  CurAbbrevs = Pos.CurAbbrevs;
+  CopyAbbrevs(CurAbbrevs);
+
+  BlockScope = Pos.BlockScope;
+  for (size_t S = 0, e = BlockScope.size(); S != e; ++S)
+    CopyAbbrevs(BlockScope[S].PrevAbbrevs);
+}
+
 void NaClBitstreamCursor::freeState() {
   // Free all the Abbrevs.
   for (size_t i = 0, e = CurAbbrevs.size(); i != e; ++i)
@@ -132,7 +205,67 @@ void NaClBitstreamCursor::skipAbbreviatedField(const NaClBitCodeAbbrevOp &Op) {
   }
 }
 
+/// readArray - Read the NumElts elements of the array read by decode
+/// operation Op. The element kind is dispatched on once, rather than per
+/// element.
+void NaClBitstreamCursor::readArray(const NaClBitCodeAbbrevDecodeOp &Op,
+                                    unsigned NumElts,
+                                    SmallVectorImpl<uint64_t> &Vals) {
+  // NumElts comes straight from the bitstream. Each element takes at least
+  // NumBits bits, so don't make room for more elements than the rest of
+  // the bitstream can hold.
+  unsigned NumBits = Op.NumBits;
+  uint64_t EndBit = GetCurrentBitNo() + uint64_t(NumElts) * NumBits;
+  if (!canSkipToPos((EndBit + 7) / 8))
+    report_fatal_error("Malformed bitcode: array runs past end of bitstream");
+  size_t Size = Vals.size();
+  Vals.resize(Size + NumElts);
+  uint64_t *Elts = Vals.data() + Size;
+  switch (Op.Kind) {
+  case NaClBitCodeAbbrevDecodeOp::Literal:
+    report_fatal_error("Should not reach here");
+  case NaClBitCodeAbbrevDecodeOp::Fixed:
+    for (unsigned i = 0; i != NumElts; ++i)
+      Elts[i] = Read(NumBits);
+    break;
+  case NaClBitCodeAbbrevDecodeOp::VBR:
+    for (unsigned i = 0; i != NumElts; ++i)
+      Elts[i] = ReadVBR64(NumBits);
+    break;
+  case NaClBitCodeAbbrevDecodeOp::Char6:
+    for (unsigned i = 0; i != NumElts; ++i)
+      Elts[i] = NaClBitCodeAbbrevOp::DecodeChar6(Read(6));
+    break;
+  }
+}
 
+/// skipArray - Skip the NumElts elements of the array read by decode
+/// operation Op.
+void NaClBitstreamCursor::skipArray(const NaClBitCodeAbbrevDecodeOp &Op,
+                                    unsigned NumElts) {
+  unsigned NumBits = Op.NumBits;
+  switch (Op.Kind) {
+  case NaClBitCodeAbbrevDecodeOp::Literal:
+    report_fatal_error("Should not reach here");
+  case NaClBitCodeAbbrevDecodeOp::Fixed:
+  case NaClBitCodeAbbrevDecodeOp::Char6: {
+    // Fixed-width elements can be jumped over, unless the array runs past
+    // the end of the bitstream.
+    uint64_t SkipTo = GetCurrentBitNo() + uint64_t(NumElts) * NumBits;
+    if (canSkipToPos(SkipTo/8)) {
+      JumpToBit(SkipTo);
+      break;
+    }
+    for (unsigned i = 0; i != NumElts; ++i)
+      (void)Read(NumBits);
+    break;
+  }
+  case NaClBitCodeAbbrevDecodeOp::VBR:
+    for (unsigned i = 0; i != NumElts; ++i)
+      (void)ReadVBR64(NumBits);
+    break;
+  }
+}
 
 /// skipRecord - Read the current record and discard it.
 void NaClBitstreamCursor::skipRecord(unsigned AbbrevID) {
@@ -148,6 +281,19 @@ void NaClBitstreamCursor::skipRecord(unsigned AbbrevID) {
 
   const NaClBitCodeAbbrev *Abbv = getAbbrev(AbbrevID);
 
+  if (Abbv->hasDecodeOps()) {
+    const SmallVectorImpl<NaClBitCodeAbbrevDecodeOp> &Ops =
+        Abbv->getDecodeOps();
+    for (size_t i = 0, e = Ops.size(); i != e; ++i) {
+      const NaClBitCodeAbbrevDecodeOp &Op = Ops[i];
+      if (Op.IsArray)
+        skipArray(Op, ReadVBR(6));
+      else
+        (void)readDecodeOpValue(Op);
+    }
+    return;
+  }
+
   for (unsigned i = 0, e = Abbv->getNumOperandInfos(); i != e; ++i) {
     const NaClBitCodeAbbrevOp &Op = Abbv->getOperandInfo(i);
     if (Op.isLiteral())
@@ -189,6 +335,23 @@ unsigned NaClBitstreamCursor::readRecord(unsigned AbbrevID,
 
   const NaClBitCodeAbbrev *Abbv = getAbbrev(AbbrevID);
 
+  if (Abbv->hasDecodeOps()) {
+    // The first decode operation reads the record code, which is never an
+    // array.
+    const SmallVectorImpl<NaClBitCodeAbbrevDecodeOp> &Ops =
+        Abbv->getDecodeOps();
+    unsigned Code = (unsigned)readDecodeOpValue(Ops[0]);
+    Vals.reserve(Vals.size() + Ops.size() - 1);
+    for (size_t i = 1, e = Ops.size(); i != e; ++i) {
+      const NaClBitCodeAbbrevDecodeOp &Op = Ops[i];
+      if (Op.IsArray)
+        readArray(Op, ReadVBR(6), Vals);
+      else
+        Vals.push_back(readDecodeOpValue(Op));
+    }
+    return Code;
+  }
+
   for (unsigned i = 0, e = Abbv->getNumOperandInfos(); i != e; ++i) {
     const NaClBitCodeAbbrevOp &Op = Abbv->getOperandInfo(i);
     if (Op.isLiteral()) {
@@ -260,6 +423,7 @@ void NaClBitstreamCursor::ReadAbbrevRecord(bool IsLocal,
     } else
       Abbv->Add(NaClBitCodeAbbrevOp(E));
   }
+  Abbv->CompileDecodeOps();
   CurAbbrevs.push_back(Abbv);
   if (Listener) {
     Listener->ProcessAbbreviation(Abbv, IsLocal);
@@ -18,6 +18,7 @@
 #include "NaClValueEnumerator.h"
 #include "llvm/Bitcode/NaCl/NaClBitstreamWriter.h"
 #include "llvm/Bitcode/NaCl/NaClLLVMBitCodes.h"
+#include "llvm/Config/config.h"
 #include "llvm/IR/Constants.h"
 #include "llvm/IR/DerivedTypes.h"
 #include "llvm/IR/InlineAsm.h"
@@ -25,14 +26,19 @@
 #include "llvm/IR/Module.h"
 #include "llvm/IR/Operator.h"
 #include "llvm/IR/ValueSymbolTable.h"
+#include "llvm/Support/Atomic.h"
 #include "llvm/Support/Debug.h"
 #include "llvm/Support/CommandLine.h"
 #include "llvm/Support/ErrorHandling.h"
 #include "llvm/Support/MathExtras.h"
 #include "llvm/Support/Program.h"
 #include "llvm/Support/raw_ostream.h"
+#include <algorithm>
 #include <cctype>
 #include <map>
+#if LLVM_ENABLE_THREADS != 0 && defined(HAVE_PTHREAD_H)
+#include <pthread.h>
+#endif
 using namespace llvm;
 
 static cl::opt<unsigned>
@@ -40,6 +46,12 @@ PNaClVersion("pnacl-version",
              cl::desc("Specify PNaCl bitcode version to write"),
              cl::init(2));
 
+static cl::opt<unsigned>
+PNaClWriterThreads("pnacl-writer-threads",
+                   cl::desc("Number of threads used to write function "
+                            "blocks"),
+                   cl::init(1));
+
 /// These are manifest constants used by the bitcode writer. They do
 /// not need to be kept in sync with the reader, but need to be
 /// consistent within this file.
@@ -905,6 +917,118 @@ static void WriteFunction(const Function &F, NaClValueEnumerator &VE,
   Stream.ExitBlock();
 }
 
+namespace {
+
+/// Writes function blocks on several threads. Each thread takes the next
+/// function to write, and writes its block into a buffer of its own, with
+/// its own copy of the value enumerator. The blocks are then appended to
+/// the module block in order, so the bitcode is the same as when the
+/// functions are written one after the other.
+class ParallelFunctionWriter {
+public:
+  ParallelFunctionWriter(const std::vector<const Function *> &Functions,
+                         const NaClValueEnumerator &VE,
+                         const NaClBitstreamWriter &Stream)
+      : Functions(Functions), VE(VE), Stream(Stream),
+        Blocks(Functions.size()), NextFunction(0) {}
+
+  /// Writes the function blocks, using NumThreads threads.
+  void run(unsigned NumThreads);
+
+  /// Appends the function blocks to Out, which must be the stream the
+  /// blocks were written for. If FlushTo is non-null, Out is flushed to
+  /// it after each block.
+  void emitBlocks(NaClBitstreamWriter &Out, raw_ostream *FlushTo);
+
+private:
+  const std::vector<const Function *> &Functions;
+  const NaClValueEnumerator &VE;
+  const NaClBitstreamWriter &Stream;
+  std::vector<SmallVector<char, 0> > Blocks;
+  volatile sys::cas_flag NextFunction;
+
+  void writeBlocks();
+  static void *runThread(void *Arg);
+};
+
+} // end of anonymous namespace
+
+void ParallelFunctionWriter::writeBlocks() {
+  NaClValueEnumerator FunctionVE(VE);
+  for (;;) {
+    size_t Index = sys::AtomicIncrement(&NextFunction) - 1;
+    if (Index >= Functions.size())
+      break;
+    NaClBitstreamWriter FunctionStream(Blocks[Index], Stream);
+    WriteFunction(*Functions[Index], FunctionVE, FunctionStream);
+  }
+}
+
+void *ParallelFunctionWriter::runThread(void *Arg) {
+  static_cast<ParallelFunctionWriter *>(Arg)->writeBlocks();
+  return 0;
+}
+
+void ParallelFunctionWriter::run(unsigned NumThreads) {
+#if LLVM_ENABLE_THREADS != 0 && defined(HAVE_PTHREAD_H)
+  // The calling thread is one of the threads. If a thread can't be
+  // created, the others write its share of the blocks.
+  std::vector<pthread_t> Threads;
+  for (unsigned i = 1; i < NumThreads; ++i) {
+    pthread_t Thread;
+    if (pthread_create(&Thread, NULL, runThread, this) != 0)
+      break;
+    Threads.push_back(Thread);
+  }
+  writeBlocks();
+  for (size_t i = 0, e = Threads.size(); i != e; ++i)
+    pthread_join(Threads[i], NULL);
+#else
+  (void)NumThreads;
+  writeBlocks();
+#endif
+}
+
+void ParallelFunctionWriter::emitBlocks(NaClBitstreamWriter &Out,
+                                        raw_ostream *FlushTo) {
+  for (size_t i = 0, e = Blocks.size(); i != e; ++i) {
+    Out.EmitWords(Blocks[i]);
+    SmallVector<char, 0>().swap(Blocks[i]);
+    if (FlushTo)
+      Out.FlushWordsTo(*FlushTo);
+  }
+}
+
+/// WriteFunctions - Emit the function bodies of the module to the module
+/// stream, using -pnacl-writer-threads threads. If FlushTo is non-null,
+/// the stream is flushed to it after each function block.
+static void WriteFunctions(const Module *M, NaClValueEnumerator &VE,
+                           NaClBitstreamWriter &Stream,
+                           raw_ostream *FlushTo) {
+  std::vector<const Function *> Functions;
+  for (Module::const_iterator F = M->begin(), E = M->end(); F != E; ++F)
+    if (!F->isDeclaration())
+      Functions.push_back(F);
+
+  // Blocks written on other threads can only be appended at a word
+  // boundary, which the stream is at after the first function block.
+  size_t NumWritten = 0;
+  for (; NumWritten != Functions.size(); ++NumWritten) {
+    if (PNaClWriterThreads > 1 && Stream.GetCurrentBitNo() % 32 == 0)
+      break;
+    WriteFunction(*Functions[NumWritten], VE, Stream);
+    if (FlushTo)
+      Stream.FlushWordsTo(*FlushTo);
+  }
+  if (NumWritten == Functions.size())
+    return;
+
+  Functions.erase(Functions.begin(), Functions.begin() + NumWritten);
+  ParallelFunctionWriter Writer(Functions, VE, Stream);
+  Writer.run(std::min<size_t>(PNaClWriterThreads, Functions.size()));
+  Writer.emitBlocks(Stream, FlushTo);
+}
+
 // Emit blockinfo, which defines the standard abbreviations etc.
 static void WriteBlockInfo(const NaClValueEnumerator &VE,
                            NaClBitstreamWriter &Stream) {
@@ -1128,8 +1252,10 @@ static void WriteBlockInfo(const NaClValueEnumerator &VE,
   Stream.ExitBlock();
 }
 
-/// WriteModule - Emit the specified module to the bitstream.
-static void WriteModule(const Module *M, NaClBitstreamWriter &Stream) {
+/// WriteModule - Emit the specified module to the bitstream. If FlushTo
+/// is non-null, function blocks are flushed to it as they are written.
+static void WriteModule(const Module *M, NaClBitstreamWriter &Stream,
+                        raw_ostream *FlushTo) {
   DEBUG(dbgs() << "-> WriteModule\n");
   Stream.EnterSubblock(naclbitc::MODULE_BLOCK_ID);
 
@@ -1156,9 +1282,7 @@ static void WriteModule(const Module *M, NaClBitstreamWriter &Stream) {
   WriteValueSymbolTable(M->getValueSymbolTable(), VE, Stream);
 
   // Emit function bodies.
-  for (Module::const_iterator F = M->begin(), E = M->end(); F != E; ++F)
-    if (!F->isDeclaration())
-      WriteFunction(*F, VE, Stream);
+  WriteFunctions(M, VE, Stream, FlushTo);
 
   Stream.ExitBlock();
   DEBUG(dbgs() << "<- WriteModule\n");
@@ -1208,6 +1332,29 @@ void llvm::NaClWriteHeader(const NaClBitcodeHeader &Header,
   Stream.BackpatchWord(NaClBitcodeHeader::WordSize, Value);
 }
 
+/// WriteBitcode - Emit the header and the specified module to the
+/// bitstream. If FlushTo is non-null, function blocks are flushed to it as
+/// they are written.
+static void WriteBitcode(const Module *M, NaClBitstreamWriter &Stream,
+                         bool AcceptSupportedOnly, raw_ostream *FlushTo) {
+  // Define header and install into stream.
+  {
+    NaClBitcodeHeader Header;
+    Header.push_back(
+        new NaClBitcodeHeaderField(NaClBitcodeHeaderField::kPNaClVersion,
+                                   PNaClVersion));
+    Header.InstallFields();
+    if (!(Header.IsSupported() ||
+          (!AcceptSupportedOnly && Header.IsReadable()))) {
+      report_fatal_error(Header.Unsupported());
+    }
+    NaClWriteHeader(Header, Stream);
+  }
+
+  // Emit the module.
+  WriteModule(M, Stream, FlushTo);
+}
+
 /// WriteBitcodeToFile - Write the specified module to the specified output
 /// stream.
 void llvm::NaClWriteBitcodeToFile(const Module *M, raw_ostream &Out,
@@ -1218,25 +1365,43 @@ void llvm::NaClWriteBitcodeToFile(const Module *M, raw_ostream &Out,
   // Emit the module into the buffer.
   {
     NaClBitstreamWriter Stream(Buffer);
-
-    // Define header and install into stream.
-    {
-      NaClBitcodeHeader Header;
-      Header.push_back(
-          new NaClBitcodeHeaderField(NaClBitcodeHeaderField::kPNaClVersion,
-                                     PNaClVersion));
-      Header.InstallFields();
-      if (!(Header.IsSupported() ||
-            (!AcceptSupportedOnly && Header.IsReadable()))) {
-        report_fatal_error(Header.Unsupported());
-      }
-      NaClWriteHeader(Header, Stream);
-    }
-
-    // Emit the module.
-    WriteModule(M, Stream);
+    WriteBitcode(M, Stream, AcceptSupportedOnly, 0);
   }
 
   // Write the generated bitstream to "Out".
   Out.write((char*)&Buffer.front(), Buffer.size());
 }
+
+void llvm::NaClWriteBitcodeToSeekableFile(const Module *M,
+                                          raw_fd_ostream &Out,
+                                          bool AcceptSupportedOnly) {
+  if (!Out.supportsSeeking()) {
+    NaClWriteBitcodeToFile(M, Out, AcceptSupportedOnly);
+    return;
+  }
+
+  // Write function blocks to Out as soon as they are written, so that the
+  // buffer only holds one function block at a time, and patch the sizes of
+  // the enclosing blocks in Out once they are known.
+  SmallVector<char, 0> Buffer;
+  Buffer.reserve(256*1024);
+  uint64_t Start = Out.tell();
+  NaClBitstreamWriter Stream(Buffer);
+  WriteBitcode(M, Stream, AcceptSupportedOnly, &Out);
+  Stream.FlushWordsTo(Out);
+
+  const std::vector<std::pair<unsigned, unsigned> > &Backpatches =
+      Stream.getFlushedBackpatches();
+  if (Backpatches.empty())
+    return;
+  uint64_t End = Out.tell();
+  for (size_t i = 0, e = Backpatches.size(); i != e; ++i) {
+    unsigned Word = Backpatches[i].second;
+    char Bytes[4] = {
+      char(Word >>  0), char(Word >>  8), char(Word >> 16), char(Word >> 24)
+    };
+    Out.seek(Start + Backpatches[i].first);
+    Out.write(Bytes, 4);
+  }
+  Out.seek(End);
+}
@@ -118,6 +118,18 @@ NaClValueEnumerator::NaClValueEnumerator(const Module *M, uint32_t PNaClVersion)
   OptimizeConstants(FirstConstant, Values.size());
 }
 
+NaClValueEnumerator::NaClValueEnumerator(const NaClValueEnumerator &VE)
+    : TypeMap(VE.TypeMap), TypeCountMap(NULL), Types(VE.Types),
+      ValueMap(VE.ValueMap), Values(VE.Values),
+      InstructionMap(VE.InstructionMap), InstructionCount(0),
+      NumModuleValues(0), FirstFuncConstantID(0), FirstInstID(0),
+      FirstGlobalVarID(VE.FirstGlobalVarID),
+      NumGlobalVarIDs(VE.NumGlobalVarIDs), PNaClVersion(VE.PNaClVersion),
+      IntPtrType(VE.IntPtrType) {
+  assert(VE.BasicBlocks.empty() && VE.FnForwardTypeRefs.empty() &&
+         "Can't copy a value enumerator with an incorporated function");
+}
+
 void NaClValueEnumerator::OptimizeTypes(const Module *M) {
 
   // Sort types by count, so that we can index them based on
@@ -87,11 +87,15 @@ private:
   /// \brief Integer type use for PNaCl conversion of pointers.
   Type *IntPtrType;
 
-  NaClValueEnumerator(const NaClValueEnumerator &) LLVM_DELETED_FUNCTION;
   void operator=(const NaClValueEnumerator &) LLVM_DELETED_FUNCTION;
 public:
   NaClValueEnumerator(const Module *M, uint32_t PNaClVersion);
 
+  /// \brief Copies the module-level values and types of VE, which must not
+  /// have a function incorporated. Functions can then be incorporated into
+  /// the copy independently of VE, e.g. on another thread.
+  NaClValueEnumerator(const NaClValueEnumerator &VE);
+
   void dump() const;
   void print(raw_ostream &OS, const ValueMapType &Map, const char *Name) const;
 
@@ -138,7 +138,13 @@ Module *llvm::NaClParseIRFile(const std::string &Filename,
                               SMDiagnostic &Err,
                               LLVMContext &Context) {
   OwningPtr<MemoryBuffer> File;
-  if (error_code ec = MemoryBuffer::getFileOrSTDIN(Filename.c_str(), File)) {
+  // PNaCl bitcode doesn't need a null terminator, so that (large enough)
+  // files are always memory-mapped rather than copied into memory.
+  bool RequiresNullTerminator = Format != PNaClFormat;
+  error_code ec = Filename == "-"
+      ? MemoryBuffer::getSTDIN(File)
+      : MemoryBuffer::getFile(Filename, File, -1, RequiresNullTerminator);
+  if (ec) {
     Err = SMDiagnostic(Filename, SourceMgr::DK_Error,
                        "Could not open input file: " + ec.message());
     return 0;
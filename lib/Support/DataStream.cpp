@@ -20,8 +20,10 @@
 #include "llvm/Support/FileSystem.h"
 #include "llvm/Support/Program.h"
 #include "llvm/Support/system_error.h"
+#include <algorithm>
 #include <cerrno>
 #include <cstdio>
+#include <cstring>
 #include <string>
 #if !defined(_MSC_VER) && !defined(__MINGW32__)
 #include <unistd.h>
@@ -89,3 +91,63 @@ DataStreamer *getDataFileStreamer(const std::string &Filename,
 }
 
 }
+
+namespace llvm {
+
+ThrottledDataStreamer::ThrottledDataStreamer(DataStreamer *Source,
+                                             uint64_t BytesPerSecond,
+                                             size_t ChunkSize)
+    : Source(Source), BytesPerSecond(BytesPerSecond),
+      Chunk(ChunkSize ? ChunkSize : 1), ChunkPos(0), ChunkEnd(0),
+      BytesFetched(0), Started(false), SourceDone(false) {}
+
+ThrottledDataStreamer::~ThrottledDataStreamer() {
+  delete Source;
+}
+
+// Sleeps until the given time.
+static void sleepUntil(sys::TimeValue Deadline) {
+  sys::TimeValue Now = sys::TimeValue::now();
+  if (Deadline <= Now)
+    return;
+  sys::sleepFor(Deadline - Now);
+}
+
+size_t ThrottledDataStreamer::GetBytes(unsigned char *buf, size_t len) {
+  if (!Started) {
+    Started = true;
+    StartTime = sys::TimeValue::now();
+  }
+  if (ChunkPos == ChunkEnd) {
+    // Fetch the next chunk from the source, and wait for it to "arrive".
+    ChunkPos = ChunkEnd = 0;
+    while (!SourceDone && ChunkEnd < Chunk.size()) {
+      size_t Bytes = Source->GetBytes(&Chunk[ChunkEnd],
+                                      Chunk.size() - ChunkEnd);
+      if (Bytes == 0)
+        SourceDone = true;
+      ChunkEnd += Bytes;
+    }
+    if (ChunkEnd == 0) {
+      if (LastByteTime == sys::TimeValue::ZeroTime)
+        LastByteTime = sys::TimeValue::now();
+      return 0;
+    }
+    BytesFetched += ChunkEnd;
+    if (BytesPerSecond) {
+      sys::TimeValue Arrival = StartTime;
+      Arrival += sys::TimeValue(double(BytesFetched) / BytesPerSecond);
+      sys::TimeValue Before = sys::TimeValue::now();
+      sleepUntil(Arrival);
+      WaitTime += sys::TimeValue::now() - Before;
+    }
+    if (SourceDone)
+      LastByteTime = sys::TimeValue::now();
+  }
+  size_t Bytes = std::min(len, ChunkEnd - ChunkPos);
+  memcpy(buf, &Chunk[ChunkPos], Bytes);
+  ChunkPos += Bytes;
+  return Bytes;
+}
+
+}
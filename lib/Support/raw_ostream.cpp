@@ -420,13 +420,24 @@ void format_object_base::home() {
 //  raw_fd_ostream
 //===----------------------------------------------------------------------===//
 
+/// isAppending - Return true if FD was opened for appending, so that every
+/// write goes to the end of the file wherever the file offset was moved.
+static bool isAppending(int FD) {
+#if defined(F_GETFL) && defined(O_APPEND)
+  int Flags = ::fcntl(FD, F_GETFL);
+  return Flags != -1 && (Flags & O_APPEND);
+#else
+  return false;
+#endif
+}
+
 /// raw_fd_ostream - Open the specified file for writing. If an error
 /// occurs, information about the error is put into ErrorInfo, and the
 /// stream should be immediately destroyed; the string will be empty
 /// if no error occurred.
 raw_fd_ostream::raw_fd_ostream(const char *Filename, std::string &ErrorInfo,
                                sys::fs::OpenFlags Flags)
-    : Error(false), UseAtomicWrites(false), pos(0) {
+    : Error(false), UseAtomicWrites(false), SupportsSeeking(false), pos(0) {
   assert(Filename != 0 && "Filename is null");
   ErrorInfo.clear();
 
@@ -455,13 +466,16 @@ raw_fd_ostream::raw_fd_ostream(const char *Filename, std::string &ErrorInfo,
 
   // Ok, we successfully opened the file, so it'll need to be closed.
   ShouldClose = true;
+  SupportsSeeking = !(Flags & sys::fs::F_Append) &&
+                    ::lseek(FD, 0, SEEK_CUR) != (off_t)-1;
 }
 
 /// raw_fd_ostream ctor - FD is the file descriptor that this writes to.  If
 /// ShouldClose is true, this closes the file when the stream is destroyed.
 raw_fd_ostream::raw_fd_ostream(int fd, bool shouldClose, bool unbuffered)
   : raw_ostream(unbuffered), FD(fd),
-    ShouldClose(shouldClose), Error(false), UseAtomicWrites(false) {
+    ShouldClose(shouldClose), Error(false), UseAtomicWrites(false),
+    SupportsSeeking(false) {
 #ifdef O_BINARY
   // Setting STDOUT and STDERR to binary mode is necessary in Win32
   // to avoid undesirable linefeed conversion.
@@ -471,10 +485,12 @@ raw_fd_ostream::raw_fd_ostream(int fd, bool shouldClose, bool unbuffered)
 
   // Get the starting position.
   off_t loc = ::lseek(FD, 0, SEEK_CUR);
-  if (loc == (off_t)-1)
+  if (loc == (off_t)-1) {
     pos = 0;
-  else
+  } else {
     pos = static_cast<uint64_t>(loc);
+    SupportsSeeking = !isAppending(FD);
+  }
 }
 
 raw_fd_ostream::~raw_fd_ostream() {
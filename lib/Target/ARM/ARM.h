@@ -50,6 +50,7 @@ FunctionPass *createThumb2SizeReductionPass();
 
 /* @LOCALMOD-START */
 FunctionPass *createARMNaClRewritePass();
+FunctionPass *createARMNaClBundleSchedulerPass();
 /* @LOCALMOD-END */
 
 /// \brief Creates an ARM-specific Target Transformation Info pass.
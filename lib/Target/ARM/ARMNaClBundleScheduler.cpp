@@ -0,0 +1,525 @@
+//===-- ARMNaClBundleScheduler.cpp - Native Client Bundle Scheduler -------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// Native Client Bundle Scheduler
+// Native Client requires that the SFI sequences inserted by the rewrite pass
+// don't cross a 16-byte bundle boundary, and that calls end a bundle. The
+// assembler enforces this by padding with NOPs before the sequences. This
+// pass runs after the rewrite pass, tracks where each instruction will fall
+// within its bundle, and moves independent instructions across the SFI
+// sequences which would otherwise be padded:
+// * Instructions which follow a sequence are hoisted in front of it, to fill
+//   the slots which would be padded.
+// * Failing that, instructions which precede a sequence (but follow the
+//   previous sequence) are sunk past it, to pull it back into a position
+//   where it needs no padding.
+//
+// Instructions are only moved within a basic block, and only across
+// instructions which they don't depend on.
+//
+//===----------------------------------------------------------------------===//
+
+#define DEBUG_TYPE "arm-sfi-sched"
+#include "ARM.h"
+#include "ARMBaseInstrInfo.h"
+#include "llvm/ADT/SmallPtrSet.h"
+#include "llvm/ADT/Statistic.h"
+#include "llvm/CodeGen/MachineFunctionPass.h"
+#include "llvm/CodeGen/MachineJumpTableInfo.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/Debug.h"
+#include "llvm/Support/raw_ostream.h"
+#include <vector>
+
+using namespace llvm;
+
+STATISTIC(NumHoisted, "Number of instructions hoisted into bundle padding");
+STATISTIC(NumSunk, "Number of instructions sunk to avoid bundle padding");
+
+static cl::opt<bool>
+FlagSfiBundleSched("sfi-bundle-sched",
+  cl::desc("Reorder instructions around SFI sequences to avoid bundle "
+           "padding"),
+  cl::init(true));
+
+namespace {
+  const unsigned BundleSize = 16;
+  const unsigned InstrSize = 4;
+
+  // Instructions which follow a SFI sequence are only considered for
+  // hoisting in front of it if they are within this many units of it.
+  const unsigned HoistWindow = 8;
+
+  /// A SchedUnit is an instruction, or a SFI sequence, which is moved and
+  /// laid out as a whole.
+  struct SchedUnit {
+    enum UnitKind {
+      Single,      // A single instruction (possibly of size 0).
+      NoCross,     // A SFI sequence which must not cross a bundle boundary.
+      AlignToEnd,  // A SFI sequence which must end a bundle.
+      Label,       // A label, which instructions must not be moved across.
+      Unknown      // Something of unknown size.
+    };
+    MachineBasicBlock::iterator First;
+    unsigned NumInstrs;
+    unsigned Size;
+    UnitKind Kind;
+
+    SchedUnit(MachineBasicBlock::iterator First, unsigned NumInstrs,
+              unsigned Size, UnitKind Kind)
+        : First(First), NumInstrs(NumInstrs), Size(Size), Kind(Kind) {}
+
+    bool isSequence() const { return Kind == NoCross || Kind == AlignToEnd; }
+
+    /// Returns the number of bytes of padding needed in front of this unit,
+    /// when it starts at Pos within its bundle.
+    unsigned getPadding(unsigned Pos) const {
+      switch (Kind) {
+      default:
+        return 0;
+      case NoCross:
+        return Pos + Size > BundleSize ? BundleSize - Pos : 0;
+      case AlignToEnd:
+        return (BundleSize - (Pos + Size) % BundleSize) % BundleSize;
+      }
+    }
+  };
+
+  class ARMNaClBundleScheduler : public MachineFunctionPass {
+  public:
+    static char ID;
+    ARMNaClBundleScheduler() : MachineFunctionPass(ID) {}
+
+    const ARMBaseInstrInfo *TII;
+    const TargetRegisterInfo *TRI;
+    virtual void getAnalysisUsage(AnalysisUsage &AU) const;
+    virtual bool runOnMachineFunction(MachineFunction &MF);
+
+    virtual const char *getPassName() const {
+      return "ARM Native Client Bundle Scheduler";
+    }
+
+  private:
+    /// True if nothing may be moved across calls, because they may throw
+    /// to a landing pad or return twice.
+    bool CallsAreBarriers;
+
+    void BuildUnits(MachineBasicBlock &MBB, std::vector<SchedUnit> &Units);
+    bool IsMovable(const SchedUnit &U) const;
+    bool CanMoveAcross(const MachineInstr &MI, const SchedUnit &U) const;
+    bool HoistIntoPadding(MachineBasicBlock &MBB,
+                          std::vector<SchedUnit> &Units, unsigned Idx);
+    unsigned SinkToAvoidPadding(MachineBasicBlock &MBB,
+                                std::vector<SchedUnit> &Units, unsigned Idx,
+                                unsigned FirstMovable, unsigned Pos);
+    bool ScheduleBlock(MachineBasicBlock &MBB, int &Pos);
+  };
+  char ARMNaClBundleScheduler::ID = 0;
+}
+
+void ARMNaClBundleScheduler::getAnalysisUsage(AnalysisUsage &AU) const {
+  AU.setPreservesCFG();
+  MachineFunctionPass::getAnalysisUsage(AU);
+}
+
+// If I is a SFI pseudo which starts a sequence that the MC layer emits
+// bundle-locked (see ARMMCNaCl.cpp), returns the layout of the instructions
+// which follow it in the sequence: 'R' for a real instruction, 'N' for a
+// SFI_NOP_IF_AT_BUNDLE_END and 'M' for a SFI_DATA_MASK. Otherwise returns
+// null.
+static const char *GetSequencePattern(const MachineInstr &MI,
+                                      SchedUnit::UnitKind *Kind) {
+  switch (MI.getOpcode()) {
+  default:
+    return 0;
+  case ARM::SFI_GUARD_LOADSTORE:
+  case ARM::SFI_GUARD_LOADSTORE_TST:
+  case ARM::SFI_GUARD_INDIRECT_JMP:
+  case ARM::SFI_GUARD_RETURN:
+    *Kind = SchedUnit::NoCross;
+    return "R";
+  case ARM::SFI_GUARD_CALL:
+  case ARM::SFI_GUARD_INDIRECT_CALL:
+    *Kind = SchedUnit::AlignToEnd;
+    return "R";
+  case ARM::SFI_NOP_IF_AT_BUNDLE_END:
+    *Kind = SchedUnit::NoCross;
+    return "RM";
+  case ARM::SFI_GUARD_SP_LOAD:
+    *Kind = SchedUnit::NoCross;
+    return "NRM";
+  }
+}
+
+// Returns the size of the code emitted for the SFI pseudo MI.
+static unsigned GetSFIPseudoSize(const MachineInstr &MI) {
+  switch (MI.getOpcode()) {
+  default:
+    return InstrSize;
+  // These only control the placement of the instructions which follow.
+  case ARM::SFI_GUARD_CALL:
+  case ARM::SFI_NOP_IF_AT_BUNDLE_END:
+    return 0;
+  }
+}
+
+static bool IsSFIPseudo(const MachineInstr &MI) {
+  switch (MI.getOpcode()) {
+  default:
+    return false;
+  case ARM::SFI_GUARD_LOADSTORE:
+  case ARM::SFI_GUARD_LOADSTORE_TST:
+  case ARM::SFI_GUARD_INDIRECT_JMP:
+  case ARM::SFI_GUARD_RETURN:
+  case ARM::SFI_GUARD_CALL:
+  case ARM::SFI_GUARD_INDIRECT_CALL:
+  case ARM::SFI_NOP_IF_AT_BUNDLE_END:
+  case ARM::SFI_GUARD_SP_LOAD:
+  case ARM::SFI_DATA_MASK:
+    return true;
+  }
+}
+
+void ARMNaClBundleScheduler::BuildUnits(MachineBasicBlock &MBB,
+                                        std::vector<SchedUnit> &Units) {
+  Units.clear();
+  MachineBasicBlock::iterator I = MBB.begin(), E = MBB.end();
+  while (I != E) {
+    SchedUnit::UnitKind Kind = SchedUnit::Single;
+    if (const char *Pattern = GetSequencePattern(*I, &Kind)) {
+      // Check that the sequence is made of what the MC layer expects.
+      MachineBasicBlock::iterator First = I;
+      unsigned Size = GetSFIPseudoSize(*I);
+      unsigned NumInstrs = 1;
+      for (++I; *Pattern && I != E; ++Pattern, ++I, ++NumInstrs) {
+        if (*Pattern == 'N') {
+          if (I->getOpcode() != ARM::SFI_NOP_IF_AT_BUNDLE_END)
+            break;
+        } else if (*Pattern == 'M') {
+          if (I->getOpcode() != ARM::SFI_DATA_MASK)
+            break;
+          Size += InstrSize;
+        } else {
+          if (IsSFIPseudo(*I) || TII->GetInstSizeInBytes(I) != InstrSize)
+            break;
+          Size += InstrSize;
+        }
+      }
+      if (*Pattern)
+        Kind = SchedUnit::Unknown;
+      Units.push_back(SchedUnit(First, NumInstrs, Size, Kind));
+      continue;
+    }
+
+    unsigned Size = TII->GetInstSizeInBytes(I);
+    if (I->isLabel())
+      Kind = SchedUnit::Label;
+    else if (I->isInlineAsm() || I->getOpcode() == ARM::CONSTPOOL_ENTRY ||
+             Size % InstrSize != 0 || IsSFIPseudo(*I) ||
+             (Size == 0 && !I->isDebugValue() && !I->isKill() &&
+              !I->isImplicitDef()))
+      Kind = SchedUnit::Unknown;
+    Units.push_back(SchedUnit(I, 1, Size, Kind));
+    ++I;
+  }
+}
+
+// Returns true if the unit U is a single instruction which can be moved
+// across other instructions it doesn't depend on.
+bool ARMNaClBundleScheduler::IsMovable(const SchedUnit &U) const {
+  if (U.Kind != SchedUnit::Single || U.Size != InstrSize)
+    return false;
+  const MachineInstr &MI = *U.First;
+  if (MI.isPseudo() || MI.isCall() || MI.isBranch() || MI.isTerminator() ||
+      MI.isReturn() || MI.hasUnmodeledSideEffects() ||
+      MI.hasOrderedMemoryRef() || MI.isInlineAsm())
+    return false;
+  for (unsigned i = 0, e = MI.getNumOperands(); i != e; ++i) {
+    const MachineOperand &MO = MI.getOperand(i);
+    if (MO.isReg()) {
+      // Changes to SP are sandboxed, and reads of PC depend on where the
+      // instruction is.
+      unsigned Reg = MO.getReg();
+      if (Reg == ARM::PC || (MO.isDef() && Reg == ARM::SP))
+        return false;
+      continue;
+    }
+    // References to blocks, constant pools and jump tables are laid out
+    // relative to the instruction.
+    if (MO.isMBB() || MO.isCPI() || MO.isJTI() || MO.isBlockAddress() ||
+        MO.isMCSymbol() || MO.isRegMask())
+      return false;
+  }
+  return true;
+}
+
+// Returns true if the movable instruction MI can be moved across the
+// instructions of unit U, i.e. if they don't depend on each other.
+bool ARMNaClBundleScheduler::CanMoveAcross(const MachineInstr &MI,
+                                           const SchedUnit &U) const {
+  if (U.Kind == SchedUnit::Label || U.Kind == SchedUnit::Unknown)
+    return false;
+  MachineBasicBlock::const_iterator I = U.First;
+  for (unsigned n = 0; n < U.NumInstrs; ++n, ++I) {
+    const MachineInstr &Other = *I;
+    if (Other.isDebugValue())
+      continue;
+    // The SFI pseudos have no patterns, so they are assumed to have side
+    // effects, but all they do is mask the registers they define (and LR,
+    // for SFI_GUARD_RETURN).
+    if (IsSFIPseudo(Other)) {
+      if (Other.getOpcode() == ARM::SFI_GUARD_RETURN &&
+          (MI.readsRegister(ARM::LR, TRI) ||
+           MI.modifiesRegister(ARM::LR, TRI)))
+        return false;
+    } else if (Other.hasUnmodeledSideEffects() || Other.isInlineAsm() ||
+               (Other.isCall() && CallsAreBarriers)) {
+      return false;
+    }
+    bool OtherMayLoad = Other.mayLoad() || Other.isCall();
+    bool OtherMayStore = Other.mayStore() || Other.isCall();
+    if ((MI.mayStore() && (OtherMayLoad || OtherMayStore)) ||
+        (MI.mayLoad() && OtherMayStore))
+      return false;
+    for (unsigned i = 0, e = MI.getNumOperands(); i != e; ++i) {
+      const MachineOperand &MO = MI.getOperand(i);
+      if (!MO.isReg() || MO.getReg() == 0)
+        continue;
+      if (Other.modifiesRegister(MO.getReg(), TRI))
+        return false;
+      if (MO.isDef() && Other.readsRegister(MO.getReg(), TRI))
+        return false;
+    }
+  }
+  return true;
+}
+
+// Moves movable instructions which follow the SFI sequence Units[Idx] in
+// front of it, if that avoids padding before the sequence. Returns true
+// if an instruction was moved, leaving it at Units[Idx].
+bool ARMNaClBundleScheduler::HoistIntoPadding(MachineBasicBlock &MBB,
+                                              std::vector<SchedUnit> &Units,
+                                              unsigned Idx) {
+  for (unsigned j = Idx + 1, e = Units.size();
+       j < e && j <= Idx + HoistWindow;
+       ++j) {
+    if (IsMovable(Units[j])) {
+      MachineInstr *MI = Units[j].First;
+      bool Independent = true;
+      for (unsigned k = Idx; k < j && Independent; ++k)
+        Independent = CanMoveAcross(*MI, Units[k]);
+      if (Independent) {
+        // Kill flags on MI may now precede other uses of the registers.
+        for (unsigned i = 0, e = MI->getNumOperands(); i != e; ++i) {
+          MachineOperand &MO = MI->getOperand(i);
+          if (MO.isReg() && MO.isUse())
+            MO.setIsKill(false);
+        }
+        MBB.splice(Units[Idx].First, &MBB, MI);
+        SchedUnit U = Units[j];
+        Units.erase(Units.begin() + j);
+        Units.insert(Units.begin() + Idx, U);
+        ++NumHoisted;
+        return true;
+      }
+    }
+    // Don't look past units which nothing can be moved across.
+    if (Units[j].Kind == SchedUnit::Label ||
+        Units[j].Kind == SchedUnit::Unknown)
+      break;
+  }
+  return false;
+}
+
+// Moves movable instructions, from Units[FirstMovable] up to the SFI
+// sequence Units[Idx], behind the sequence, if that moves the sequence
+// (starting at Pos) back to a position where it needs no padding. Returns
+// the number of instructions moved, by which the sequence's index drops.
+unsigned
+ARMNaClBundleScheduler::SinkToAvoidPadding(MachineBasicBlock &MBB,
+                                           std::vector<SchedUnit> &Units,
+                                           unsigned Idx,
+                                           unsigned FirstMovable,
+                                           unsigned Pos) {
+  const SchedUnit &Seq = Units[Idx];
+  // Nothing after a branch executes in its place.
+  MachineBasicBlock::iterator I = Seq.First;
+  for (unsigned n = 0; n < Seq.NumInstrs; ++n, ++I) {
+    if (I->isBranch() || I->isTerminator() || I->isReturn())
+      return 0;
+  }
+
+  // Find how many instructions need to be sunk.
+  unsigned NumToSink = 1;
+  for (; NumToSink < BundleSize / InstrSize; ++NumToSink) {
+    unsigned NewPos = (Pos + BundleSize - NumToSink * InstrSize) % BundleSize;
+    if (Seq.getPadding(NewPos) == 0)
+      break;
+  }
+  if (NumToSink == BundleSize / InstrSize)
+    return 0;
+
+  // Pick them from the closest to the sequence backwards. Each one must
+  // be independent of the units between it and the end of the sequence,
+  // other than those picked already (which keep their relative order).
+  SmallVector<unsigned, 4> Picked;
+  SmallPtrSet<const MachineInstr *, 4> PickedInstrs;
+  for (unsigned j = Idx; j > FirstMovable && Picked.size() < NumToSink; ) {
+    --j;
+    if (!IsMovable(Units[j]))
+      continue;
+    MachineInstr *MI = Units[j].First;
+    bool Independent = true;
+    for (unsigned k = j + 1; k <= Idx && Independent; ++k) {
+      if (!PickedInstrs.count(Units[k].First))
+        Independent = CanMoveAcross(*MI, Units[k]);
+    }
+    if (Independent) {
+      Picked.push_back(j);
+      PickedInstrs.insert(MI);
+    }
+  }
+  if (Picked.size() != NumToSink)
+    return 0;
+
+  // Move them right behind the sequence, the last one first.
+  MachineBasicBlock::iterator InsertPt = Seq.First;
+  std::advance(InsertPt, Seq.NumInstrs);
+  for (unsigned p = 0; p < Picked.size(); ++p) {
+    SchedUnit U = Units[Picked[p]];
+    MachineInstr *MI = U.First;
+    // MI's kill flags may now follow other uses of the registers, and the
+    // kill flags on those uses now precede MI.
+    for (unsigned i = 0, e = MI->getNumOperands(); i != e; ++i) {
+      MachineOperand &MO = MI->getOperand(i);
+      if (!MO.isReg() || !MO.isUse() || MO.getReg() == 0)
+        continue;
+      MO.setIsKill(false);
+      for (MachineBasicBlock::iterator J = llvm::next(
+               MachineBasicBlock::iterator(MI));
+           J != InsertPt;
+           ++J)
+        J->clearRegisterKills(MO.getReg(), TRI);
+    }
+    MBB.splice(InsertPt, &MBB, MI);
+    InsertPt = MI;
+    // Keep Units in the same order as the instructions.
+    unsigned NewIdx = Idx - p;
+    Units.erase(Units.begin() + Picked[p]);
+    Units.insert(Units.begin() + NewIdx, U);
+    ++NumSunk;
+  }
+  return NumToSink;
+}
+
+// Schedules MBB, which starts at Pos within its bundle (or at an unknown
+// position if Pos is negative). Updates Pos to the position at which the
+// block ends.
+bool ARMNaClBundleScheduler::ScheduleBlock(MachineBasicBlock &MBB,
+                                           int &Pos) {
+  std::vector<SchedUnit> Units;
+  BuildUnits(MBB, Units);
+
+  CallsAreBarriers = MBB.getParent()->exposesReturnsTwice();
+  for (MachineBasicBlock::succ_iterator SI = MBB.succ_begin(),
+           SE = MBB.succ_end();
+       SI != SE;
+       ++SI) {
+    if ((*SI)->isLandingPad())
+      CallsAreBarriers = true;
+  }
+
+  bool Modified = false;
+  // Units from FirstMovable up to the one being scheduled are single
+  // instructions, which can be moved without changing the padding of
+  // anything already scheduled.
+  unsigned FirstMovable = 0;
+  for (unsigned Idx = 0; Idx < Units.size(); ++Idx) {
+    switch (Units[Idx].Kind) {
+    case SchedUnit::Label:
+      // Labels which may be indirect entry points are bundle aligned.
+      if (Units[Idx].First->isEHLabel() || Units[Idx].First->isGCLabel())
+        Pos = 0;
+      FirstMovable = Idx + 1;
+      continue;
+    case SchedUnit::Unknown:
+      Pos = -1;
+      FirstMovable = Idx + 1;
+      continue;
+    default:
+      break;
+    }
+    if (Pos < 0)
+      continue;
+
+    if (Units[Idx].getPadding(Pos) > 0) {
+      if (HoistIntoPadding(MBB, Units, Idx)) {
+        // Schedule the hoisted instruction, now at Idx, and then reconsider
+        // the sequence.
+        Modified = true;
+        --Idx;
+        continue;
+      }
+      if (unsigned NumSunk =
+              SinkToAvoidPadding(MBB, Units, Idx, FirstMovable, Pos)) {
+        // The sequence now starts that many instructions earlier.
+        Modified = true;
+        Idx -= NumSunk;
+        Pos = (Pos + BundleSize - NumSunk * InstrSize) % BundleSize;
+      }
+    }
+    Pos = (Pos + Units[Idx].getPadding(Pos) + Units[Idx].Size) % BundleSize;
+    if (Units[Idx].isSequence())
+      FirstMovable = Idx + 1;
+  }
+  return Modified;
+}
+
+bool ARMNaClBundleScheduler::runOnMachineFunction(MachineFunction &MF) {
+  if (!FlagSfiBundleSched)
+    return false;
+  TII = static_cast<const ARMBaseInstrInfo*>(MF.getTarget().getInstrInfo());
+  TRI = MF.getTarget().getRegisterInfo();
+
+  // Jump table targets are bundle aligned by the asm printer.
+  SmallPtrSet<const MachineBasicBlock *, 16> JumpTargets;
+  if (const MachineJumpTableInfo *JTI = MF.getJumpTableInfo()) {
+    const std::vector<MachineJumpTableEntry> &JT = JTI->getJumpTables();
+    for (unsigned i = 0, e = JT.size(); i != e; ++i)
+      JumpTargets.insert(JT[i].MBBs.begin(), JT[i].MBBs.end());
+  }
+
+  bool Modified = false;
+  // Functions start at the beginning of a bundle.
+  int Pos = 0;
+  bool LastWasConstantPool = false;
+  for (MachineFunction::iterator MFI = MF.begin(), E = MF.end();
+       MFI != E;
+       ++MFI) {
+    MachineBasicBlock &MBB = *MFI;
+    bool IsConstantPool =
+        !MBB.empty() && MBB.begin()->getOpcode() == ARM::CONSTPOOL_ENTRY;
+    unsigned Align = 1u << MBB.getAlignment();
+    if (Align >= BundleSize || MBB.isLandingPad() || MBB.hasAddressTaken() ||
+        JumpTargets.count(&MBB) || IsConstantPool != LastWasConstantPool)
+      Pos = 0;
+    else if (Pos >= 0)
+      Pos = RoundUpToAlignment(Pos, Align) % BundleSize;
+    if (!MBB.empty())
+      LastWasConstantPool = IsConstantPool;
+    Modified |= ScheduleBlock(MBB, Pos);
+  }
+  return Modified;
+}
+
+/// createARMNaClBundleSchedulerPass - returns an instance of the
+/// ARMNaClBundleScheduler pass.
+FunctionPass *llvm::createARMNaClBundleSchedulerPass() {
+  return new ARMNaClBundleScheduler();
+}
@@ -244,6 +244,9 @@ bool ARMPassConfig::addPreEmitPass() {
   // This pass does all the heavy sfi lifting.
   if (getARMSubtarget().isTargetNaCl()) {
     addPass(createARMNaClRewritePass());
+    // Reduce the padding the assembler inserts around the SFI sequences.
+    if (getOptLevel() != CodeGenOpt::None)
+      addPass(createARMNaClBundleSchedulerPass());
   }
   // @LOCALMOD-END
  
@@ -323,7 +323,7 @@ void ARMInstPrinter::printInst(const MCInst *MI, raw_ostream &O,
     SFIEmitPred = 2;
     break;
   case ARM::SFI_GUARD_LOADSTORE_TST:
-    SFIInst = "sfi_cload_store_preamble";
+    SFIInst = "sfi_cstore_preamble";
     SFIEmitDest = 0;
     SFIEmitPred = ~0;
     break;
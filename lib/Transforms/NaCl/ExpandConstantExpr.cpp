@@ -26,11 +26,10 @@
 #include "llvm/IR/Instructions.h"
 #include "llvm/Pass.h"
 #include "llvm/Transforms/NaCl.h"
+#include "FunctionExpansions.h"
 
 using namespace llvm;
 
-static bool expandInstruction(Instruction *Inst);
-
 namespace {
   // This is a FunctionPass because our handling of PHI nodes means
   // that our modifications may cross BasicBlocks.
@@ -49,15 +48,19 @@ INITIALIZE_PASS(ExpandConstantExpr, "expand-constant-expr",
                 "Expand out ConstantExprs into Instructions",
                 false, false)
 
-static Value *expandConstantExpr(Instruction *InsertPt, ConstantExpr *Expr) {
+static Value *expandConstantExpr(Instruction *InsertPt, ConstantExpr *Expr,
+                                 SmallVectorImpl<Instruction *> *NewInsts) {
   Instruction *NewInst = Expr->getAsInstruction();
   NewInst->insertBefore(InsertPt);
   NewInst->setName("expanded");
-  expandInstruction(NewInst);
+  if (NewInsts)
+    NewInsts->push_back(NewInst);
+  ExpandConstantExprOperands(NewInst, NewInsts);
   return NewInst;
 }
 
-static bool expandInstruction(Instruction *Inst) {
+bool llvm::ExpandConstantExprOperands(
+    Instruction *Inst, SmallVectorImpl<Instruction *> *NewInsts) {
   // A landingpad can only accept ConstantExprs, so it should remain
   // unmodified.
   if (isa<LandingPadInst>(Inst))
@@ -69,7 +72,8 @@ static bool expandInstruction(Instruction *Inst) {
         dyn_cast<ConstantExpr>(Inst->getOperand(OpNum))) {
       Modified = true;
       Use *U = &Inst->getOperandUse(OpNum);
-      PhiSafeReplaceUses(U, expandConstantExpr(PhiSafeInsertPt(U), Expr));
+      PhiSafeReplaceUses(U, expandConstantExpr(PhiSafeInsertPt(U), Expr,
+                                               NewInsts));
     }
   }
   return Modified;
@@ -83,7 +87,7 @@ bool ExpandConstantExpr::runOnFunction(Function &Func) {
     for (BasicBlock::InstListType::iterator Inst = BB->begin(), E = BB->end();
          Inst != E;
          ++Inst) {
-      Modified |= expandInstruction(Inst);
+      Modified |= ExpandConstantExprOperands(Inst);
     }
   }
   return Modified;
@@ -0,0 +1,161 @@
+//===- ExpandFunctionBodies.cpp - Expand instructions in one walk ---------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// This pass applies the function-local rewrites of the following passes,
+// which PNaClABISimplifyAddPostOptPasses would otherwise run one after
+// the other, each walking every instruction of every function again:
+//
+//   -expand-constant-expr
+//   -nacl-promote-ints
+//   -expand-getelementptr
+//   -nacl-rewrite-atomics
+//   -remove-asm-memory
+//
+// Instead, it walks each function once. Each instruction goes through
+// all the rewrites in the order of the passes, together with the
+// instructions that the earlier rewrites insert for it, before the walk
+// moves on. This gives the same result as running the passes in order:
+//
+//  * ExpandConstantExpr and ExpandGetElementPtr only look at the
+//    instruction they expand.
+//  * PromoteIntegers uses placeholders for operands which haven't been
+//    promoted yet, so it doesn't depend on the order of the walk. The
+//    instructions it replaces are only erased at the end.
+//  * RewriteAtomics rewrites a fence according to the inline assembly
+//    around it, so the inline assembly is only erased at the end.
+//
+//===----------------------------------------------------------------------===//
+
+#include "llvm/ADT/STLExtras.h"
+#include "llvm/ADT/SmallPtrSet.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/IR/DataLayout.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Pass.h"
+#include "llvm/Transforms/NaCl.h"
+#include "FunctionExpansions.h"
+
+using namespace llvm;
+
+namespace {
+class ExpandFunctionBodies : public FunctionPass {
+public:
+  static char ID; // Pass identification, replacement for typeid
+  ExpandFunctionBodies() : FunctionPass(ID) {
+    initializeExpandFunctionBodiesPass(*PassRegistry::getPassRegistry());
+  }
+
+  virtual bool runOnFunction(Function &F);
+  virtual void getAnalysisUsage(AnalysisUsage &Info) const {
+    Info.addRequired<DataLayout>();
+  }
+};
+
+// Applies the rewrites that follow ExpandConstantExpr and PromoteIntegers
+// to the instructions of a function.
+class LateExpander {
+public:
+  LateExpander(Function &F, const DataLayout &DL)
+      : DL(DL), PtrType(DL.getIntPtrType(F.getContext())),
+        Atomics(*F.getParent(), DL), Modified(false) {}
+
+  void expand(Instruction *Inst) {
+    if (GetElementPtrInst *GEP = dyn_cast<GetElementPtrInst>(Inst)) {
+      ExpandGetElementPtrInst(GEP, DL, PtrType);
+      Modified = true;
+    } else if (IsAsmMemoryCall(Inst)) {
+      AsmMemoryCalls.push_back(Inst);
+    } else {
+      Atomics.rewriteInstruction(Inst);
+    }
+  }
+
+  // Erases the inline assembly, and returns true if the function was
+  // modified.
+  bool finish() {
+    for (size_t I = 0, E = AsmMemoryCalls.size(); I != E; ++I)
+      AsmMemoryCalls[I]->eraseFromParent();
+    return Modified || Atomics.modified() || !AsmMemoryCalls.empty();
+  }
+
+private:
+  const DataLayout &DL;
+  Type *PtrType;
+  AtomicRewriter Atomics;
+  SmallVector<Instruction *, 8> AsmMemoryCalls;
+  bool Modified;
+};
+}
+
+char ExpandFunctionBodies::ID = 0;
+INITIALIZE_PASS(ExpandFunctionBodies, "expand-function-bodies",
+                "Apply the function-local PNaCl ABI expansions in one walk",
+                false, false)
+
+// Promotes Inst, and collects the instructions that the later rewrites
+// apply to: those PromoteIntegers inserted around Inst, and Inst itself
+// unless it was replaced. Returns true if Inst was replaced.
+static bool promoteAndCollect(IntegerPromoter &Promoter, Instruction *Inst,
+                              SmallVectorImpl<Instruction *> &Insts) {
+  BasicBlock *BB = Inst->getParent();
+  BasicBlock::iterator Prev = Inst, End = llvm::next(Prev);
+  bool AtBegin = Prev == BB->begin();
+  if (!AtBegin)
+    --Prev;
+  bool Promoted = Promoter.promoteInstruction(Inst);
+  // A replaced instruction is left in place until the end, except for a
+  // switch, which is already erased.
+  for (BasicBlock::iterator I = AtBegin ? BB->begin() : llvm::next(Prev);
+       I != End; ++I) {
+    if (!Promoted || &*I != Inst)
+      Insts.push_back(I);
+  }
+  return Promoted;
+}
+
+bool ExpandFunctionBodies::runOnFunction(Function &F) {
+  IntegerPromoter Promoter(F);
+  LateExpander Expander(F, getAnalysis<DataLayout>());
+  bool Modified = false;
+  SmallPtrSet<BasicBlock *, 16> VisitedBlocks;
+  SmallVector<Instruction *, 16> NewInsts;
+  SmallVector<Instruction *, 16> Worklist;
+  for (Function::iterator BB = F.begin(), E = F.end(); BB != E; ++BB) {
+    VisitedBlocks.insert(BB);
+    for (BasicBlock::iterator Iter = BB->begin(); Iter != BB->end(); ) {
+      Instruction *Inst = Iter;
+      NewInsts.clear();
+      Modified |= ExpandConstantExprOperands(Inst, &NewInsts);
+      ++Iter;
+
+      // The instructions inserted for Inst are found before it, where the
+      // walk has already been, except for those inserted at the end of the
+      // incoming blocks of a PHI node. The walk will still get to those in
+      // blocks it hasn't left.
+      Worklist.clear();
+      for (size_t I = 0, IE = NewInsts.size(); I != IE; ++I) {
+        BasicBlock *Parent = NewInsts[I]->getParent();
+        if (Parent == BB ? !isa<PHINode>(Inst) : VisitedBlocks.count(Parent))
+          Modified |= promoteAndCollect(Promoter, NewInsts[I], Worklist);
+      }
+      Modified |= promoteAndCollect(Promoter, Inst, Worklist);
+      for (size_t I = 0, IE = Worklist.size(); I != IE; ++I)
+        Expander.expand(Worklist[I]);
+    }
+  }
+  Promoter.finish();
+  Modified |= Expander.finish();
+  return Modified;
+}
+
+FunctionPass *llvm::createExpandFunctionBodiesPass() {
+  return new ExpandFunctionBodies();
+}
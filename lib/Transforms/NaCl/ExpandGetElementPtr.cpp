@@ -28,6 +28,7 @@
 #include "llvm/IR/Type.h"
 #include "llvm/Pass.h"
 #include "llvm/Transforms/NaCl.h"
+#include "FunctionExpansions.h"
 
 using namespace llvm;
 
@@ -77,7 +78,8 @@ static void FlushOffset(Instruction **Ptr, uint64_t *CurrentOffset,
   }
 }
 
-static void ExpandGEP(GetElementPtrInst *GEP, DataLayout *DL, Type *PtrType) {
+void llvm::ExpandGetElementPtrInst(GetElementPtrInst *GEP,
+                                   const DataLayout &DL, Type *PtrType) {
   const DebugLoc &Debug = GEP->getDebugLoc();
   Instruction *Ptr = new PtrToIntInst(GEP->getPointerOperand(), PtrType,
                                       "gep_int", GEP);
@@ -98,10 +100,10 @@ static void ExpandGEP(GetElementPtrInst *GEP, DataLayout *DL, Type *PtrType) {
     if (StructType *StTy = dyn_cast<StructType>(CurrentTy)) {
       uint64_t Field = cast<ConstantInt>(Op)->getZExtValue();
       CurrentTy = StTy->getElementType(Field);
-      CurrentOffset += DL->getStructLayout(StTy)->getElementOffset(Field);
+      CurrentOffset += DL.getStructLayout(StTy)->getElementOffset(Field);
     } else {
       CurrentTy = cast<SequentialType>(CurrentTy)->getElementType();
-      uint64_t ElementSize = DL->getTypeAllocSize(CurrentTy);
+      uint64_t ElementSize = DL.getTypeAllocSize(CurrentTy);
       if (ConstantInt *C = dyn_cast<ConstantInt>(Index)) {
         CurrentOffset += C->getSExtValue() * ElementSize;
       } else {
@@ -140,7 +142,7 @@ bool ExpandGetElementPtr::runOnBasicBlock(BasicBlock &BB) {
     Instruction *Inst = Iter++;
     if (GetElementPtrInst *GEP = dyn_cast<GetElementPtrInst>(Inst)) {
       Modified = true;
-      ExpandGEP(GEP, &DL, PtrType);
+      ExpandGetElementPtrInst(GEP, DL, PtrType);
     }
   }
   return Modified;
@@ -0,0 +1,102 @@
+//===-- FunctionExpansions.h - Per-instruction PNaCl expansions -*- C++ -*-===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// The function-local rewrites of the ExpandConstantExpr, PromoteIntegers,
+// ExpandGetElementPtr, RewriteAtomics and RemoveAsmMemory passes, applied
+// to one instruction at a time. Each pass applies its rewrite to every
+// instruction of a function, and ExpandFunctionBodies applies all of them
+// in a single walk over the function.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef LLVM_TRANSFORMS_NACL_FUNCTIONEXPANSIONS_H
+#define LLVM_TRANSFORMS_NACL_FUNCTIONEXPANSIONS_H
+
+#include "llvm/ADT/OwningPtr.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/Support/Compiler.h"
+
+namespace llvm {
+
+class DataLayout;
+class Function;
+class GetElementPtrInst;
+class Instruction;
+class Module;
+class Type;
+
+// Expands the ConstantExpr operands of Inst into instructions, inserted
+// before Inst, or before the end of the incoming block for a PHI
+// operand. Adds the instructions to NewInsts if it is non-null. Returns
+// true if Inst was modified.
+bool ExpandConstantExprOperands(Instruction *Inst,
+                                SmallVectorImpl<Instruction *> *NewInsts = 0);
+
+// Replaces instructions which have operands or results of illegal
+// integer types with instructions on promoted types, within a function.
+class IntegerPromoter {
+public:
+  // Reports a fatal error if Func has arguments of illegal types.
+  explicit IntegerPromoter(Function &Func);
+  ~IntegerPromoter();
+
+  // Returns true if Inst was replaced. Instructions defining Inst's
+  // operands may be promoted before or after Inst. The new instructions
+  // are inserted before Inst. A replaced switch is erased, and any other
+  // replaced instruction stays in place, unused, until finish() is
+  // called.
+  bool promoteInstruction(Instruction *Inst);
+
+  // Erases the replaced instructions, once all instructions of the
+  // function have been promoted.
+  void finish();
+
+private:
+  class State;
+  OwningPtr<State> S;
+
+  IntegerPromoter(const IntegerPromoter &) LLVM_DELETED_FUNCTION;
+  void operator=(const IntegerPromoter &) LLVM_DELETED_FUNCTION;
+};
+
+// Expands GEP into ptrtoint, inttoptr and arithmetic instructions on
+// PtrType, the integer type of pointers, and erases it.
+void ExpandGetElementPtrInst(GetElementPtrInst *GEP, const DataLayout &DL,
+                             Type *PtrType);
+
+// Replaces atomic and volatile instructions, and fences, with calls to
+// the @llvm.nacl.atomic.* intrinsics, declaring them in M as needed.
+class AtomicRewriter {
+public:
+  AtomicRewriter(Module &M, const DataLayout &DL);
+  ~AtomicRewriter();
+
+  // Rewrites Inst, erasing it, if it is atomic, volatile or a fence. A
+  // fence is rewritten according to the instructions around it, so
+  // these must not have been removed by RemoveAsmMemory yet.
+  void rewriteInstruction(Instruction *Inst);
+
+  // Returns true if any instruction was rewritten.
+  bool modified() const;
+
+private:
+  class Visitor;
+  OwningPtr<Visitor> V;
+
+  AtomicRewriter(const AtomicRewriter &) LLVM_DELETED_FUNCTION;
+  void operator=(const AtomicRewriter &) LLVM_DELETED_FUNCTION;
+};
+
+// Returns true if Inst is ``asm("":::"memory")``, which RemoveAsmMemory
+// removes.
+bool IsAsmMemoryCall(const Instruction *Inst);
+
+}
+
+#endif
@@ -124,21 +124,25 @@ void llvm::PNaClABISimplifyAddPostOptPasses(PassManagerBase &PM) {
   // are expanded out later.
   PM.add(createFlattenGlobalsPass());
 
+  // ExpandFunctionBodies applies the following passes in one walk over
+  // each function, with the same result as running them in this order:
+  //
   // We should not place arbitrary passes after ExpandConstantExpr
   // because they might reintroduce ConstantExprs.
-  PM.add(createExpandConstantExprPass());
+  //   ExpandConstantExpr
   // PromoteIntegersPass does not handle constexprs and creates GEPs,
   // so it goes between those passes.
-  PM.add(createPromoteIntegersPass());
+  //   PromoteIntegers
   // ExpandGetElementPtr must follow ExpandConstantExpr to expand the
   // getelementptr instructions it creates.
-  PM.add(createExpandGetElementPtrPass());
+  //   ExpandGetElementPtr
   // Rewrite atomic and volatile instructions with intrinsic calls.
-  PM.add(createRewriteAtomicsPass());
+  //   RewriteAtomics
   // Remove ``asm("":::"memory")``. This must occur after rewriting
   // atomics: a ``fence seq_cst`` surrounded by ``asm("":::"memory")``
   // has special meaning and is translated differently.
-  PM.add(createRemoveAsmMemoryPass());
+  //   RemoveAsmMemory
+  PM.add(createExpandFunctionBodiesPass());
   // ReplacePtrsWithInts assumes that getelementptr instructions and
   // ConstantExprs have already been expanded out.
   PM.add(createReplacePtrsWithIntsPass());
@@ -0,0 +1,77 @@
+//===-- PNaClTranslation.cpp - Shared setup for translating pexes ---------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// This file implements the parts of a pexe translation that are shared by
+// the tools that translate pexes (pnacl-llc and pnacl-benchmark): the
+// passes that run ahead of the code generator, and the preparation of
+// the parts of a module that is split for parallel translation.
+//
+//===----------------------------------------------------------------------===//
+
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/Module.h"
+#include "llvm/PassManager.h"
+#include "llvm/Target/TargetLibraryInfo.h"
+#include "llvm/Target/TargetMachine.h"
+#include "llvm/Transforms/NaCl.h"
+
+using namespace llvm;
+
+bool llvm::PNaClTranslationAddCodeGenPasses(
+    PassManagerBase &PM, TargetMachine &TM, TargetLibraryInfo *TLI,
+    formatted_raw_ostream &Out, TargetMachine::CodeGenFileType FileType) {
+  // Add the intrinsic resolution pass. It assumes ABI-conformant code.
+  PM.add(createResolvePNaClIntrinsicsPass());
+
+  PM.add(TLI);
+
+  // Allow subsequent passes and the backend to better optimize instructions
+  // that were simplified for PNaCl's ABI. This pass uses the TargetLibraryInfo
+  // above.
+  PM.add(createBackendCanonicalizePass());
+
+  // Add internal analysis passes from the target machine.
+  TM.addAnalysisPasses(PM);
+
+  // The IR is verified, if at all, before the PNaCl ABI is, so the target
+  // must not add the verifier pass again.
+  return TM.addPassesToEmitFile(PM, Out, FileType, /* DisableVerify */ true);
+}
+
+void llvm::PNaClExternalizeSplitModule(Module *M) {
+  // This relies on LLVM's consistent auto-generation of names, we could
+  // maybe do our own in case something changes there.
+  for (Module::iterator I = M->begin(), E = M->end(); I != E; ++I) {
+    if (!I->hasName())
+      I->setName("Function");
+    if (I->hasInternalLinkage())
+      I->setLinkage(GlobalValue::ExternalLinkage);
+  }
+  for (Module::global_iterator GI = M->global_begin(), GE = M->global_end();
+       GI != GE; ++GI) {
+    if (!GI->hasName())
+      GI->setName("Global");
+    if (GI->hasInternalLinkage())
+      GI->setLinkage(GlobalValue::ExternalLinkage);
+  }
+}
+
+void llvm::PNaClRemoveGlobalInitializers(Module *M) {
+  for (Module::global_iterator GI = M->global_begin(), GE = M->global_end();
+       GI != GE; ++GI) {
+    // Copies of a module that was parsed once may only contain
+    // declarations of the global variables.
+    if (!GI->hasInitializer())
+      continue;
+    Constant *Init = GI->getInitializer();
+    GI->setInitializer(NULL);
+    if (Init->getNumUses() == 0)
+      Init->destroyConstant();
+  }
+}
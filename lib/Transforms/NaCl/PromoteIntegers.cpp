@@ -37,6 +37,7 @@
 #include "llvm/Pass.h"
 #include "llvm/Support/raw_ostream.h"
 #include "llvm/Transforms/NaCl.h"
+#include "FunctionExpansions.h"
 
 using namespace llvm;
 
@@ -561,7 +562,9 @@ static void convertInstruction(Instruction *Inst, ConversionState &State) {
   }
 }
 
-bool PromoteIntegers::runOnFunction(Function &F) {
+class IntegerPromoter::State : public ConversionState {};
+
+IntegerPromoter::IntegerPromoter(Function &F) : S(new State()) {
   // Don't support changing the function arguments. This should not be
   // generated by clang.
   for (Function::arg_iterator I = F.arg_begin(), E = F.arg_end(); I != E; ++I) {
@@ -571,26 +574,37 @@ bool PromoteIntegers::runOnFunction(Function &F) {
       llvm_unreachable("Function has illegal integer/pointer argument");
     }
   }
+}
 
-  ConversionState State;
+IntegerPromoter::~IntegerPromoter() {}
+
+bool IntegerPromoter::promoteInstruction(Instruction *Inst) {
+  // Only attempt to convert an instruction if its result or any of its
+  // operands are illegal.
+  bool ShouldConvert = shouldConvert(Inst);
+  for (User::op_iterator OI = Inst->op_begin(), OE = Inst->op_end();
+       OI != OE; ++OI)
+    ShouldConvert |= shouldConvert(cast<Value>(OI));
+
+  if (ShouldConvert)
+    convertInstruction(Inst, *S);
+  return ShouldConvert;
+}
+
+void IntegerPromoter::finish() {
+  S->eraseReplacedInstructions();
+}
+
+bool PromoteIntegers::runOnFunction(Function &F) {
+  IntegerPromoter Promoter(F);
   bool Modified = false;
   for (Function::iterator FI = F.begin(), FE = F.end(); FI != FE; ++FI) {
     for (BasicBlock::iterator BBI = FI->begin(), BBE = FI->end(); BBI != BBE;) {
       Instruction *Inst = BBI++;
-      // Only attempt to convert an instruction if its result or any of its
-      // operands are illegal.
-      bool ShouldConvert = shouldConvert(Inst);
-      for (User::op_iterator OI = Inst->op_begin(), OE = Inst->op_end();
-           OI != OE; ++OI)
-        ShouldConvert |= shouldConvert(cast<Value>(OI));
-
-      if (ShouldConvert) {
-        convertInstruction(Inst, State);
-        Modified = true;
-      }
+      Modified |= Promoter.promoteInstruction(Inst);
     }
   }
-  State.eraseReplacedInstructions();
+  Promoter.finish();
   return Modified;
 }
 
@@ -18,6 +18,7 @@
 #include "llvm/IR/Module.h"
 #include "llvm/InstVisitor.h"
 #include "llvm/Pass.h"
+#include "FunctionExpansions.h"
 #include <string>
 
 using namespace llvm;
@@ -66,9 +67,14 @@ bool RemoveAsmMemory::runOnFunction(Function &F) {
   return AV.modifiedFunction();
 }
 
+bool llvm::IsAsmMemoryCall(const Instruction *Inst) {
+  const CallInst *CI = dyn_cast<CallInst>(Inst);
+  return CI && CI->isInlineAsm() &&
+         cast<InlineAsm>(CI->getCalledValue())->isAsmMemory();
+}
+
 void AsmDirectivesVisitor::visitCallInst(CallInst &CI) {
-  if (!CI.isInlineAsm() ||
-      !cast<InlineAsm>(CI.getCalledValue())->isAsmMemory())
+  if (!IsAsmMemoryCall(&CI))
     return;
 
   // In NaCl ``asm("":::"memory")`` always comes in pairs, straddling a
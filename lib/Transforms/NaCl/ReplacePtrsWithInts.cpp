@@ -53,6 +53,7 @@
 #include "llvm/IR/Module.h"
 #include "llvm/IR/Type.h"
 #include "llvm/Pass.h"
+#include "llvm/Support/CallSite.h"
 #include "llvm/Support/raw_ostream.h"
 #include "llvm/Transforms/NaCl.h"
 
@@ -70,24 +71,43 @@ namespace {
     virtual bool runOnModule(Module &M);
   };
 
-  // FunctionConverter stores the state for mapping old instructions
-  // (of pointer type) to converted instructions (of integer type)
-  // within a function, and provides methods for doing the conversion.
+  // FunctionConverter stores the state for converting the instructions
+  // of a function in place, and provides methods for doing the
+  // conversion.
+  //
+  // Instructions of pointer type whose result can simply become an
+  // IntPtrType value (loads, PHI nodes, selects and calls) are kept,
+  // and their types are only changed once the whole function has been
+  // converted.  Until then, their users refer to them as they are.
+  // Other pointer values are replaced by integer values which are
+  // created when they are first used.  This means the instructions can
+  // be converted in any order, without placeholders for values which
+  // haven't been converted yet.
   class FunctionConverter {
+    DataLayout *DL;
     // Int type that pointer types are to be replaced with, typically i32.
     Type *IntPtrType;
 
-    struct RewrittenVal {
-      RewrittenVal(): Placeholder(NULL), NewIntVal(NULL) {}
-      Value *Placeholder;
-      Value *NewIntVal;
-    };
-    // Maps from old values (of pointer type) to converted values (of
-    // IntPtrType type).
-    DenseMap<Value *, RewrittenVal> RewriteMap;
+    // Maps from old values (of pointer type) which are not converted in
+    // place to the values (of IntPtrType type) which replace them.
+    DenseMap<Value *, Value *> ConvertedMap;
+    // Instructions whose types are changed at the end: allocas to i8*,
+    // and the others to IntPtrType.
+    SmallVector<Instruction *, 20> ToMutate;
+    // Instructions (of integer type) which are replaced at the end,
+    // once the values replacing them have their final types.
+    SmallVector<std::pair<Instruction *, Value *>, 4> ToReplace;
+
+    // Creates the value which replaces Inst, a pointer value which is
+    // not converted in place.
+    Value *convertValue(Instruction *Inst);
+    // Converts Alloca in place, and returns the ptrtoint of it which
+    // replaces it.
+    Value *convertAlloca(AllocaInst *Alloca);
 
   public:
-    FunctionConverter(Type *IntPtrType) : IntPtrType(IntPtrType) {}
+    FunctionConverter(DataLayout *DL, Type *IntPtrType)
+        : DL(DL), IntPtrType(IntPtrType) {}
 
     // Returns the normalized version of the given type, converting
     // pointer types to IntPtrType.
@@ -96,36 +116,49 @@ namespace {
     // normalizing the function's argument types.
     FunctionType *convertFuncType(FunctionType *FTy);
 
-    // Records that 'To' is the normalized version of 'From'.  If 'To'
-    // is not of pointer type, no type conversion is required, so this
-    // can take the short cut of replacing 'To' with 'From'.
-    void recordConverted(Value *From, Value *To);
-    void recordConvertedAndErase(Instruction *From, Value *To);
+    // Records that the argument 'To' is the normalized version of
+    // 'From'.  If 'To' is not of pointer type, no type conversion is
+    // required, so this can take the short cut of replacing 'To' with
+    // 'From'.
+    void recordConverted(Argument *From, Argument *To);
+    // Records that Inst is kept, with its type changed to IntPtrType at
+    // the end if it is of pointer type.
+    void recordTypeConverted(Instruction *Inst);
+    // Records that From, of integer type, is to be replaced with To, and
+    // erased.
+    void recordReplacedAndErase(Instruction *From, Value *To);
 
     // Returns Val with no-op casts (those that convert between
     // IntPtrType and pointer types) stripped off.
     Value *stripNoopCasts(Value *Val);
 
-    // Returns the normalized version of the given value.
-    //
-    // If the conversion of Val has been deferred, this returns a
-    // placeholder object, which will later be replaceAllUsesWith'd to
-    // the final value.  Since replaceAllUsesWith does not work on
-    // references by metadata nodes, this can be bypassed using
-    // BypassPlaceholder to get the real converted value, assuming it
-    // is available.
-    Value *convert(Value *Val, bool BypassPlaceholder = false);
-    // Returns the NormalizedPtr form of the given pointer value.
-    // Inserts conversion instructions at InsertPt.
-    Value *convertBackToPtr(Value *Val, Instruction *InsertPt);
+    // Returns the normalized version of the given value.  This may be an
+    // instruction which doesn't have its integer type yet.
+    Value *convert(Value *Val);
+    // Replaces operand Index of Inst with its normalized version.
+    void convertOperand(Instruction *Inst, unsigned Index);
+    // Returns a cast of the operand of Cast, a ptrtoint or inttoptr, to
+    // the normalized version of Cast's type, inserted before Cast.
+    Value *convertIntCast(Instruction *Cast);
+    // Returns a cast of IntVal, a normalized value, to type Ty.  Inserts
+    // the cast at InsertPt.
+    Instruction *createCast(Instruction::CastOps Op, Value *IntVal, Type *Ty,
+                            Instruction *InsertPt);
+    // Returns the NormalizedPtr form of the given pointer value, as a
+    // pointer to the normalized version of ElementTy.  Inserts
+    // conversion instructions at InsertPt.
+    Value *convertBackToPtr(Value *Val, Type *ElementTy,
+                            Instruction *InsertPt);
     // Returns the NormalizedPtr form of the given function pointer.
     // Inserts conversion instructions at InsertPt.
     Value *convertFunctionPtr(Value *Callee, Instruction *InsertPt);
-    // Converts an instruction without recreating it, by wrapping its
-    // operands and result.
+    // Converts an instruction without changing its type, by wrapping its
+    // operands.  A pointer result is converted when it is used.
     void convertInPlace(Instruction *Inst);
 
-    void eraseReplacedInstructions();
+    // Changes the types of the instructions converted in place, and
+    // erases the replaced instructions.
+    void finish();
 
     // List of instructions whose deletion has been deferred.
     SmallVector<Instruction *, 20> ToErase;
@@ -148,18 +181,21 @@ FunctionType *FunctionConverter::convertFuncType(FunctionType *FTy) {
                            FTy->isVarArg());
 }
 
-void FunctionConverter::recordConverted(Value *From, Value *To) {
+void FunctionConverter::recordConverted(Argument *From, Argument *To) {
   if (!From->getType()->isPointerTy()) {
     From->replaceAllUsesWith(To);
     return;
   }
-  RewrittenVal *RV = &RewriteMap[From];
-  assert(!RV->NewIntVal);
-  RV->NewIntVal = To;
+  ConvertedMap[From] = To;
+}
+
+void FunctionConverter::recordTypeConverted(Instruction *Inst) {
+  if (Inst->getType()->isPointerTy())
+    ToMutate.push_back(Inst);
 }
 
-void FunctionConverter::recordConvertedAndErase(Instruction *From, Value *To) {
-  recordConverted(From, To);
+void FunctionConverter::recordReplacedAndErase(Instruction *From, Value *To) {
+  ToReplace.push_back(std::make_pair(From, To));
   // There may still be references to this value, so defer deleting it.
   ToErase.push_back(From);
 }
@@ -185,35 +221,134 @@ Value *FunctionConverter::stripNoopCasts(Value *Val) {
   }
 }
 
-Value *FunctionConverter::convert(Value *Val, bool BypassPlaceholder) {
+// Returns whether V, a value of pointer type, is an instruction which
+// is kept and given the type IntPtrType.
+static bool IsConvertedInPlace(Value *V) {
+  if (isa<LoadInst>(V) || isa<PHINode>(V) || isa<SelectInst>(V) ||
+      isa<InvokeInst>(V))
+    return true;
+  if (CallInst *Call = dyn_cast<CallInst>(V))
+    return !isa<IntrinsicInst>(Call) && !isa<InlineAsm>(Call->getCalledValue());
+  return false;
+}
+
+Value *FunctionConverter::convert(Value *Val) {
   Val = stripNoopCasts(Val);
   if (!Val->getType()->isPointerTy())
     return Val;
   if (Constant *C = dyn_cast<Constant>(Val))
     return ConstantExpr::getPtrToInt(C, IntPtrType);
-  RewrittenVal *RV = &RewriteMap[Val];
-  if (BypassPlaceholder) {
-    assert(RV->NewIntVal);
-    return RV->NewIntVal;
+  if (IsConvertedInPlace(Val))
+    return Val;
+  DenseMap<Value *, Value *>::iterator Found = ConvertedMap.find(Val);
+  if (Found != ConvertedMap.end())
+    return Found->second;
+  Value *Converted = convertValue(cast<Instruction>(Val));
+  ConvertedMap[Val] = Converted;
+  return Converted;
+}
+
+void FunctionConverter::convertOperand(Instruction *Inst, unsigned Index) {
+  Value *Arg = Inst->getOperand(Index);
+  Value *Conv = convert(Arg);
+  if (Conv != Arg)
+    Inst->setOperand(Index, Conv);
+}
+
+Value *FunctionConverter::convertValue(Instruction *Inst) {
+  if (AllocaInst *Alloca = dyn_cast<AllocaInst>(Inst))
+    return convertAlloca(Alloca);
+  // stripNoopCasts() strips inttoptrs from IntPtrType, so this one
+  // truncates or extends its operand.
+  if (isa<IntToPtrInst>(Inst))
+    return convertIntCast(Inst);
+  // These are the instructions which convertInPlace() keeps with their
+  // pointer types.
+  if (isa<CallInst>(Inst) || isa<GetElementPtrInst>(Inst) ||
+      isa<VAArgInst>(Inst) || isa<ExtractValueInst>(Inst)) {
+    Instruction *Cast = new PtrToIntInst(
+        Inst, IntPtrType, Inst->getName() + ".asint");
+    Cast->insertAfter(Inst);
+    return Cast;
   }
-  if (!RV->Placeholder)
-    RV->Placeholder = new Argument(convertType(Val->getType()));
-  return RV->Placeholder;
+  errs() << "Not converted: " << *Inst << "\n";
+  report_fatal_error("Case not handled in ReplacePtrsWithInts");
+}
+
+Value *FunctionConverter::convertAlloca(AllocaInst *Alloca) {
+  Type *ElementTy = Alloca->getAllocatedType();
+  Constant *ElementSize = ConstantInt::get(IntPtrType,
+                                           DL->getTypeAllocSize(ElementTy));
+  // Expand out alloca's built-in multiplication.
+  Value *MulSize;
+  if (ConstantInt *C = dyn_cast<ConstantInt>(Alloca->getArraySize())) {
+    MulSize = ConstantExpr::getMul(ElementSize, C);
+  } else {
+    MulSize = BinaryOperator::Create(
+        Instruction::Mul, ElementSize, Alloca->getArraySize(),
+        Alloca->getName() + ".alloca_mul", Alloca);
+  }
+  unsigned Alignment = Alloca->getAlignment();
+  if (Alignment == 0)
+    Alignment = DL->getPrefTypeAlignment(ElementTy);
+  // The alloca becomes an array of i8.  Its type only changes at the
+  // end, since users which are converted later need the old type.
+  Alloca->setOperand(0, MulSize);
+  Alloca->setAlignment(Alignment);
+  ToMutate.push_back(Alloca);
+  Instruction *Cast = new PtrToIntInst(
+      Alloca, IntPtrType, Alloca->getName() + ".asint");
+  Cast->insertAfter(Alloca);
+  return Cast;
+}
+
+Value *FunctionConverter::convertIntCast(Instruction *Cast) {
+  Value *Arg = convert(Cast->getOperand(0));
+  Type *ResultTy = convertType(Cast->getType());
+  unsigned ArgSize = convertType(Arg->getType())->getIntegerBitWidth();
+  unsigned ResultSize = ResultTy->getIntegerBitWidth();
+  // We avoid using IRBuilder's CreateZExtOrTrunc() here because it
+  // constant-folds ptrtoint ConstantExprs.  This leads to creating
+  // ptrtoints of non-IntPtrType type, which is not what we want,
+  // because we want truncation/extension to be done explicitly by
+  // separate instructions.
+  if (ArgSize == ResultSize)
+    return Arg;
+  Instruction::CastOps CastType =
+      ArgSize > ResultSize ? Instruction::Trunc : Instruction::ZExt;
+  Instruction *Result =
+      CopyDebug(createCast(CastType, Arg, ResultTy, Cast), Cast);
+  Result->takeName(Cast);
+  return Result;
 }
 
-Value *FunctionConverter::convertBackToPtr(Value *Val, Instruction *InsertPt) {
-  Type *NewTy =
-    convertType(Val->getType()->getPointerElementType())->getPointerTo();
-  return new IntToPtrInst(convert(Val), NewTy, "", InsertPt);
+Instruction *FunctionConverter::createCast(Instruction::CastOps Op,
+                                           Value *IntVal, Type *Ty,
+                                           Instruction *InsertPt) {
+  // IntVal may still have its pointer type, which the cast's
+  // constructor would reject, so it is only set as the operand once the
+  // cast exists.
+  Value *Operand = IntVal;
+  if (IntVal->getType()->isPointerTy())
+    Operand = UndefValue::get(IntPtrType);
+  Instruction *Cast = CastInst::Create(Op, Operand, Ty, "", InsertPt);
+  if (Operand != IntVal)
+    Cast->setOperand(0, IntVal);
+  return Cast;
+}
+
+Value *FunctionConverter::convertBackToPtr(Value *Val, Type *ElementTy,
+                                           Instruction *InsertPt) {
+  Type *NewTy = convertType(ElementTy)->getPointerTo();
+  return createCast(Instruction::IntToPtr, convert(Val), NewTy, InsertPt);
 }
 
 Value *FunctionConverter::convertFunctionPtr(Value *Callee,
                                              Instruction *InsertPt) {
   FunctionType *FuncType = cast<FunctionType>(
       Callee->getType()->getPointerElementType());
-  return new IntToPtrInst(convert(Callee),
-                          convertFuncType(FuncType)->getPointerTo(),
-                          "", InsertPt);
+  return createCast(Instruction::IntToPtr, convert(Callee),
+                    convertFuncType(FuncType)->getPointerTo(), InsertPt);
 }
 
 static bool ShouldLeaveAlone(Value *V) {
@@ -229,41 +364,25 @@ void FunctionConverter::convertInPlace(Instruction *Inst) {
   for (unsigned I = 0; I < Inst->getNumOperands(); ++I) {
     Value *Arg = Inst->getOperand(I);
     if (Arg->getType()->isPointerTy() && !ShouldLeaveAlone(Arg)) {
-      Value *Conv = convert(Arg);
-      Inst->setOperand(I, new IntToPtrInst(Conv, Arg->getType(), "", Inst));
+      Inst->setOperand(I, createCast(Instruction::IntToPtr, convert(Arg),
+                                     Arg->getType(), Inst));
     }
   }
-  // Convert result.
-  if (Inst->getType()->isPointerTy()) {
-    Instruction *Cast = new PtrToIntInst(
-        Inst, convertType(Inst->getType()), Inst->getName() + ".asint");
-    Cast->insertAfter(Inst);
-    recordConverted(Inst, Cast);
-  }
 }
 
-void FunctionConverter::eraseReplacedInstructions() {
-  bool Error = false;
-  for (DenseMap<Value *, RewrittenVal>::iterator I = RewriteMap.begin(),
-           E = RewriteMap.end(); I != E; ++I) {
-    if (I->second.Placeholder) {
-      if (I->second.NewIntVal) {
-        I->second.Placeholder->replaceAllUsesWith(I->second.NewIntVal);
-      } else {
-        errs() << "Not converted: " << *I->first << "\n";
-        Error = true;
-      }
-    }
+void FunctionConverter::finish() {
+  for (SmallVectorImpl<Instruction *>::iterator I = ToMutate.begin(),
+           E = ToMutate.end();
+       I != E; ++I) {
+    if (isa<AllocaInst>(*I))
+      (*I)->mutateType(Type::getInt8PtrTy((*I)->getContext()));
+    else
+      (*I)->mutateType(IntPtrType);
   }
-  if (Error)
-    report_fatal_error("Case not handled in ReplacePtrsWithInts");
-
-  // Delete the placeholders in a separate pass.  This means that if
-  // one placeholder is accidentally rewritten to another, we will get
-  // a useful error message rather than accessing a dangling pointer.
-  for (DenseMap<Value *, RewrittenVal>::iterator I = RewriteMap.begin(),
-           E = RewriteMap.end(); I != E; ++I) {
-    delete I->second.Placeholder;
+  for (SmallVectorImpl<std::pair<Instruction *, Value *> >::iterator
+           I = ToReplace.begin(), E = ToReplace.end();
+       I != E; ++I) {
+    I->first->replaceAllUsesWith(I->second);
   }
 
   // We must do dropAllReferences() before doing eraseFromParent(),
@@ -288,7 +407,7 @@ static void ConvertMetadataOperand(FunctionConverter *FC,
     return;
   Value *MDArg = MD->getOperand(0);
   if (MDArg && (isa<Argument>(MDArg) || isa<Instruction>(MDArg))) {
-    MDArg = FC->convert(MDArg, /* BypassPlaceholder= */ true);
+    MDArg = FC->convert(MDArg);
     if (PtrToIntInst *Cast = dyn_cast<PtrToIntInst>(MDArg)) {
       // Unwrapping this is necessary for llvm.dbg.declare to work.
       MDArg = Cast->getPointerOperand();
@@ -337,155 +456,66 @@ static AttributeSet RemovePointerAttrs(LLVMContext &Context,
   return AttributeSet::get(Context, AttrList);
 }
 
-static void ConvertInstruction(DataLayout *DL, Type *IntPtrType,
-                               FunctionConverter *FC, Instruction *Inst) {
-  if (ReturnInst *Ret = dyn_cast<ReturnInst>(Inst)) {
-    Value *Result = Ret->getReturnValue();
-    if (Result)
-      Result = FC->convert(Result);
-    CopyDebug(ReturnInst::Create(Ret->getContext(), Result, Ret), Inst);
-    Ret->eraseFromParent();
-  } else if (PHINode *Phi = dyn_cast<PHINode>(Inst)) {
-    PHINode *Phi2 = PHINode::Create(FC->convertType(Phi->getType()),
-                                    Phi->getNumIncomingValues(),
-                                    "", Phi);
-    CopyDebug(Phi2, Phi);
-    for (unsigned I = 0; I < Phi->getNumIncomingValues(); ++I) {
-      Phi2->addIncoming(FC->convert(Phi->getIncomingValue(I)),
-                        Phi->getIncomingBlock(I));
-    }
-    Phi2->takeName(Phi);
-    FC->recordConvertedAndErase(Phi, Phi2);
-  } else if (SelectInst *Op = dyn_cast<SelectInst>(Inst)) {
-    Instruction *Op2 = SelectInst::Create(Op->getCondition(),
-                                          FC->convert(Op->getTrueValue()),
-                                          FC->convert(Op->getFalseValue()),
-                                          "", Op);
-    CopyDebug(Op2, Op);
-    Op2->takeName(Op);
-    FC->recordConvertedAndErase(Op, Op2);
-  } else if (isa<PtrToIntInst>(Inst) || isa<IntToPtrInst>(Inst)) {
-    Value *Arg = FC->convert(Inst->getOperand(0));
-    Type *ResultTy = FC->convertType(Inst->getType());
-    unsigned ArgSize = Arg->getType()->getIntegerBitWidth();
-    unsigned ResultSize = ResultTy->getIntegerBitWidth();
-    Value *Result;
-    // We avoid using IRBuilder's CreateZExtOrTrunc() here because it
-    // constant-folds ptrtoint ConstantExprs.  This leads to creating
-    // ptrtoints of non-IntPtrType type, which is not what we want,
-    // because we want truncation/extension to be done explicitly by
-    // separate instructions.
-    if (ArgSize == ResultSize) {
-      Result = Arg;
-    } else {
-      Instruction::CastOps CastType =
-          ArgSize > ResultSize ? Instruction::Trunc : Instruction::ZExt;
-      Result = CopyDebug(CastInst::Create(CastType, Arg, ResultTy, "", Inst),
-                         Inst);
-    }
-    if (Result != Arg)
-      Result->takeName(Inst);
-    FC->recordConvertedAndErase(Inst, Result);
-  } else if (isa<BitCastInst>(Inst)) {
-    if (Inst->getType()->isPointerTy()) {
-      FC->ToErase.push_back(Inst);
-    }
-  } else if (ICmpInst *Cmp = dyn_cast<ICmpInst>(Inst)) {
-    Value *Cmp2 = CopyDebug(new ICmpInst(Inst, Cmp->getPredicate(),
-                                         FC->convert(Cmp->getOperand(0)),
-                                         FC->convert(Cmp->getOperand(1)), ""),
-                            Inst);
-    Cmp2->takeName(Cmp);
-    Cmp->replaceAllUsesWith(Cmp2);
-    Cmp->eraseFromParent();
+static void ConvertInstruction(FunctionConverter *FC, Instruction *Inst) {
+  if (isa<ReturnInst>(Inst) || isa<PHINode>(Inst) || isa<SelectInst>(Inst) ||
+      isa<ICmpInst>(Inst)) {
+    for (unsigned I = 0; I < Inst->getNumOperands(); ++I)
+      FC->convertOperand(Inst, I);
+    FC->recordTypeConverted(Inst);
+  } else if (isa<PtrToIntInst>(Inst)) {
+    Value *Result = FC->convertIntCast(Inst);
+    // The ptrtoints which convert() creates for allocas and the like are
+    // their own normalized versions.
+    if (Result != Inst)
+      FC->recordReplacedAndErase(Inst, Result);
+  } else if (isa<IntToPtrInst>(Inst) ||
+             (isa<BitCastInst>(Inst) && Inst->getType()->isPointerTy())) {
+    // Users of these refer to the converted operand instead.
+    FC->ToErase.push_back(Inst);
   } else if (LoadInst *Load = dyn_cast<LoadInst>(Inst)) {
-    Value *Ptr = FC->convertBackToPtr(Load->getPointerOperand(), Inst);
-    LoadInst *Result = new LoadInst(Ptr, "", Inst);
-    Result->takeName(Inst);
-    CopyDebug(Result, Inst);
-    CopyLoadOrStoreAttrs(Result, Load);
-    FC->recordConvertedAndErase(Inst, Result);
+    Load->setOperand(0, FC->convertBackToPtr(Load->getPointerOperand(),
+                                             Load->getType(), Load));
+    FC->recordTypeConverted(Load);
   } else if (StoreInst *Store = dyn_cast<StoreInst>(Inst)) {
-    Value *Ptr = FC->convertBackToPtr(Store->getPointerOperand(), Inst);
-    StoreInst *Result = new StoreInst(FC->convert(Store->getValueOperand()),
-                                      Ptr, Inst);
-    CopyDebug(Result, Inst);
-    CopyLoadOrStoreAttrs(Result, Store);
-    Inst->eraseFromParent();
-  } else if (CallInst *Call = dyn_cast<CallInst>(Inst)) {
-    if (IntrinsicInst *ICall = dyn_cast<IntrinsicInst>(Inst)) {
-      if (ICall->getIntrinsicID() == Intrinsic::lifetime_start ||
-          ICall->getIntrinsicID() == Intrinsic::lifetime_end ||
-          ICall->getIntrinsicID() == Intrinsic::invariant_start) {
-        // Remove alloca lifetime markers for now.  This is because
-        // the GVN pass can introduce lifetime markers taking PHI
-        // nodes as arguments.  If ReplacePtrsWithInts converts the
-        // PHI node to int type, we will render those lifetime markers
-        // ineffective.  But dropping a subset of lifetime markers is
-        // not safe in general.  So, until LLVM better defines the
-        // semantics of lifetime markers, we drop them all.  See:
-        // https://code.google.com/p/nativeclient/issues/detail?id=3443
-        // We do the same for invariant.start/end because they work in
-        // a similar way.
-        Inst->eraseFromParent();
-      } else {
-        FC->convertInPlace(Inst);
-      }
-    } else if (isa<InlineAsm>(Call->getCalledValue())) {
-      FC->convertInPlace(Inst);
+    Value *Ptr = FC->convertBackToPtr(Store->getPointerOperand(),
+                                      Store->getValueOperand()->getType(),
+                                      Store);
+    Store->setOperand(1, Ptr);
+    FC->convertOperand(Store, 0);
+  } else if (IntrinsicInst *ICall = dyn_cast<IntrinsicInst>(Inst)) {
+    if (ICall->getIntrinsicID() == Intrinsic::lifetime_start ||
+        ICall->getIntrinsicID() == Intrinsic::lifetime_end ||
+        ICall->getIntrinsicID() == Intrinsic::invariant_start) {
+      // Remove alloca lifetime markers for now.  This is because
+      // the GVN pass can introduce lifetime markers taking PHI
+      // nodes as arguments.  If ReplacePtrsWithInts converts the
+      // PHI node to int type, we will render those lifetime markers
+      // ineffective.  But dropping a subset of lifetime markers is
+      // not safe in general.  So, until LLVM better defines the
+      // semantics of lifetime markers, we drop them all.  See:
+      // https://code.google.com/p/nativeclient/issues/detail?id=3443
+      // We do the same for invariant.start/end because they work in
+      // a similar way.
+      Inst->eraseFromParent();
     } else {
-      SmallVector<Value *, 10> Args;
-      for (unsigned I = 0; I < Call->getNumArgOperands(); ++I)
-        Args.push_back(FC->convert(Call->getArgOperand(I)));
-      CallInst *NewCall = CallInst::Create(
-          FC->convertFunctionPtr(Call->getCalledValue(), Call),
-          Args, "", Inst);
-      CopyDebug(NewCall, Call);
-      NewCall->setAttributes(RemovePointerAttrs(Call->getContext(),
-                                                Call->getAttributes()));
-      NewCall->setCallingConv(Call->getCallingConv());
-      NewCall->setTailCall(Call->isTailCall());
-      NewCall->takeName(Call);
-      FC->recordConvertedAndErase(Call, NewCall);
+      FC->convertInPlace(Inst);
     }
-  } else if (InvokeInst *Call = dyn_cast<InvokeInst>(Inst)) {
-    SmallVector<Value *, 10> Args;
-    for (unsigned I = 0; I < Call->getNumArgOperands(); ++I)
-      Args.push_back(FC->convert(Call->getArgOperand(I)));
-    InvokeInst *NewCall = InvokeInst::Create(
-        FC->convertFunctionPtr(Call->getCalledValue(), Call),
-        Call->getNormalDest(),
-        Call->getUnwindDest(),
-        Args, "", Inst);
-    CopyDebug(NewCall, Call);
-    NewCall->setAttributes(RemovePointerAttrs(Call->getContext(),
-                                              Call->getAttributes()));
-    NewCall->setCallingConv(Call->getCallingConv());
-    NewCall->takeName(Call);
-    FC->recordConvertedAndErase(Call, NewCall);
-  } else if (AllocaInst *Alloca = dyn_cast<AllocaInst>(Inst)) {
-    Type *ElementTy = Inst->getType()->getPointerElementType();
-    Constant *ElementSize = ConstantInt::get(IntPtrType,
-                                             DL->getTypeAllocSize(ElementTy));
-    // Expand out alloca's built-in multiplication.
-    Value *MulSize;
-    if (ConstantInt *C = dyn_cast<ConstantInt>(Alloca->getArraySize())) {
-      MulSize = ConstantExpr::getMul(ElementSize, C);
+  } else if (isa<CallInst>(Inst) || isa<InvokeInst>(Inst)) {
+    CallSite Call(Inst);
+    if (isa<InlineAsm>(Call.getCalledValue())) {
+      FC->convertInPlace(Inst);
     } else {
-      MulSize = BinaryOperator::Create(
-          Instruction::Mul, ElementSize, Alloca->getArraySize(),
-          Alloca->getName() + ".alloca_mul", Alloca);
+      for (unsigned I = 0; I < Call.arg_size(); ++I)
+        FC->convertOperand(Inst, I);
+      Call.setCalledFunction(
+          FC->convertFunctionPtr(Call.getCalledValue(), Inst));
+      Call.setAttributes(RemovePointerAttrs(Inst->getContext(),
+                                            Call.getAttributes()));
+      FC->recordTypeConverted(Inst);
     }
-    unsigned Alignment = Alloca->getAlignment();
-    if (Alignment == 0)
-      Alignment = DL->getPrefTypeAlignment(ElementTy);
-    Value *Tmp = CopyDebug(new AllocaInst(Type::getInt8Ty(Inst->getContext()),
-                                          MulSize, Alignment, "", Inst),
-                           Inst);
-    Tmp->takeName(Alloca);
-    Value *Alloca2 = new PtrToIntInst(Tmp, IntPtrType,
-                                      Tmp->getName() + ".asint", Inst);
-    FC->recordConvertedAndErase(Alloca, Alloca2);
+  } else if (isa<AllocaInst>(Inst)) {
+    // The alloca is converted even if it is unused.
+    FC->convert(Inst);
   } else if (// Handle these instructions as a convenience to allow
              // the pass to be used in more situations, even though we
              // don't expect them in PNaCl's stable ABI.
@@ -571,7 +601,7 @@ bool ReplacePtrsWithInts::runOnModule(Module &M) {
     if (OldFunc->isIntrinsic())
       continue;
 
-    FunctionConverter FC(IntPtrType);
+    FunctionConverter FC(&DL, IntPtrType);
     FunctionType *NFTy = FC.convertFuncType(OldFunc->getFunctionType());
     OldFunc->setAttributes(RemovePointerAttrs(M.getContext(),
                                               OldFunc->getAttributes()));
@@ -603,7 +633,7 @@ bool ReplacePtrsWithInts::runOnModule(Module &M) {
          BB != E; ++BB) {
       for (BasicBlock::iterator Iter = BB->begin(), E = BB->end();
            Iter != E; ) {
-        ConvertInstruction(&DL, IntPtrType, &FC, Iter++);
+        ConvertInstruction(&FC, Iter++);
       }
     }
     // Now that all the replacement instructions have been created, we
@@ -619,7 +649,7 @@ bool ReplacePtrsWithInts::runOnModule(Module &M) {
         }
       }
     }
-    FC.eraseReplacedInstructions();
+    FC.finish();
     OldFunc->eraseFromParent();
   }
   // Now that all functions have their normalized types, we can remove
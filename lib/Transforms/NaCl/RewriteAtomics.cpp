@@ -28,6 +28,7 @@
 #include "llvm/Support/Compiler.h"
 #include "llvm/Support/raw_ostream.h"
 #include "llvm/Transforms/NaCl.h"
+#include "FunctionExpansions.h"
 #include <climits>
 #include <string>
 
@@ -58,9 +59,8 @@ template <class T> std::string ToStr(const T &V) {
 
 class AtomicVisitor : public InstVisitor<AtomicVisitor> {
 public:
-  AtomicVisitor(Module &M, Pass &P)
-      : M(M), C(M.getContext()), TD(P.getAnalysis<DataLayout>()), AI(C),
-        ModifiedModule(false) {}
+  AtomicVisitor(Module &M, const DataLayout &TD)
+      : M(M), C(M.getContext()), TD(TD), AI(C), ModifiedModule(false) {}
   ~AtomicVisitor() {}
   bool modifiedModule() const { return ModifiedModule; }
 
@@ -148,11 +148,27 @@ INITIALIZE_PASS(RewriteAtomics, "nacl-rewrite-atomics",
                 false, false)
 
 bool RewriteAtomics::runOnModule(Module &M) {
-  AtomicVisitor AV(M, *this);
+  AtomicVisitor AV(M, getAnalysis<DataLayout>());
   AV.visit(M);
   return AV.modifiedModule();
 }
 
+class AtomicRewriter::Visitor : public AtomicVisitor {
+public:
+  Visitor(Module &M, const DataLayout &TD) : AtomicVisitor(M, TD) {}
+};
+
+AtomicRewriter::AtomicRewriter(Module &M, const DataLayout &DL)
+    : V(new Visitor(M, DL)) {}
+
+AtomicRewriter::~AtomicRewriter() {}
+
+void AtomicRewriter::rewriteInstruction(Instruction *Inst) {
+  V->visit(Inst);
+}
+
+bool AtomicRewriter::modified() const { return V->modifiedModule(); }
+
 template <class Instruction>
 ConstantInt *AtomicVisitor::freezeMemoryOrder(const Instruction &I) const {
   NaCl::MemoryOrder AO = NaCl::MemoryOrderInvalid;
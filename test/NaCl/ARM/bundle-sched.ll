@@ -0,0 +1,37 @@
+; RUN: pnacl-llc -mtriple=armv7-unknown-nacl -filetype=obj %s -o - \
+; RUN:  | llvm-objdump -disassemble -triple armv7 - | FileCheck %s
+; RUN: pnacl-llc -mtriple=armv7-unknown-nacl -filetype=obj \
+; RUN:     -sfi-bundle-sched=false %s -o - \
+; RUN:  | llvm-objdump -disassemble -triple armv7 - \
+; RUN:  | FileCheck %s -check-prefix=NOSCHED
+
+; Test that independent instructions are moved across SFI sequences which
+; would otherwise need bundle padding.
+
+define i32 @f(i32* %p, i32 %a, i32 %b, i32 %c) {
+  %x = add i32 %a, %b
+  %y = mul i32 %x, %c
+  %z = mul i32 %y, %x
+  store i32 %z, i32* %p, align 4
+  %w = add i32 %c, 5
+  %r = mul i32 %w, %a
+  %q = getelementptr i32* %p, i32 1
+  %l = load i32* %q, align 4
+  %s = add i32 %r, %l
+  ret i32 %s
+}
+
+; Without scheduling, the load's guard would start in the last slot of a
+; bundle and be padded. The add is sunk past the load instead.
+; NOSCHED:      str r2, [r0]
+; NOSCHED-NEXT: add r2, r3, #5
+; NOSCHED-NEXT: nop
+; NOSCHED-NEXT: bic r0, r0, #3221225472
+; NOSCHED-NEXT: ldr r0, [r0, #4]
+
+; CHECK:      18: {{.*}} bic r0, r0, #3221225472
+; CHECK-NEXT: 1c: {{.*}} ldr r0, [r0, #4]
+; CHECK-NEXT: 20: {{.*}} add r2, r3, #5
+; CHECK-NEXT: 24: {{.*}} mla r0, r2, r1, r0
+; CHECK-NEXT: 28: {{.*}} bic lr, lr, #3221225487
+; CHECK-NEXT: 2c: {{.*}} bx lr
@@ -0,0 +1,35 @@
+; Test that pnacl-bccompress synthesizes abbreviations from the value
+; distributions of records, rather than only reusing the abbreviations
+; of the input file.
+
+; RUN: llvm-as < %s | pnacl-freeze | pnacl-bccompress -abbreviations \
+; RUN:              2>&1 >/dev/null | FileCheck %s --check-prefix ABBREVS
+; RUN: llvm-as < %s | pnacl-freeze | pnacl-bccompress | pnacl-thaw \
+; RUN:              | llvm-dis - | FileCheck %s
+
+define internal i32 @f(i32 %a, i32 %b) {
+  %1 = add i32 %a, %b
+  %2 = add i32 %1, %b
+  %3 = add i32 %2, %a
+  %4 = add i32 %3, %1
+  %5 = add i32 %4, %2
+  %6 = add i32 %5, %3
+  %7 = add i32 %6, %4
+  %8 = add i32 %7, %5
+  %9 = add i32 %8, %6
+  %10 = add i32 %9, %7
+  %11 = add i32 %10, %8
+  %12 = add i32 %11, %9
+  ret i32 %12
+}
+
+; The binary operators use a literal record code, a literal first
+; operand (always the previous instruction), a small fixed width second
+; operand, and a literal opcode.
+; ABBREVS: -- New abbrevations:
+; ABBREVS-NEXT: Abbrev(block 12): [2, 1, Fixed(3), 0]
+; ABBREVS: --
+
+; CHECK: define internal i32 @f(i32, i32)
+; CHECK: %14 = add i32 %13, %11
+; CHECK-NEXT: ret i32 %14
@@ -0,0 +1,62 @@
+; Test that analyzing and copying function blocks on several threads
+; generates the same compressed bitcode as processing them one after
+; the other.
+
+; RUN: llvm-as < %s | pnacl-freeze -allow-local-symbol-tables > %t.pexe
+; RUN: pnacl-bccompress %t.pexe -o %t.1.pexe
+; RUN: pnacl-bccompress -threads=3 %t.pexe -o %t.3.pexe
+; RUN: cmp %t.1.pexe %t.3.pexe
+; RUN: pnacl-bccompress -show-distributions %t.pexe -o %t.1.txt
+; RUN: pnacl-bccompress -show-distributions -threads=3 %t.pexe -o %t.3.txt
+; RUN: cmp %t.1.txt %t.3.txt
+; RUN: pnacl-thaw -allow-local-symbol-tables %t.3.pexe | llvm-dis - \
+; RUN:   | FileCheck %s
+
+@G = internal global [4 x i8] c"abcd"
+
+define internal i32 @f0(i32 %x) {
+  %y = add i32 %x, 1
+  ret i32 %y
+}
+
+define internal i32 @f1(i32 %x) {
+  %c = icmp slt i32 %x, 10
+  br i1 %c, label %then, label %else
+then:
+  %y = call i32 @f0(i32 %x)
+  ret i32 %y
+else:
+  ret i32 7
+}
+
+define internal float @f2(float %x) {
+  %y = fmul float %x, 2.5
+  ret float %y
+}
+
+define internal i32 @f3(i32 %x) {
+  %p = ptrtoint [4 x i8]* @G to i32
+  %y = add i32 %p, %x
+  %z = call i32 @f1(i32 %y)
+  ret i32 %z
+}
+
+define internal void @f4(i32 %x) {
+  switch i32 %x, label %done [
+    i32 1, label %done
+    i32 2, label %done
+  ]
+done:
+  ret void
+}
+
+; CHECK: define internal i32 @f0(i32 %x)
+; CHECK: %y = add i32 %x, 1
+; CHECK: define internal i32 @f1(i32 %x)
+; CHECK: %y = call i32 @f0(i32 %x)
+; CHECK: define internal float @f2(float %x)
+; CHECK: %y = fmul float %x, 2.500000e+00
+; CHECK: define internal i32 @f3(i32 %x)
+; CHECK: %z = call i32 @f1(i32 %y)
+; CHECK: define internal void @f4(i32 %x)
+; CHECK: switch i32 %x
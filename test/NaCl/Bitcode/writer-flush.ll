@@ -0,0 +1,30 @@
+; Test that writing bitcode to a file, which flushes function blocks as
+; they are written and patches block sizes afterwards, generates the same
+; bitcode as writing it to a pipe, which buffers the whole file.
+
+; RUN: llvm-as < %s | pnacl-freeze -o %t.pexe
+; RUN: llvm-as < %s | pnacl-freeze | cat > %t.pipe.pexe
+; RUN: cmp %t.pexe %t.pipe.pexe
+; RUN: llvm-as < %s | pnacl-freeze -pnacl-writer-threads=2 -o %t.threads.pexe
+; RUN: cmp %t.pexe %t.threads.pexe
+; RUN: pnacl-thaw %t.pexe | llvm-dis - | FileCheck %s
+
+define internal i32 @f0(i32 %x) {
+  %y = add i32 %x, 1
+  ret i32 %y
+}
+
+define internal i32 @f1(i32 %x) {
+  %y = call i32 @f0(i32 %x)
+  %z = mul i32 %y, %x
+  ret i32 %z
+}
+
+define internal void @f2() {
+  ret void
+}
+
+; CHECK: define internal i32 @f0(i32)
+; CHECK: define internal i32 @f1(i32)
+; CHECK: call i32 @f0(i32 %0)
+; CHECK: define internal void @f2()
@@ -0,0 +1,56 @@
+; Test that writing function blocks on several threads generates the same
+; bitcode as writing them one after the other.
+
+; RUN: llvm-as < %s | pnacl-freeze > %t.pexe
+; RUN: llvm-as < %s | pnacl-freeze -pnacl-writer-threads=3 > %t.threads.pexe
+; RUN: cmp %t.pexe %t.threads.pexe
+; RUN: pnacl-thaw %t.threads.pexe | llvm-dis - | FileCheck %s
+
+@G = internal global [4 x i8] c"abcd"
+
+define internal i32 @f0(i32 %x) {
+  %y = add i32 %x, 1
+  ret i32 %y
+}
+
+define internal i32 @f1(i32 %x) {
+  %c = icmp slt i32 %x, 10
+  br i1 %c, label %then, label %else
+then:
+  %y = call i32 @f0(i32 %x)
+  ret i32 %y
+else:
+  ret i32 7
+}
+
+define internal float @f2(float %x) {
+  %y = fmul float %x, 2.5
+  ret float %y
+}
+
+define internal i32 @f3(i32 %x) {
+  %p = ptrtoint [4 x i8]* @G to i32
+  %y = add i32 %p, %x
+  %z = call i32 @f1(i32 %y)
+  ret i32 %z
+}
+
+define internal void @f4(i32 %x) {
+  switch i32 %x, label %done [
+    i32 1, label %done
+    i32 2, label %done
+  ]
+done:
+  ret void
+}
+
+; CHECK: define internal i32 @f0(i32)
+; CHECK: add i32 %0, 1
+; CHECK: define internal i32 @f1(i32)
+; CHECK: call i32 @f0(i32 %0)
+; CHECK: define internal float @f2(float)
+; CHECK: fmul float %0, 2.500000e+00
+; CHECK: define internal i32 @f3(i32)
+; CHECK: call i32 @f1(i32
+; CHECK: define internal void @f4(i32)
+; CHECK: switch i32 %0
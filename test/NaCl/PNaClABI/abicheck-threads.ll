@@ -0,0 +1,51 @@
+; Test that checking function bodies on several threads, or each right
+; after it is read, reports the same errors, in the same order, as
+; checking them one after the other.
+
+; RUN: not pnacl-abicheck < %s > %t.1
+; RUN: not pnacl-abicheck -threads=3 < %s > %t.3
+; RUN: cmp %t.1 %t.3
+; RUN: llvm-as < %s > %t.bc
+; RUN: not pnacl-abicheck -incremental %t.bc > %t.incremental
+; RUN: cmp %t.1 %t.incremental
+; RUN: FileCheck %s < %t.3
+
+define internal i32 @f0(i32 %x) {
+  %y = add nsw i32 %x, 1
+  ret i32 %y
+}
+; CHECK: ERROR: Function f0 is not valid PNaCl bitcode:
+; CHECK-NEXT: Function f0 disallowed: has "nsw" attribute
+
+define internal i32 @f1(i32 %x) {
+  %y = add i32 %x, 1
+  ret i32 %y
+}
+; CHECK-NOT: Function f1
+
+define internal void @f2(i32 %x) {
+  %p = inttoptr i32 %x to i32*
+  %v = load i32* %p, align 4
+  ret void
+}
+; CHECK: ERROR: Function f2 is not valid PNaCl bitcode:
+; CHECK-NEXT: Function f2 disallowed: bad alignment
+
+define internal void @f3() {
+  ret void
+}
+; CHECK-NOT: Function f3
+
+define internal void @f4(i64 %x) {
+  %p = inttoptr i64 %x to i8*
+  ret void
+}
+; CHECK: ERROR: Function f4 is not valid PNaCl bitcode:
+; CHECK-NEXT: Function f4 disallowed: non-i32 inttoptr
+
+define internal i32 @f5(i32 %x) {
+  %y = udiv exact i32 %x, 2
+  ret i32 %y
+}
+; CHECK: ERROR: Function f5 is not valid PNaCl bitcode:
+; CHECK-NEXT: Function f5 disallowed: has "exact" attribute
@@ -0,0 +1,37 @@
+; RUN: llvm-as < %s | pnacl-freeze > %t.pexe
+; RUN: pnacl-llc -mtriple=i686-none-nacl-gnu -filetype=asm \
+; RUN:     -bitcode-format=pnacl -streaming-bitcode -pnaclabi-verify \
+; RUN:     -pnaclabi-verify-fatal-errors %t.pexe -o %t.s
+; RUN: pnacl-llc -mtriple=i686-none-nacl-gnu -filetype=asm \
+; RUN:     -bitcode-format=pnacl -streaming-bitcode -pnaclabi-verify \
+; RUN:     -pnaclabi-verify-fatal-errors -pnaclabi-verify-in-reader=false \
+; RUN:     %t.pexe -o %t.pass.s
+; RUN: cmp %t.s %t.pass.s
+; RUN: sed 's/align 1/align 8/' %s | llvm-as | pnacl-freeze > %t.bad.pexe
+; RUN: not pnacl-llc -mtriple=i686-none-nacl-gnu -filetype=asm \
+; RUN:     -bitcode-format=pnacl -streaming-bitcode -pnaclabi-verify \
+; RUN:     -pnaclabi-verify-fatal-errors %t.bad.pexe -o %t.bad.s 2>&1 \
+; RUN:   | FileCheck %s
+
+; Test that the bitcode reader reports the same PNaCl ABI errors in
+; streamed function bodies as the PNaClABIVerifyFunctions pass.
+
+define internal i32 @f0(i32 %x) {
+  %y = add i32 %x, 1
+  ret i32 %y
+}
+
+define internal i32 @f1(i32 %x) {
+  %p = inttoptr i32 %x to i32*
+  %v = load i32* %p, align 1
+  ret i32 %v
+}
+
+define void @_start(i32 %arg) {
+  %y = call i32 @f0(i32 %arg)
+  %z = call i32 @f1(i32 %y)
+  ret void
+}
+
+; CHECK: Function f1 disallowed: bad alignment: {{.*}} load i32* {{.*}}, align 8
+; CHECK: PNaCl ABI verification failed
@@ -0,0 +1,44 @@
+; Test that -function-cache-dir keeps functions with identical bodies
+; apart, since they define different symbols.
+
+; REQUIRES: asserts
+; RUN: llvm-as < %s | pnacl-freeze > %t.pexe
+; RUN: rm -rf %t.cache
+; RUN: pnacl-llc -mtriple=i686-none-nacl-gnu -filetype=obj \
+; RUN:     -bitcode-format=pnacl -streaming-bitcode -stats \
+; RUN:     -function-cache-dir=%t.cache %t.pexe -o %t.1.o 2>&1 \
+; RUN:   | FileCheck %s -check-prefix=COLD
+; RUN: ls %t.cache | count 3
+; RUN: llvm-objdump -d %t.1.o | FileCheck %s
+
+; COLD: 3 pnacl-llc - Number of functions compiled and cached
+
+; RUN: pnacl-llc -mtriple=i686-none-nacl-gnu -filetype=obj \
+; RUN:     -bitcode-format=pnacl -streaming-bitcode -stats \
+; RUN:     -function-cache-dir=%t.cache %t.pexe -o %t.2.o 2>&1 \
+; RUN:   | FileCheck %s -check-prefix=WARM
+; RUN: cmp %t.1.o %t.2.o
+
+; WARM: 3 pnacl-llc - Number of functions found in the cache
+
+define i32 @f0(i32 %x) {
+  %y = add i32 %x, 7
+  ret i32 %y
+}
+
+define i32 @f1(i32 %x) {
+  %y = add i32 %x, 7
+  ret i32 %y
+}
+
+define i32 @f2(i32 %x) {
+  %y = call i32 @f0(i32 %x)
+  %z = call i32 @f1(i32 %y)
+  ret i32 %z
+}
+
+; CHECK: f0:
+; CHECK: f1:
+; CHECK: f2:
+; CHECK: call
+; CHECK: call
@@ -0,0 +1,97 @@
+; Test that -function-cache-dir only compiles the functions that changed
+; since an earlier translation.
+
+; REQUIRES: asserts
+; RUN: llvm-as < %s | pnacl-freeze > %t.pexe
+; RUN: rm -rf %t.cache
+; RUN: pnacl-llc -mtriple=i686-none-nacl-gnu -filetype=obj \
+; RUN:     -bitcode-format=pnacl -streaming-bitcode -stats \
+; RUN:     -function-cache-dir=%t.cache %t.pexe -o %t.1.o 2>&1 \
+; RUN:   | FileCheck %s -check-prefix=COLD
+; RUN: ls %t.cache | count 3
+; RUN: llvm-objdump -d %t.1.o | FileCheck %s
+
+; COLD: 3 pnacl-llc - Number of functions compiled and cached
+; COLD-NOT: found in the cache
+
+; RUN: pnacl-llc -mtriple=i686-none-nacl-gnu -filetype=obj \
+; RUN:     -bitcode-format=pnacl -streaming-bitcode -stats \
+; RUN:     -function-cache-dir=%t.cache %t.pexe -o %t.2.o 2>&1 \
+; RUN:   | FileCheck %s -check-prefix=WARM
+; RUN: cmp %t.1.o %t.2.o
+
+; WARM: 3 pnacl-llc - Number of functions found in the cache
+; WARM-NOT: compiled and cached
+
+; Only the changed function is compiled again.
+; RUN: sed 's/x, 7/x, 8/' %s | llvm-as | pnacl-freeze > %t.changed.pexe
+; RUN: pnacl-llc -mtriple=i686-none-nacl-gnu -filetype=obj \
+; RUN:     -bitcode-format=pnacl -streaming-bitcode -stats \
+; RUN:     -function-cache-dir=%t.cache %t.changed.pexe -o %t.3.o 2>&1 \
+; RUN:   | FileCheck %s -check-prefix=CHANGED
+; RUN: ls %t.cache | count 4
+; RUN: llvm-objdump -d %t.3.o | FileCheck %s
+
+; CHANGED-DAG: 2 pnacl-llc - Number of functions found in the cache
+; CHANGED-DAG: 1 pnacl-llc - Number of functions compiled and cached
+
+; Adding a global variable and a function renumbers the values that the
+; bitcode of the other functions refers to, but doesn't change their keys.
+; RUN: sed 's/^; NEW: //' %s | llvm-as | pnacl-freeze > %t.added.pexe
+; RUN: pnacl-llc -mtriple=i686-none-nacl-gnu -filetype=obj \
+; RUN:     -bitcode-format=pnacl -streaming-bitcode -stats \
+; RUN:     -function-cache-dir=%t.cache %t.added.pexe -o %t.4.o 2>&1 \
+; RUN:   | FileCheck %s -check-prefix=ADDED
+; RUN: ls %t.cache | count 5
+; RUN: llvm-objdump -d %t.4.o | FileCheck %s -check-prefix=ADDED-CODE
+
+; ADDED-DAG: 3 pnacl-llc - Number of functions found in the cache
+; ADDED-DAG: 1 pnacl-llc - Number of functions compiled and cached
+
+; With -split-module, the functions missing from the cache are compiled on
+; several threads.
+; RUN: rm -rf %t.cache2
+; RUN: pnacl-llc -mtriple=i686-none-nacl-gnu -filetype=obj \
+; RUN:     -bitcode-format=pnacl -streaming-bitcode -stats -split-module=2 \
+; RUN:     -function-cache-dir=%t.cache2 %t.pexe -o %t.5.o 2>&1 \
+; RUN:   | FileCheck %s -check-prefix=COLD
+; RUN: cmp %t.1.o %t.5.o
+
+; NEW: @H = global [4 x i8] c"efgh"
+@G = global [4 x i8] c"abcd"
+
+define i32 @f0(i32 %x) {
+  %y = add i32 %x, 7
+  ret i32 %y
+}
+
+; NEW: define i32 @g(i32 %x) {
+; NEW:   %p = ptrtoint [4 x i8]* @H to i32
+; NEW:   %y = add i32 %x, %p
+; NEW:   ret i32 %y
+; NEW: }
+
+define i32 @f1(i32 %x) {
+  %y = call i32 @f0(i32 %x)
+  %p = ptrtoint [4 x i8]* @G to i32
+  %z = add i32 %y, %p
+  ret i32 %z
+}
+
+define i32 @f2(i32 %x) {
+  %y = call i32 @f1(i32 %x)
+  ret i32 %y
+}
+
+; CHECK: f0:
+; CHECK: f1:
+; CHECK: call
+; CHECK: f2:
+; CHECK: call
+
+; ADDED-CODE: f0:
+; ADDED-CODE: g:
+; ADDED-CODE: f1:
+; ADDED-CODE: call
+; ADDED-CODE: f2:
+; ADDED-CODE: call
@@ -0,0 +1,53 @@
+; RUN: llvm-as < %s | pnacl-freeze > %t.pexe
+; RUN: pnacl-llc -mtriple=i686-none-nacl-gnu -filetype=obj \
+; RUN:     -bitcode-format=pnacl -streaming-bitcode -split-module=2 \
+; RUN:     -split-module-sched=static -split-module-merge-objects \
+; RUN:     %t.pexe -o %t.o
+; RUN: llvm-readobj -s -t -r %t.o | FileCheck %s
+; RUN: pnacl-llc -mtriple=x86_64-none-nacl-gnu -filetype=obj \
+; RUN:     -bitcode-format=pnacl -streaming-bitcode -split-module=2 \
+; RUN:     -split-module-sched=static -split-module-merge-objects \
+; RUN:     %t.pexe -o %t64.o
+; RUN: llvm-readobj -s -t -r %t64.o | FileCheck %s
+
+; Test that the objects of split modules are merged into one object, in
+; which the functions compiled by different modules share a text section
+; and calls between them are resolved against the merged symbols.
+
+define i32 @f0(i32 %x) {
+  %y = add i32 %x, 1
+  ret i32 %y
+}
+
+define i32 @f1(i32 %x) {
+  %y = call i32 @f0(i32 %x)
+  ret i32 %y
+}
+
+define i32 @f2(i32 %x) {
+  %y = call i32 @f1(i32 %x)
+  ret i32 %y
+}
+
+; The NaCl ABI note of each module is in a COMDAT group, of which only
+; one copy is kept.
+; CHECK: Name: .group
+; CHECK-NEXT: Type: SHT_GROUP
+; CHECK-NOT: Name: .group
+; CHECK: Name: .text
+; CHECK-NOT: Name: .text
+; CHECK: Name: .note.NaCl.ABI
+; CHECK-NOT: Name: .note.NaCl.ABI
+; CHECK: Relocations [
+; CHECK: Section {{.*}} .rel{{a?}}.text {
+; CHECK: 0x{{[0-9A-F]+}} R_{{.*}} f1
+; CHECK: 0x{{[0-9A-F]+}} R_{{.*}} f0
+; CHECK-NEXT: }
+; CHECK: Symbols [
+; CHECK: Name: f0
+; CHECK-NEXT: Value: 0x0
+; CHECK-NOT: Name: f0
+; CHECK: Name: f2
+; CHECK-NEXT: Value: 0x{{[1-9A-F][0-9A-F]*}}
+; CHECK: Name: f1
+; CHECK-NEXT: Value: 0x{{[1-9A-F][0-9A-F]*}}
@@ -0,0 +1,40 @@
+; RUN: llvm-as < %s | pnacl-freeze > %t.pexe
+; RUN: pnacl-llc -mtriple=i686-none-nacl-gnu -filetype=asm \
+; RUN:     -bitcode-format=pnacl -streaming-bitcode -split-module=2 \
+; RUN:     -split-module-sched=static -split-module-parse-once \
+; RUN:     %t.pexe -o %t.s
+; RUN: FileCheck %s -check-prefix=MOD0 < %t.s
+; RUN: FileCheck %s -check-prefix=MOD1 < %t.s.module1
+
+; Test that split modules can share the module-level blocks parsed by
+; the first module. Function bodies are assigned round-robin to the
+; modules, and only the first module defines the global variables.
+
+@bytes = internal global [4 x i8] c"abcd"
+
+define i32 @f0(i32 %x) {
+  %y = add i32 %x, 1
+  ret i32 %y
+}
+
+define i32 @f1(i32 %x) {
+  %addr = ptrtoint [4 x i8]* @bytes to i32
+  %sum = add i32 %x, %addr
+  ret i32 %sum
+}
+
+define i32 @f2(i32 %x) {
+  %y = call i32 @f1(i32 %x)
+  ret i32 %y
+}
+
+; MOD0: f0:
+; MOD0-NOT: f1:
+; MOD0: f2:
+; MOD0: bytes:
+; MOD0-NEXT: .ascii "abcd"
+
+; MOD1-NOT: f0:
+; MOD1: f1:
+; MOD1-NOT: f2:
+; MOD1-NOT: bytes:
@@ -0,0 +1,33 @@
+; RUN: llvm-as < %s | pnacl-freeze > %t.pexe
+; RUN: pnacl-llc -mtriple=i686-none-nacl-gnu -filetype=asm \
+; RUN:     -bitcode-format=pnacl -streaming-bitcode -split-module=2 \
+; RUN:     -split-module-sched=stealing %t.pexe -o %t.s
+; RUN: cat %t.s %t.s.module1 | FileCheck %s
+
+; Test that cost-based scheduling with work stealing compiles every
+; function exactly once, whichever thread it ends up on.
+
+define i32 @f0(i32 %x) {
+  %y = add i32 %x, 1
+  ret i32 %y
+}
+
+define i32 @f1(i32 %x) {
+  %a = mul i32 %x, %x
+  %b = add i32 %a, 7
+  %c = mul i32 %b, %x
+  %d = sub i32 %c, %a
+  ret i32 %d
+}
+
+define i32 @f2(i32 %x) {
+  %y = call i32 @f1(i32 %x)
+  ret i32 %y
+}
+
+; CHECK-DAG: f0:
+; CHECK-DAG: f1:
+; CHECK-DAG: f2:
+; CHECK-NOT: f0:
+; CHECK-NOT: f1:
+; CHECK-NOT: f2:
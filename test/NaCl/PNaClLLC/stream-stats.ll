@@ -0,0 +1,35 @@
+; RUN: llvm-as < %s | pnacl-freeze > %t.pexe
+; RUN: pnacl-llc -mtriple=i686-none-nacl-gnu -filetype=asm \
+; RUN:     -bitcode-format=pnacl -streaming-bitcode %t.pexe -o %t.s
+; RUN: pnacl-llc -mtriple=i686-none-nacl-gnu -filetype=asm \
+; RUN:     -bitcode-format=pnacl -streaming-bitcode -stream-stats \
+; RUN:     -stream-bandwidth=20000 -stream-chunk-size=64 \
+; RUN:     %t.pexe -o %t.throttled.s 2>&1 | FileCheck %s
+; RUN: cmp %t.s %t.throttled.s
+; RUN: pnacl-llc -mtriple=i686-none-nacl-gnu -filetype=asm \
+; RUN:     -bitcode-format=pnacl -streaming-bitcode -stream-stats \
+; RUN:     -split-module=2 %t.pexe -o %t.split.s 2>&1 | FileCheck %s
+
+; Test that -stream-stats reports the streaming latency statistics, and
+; that streaming the bitcode in throttled chunks doesn't change the code.
+
+; CHECK: stream-stats: time to first function: {{[0-9]+\.[0-9]+}} s
+; CHECK-NEXT: stream-stats: time from last byte to object: {{[0-9]+\.[0-9]+}} s
+; CHECK-NEXT: stream-stats: thread idle time waiting for bitcode: {{[0-9]+\.[0-9]+}} s
+
+define i32 @f0(i32 %x) {
+  %y = add i32 %x, 1
+  ret i32 %y
+}
+
+define i32 @f1(i32 %x) {
+  %a = mul i32 %x, %x
+  %b = add i32 %a, 7
+  ret i32 %b
+}
+
+define i32 @f2(i32 %x) {
+  %a = call i32 @f0(i32 %x)
+  %b = call i32 @f1(i32 %a)
+  ret i32 %b
+}
@@ -0,0 +1,63 @@
+; Test that -translation-cache-dir reuses the object of an earlier
+; translation of the same input with the same options.
+
+; RUN: llvm-as < %s | pnacl-freeze > %t.pexe
+; RUN: rm -rf %t.cache
+; RUN: pnacl-llc -mtriple=i686-none-nacl-gnu -filetype=obj \
+; RUN:     -bitcode-format=pnacl -translation-cache-dir=%t.cache \
+; RUN:     %t.pexe -o %t.1.o
+; RUN: ls %t.cache | count 1
+; RUN: cmp %t.1.o %t.cache/*.o
+
+; A second translation copies the cached object, even under another name.
+; RUN: echo cached > %t.cache/*.o
+; RUN: cp %t.pexe %t.copy.pexe
+; RUN: pnacl-llc -mtriple=i686-none-nacl-gnu -filetype=obj \
+; RUN:     -bitcode-format=pnacl -translation-cache-dir %t.cache \
+; RUN:     %t.copy.pexe -o %t.2.o
+; RUN: cmp %t.2.o %t.cache/*.o
+
+; Other options and other inputs are translated, and cached separately.
+; RUN: pnacl-llc -mtriple=i686-none-nacl-gnu -filetype=obj -O0 \
+; RUN:     -bitcode-format=pnacl -translation-cache-dir=%t.cache \
+; RUN:     %t.pexe -o %t.3.o
+; RUN: llvm-objdump -d %t.3.o | FileCheck %s
+; RUN: sed 's/x, 1/x, 2/' %s | llvm-as | pnacl-freeze > %t.other.pexe
+; RUN: pnacl-llc -mtriple=i686-none-nacl-gnu -filetype=obj \
+; RUN:     -bitcode-format=pnacl -translation-cache-dir=%t.cache \
+; RUN:     %t.other.pexe -o %t.4.o
+; RUN: llvm-objdump -d %t.4.o | FileCheck %s
+; RUN: ls %t.cache | count 3
+
+; Options whose names start with "o" are part of the key, unlike -o.
+; RUN: pnacl-llc -mtriple=i686-none-nacl-gnu -filetype=obj \
+; RUN:     -bitcode-format=pnacl -translation-cache-dir=%t.cache \
+; RUN:     -optimize-regalloc=false %t.pexe -o=%t.5.o
+; RUN: ls %t.cache | count 4
+; RUN: pnacl-llc -mtriple=i686-none-nacl-gnu -filetype=obj \
+; RUN:     -bitcode-format=pnacl -translation-cache-dir=%t.cache \
+; RUN:     -optimize-regalloc=false %t.pexe -o %t.6.o
+; RUN: ls %t.cache | count 4
+; RUN: cmp %t.5.o %t.6.o
+
+; Code for another CPU is translated, and cached separately.
+; RUN: pnacl-llc -mtriple=i686-none-nacl-gnu -filetype=obj -mcpu=atom \
+; RUN:     -bitcode-format=pnacl -translation-cache-dir=%t.cache \
+; RUN:     %t.pexe -o %t.7.o
+; RUN: ls %t.cache | count 5
+; RUN: pnacl-llc -mtriple=i686-none-nacl-gnu -filetype=obj -mcpu=core2 \
+; RUN:     -bitcode-format=pnacl -translation-cache-dir=%t.cache \
+; RUN:     %t.pexe -o %t.8.o
+; RUN: ls %t.cache | count 6
+; RUN: pnacl-llc -mtriple=i686-none-nacl-gnu -filetype=obj -mcpu=atom \
+; RUN:     -bitcode-format=pnacl -translation-cache-dir=%t.cache \
+; RUN:     %t.pexe -o %t.9.o
+; RUN: ls %t.cache | count 6
+; RUN: cmp %t.7.o %t.9.o
+
+define i32 @f(i32 %x) {
+  %y = add i32 %x, 1
+  ret i32 %y
+}
+
+; CHECK: f:
@@ -0,0 +1,73 @@
+; Test that -expand-function-bodies, which applies the rewrites of several
+; passes in one walk over each function, gives the same result as running
+; those passes one after the other.
+
+; RUN: opt %s -expand-constant-expr -nacl-promote-ints -expand-getelementptr \
+; RUN:     -nacl-rewrite-atomics -remove-asm-memory -S > %t.passes.ll
+; RUN: opt %s -expand-function-bodies -S > %t.fused.ll
+; RUN: diff %t.passes.ll %t.fused.ll
+; RUN: FileCheck %s < %t.fused.ll
+
+target datalayout = "p:32:32:32"
+
+%struct = type { i8, i32 }
+
+@var = global [8 x i8] zeroinitializer
+@ptr = global i32 0
+
+; A ConstantExpr operand which becomes an illegal integer operation,
+; whose promotion creates a getelementptr.
+define i32 @constexpr_promote() {
+  %val = load i24* bitcast ([8 x i8]* @var to i24*)
+  %ext = zext i24 %val to i32
+  ret i32 %ext
+}
+; CHECK-LABEL: define i32 @constexpr_promote()
+; CHECK-NOT: getelementptr
+; CHECK-NOT: bitcast ([8 x i8]* @var to i24*)
+; CHECK: ret i32
+
+; ConstantExprs in PHI nodes, expanded into blocks which the walk has
+; already left and into blocks it hasn't reached yet.
+define i32 @constexpr_phi(i1 %cond) {
+entry:
+  br i1 %cond, label %loop, label %exit
+loop:
+  %x = phi i32 [ ptrtoint (i8* getelementptr ([8 x i8]* @var, i32 0, i32 2) to i32), %entry ],
+               [ ptrtoint (i32* getelementptr (%struct* bitcast (i32* @ptr to %struct*), i32 0, i32 1) to i32), %loop ],
+               [ ptrtoint (i8* getelementptr ([8 x i8]* @var, i32 0, i32 3) to i32), %latch ]
+  br i1 %cond, label %loop, label %latch
+latch:
+  br label %loop
+exit:
+  ret i32 0
+}
+; CHECK-LABEL: define i32 @constexpr_phi(i1 %cond)
+; CHECK-NOT: getelementptr
+; CHECK: ret i32 0
+
+define i32 @illegal_switch(i32 %a) {
+  %a24 = trunc i32 %a to i24
+  switch i24 %a24, label %end [
+    i24 0, label %end
+  ]
+end:
+  ret i32 0
+}
+; CHECK-LABEL: define i32 @illegal_switch(
+; CHECK: switch i32
+
+; An atomic access through a ConstantExpr getelementptr, and a fence
+; between inline assembly barriers.
+define i32 @atomics() {
+  %v = load atomic i32* bitcast (i8* getelementptr ([8 x i8]* @var, i32 0, i32 4) to i32*) seq_cst, align 4
+  call void asm sideeffect "", "~{memory}"()
+  fence seq_cst
+  call void asm sideeffect "", "~{memory}"()
+  ret i32 %v
+}
+; CHECK-LABEL: define i32 @atomics()
+; CHECK-NOT: getelementptr
+; CHECK: call i32 @llvm.nacl.atomic.load.i32
+; CHECK-NEXT: call void @llvm.nacl.atomic.fence.all()
+; CHECK-NEXT: ret i32
@@ -99,6 +99,33 @@ block3:
 ; CHECK-NEXT: ret i32 %val
 
 
+; Forwards references to values which are replaced by new instructions
+; when first used.
+define i8* @forwards_reference_replaced(i8* %ptr) {
+  br label %block1
+block2:
+  %cmp = icmp eq i8* %result, %ptr
+  store i32 0, i32* %addr
+  ret i8* %result
+block1:
+  %addr = alloca i32
+  %result = call i8* @llvm.some.intrinsic(i8* %ptr)
+  br label %block2
+}
+; CHECK: define i32 @forwards_reference_replaced(i32 %ptr) {
+; CHECK: block2:
+; CHECK-NEXT: %cmp = icmp eq i32 %result.asint, %ptr
+; CHECK-NEXT: %addr.bc = bitcast i8* %addr to i32*
+; CHECK-NEXT: store i32 0, i32* %addr.bc
+; CHECK-NEXT: ret i32 %result.asint
+; CHECK: block1:
+; CHECK-NEXT: %addr = alloca i8, i32 4, align 4
+; CHECK-NEXT: %ptr.asptr = inttoptr i32 %ptr to i8*
+; CHECK-NEXT: %result = call i8* @llvm.some.intrinsic(i8* %ptr.asptr)
+; CHECK-NEXT: %result.asint = ptrtoint i8* %result to i32
+; CHECK-NEXT: br label %block2
+
+
 define i8* @phi_multiple_entry(i1 %arg, i8* %ptr) {
 entry:
   br i1 %arg, label %done, label %done
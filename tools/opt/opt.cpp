@@ -634,6 +634,7 @@ int main(int argc, char **argv) {
   initializeExpandByValPass(Registry);
   initializeExpandConstantExprPass(Registry);
   initializeExpandCtorsPass(Registry);
+  initializeExpandFunctionBodiesPass(Registry);
   initializeExpandGetElementPtrPass(Registry);
   initializeExpandIndirectBrPass(Registry);
   initializeExpandShuffleVectorPass(Registry);
@@ -9,20 +9,42 @@
 //
 // This tool checks files for compliance with the PNaCl bitcode ABI
 //
+// With -threads=N, the function bodies are checked on N threads. Each
+// thread collects errors with an error reporter of its own, and the
+// errors are printed in module order, so the output doesn't depend on
+// the number of threads.
+//
+// With -incremental, function bodies are read lazily. Each function is
+// checked right after it is materialized, and its body is released
+// before the next function is materialized.
+//
 //===----------------------------------------------------------------------===//
 
 #include "llvm/ADT/OwningPtr.h"
+#include "llvm/ADT/STLExtras.h"
 #include "llvm/Analysis/NaCl.h"
+#include "llvm/Analysis/NaCl/PNaClABIVerifyFunctions.h"
+#include "llvm/Bitcode/NaCl/NaClReaderWriter.h"
+#include "llvm/Config/config.h"
 #include "llvm/IR/DataLayout.h"
 #include "llvm/IR/LLVMContext.h"
 #include "llvm/IR/Module.h"
 #include "llvm/IRReader/IRReader.h"
 #include "llvm/Pass.h"
 #include "llvm/PassManager.h"
+#include "llvm/Support/Atomic.h"
 #include "llvm/Support/CommandLine.h"
 #include "llvm/Support/FormattedStream.h"
+#include "llvm/Support/MemoryBuffer.h"
 #include "llvm/Support/SourceMgr.h"
+#include "llvm/Support/Threading.h"
+#include "llvm/Support/system_error.h"
+#include <algorithm>
 #include <string>
+#include <vector>
+#if LLVM_ENABLE_THREADS != 0 && defined(HAVE_PTHREAD_H)
+#include <pthread.h>
+#endif
 
 using namespace llvm;
 
@@ -42,6 +64,16 @@ InputFileFormat(
         clEnumValEnd),
     cl::init(LLVMFormat));
 
+static cl::opt<unsigned>
+NumThreads("threads",
+           cl::desc("Number of threads used to check function bodies"),
+           cl::init(1));
+
+static cl::opt<bool>
+Incremental("incremental",
+            cl::desc("Check each function right after reading its body, "
+                     "and release the body afterwards"));
+
 // Print any errors collected by the error reporter. Return true if
 // there were any.
 static bool CheckABIVerifyErrors(PNaClABIErrorReporter &Reporter,
@@ -57,13 +89,155 @@ static bool CheckABIVerifyErrors(PNaClABIErrorReporter &Reporter,
   return HasErrors;
 }
 
+namespace {
+
+/// Checks the (materialized) function bodies of a module on several
+/// threads. Each thread takes the next function to check, and adds the
+/// errors it finds to an error reporter local to the thread. The errors
+/// of each function are then moved to a reporter of that function, so
+/// that they can be printed in module order.
+class ParallelFunctionChecker {
+  ParallelFunctionChecker(const ParallelFunctionChecker&)
+      LLVM_DELETED_FUNCTION;
+  void operator=(const ParallelFunctionChecker&) LLVM_DELETED_FUNCTION;
+
+public:
+  ParallelFunctionChecker(const std::vector<const Function *> &Functions,
+                          const PNaClABIVerifyFunctions &Verifier,
+                          const DataLayout &DL)
+      : Functions(Functions), Verifier(Verifier), DL(DL),
+        FunctionErrors(Functions.size()), NextFunction(0) {}
+
+  ~ParallelFunctionChecker() {
+    DeleteContainerPointers(FunctionErrors);
+  }
+
+  /// Checks the functions, using NumThreads threads. The calling
+  /// thread is one of them.
+  void run(unsigned NumThreads);
+
+  /// Returns the reporter holding the errors of the Index-th function,
+  /// or null if no errors were found.
+  PNaClABIErrorReporter *getErrors(size_t Index) const {
+    return FunctionErrors[Index];
+  }
+
+private:
+  const std::vector<const Function *> &Functions;
+  const PNaClABIVerifyFunctions &Verifier;
+  const DataLayout &DL;
+  std::vector<PNaClABIErrorReporter *> FunctionErrors;
+  volatile sys::cas_flag NextFunction;
+
+  void checkFunctions();
+  static void *runThread(void *Arg);
+};
+
+} // end of anonymous namespace
+
+void ParallelFunctionChecker::checkFunctions() {
+  PNaClABIErrorReporter Reporter;
+  Reporter.setNonFatal();
+  for (;;) {
+    size_t Index = sys::AtomicIncrement(&NextFunction) - 1;
+    if (Index >= Functions.size())
+      break;
+    Verifier.verifyFunction(*Functions[Index], &DL, Reporter);
+    if (Reporter.getErrorCount() == 0)
+      continue;
+    // Only this thread accesses the reporter of the function.
+    FunctionErrors[Index] = new PNaClABIErrorReporter();
+    FunctionErrors[Index]->mergeErrors(Reporter);
+  }
+}
+
+void *ParallelFunctionChecker::runThread(void *Arg) {
+  static_cast<ParallelFunctionChecker *>(Arg)->checkFunctions();
+  return 0;
+}
+
+void ParallelFunctionChecker::run(unsigned NumThreads) {
+#if LLVM_ENABLE_THREADS != 0 && defined(HAVE_PTHREAD_H)
+  // If a thread can't be created, the others check its share of the
+  // functions.
+  std::vector<pthread_t> Threads;
+  for (unsigned i = 1; i < NumThreads; ++i) {
+    pthread_t Thread;
+    if (pthread_create(&Thread, NULL, runThread, this) != 0)
+      break;
+    Threads.push_back(Thread);
+  }
+  checkFunctions();
+  for (size_t i = 0, e = Threads.size(); i != e; ++i)
+    pthread_join(Threads[i], NULL);
+#else
+  (void)NumThreads;
+  checkFunctions();
+#endif
+}
+
+// Checks the function bodies of Mod on -threads threads. Returns true
+// if errors were found.
+static bool CheckFunctionsInParallel(Module *Mod,
+                                     PNaClABIErrorReporter &Reporter) {
+  std::vector<const Function *> Functions;
+  for (Module::const_iterator I = Mod->begin(), E = Mod->end(); I != E; ++I)
+    if (!I->isDeclaration())
+      Functions.push_back(I);
+
+  DataLayout DL(Mod);
+  PNaClABIVerifyFunctions Verifier(&Reporter);
+  Verifier.doInitialization(*Mod);
+  ParallelFunctionChecker Checker(Functions, Verifier, DL);
+  Checker.run(std::min<size_t>(NumThreads, Functions.size()));
+
+  bool ErrorsFound = false;
+  for (size_t i = 0, e = Functions.size(); i != e; ++i) {
+    if (PNaClABIErrorReporter *Errors = Checker.getErrors(i)) {
+      Reporter.mergeErrors(*Errors);
+      ErrorsFound |= CheckABIVerifyErrors(
+          Reporter, "Function " + Functions[i]->getName());
+    }
+  }
+  return ErrorsFound;
+}
+
+// Reads the module in InputFilename, without reading the function
+// bodies if -incremental is specified.
+static Module *ReadModule(SMDiagnostic &Err, LLVMContext &Context) {
+  if (!Incremental)
+    return NaClParseIRFile(InputFilename, InputFileFormat, Err, Context);
+  if (InputFileFormat == LLVMFormat)
+    return getLazyIRFileModule(InputFilename, Err, Context);
+
+  OwningPtr<MemoryBuffer> File;
+  if (error_code ec = MemoryBuffer::getFileOrSTDIN(InputFilename, File)) {
+    Err = SMDiagnostic(InputFilename, SourceMgr::DK_Error,
+                       "Could not open input file: " + ec.message());
+    return 0;
+  }
+  std::string ErrMsg;
+  Module *M = getNaClLazyBitcodeModule(File.get(), Context, &ErrMsg);
+  if (M == 0) {
+    Err = SMDiagnostic(InputFilename, SourceMgr::DK_Error, ErrMsg);
+    return 0;
+  }
+  // The module now owns the buffer.
+  File.take();
+  return M;
+}
+
 int main(int argc, char **argv) {
   LLVMContext &Context = getGlobalContext();
   SMDiagnostic Err;
   cl::ParseCommandLineOptions(argc, argv, "PNaCl Bitcode ABI checker\n");
 
-  OwningPtr<Module> Mod(
-      NaClParseIRFile(InputFilename, InputFileFormat, Err, Context));
+  if (Incremental && NumThreads > 1) {
+    errs() << argv[0] << ": -incremental can't be used with -threads\n";
+    return 1;
+  }
+
+  OwningPtr<Module> Mod(ReadModule(Err, Context));
   if (Mod.get() == 0) {
     Err.print(argv[0], errs());
     return 1;
@@ -78,6 +252,12 @@ int main(int argc, char **argv) {
   ModuleChecker->runOnModule(*Mod);
   ErrorsFound |= CheckABIVerifyErrors(ABIErrorReporter, "Module");
 
+  if (NumThreads > 1) {
+    llvm_start_multithreaded();
+    ErrorsFound |= CheckFunctionsInParallel(Mod.get(), ABIErrorReporter);
+    return ErrorsFound ? 1 : 0;
+  }
+
   OwningPtr<FunctionPassManager> PM(new FunctionPassManager(&*Mod));
   PM->add(new DataLayout(&*Mod));
   PM->add(createPNaClABIVerifyFunctionsPass(&ABIErrorReporter));
@@ -87,6 +267,8 @@ int main(int argc, char **argv) {
     PM->run(*I);
     ErrorsFound |=
         CheckABIVerifyErrors(ABIErrorReporter, "Function " + I->getName());
+    if (Incremental)
+      I->Dematerialize();
   }
   PM->doFinalization();
 
@@ -40,17 +40,32 @@
 // figures out that leaving the record unabbreviated is best) and
 // writes the record out accordingly.
 //
-// TODO(kschimpf): The current implementation does a trivial solution
-// for the first round.  It just converts all abbreviations (local and
-// global) into global abbreviations.  Future refinements of this file
-// will generate better (and more intelligent) global abbreviations,
-// based on the records found on the first read of the bitcode file.
+// In the first round, all abbreviations (local and global) are
+// converted into global abbreviations. Records are then grouped by
+// the abbreviation they were read with, their record code, and their
+// size. For each group, the value distributions of the group are used
+// to find the cheapest literal, fixed, VBR, or char6 operator for each
+// (tracked) value, and to estimate the number of bits saved by the
+// resulting candidate abbreviations. Finally, candidates are greedily
+// selected for each block, as long as they save more bits than they
+// cost (i.e. their definition, and wider abbreviation indices).
+//
+// With -threads=N, both rounds defer the function blocks of the
+// module, and process them on N threads. In the first round, each
+// thread collects its own distributions, which are then merged.
+// Function blocks that define local abbreviations can't be analyzed
+// this way, since that adds global abbreviations. If there are any,
+// the function blocks are analyzed one after the other instead. In
+// the second round, each function block is copied into a buffer of
+// its own, and the buffers are appended in order. Either way, the
+// output is the same as with a single thread.
 //
 //===----------------------------------------------------------------------===//
 
 #include "llvm/ADT/SmallVector.h"
 #include "llvm/ADT/DenseMap.h"
 #include "llvm/ADT/DenseSet.h"
+#include "llvm/ADT/STLExtras.h"
 #include "llvm/Bitcode/NaCl/AbbrevTrieNode.h"
 #include "llvm/Bitcode/NaCl/NaClBitcodeHeader.h"
 #include "llvm/Bitcode/NaCl/NaClBitcodeParser.h"
@@ -58,17 +73,25 @@
 #include "llvm/Bitcode/NaCl/NaClBitstreamWriter.h"
 #include "llvm/Bitcode/NaCl/NaClCompressBlockDist.h"
 #include "llvm/Bitcode/NaCl/NaClReaderWriter.h"
+#include "llvm/Config/config.h"
+#include "llvm/Support/Atomic.h"
 #include "llvm/Support/CommandLine.h"
 #include "llvm/Support/Format.h"
 #include "llvm/Support/ManagedStatic.h"
 #include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Mutex.h"
+#include "llvm/Support/MutexGuard.h"
 #include "llvm/Support/PrettyStackTrace.h"
 #include "llvm/Support/raw_ostream.h"
 #include "llvm/Support/Signals.h"
 #include "llvm/Support/system_error.h"
 #include "llvm/Support/ToolOutputFile.h"
+#include <algorithm>
 #include <set>
 #include <map>
+#if LLVM_ENABLE_THREADS != 0 && defined(HAVE_PTHREAD_H)
+#include <pthread.h>
+#endif
 
 namespace {
 
@@ -119,6 +142,12 @@ RemoveAbbreviations(
     cl::desc("Remove abbreviations from input bitcode file."),
     cl::init(false));
 
+static cl::opt<unsigned>
+NumThreads(
+    "threads",
+    cl::desc("Number of threads used to analyze and copy function blocks"),
+    cl::init(1));
+
 /// Error - All bitcode analysis errors go through this function,
 /// making this a good place to breakpoint if debugging.
 static bool Error(const std::string &Err) {
@@ -224,11 +253,6 @@ public:
          Iter != IterEnd; ++Iter) {
       (*Iter)->dropRef();
     }
-    for (AbbrevLookupSizeMap::const_iterator
-             Iter = LookupMap.begin(), IterEnd = LookupMap.end();
-         Iter != IterEnd; ++Iter) {
-      delete Iter->second;
-    }
   }
 
   // Constant used to denote that a given abbreviation is not in the
@@ -297,23 +321,23 @@ public:
     return Abbrevs[index];
   }
 
-  // Builds the corresponding fast lookup map for finding abbreviations
-  // that applies to abbreviations in the block
+  // Builds the corresponding fast lookup table for finding
+  // abbreviations that applies to abbreviations in the block. Must
+  // be called once all abbreviations of the block have been added.
   void BuildAbbrevLookupSizeMap() {
-    NaClBuildAbbrevLookupMap(GetLookupMap(),
+    AbbrevLookupSizeMap LookupMap;
+    NaClBuildAbbrevLookupMap(LookupMap,
                              GetAbbrevs(),
                              GetFirstApplicationAbbreviation());
-    if (ShowAbbrevLookupTries) PrintLookupMap(errs());
+    if (ShowAbbrevLookupTries) PrintLookupMap(errs(), LookupMap);
+    LookupTable.Build(LookupMap);
+    DeleteContainerSeconds(LookupMap);
   }
 
   AbbrevBitstreamToInternalMap &GetGlobalAbbrevBitstreamToInternalMap() {
     return GlobalAbbrevBitstreamToInternalMap;
   }
 
-  AbbrevLookupSizeMap &GetLookupMap() {
-    return LookupMap;
-  }
-
   // Returns lower level vector of abbreviations.
   const AbbrevVector &GetAbbrevs() const {
     return Abbrevs;
@@ -322,35 +346,22 @@ public:
   // Returns the abbreviation (index) to use for the corresponding
   // record, based on the abbreviations of this block.  Note: Assumes
   // that BuildAbbrevLookupSizeMap has already been called.
-  unsigned GetRecordAbbrevIndex(const NaClBitcodeRecordData &Record) {
+  unsigned GetRecordAbbrevIndex(const NaClBitcodeRecordData &Record) const {
     unsigned BestIndex = 0; // Ignored unless found candidate.
     unsigned BestScore = 0; // Number of bits associated with BestIndex.
     bool FoundCandidate = false;
     NaClBitcodeValues Values(Record);
-    size_t Size = Values.size();
-
-    if (Size > NaClValueIndexCutoff) Size = NaClValueIndexCutoff+1;
-    AbbrevLookupSizeMap::const_iterator Pos = LookupMap.find(Size);
-    if (Pos != LookupMap.end()) {
-      if (const AbbrevTrieNode *Node = Pos->second) {
-        if (const AbbrevTrieNode *MatchNode =
-            Node->MatchRecord(Record)) {
-          const std::set<AbbrevIndexPair> &Abbreviations =
-              MatchNode->GetAbbreviations();
-          for (std::set<AbbrevIndexPair>::const_iterator
-                   Iter = Abbreviations.begin(),
-                   IterEnd = Abbreviations.end();
-               Iter != IterEnd; ++Iter) {
-            uint64_t NumBits = 0;
-            if (CanUseAbbreviation(Values, Iter->second, NumBits)) {
-              if (!FoundCandidate || NumBits < BestScore) {
-                // Use this as candidate.
-                BestIndex = Iter->first;
-                BestScore = NumBits;
-                FoundCandidate = true;
-              }
-            }
-          }
+    ArrayRef<AbbrevIndexPair> Abbreviations = LookupTable.MatchRecord(Record);
+    for (ArrayRef<AbbrevIndexPair>::iterator
+             Iter = Abbreviations.begin(), IterEnd = Abbreviations.end();
+         Iter != IterEnd; ++Iter) {
+      uint64_t NumBits = 0;
+      if (CanUseAbbreviation(Values, Iter->second, NumBits)) {
+        if (!FoundCandidate || NumBits < BestScore) {
+          // Use this as candidate.
+          BestIndex = Iter->first;
+          BestScore = NumBits;
+          FoundCandidate = true;
         }
       }
     }
@@ -495,20 +506,21 @@ public:
   // operand VBR(Width). Note: Returns 0 if Val can't be represented
   // by VBR(Width).
   static unsigned MatchVBRBits(uint64_t Val, unsigned Width) {
-    if (Width == 0) return 0;
+    if (Width < 2) return 0;
     unsigned NumBits = 0;
     while (1) {
       // values emitted Width-1 bits at a time (plus a continue bit).
       NumBits += Width;
-      if ((Val & (1U << (Width-1))) == 0)
+      if ((Val >> (Width-1)) == 0)
         return NumBits;
       Val >>= Width-1;
     }
   }
 
-private:
   // Defines the number of bits used to print VBR array field values.
   static const unsigned DefaultVBRBits = 6;
+
+private:
   // Masks out the top-32 bits of a uint64_t value.
   static const uint64_t Mask32 = 0xFFFFFFFF00000000;
   // The block ID for which abbreviations are being associated.
@@ -518,11 +530,12 @@ private:
   // The mapping from global bitstream abbreviations to the corresponding
   // block abbreviation index (in Abbrevs).
   AbbrevBitstreamToInternalMap GlobalAbbrevBitstreamToInternalMap;
-  // A fast lookup map for finding the abbreviation that applies
+  // A fast lookup table for finding the abbreviation that applies
   // to a record.
-  AbbrevLookupSizeMap LookupMap;
+  AbbrevLookupTable LookupTable;
 
-  void PrintLookupMap(raw_ostream &Stream) {
+  void PrintLookupMap(raw_ostream &Stream,
+                      const AbbrevLookupSizeMap &LookupMap) const {
     Stream << "------------------------------\n";
     Stream << "Block " << GetBlockID() << " abbreviation tries:\n";
     bool IsFirstIteration = true;
@@ -546,6 +559,103 @@ private:
 /// map to use.
 typedef DenseMap<unsigned, BlockAbbrevs*> BlockAbbrevsMapType;
 
+/// The position of a function block whose processing has been
+/// deferred, so that it can be processed on another thread.
+struct DeferredBlock {
+  DeferredBlock(uint64_t EntryBit, uint64_t BodyBit)
+      : EntryBit(EntryBit), BodyBit(BodyBit) {}
+  // The bit of the entry that begins the block.
+  uint64_t EntryBit;
+  // The bit just after the block ID of the entry.
+  uint64_t BodyBit;
+};
+
+typedef std::vector<DeferredBlock> DeferredBlockList;
+
+/// Processes a list of deferred function blocks on several threads.
+/// Each thread takes the next unprocessed block until none are left,
+/// reading it with a bitstream reader of its own.
+class ParallelFunctionBlocks {
+  ParallelFunctionBlocks(const ParallelFunctionBlocks&)
+      LLVM_DELETED_FUNCTION;
+  void operator=(const ParallelFunctionBlocks&) LLVM_DELETED_FUNCTION;
+
+public:
+  ParallelFunctionBlocks(const DeferredBlockList &Blocks,
+                         const NaClBitstreamReader &MainReader)
+      : Blocks(Blocks), MainReader(MainReader), NextBlock(0) {}
+
+  virtual ~ParallelFunctionBlocks() {}
+
+  /// Processes the blocks, using (at most) NumThreads threads. The
+  /// calling thread is one of them.
+  void Run(unsigned NumThreads);
+
+protected:
+  // The blocks to process.
+  const DeferredBlockList &Blocks;
+
+  /// Processes blocks on the calling thread (using GetNextBlock to
+  /// select them), reading them with Cursor.
+  virtual void ProcessBlocks(NaClBitstreamCursor &Cursor) = 0;
+
+  /// Returns true, and sets Index to the index of the next block to
+  /// process, if there are blocks left.
+  bool GetNextBlock(size_t &Index) {
+    Index = sys::AtomicIncrement(&NextBlock) - 1;
+    return Index < Blocks.size();
+  }
+
+private:
+  // The reader of the module, whose block info records each thread
+  // copies.
+  const NaClBitstreamReader &MainReader;
+  volatile sys::cas_flag NextBlock;
+
+  void RunThread();
+  static void *RunThreadCallback(void *Arg);
+};
+
+void ParallelFunctionBlocks::RunThread() {
+  size_t Size;
+  const unsigned char *Start = MainReader.getMemoryBytes(Size);
+  NaClBitstreamReader Reader(Start, Start + Size);
+  Reader.CopyBlockInfoRecords(MainReader);
+  NaClBitstreamCursor Cursor(Reader);
+  ProcessBlocks(Cursor);
+}
+
+void *ParallelFunctionBlocks::RunThreadCallback(void *Arg) {
+  static_cast<ParallelFunctionBlocks*>(Arg)->RunThread();
+  return 0;
+}
+
+void ParallelFunctionBlocks::Run(unsigned NumThreads) {
+#if LLVM_ENABLE_THREADS != 0 && defined(HAVE_PTHREAD_H)
+  // If a thread can't be created, the others process its share of
+  // the blocks.
+  std::vector<pthread_t> Threads;
+  for (unsigned i = 1; i < NumThreads; ++i) {
+    pthread_t Thread;
+    if (pthread_create(&Thread, NULL, RunThreadCallback, this) != 0)
+      break;
+    Threads.push_back(Thread);
+  }
+  RunThread();
+  for (size_t i = 0, e = Threads.size(); i != e; ++i)
+    pthread_join(Threads[i], NULL);
+#else
+  (void)NumThreads;
+  RunThread();
+#endif
+}
+
+/// Returns the number of threads to use for the given number of
+/// deferred function blocks.
+static unsigned GetNumThreads(const DeferredBlockList &Blocks) {
+  return std::min<size_t>(NumThreads, Blocks.size());
+}
+
 /// Parses the bitcode file, analyzes it, and generates the
 /// corresponding lists of global abbreviations to use in the
 /// generated (compressed) bitcode file.
@@ -558,13 +668,19 @@ class NaClAnalyzeParser : public NaClBitcodeParser {
 public:
   // Creates the analysis parser, which will fill the given
   // BlockAbbrevsMap with appropriate abbreviations, after
-  // analyzing the bitcode file defined by Cursor.
+  // analyzing the bitcode file defined by Cursor. If IsWorker,
+  // the parser analyzes function blocks on a thread other than
+  // the one parsing the module, and must not change BlockAbbrevsMap.
   NaClAnalyzeParser(NaClBitstreamCursor &Cursor,
-                    BlockAbbrevsMapType &BlockAbbrevsMap)
+                    BlockAbbrevsMapType &BlockAbbrevsMap,
+                    bool IsWorker = false)
       : NaClBitcodeParser(Cursor),
         BlockAbbrevsMap(BlockAbbrevsMap),
         BlockDist(&NaClCompressBlockDistElement::Sentinel),
-        AbbrevListener(this)
+        AbbrevListener(this),
+        IsWorker(IsWorker),
+        NeedsSequentialAnalysis(false),
+        DeferredAnalysisFailed(false)
   {
     SetListener(&AbbrevListener);
   }
@@ -578,6 +694,21 @@ public:
 
   virtual bool ParseBlock(unsigned BlockID);
 
+  /// Returns the reader of the bitcode file.
+  const NaClBitstreamReader &GetReader() const {
+    return Record.GetReader();
+  }
+
+  /// Returns true if function blocks of the module should be deferred,
+  /// and analyzed on several threads.
+  bool DefersFunctionBlocks() const {
+    return NumThreads > 1 && !IsWorker;
+  }
+
+  /// Analyzes the deferred function blocks (if any). Returns true
+  /// if unable to analyze a deferred function block.
+  bool AnalyzeDeferredFunctionBlocks();
+
   // Mapping from block ID's to the corresponding list of abbreviations
   // associated with that block.
   BlockAbbrevsMapType &BlockAbbrevsMap;
@@ -587,6 +718,19 @@ public:
 
   // Listener used to get abbreviations as they are read.
   NaClBitcodeParserListener AbbrevListener;
+
+  // True if the parser analyzes function blocks on a worker thread.
+  const bool IsWorker;
+
+  // True if a worker found a block it can't analyze without changing
+  // BlockAbbrevsMap (i.e. one that defines local abbreviations).
+  bool NeedsSequentialAnalysis;
+
+  // True if the analysis of a deferred function block failed.
+  bool DeferredAnalysisFailed;
+
+  // The function blocks whose analysis has been deferred.
+  DeferredBlockList DeferredFunctionBlocks;
 };
 
 class NaClBlockAnalyzeParser : public NaClBitcodeParser {
@@ -626,11 +770,33 @@ public:
   }
 
   virtual bool ParseBlock(unsigned BlockID) {
+    if (Context->IsWorker && Context->BlockAbbrevsMap.lookup(BlockID) == 0) {
+      // Only the main thread can add block abbreviations.
+      Context->NeedsSequentialAnalysis = true;
+      return SkipBlock();
+    }
+    if (GetBlockID() == naclbitc::MODULE_BLOCK_ID &&
+        Context->DefersFunctionBlocks()) {
+      if (BlockID == naclbitc::FUNCTION_BLOCK_ID) {
+        Context->DeferredFunctionBlocks.push_back(
+            DeferredBlock(Record.GetStartBit(),
+                          Record.GetCursor().GetCurrentBitNo()));
+        return SkipBlock();
+      }
+      if (Context->AnalyzeDeferredFunctionBlocks()) return true;
+    }
     NaClBlockAnalyzeParser Parser(BlockID, this);
     return Parser.ParseThisBlock();
   }
 
+  virtual void ExitBlock() {
+    AnalyzeDeferredFunctionBlocks();
+  }
+
   virtual void ProcessRecord() {
+    AnalyzeDeferredFunctionBlocks();
+    if (Context->NeedsSequentialAnalysis) return;
+
     // Before processing the record, we need to rename the abbreviation
     // index, so that we can look it up in the set of block abbreviations
     // being defined.
@@ -663,6 +829,12 @@ public:
   virtual void ProcessAbbreviation(unsigned BlockID,
                                    NaClBitCodeAbbrev *Abbrev,
                                    bool IsLocal) {
+    AnalyzeDeferredFunctionBlocks();
+    if (Context->IsWorker) {
+      // Only the main thread can add block abbreviations.
+      Context->NeedsSequentialAnalysis = true;
+      return;
+    }
     int Index;
     AddAbbreviation(BlockID, Abbrev->Simplify(), Index);
     if (IsLocal) {
@@ -718,6 +890,13 @@ protected:
     return GetGlobalAbbrevs(BlockID)->FindAbbreviation(Abbrev);
   }
 
+  /// Analyzes the function blocks deferred by the module block, before
+  /// the module block goes on to what follows them.
+  void AnalyzeDeferredFunctionBlocks() {
+    if (GetBlockID() == naclbitc::MODULE_BLOCK_ID)
+      Context->AnalyzeDeferredFunctionBlocks();
+  }
+
   void Init() {
     GlobalBlockAbbrevs = GetGlobalAbbrevs(GetBlockID());
     LocalAbbrevBitstreamToInternalMap.SetNextBitstreamAbbrevIndex(
@@ -731,6 +910,85 @@ bool NaClAnalyzeParser::ParseBlock(unsigned BlockID) {
   return Parser.ParseThisBlock();
 }
 
+/// Analyzes deferred function blocks on several threads. Each thread
+/// analyzes its blocks with a worker parser of its own, whose record
+/// distributions are merged once the thread is done.
+class ParallelFunctionAnalyzer : public ParallelFunctionBlocks {
+public:
+  ParallelFunctionAnalyzer(NaClAnalyzeParser &Main, bool IsWorker)
+      : ParallelFunctionBlocks(Main.DeferredFunctionBlocks,
+                               Main.GetReader()),
+        Main(Main), IsWorker(IsWorker), Failed(false),
+        NeedsSequentialAnalysis(false),
+        BlockDist(&NaClCompressBlockDistElement::Sentinel) {}
+
+  virtual ~ParallelFunctionAnalyzer() {}
+
+  // The parser of the module whose function blocks are analyzed.
+  NaClAnalyzeParser &Main;
+  // True if the blocks are analyzed by worker parsers.
+  const bool IsWorker;
+  // True if unable to analyze a block.
+  bool Failed;
+  // True if a worker parser found a block it can't analyze.
+  bool NeedsSequentialAnalysis;
+  // The merged distributions of the analyzed blocks.
+  NaClBitcodeBlockDist BlockDist;
+
+protected:
+  virtual void ProcessBlocks(NaClBitstreamCursor &Cursor);
+
+private:
+  // Protects the results above while threads merge into them.
+  sys::Mutex ResultsLock;
+};
+
+void ParallelFunctionAnalyzer::ProcessBlocks(NaClBitstreamCursor &Cursor) {
+  NaClAnalyzeParser Parser(Cursor, Main.BlockAbbrevsMap, IsWorker);
+  bool BlockFailed = false;
+  size_t Index;
+  while (!BlockFailed && !Parser.NeedsSequentialAnalysis &&
+         GetNextBlock(Index)) {
+    const DeferredBlock &Block = Blocks[Index];
+    BlockFailed = Parser.ParseAt(naclbitc::FUNCTION_BLOCK_ID,
+                                 Block.EntryBit, Block.BodyBit);
+  }
+  MutexGuard Lock(ResultsLock);
+  Failed |= BlockFailed;
+  NeedsSequentialAnalysis |= Parser.NeedsSequentialAnalysis;
+  BlockDist.Merge(Parser.BlockDist);
+}
+
+bool NaClAnalyzeParser::AnalyzeDeferredFunctionBlocks() {
+  if (DeferredFunctionBlocks.empty() || DeferredAnalysisFailed)
+    return DeferredAnalysisFailed;
+
+  // Workers can only analyze function blocks whose abbreviations are
+  // all known. If a block defines local abbreviations, fall back to
+  // analyzing the blocks (in order) on this thread.
+  bool Sequential =
+      BlockAbbrevsMap.lookup(naclbitc::FUNCTION_BLOCK_ID) == 0;
+  if (!Sequential) {
+    ParallelFunctionAnalyzer Analyzer(*this, true);
+    Analyzer.Run(GetNumThreads(DeferredFunctionBlocks));
+    if (Analyzer.Failed) {
+      DeferredAnalysisFailed = true;
+    } else if (Analyzer.NeedsSequentialAnalysis) {
+      Sequential = true;
+    } else {
+      BlockDist.Merge(Analyzer.BlockDist);
+    }
+  }
+  if (Sequential) {
+    ParallelFunctionAnalyzer Analyzer(*this, false);
+    Analyzer.Run(1);
+    DeferredAnalysisFailed = Analyzer.Failed;
+    BlockDist.Merge(Analyzer.BlockDist);
+  }
+  DeferredFunctionBlocks.clear();
+  return DeferredAnalysisFailed;
+}
+
 /// Models the unrolling of an abbreviation into its sequence of
 /// individual operators. That is, unrolling arrays to match the width
 /// of the abbreviation.
@@ -913,17 +1171,35 @@ static inline bool operator<(const CandBlockAbbrev &A1,
 }
 
 /// Models the set of candidate abbreviations being considered, and
-/// the number of abbreviations associated with each candidate
-/// Abbreviation.
+/// the estimated number of bits saved by each candidate abbreviation.
+///
+/// Records are grouped by the abbreviation they were read with, their
+/// record code, and their size. Candidate abbreviations are generated
+/// for each group, and apply to all (or a subset of) the records in
+/// the group.
 ///
 /// Note: Because we may have abbreviation refinements of A->B->C and
-/// A->D->C, we need to accumulate instance counts in such cases.
+/// A->D->C, a candidate abbreviation may apply to several groups.
 class CandidateAbbrevs {
 public:
-  // Map from candidate abbreviations to the corresponding number of
-  // instances.
-  typedef std::map<CandBlockAbbrev, unsigned> AbbrevCountMap;
-  typedef AbbrevCountMap::const_iterator const_iterator;
+  /// Models the use of a candidate abbreviation on the records of a
+  /// group.
+  struct CandUse {
+    CandUse(unsigned GroupID, unsigned NumRecords, double BitsSaved)
+        : GroupID(GroupID), NumRecords(NumRecords), BitsSaved(BitsSaved) {}
+    // The group of records the abbreviation applies to.
+    unsigned GroupID;
+    // The number of records, in the group, the abbreviation applies to.
+    unsigned NumRecords;
+    // The estimated number of bits saved on each of these records.
+    double BitsSaved;
+  };
+
+  typedef std::vector<CandUse> CandUseList;
+
+  // Map from candidate abbreviations to the corresponding uses.
+  typedef std::map<CandBlockAbbrev, CandUseList> AbbrevUsesMap;
+  typedef AbbrevUsesMap::const_iterator const_iterator;
 
   /// Creates an empty set of candidate abbreviations, to be
   /// (potentially) added to the given set of block abbreviations.
@@ -933,34 +1209,63 @@ public:
       : BlockAbbrevsMap(BlockAbbrevsMap)
   {}
 
+  /// Adds a group of NumRecords records that candidate abbreviations
+  /// can apply to. Returns the ID of the added group.
+  unsigned AddGroup(unsigned NumRecords) {
+    GroupSizes.push_back(NumRecords);
+    return GroupSizes.size() - 1;
+  }
+
+  /// Returns the number of records in the group with the given ID.
+  unsigned GetGroupSize(unsigned GroupID) const {
+    return GroupSizes[GroupID];
+  }
+
   /// Adds the given (unrolled) abbreviation as a candidate
-  /// abbreviation to the given block. NumInstances is the number of
-  /// instances expected to use this candidate abbreviation. Returns
-  /// true if the corresponding candidate abbreviation is added to this
-  /// set of candidate abbreviations.
+  /// abbreviation to the given block. The candidate applies to
+  /// NumRecords records of group GroupID, and saves BitsSaved bits on
+  /// each of them. Returns true if the corresponding candidate
+  /// abbreviation is added to this set of candidate abbreviations.
   bool Add(unsigned BlockID,
            UnrolledAbbreviation &UnrolledAbbrev,
-           unsigned NumInstances);
+           unsigned GroupID,
+           unsigned NumRecords,
+           double BitsSaved);
 
   /// Returns the list of candidate abbreviations in this set.
-  const AbbrevCountMap &GetAbbrevsMap() const {
+  const AbbrevUsesMap &GetAbbrevsMap() const {
     return AbbrevsMap;
   }
 
+  /// Returns the estimated number of bits saved by the given uses of
+  /// a candidate abbreviation, ignoring other candidates.
+  static double GetBitsSaved(const CandUseList &Uses) {
+    double BitsSaved = 0;
+    for (CandUseList::const_iterator
+             Iter = Uses.begin(), IterEnd = Uses.end();
+         Iter != IterEnd; ++Iter) {
+      BitsSaved += Iter->NumRecords * Iter->BitsSaved;
+    }
+    return BitsSaved;
+  }
+
   /// Prints out the current contents of this set.
   void Print(raw_ostream &Stream, const char *Title = "Candidates") const {
     Stream << "-- " << Title << ": \n";
     for (const_iterator Iter = AbbrevsMap.begin(), IterEnd = AbbrevsMap.end();
          Iter != IterEnd; ++Iter) {
-      Stream << format("%12u", Iter->second) << ": ";
+      Stream << format("%12.0f", GetBitsSaved(Iter->second)) << ": ";
       Iter->first.Print(Stream);
     }
     Stream << "--\n";
   }
 
 private:
-  // The set of abbreviations and corresponding number instances.
-  AbbrevCountMap AbbrevsMap;
+  // The set of abbreviations and corresponding uses.
+  AbbrevUsesMap AbbrevsMap;
+
+  // The number of records in each group of records.
+  std::vector<unsigned> GroupSizes;
 
   // The map of (global) abbreviations already associated with each block.
   BlockAbbrevsMapType &BlockAbbrevsMap;
@@ -968,7 +1273,9 @@ private:
 
 bool CandidateAbbrevs::Add(unsigned BlockID,
                            UnrolledAbbreviation &UnrolledAbbrev,
-                           unsigned NumInstances) {
+                           unsigned GroupID,
+                           unsigned NumRecords,
+                           double BitsSaved) {
   // Drop if it corresponds to an existing global abbreviation.
   NaClBitCodeAbbrev *Abbrev = UnrolledAbbrev.Restore();
   if (BlockAbbrevs* Abbrevs = BlockAbbrevsMap[BlockID]) {
@@ -980,80 +1287,169 @@ bool CandidateAbbrevs::Add(unsigned BlockID,
   }
 
   CandBlockAbbrev CandAbbrev(BlockID, Abbrev);
-  AbbrevCountMap::iterator Pos = AbbrevsMap.find(CandAbbrev);
-  if (Pos == AbbrevsMap.end()) {
-    AbbrevsMap[CandAbbrev] = NumInstances;
-  } else {
-    Pos->second += NumInstances;
-  }
+  AbbrevsMap[CandAbbrev].push_back(CandUse(GroupID, NumRecords, BitsSaved));
   return true;
 }
 
-// Look for new abbreviations in block BlockID, considering it was
-// read with the given abbreviation Abbrev, and considering changing
-// the abbreviation opererator for value Index. ValueDist is how
-// values at Index are distributed. Any found abbreviations are added
-// to the candidate abbreviations CandAbbrevs. Returns true only if we
-// have added new candidate abbreviations to CandAbbrevs.
-static bool AddNewAbbreviations(unsigned BlockID,
-                                const UnrolledAbbreviation &Abbrev,
-                                unsigned Index,
-                                NaClBitcodeValueDist &ValueDist,
-                                CandidateAbbrevs &CandAbbrevs) {
-  // TODO(kschimpf): Add code to try and find a better encoding for
-  // the values, based on the distribution.
-
-  // If this index is already a literal abbreviation, no improvements can
-  // be made.
-  const NaClBitCodeAbbrevOp Op = Abbrev.AbbrevOps[Index];
-  if (Op.isLiteral()) return false;
-
-  // Search based on sorted distribution, which sorts by number of
-  // instances.  Start by trying to find possible constants to use.
-  const NaClBitcodeDist::Distribution *
-      Distribution = ValueDist.GetDistribution();
-  for (NaClBitcodeDist::Distribution::const_iterator
-           Iter = Distribution->begin(), IterEnd = Distribution->end();
+// Estimates the number of bits abbreviation operator Op generates
+// for the values in ValueDist, and stores it in NumBits. Values in
+// multiple element ranges are estimated using the largest value of
+// the range. Returns false if Op can't represent all values in
+// ValueDist. If AssumeFits is true, Op is known to represent all
+// values, and fixed width operators are not checked against the
+// (overestimated) values of ranges.
+static bool EstimateOpBits(const NaClBitCodeAbbrevOp &Op,
+                           NaClBitcodeValueDist &ValueDist,
+                           bool AssumeFits,
+                           uint64_t &NumBits) {
+  NumBits = 0;
+  for (NaClBitcodeDist::const_iterator
+           Iter = ValueDist.begin(), IterEnd = ValueDist.end();
        Iter != IterEnd; ++Iter) {
-    NaClValueRangeType Range = GetNaClValueRange(Iter->second);
-    if (Range.first != Range.second) continue;  // not a constant.
+    uint64_t NumInstances = Iter->second->GetNumInstances();
+    if (AssumeFits && Op.isEncoding() &&
+        Op.getEncoding() == NaClBitCodeAbbrevOp::Fixed) {
+      NumBits += NumInstances * Op.getEncodingData();
+      continue;
+    }
+    NaClValueRangeType Range = GetNaClValueRange(Iter->first);
+    if (Range.first != Range.second &&
+        (Op.isLiteral() || Op.getEncoding() == NaClBitCodeAbbrevOp::Char6))
+      return false;
+    uint64_t ValueBits = 0;
+    if (!BlockAbbrevs::CanUseSimpleAbbrevOp(Op, Range.second, ValueBits))
+      return false;
+    NumBits += NumInstances * ValueBits;
+  }
+  return true;
+}
+
+// The largest width allowed for fixed and VBR abbreviation operators.
+static const unsigned MaxAbbrevOpWidth = 32;
+
+// Searches for the abbreviation operator that generates the fewest
+// bits for the values in ValueDist. Op is the operator currently
+// used, and NumBits the number of bits it generates. Updates Op and
+// NumBits if a better operator is found.
+static void FindBestAbbrevOp(NaClBitcodeValueDist &ValueDist,
+                             NaClBitCodeAbbrevOp &Op,
+                             uint64_t &NumBits) {
+  SmallVector<NaClBitCodeAbbrevOp, 64> CandOps;
+  // A single (small) value can be represented by a literal.
+  NaClBitcodeDist::const_iterator Iter = ValueDist.begin();
+  if (Iter != ValueDist.end() && llvm::next(Iter) == ValueDist.end()) {
+    NaClValueRangeType Range = GetNaClValueRange(Iter->first);
+    if (Range.first == Range.second)
+      CandOps.push_back(NaClBitCodeAbbrevOp(Range.first));
+  }
+  for (unsigned Width = 1; Width <= MaxAbbrevOpWidth; ++Width) {
+    CandOps.push_back(NaClBitCodeAbbrevOp(NaClBitCodeAbbrevOp::Fixed, Width));
+  }
+  for (unsigned Width = 2; Width <= MaxAbbrevOpWidth; ++Width) {
+    CandOps.push_back(NaClBitCodeAbbrevOp(NaClBitCodeAbbrevOp::VBR, Width));
+  }
+  CandOps.push_back(NaClBitCodeAbbrevOp(NaClBitCodeAbbrevOp::Char6));
+
+  for (SmallVectorImpl<NaClBitCodeAbbrevOp>::const_iterator
+           OpIter = CandOps.begin(), OpIterEnd = CandOps.end();
+       OpIter != OpIterEnd; ++OpIter) {
+    uint64_t CandBits;
+    if (EstimateOpBits(*OpIter, ValueDist, false, CandBits) &&
+        CandBits < NumBits) {
+      Op = *OpIter;
+      NumBits = CandBits;
+    }
+  }
+}
 
-    // Defines a constant. Try as new candidate range.  In addition,
-    // don't try any more constant values, since this is the one with
-    // the greatest number of instances.
-    NaClBitcodeDistElement *Elmt = ValueDist.at(Range.first);
-    UnrolledAbbreviation CandAbbrev(Abbrev);
-    CandAbbrev.AbbrevOps[Index] = NaClBitCodeAbbrevOp(Range.first);
-    return CandAbbrevs.Add(BlockID, CandAbbrev, Elmt->GetNumInstances());
+// Returns the number of bits used by the length of the array in
+// Abbrev, when Abbrev is used for records of the given Size. Returns
+// zero if Abbrev doesn't end with an array.
+static unsigned ArrayLengthBits(const NaClBitCodeAbbrev *Abbrev,
+                                unsigned Size) {
+  for (unsigned i = 0, e = Abbrev->getNumOperandInfos(); i < e; ++i) {
+    // Each operator before the array defines one value (including the
+    // record code).
+    if (Abbrev->getOperandInfo(i).isArrayOp())
+      return BlockAbbrevs::MatchVBRBits(Size + 1 - i,
+                                        BlockAbbrevs::DefaultVBRBits);
   }
-  return false;
+  return 0;
 }
 
-// Look for new abbreviations in block BlockID, considering it was
-// read with the given abbreviation Abbrev. IndexDist is the
-// corresponding distribution of value indices associated with the
-// abbreviation.  Any found abbreviations are added to the candidate
+// Look for new abbreviations in block BlockID, for the NumRecords
+// records with the given record Code that were read with the
+// (unrolled) abbreviation Abbrev. ArrayBits is the number of bits
+// used by the array length of the abbreviation, if it was
+// unrolled. IndexDist is the corresponding distribution of value
+// indices.  Any found abbreviations are added to the candidate
 // abbreviations CandAbbrevs.
 static void AddNewAbbreviations(unsigned BlockID,
                                 const UnrolledAbbreviation &Abbrev,
+                                unsigned Code,
+                                unsigned NumRecords,
+                                unsigned ArrayBits,
                                 NaClBitcodeDist &IndexDist,
                                 CandidateAbbrevs &CandAbbrevs) {
-  // Search based on sorted distribution, which sorts based on heuristic
-  // of best index to fix first.
-  const NaClBitcodeDist::Distribution *
-      IndexDistribution = IndexDist.GetDistribution();
-  for (NaClBitcodeDist::Distribution::const_iterator
-           IndexIter = IndexDistribution->begin(),
-           IndexIterEnd = IndexDistribution->end();
+  // Start by building the abbreviation that uses the cheapest
+  // operator for the code, and for each tracked value index.
+  uint64_t CodeBits = 0;
+  if (!BlockAbbrevs::CanUseSimpleAbbrevOp(Abbrev.CodeOp, Code, CodeBits))
+    return;
+  UnrolledAbbreviation BestAbbrev(Abbrev);
+  BestAbbrev.CodeOp = NaClBitCodeAbbrevOp(Code);
+  uint64_t CurBits = (CodeBits + ArrayBits) * NumRecords;
+  uint64_t BestBits = 0;
+  std::vector<uint64_t> IndexBits(Abbrev.AbbrevOps.size(), 0);
+  for (NaClBitcodeDist::const_iterator
+           IndexIter = IndexDist.begin(), IndexIterEnd = IndexDist.end();
        IndexIter != IndexIterEnd; ++IndexIter) {
-    unsigned Index = static_cast<unsigned>(IndexIter->second);
-    if (AddNewAbbreviations(
-            BlockID, Abbrev, Index,
-            cast<NaClBitcodeValueIndexDistElement>(IndexDist.at(Index))
-            ->GetValueDist(),
-            CandAbbrevs)) {
+    unsigned Index = static_cast<unsigned>(IndexIter->first);
+    assert(Index < Abbrev.AbbrevOps.size());
+    NaClBitcodeValueDist &ValueDist =
+        cast<NaClBitcodeValueIndexDistElement>(IndexIter->second)
+        ->GetValueDist();
+    uint64_t NumBits;
+    if (!EstimateOpBits(Abbrev.AbbrevOps[Index], ValueDist, true, NumBits))
       return;
+    CurBits += NumBits;
+    FindBestAbbrevOp(ValueDist, BestAbbrev.AbbrevOps[Index], NumBits);
+    IndexBits[Index] = NumBits;
+    BestBits += NumBits;
+  }
+  unsigned GroupID = CandAbbrevs.AddGroup(NumRecords);
+  double BitsSaved = static_cast<double>(CurBits - BestBits) / NumRecords;
+  if (BitsSaved > 0)
+    CandAbbrevs.Add(BlockID, BestAbbrev, GroupID, NumRecords, BitsSaved);
+
+  // Then try replacing the operator of each value index with the most
+  // frequent constant at that index. Records with that constant save
+  // the bits of the replaced operator as well.
+  for (size_t Index = 0; Index < IndexBits.size(); ++Index) {
+    if (IndexBits[Index] == 0) continue;
+    NaClBitcodeValueDist &ValueDist =
+        cast<NaClBitcodeValueIndexDistElement>(IndexDist.at(Index))
+        ->GetValueDist();
+    NaClBitcodeDistValue Constant = 0;
+    unsigned NumInstances = 0;
+    for (NaClBitcodeDist::const_iterator
+             Iter = ValueDist.begin(), IterEnd = ValueDist.end();
+         Iter != IterEnd; ++Iter) {
+      NaClValueRangeType Range = GetNaClValueRange(Iter->first);
+      if (Range.first != Range.second) continue;  // not a constant.
+      if (Iter->second->GetNumInstances() > NumInstances) {
+        Constant = Range.first;
+        NumInstances = Iter->second->GetNumInstances();
+      }
     }
+    if (NumInstances == 0) continue;
+    uint64_t ConstantBits = 0;
+    BlockAbbrevs::CanUseSimpleAbbrevOp(BestAbbrev.AbbrevOps[Index], Constant,
+                                       ConstantBits);
+    UnrolledAbbreviation CandAbbrev(BestAbbrev);
+    CandAbbrev.AbbrevOps[Index] = NaClBitCodeAbbrevOp(Constant);
+    CandAbbrevs.Add(BlockID, CandAbbrev, GroupID, NumInstances,
+                    BitsSaved + ConstantBits);
   }
 }
 
@@ -1074,21 +1470,15 @@ static void AddNewAbbreviations(unsigned BlockID,
            SizeIterEnd = SizeDistribution->end();
        SizeIter != SizeIterEnd; ++SizeIter) {
     unsigned Size = static_cast<unsigned>(SizeIter->second);
+    bool CanBeBigger = Size >= NaClValueIndexCutoff;
     UnrolledAbbreviation UnrolledAbbrev(Abbrev, Size+1 /* Add code! */,
-                                        Size >= NaClValueIndexCutoff);
-    if (!UnrolledAbbrev.CodeOp.isLiteral()) {
-      // Try making the code a literal.
-      UnrolledAbbreviation CandAbbrev(UnrolledAbbrev);
-      CandAbbrev.CodeOp = NaClBitCodeAbbrevOp(Code);
-      CandAbbrevs.Add(BlockID, CandAbbrev,
-                      SizeDist.at(Size)->GetNumInstances());
-    }
-    // Now process value indices to find candidate abbreviations.
+                                        CanBeBigger);
+    NaClBitcodeSizeDistElement *SizeElmt =
+        cast<NaClBitcodeSizeDistElement>(SizeDist.at(Size));
     AddNewAbbreviations(
-        BlockID, UnrolledAbbrev,
-        cast<NaClBitcodeSizeDistElement>(SizeDist.at(Size))
-        ->GetValueIndexDist(),
-        CandAbbrevs);
+        BlockID, UnrolledAbbrev, Code, SizeElmt->GetNumInstances(),
+        CanBeBigger ? 0 : ArrayLengthBits(Abbrev, Size),
+        SizeElmt->GetValueIndexDist(), CandAbbrevs);
   }
 }
 
@@ -1131,7 +1521,203 @@ static void AddNewAbbreviations(unsigned BlockID,
   }
 }
 
-typedef std::pair<unsigned, CandBlockAbbrev> CountedAbbrevType;
+// Returns the number of bits needed to define the given abbreviation
+// in a BlockInfo block.
+static uint64_t AbbrevDefinitionBits(const NaClBitCodeAbbrev *Abbrev) {
+  // The DEFINE_ABBREV abbreviation index, and the number of operators.
+  uint64_t NumBits =
+      NaClBitsNeededForValue(naclbitc::DEFAULT_MAX_ABBREV) +
+      BlockAbbrevs::MatchVBRBits(Abbrev->getNumOperandInfos(), 5);
+  for (unsigned i = 0, e = Abbrev->getNumOperandInfos(); i < e; ++i) {
+    const NaClBitCodeAbbrevOp &Op = Abbrev->getOperandInfo(i);
+    // The literal flag, followed by the literal or the encoding.
+    NumBits += 1;
+    if (Op.isLiteral()) {
+      NumBits += BlockAbbrevs::MatchVBRBits(Op.getLiteralValue(), 8);
+    } else {
+      NumBits += 3;
+      if (Op.hasEncodingData())
+        NumBits += BlockAbbrevs::MatchVBRBits(Op.getEncodingData(), 5);
+    }
+  }
+  return NumBits;
+}
+
+/// Defines the estimated number of bits saved on (a subset of) the
+/// records of a group, paired with the number of records in the
+/// subset.
+typedef std::pair<double, unsigned> GroupSavingsType;
+
+/// Defines the list of estimated savings on subsets of the records of
+/// a group.
+typedef std::vector<GroupSavingsType> GroupSavingsList;
+
+// Returns the estimated number of bits saved on a group of NumRecords
+// records, given the subsets of records that selected abbreviations
+// apply to. Records are assumed to use the abbreviation that saves
+// the most bits, and the subsets are assumed not to overlap unless
+// they must.
+static double EstimateGroupSavings(unsigned NumRecords,
+                                   GroupSavingsList Savings) {
+  std::sort(Savings.begin(), Savings.end());
+  double Total = 0;
+  for (GroupSavingsList::const_reverse_iterator
+           Iter = Savings.rbegin(), IterEnd = Savings.rend();
+       Iter != IterEnd && NumRecords > 0; ++Iter) {
+    unsigned Count = std::min(Iter->second, NumRecords);
+    Total += Count * Iter->first;
+    NumRecords -= Count;
+  }
+  return Total;
+}
+
+/// Selects the candidate abbreviations of a block to add as global
+/// abbreviations. Candidates are added greedily, choosing the one
+/// that saves the most bits at each step. The cost of a candidate
+/// includes its definition, and the extra bit each record in the
+/// block needs when the abbreviation index gets wider.
+class BlockCandidateSelector {
+public:
+  /// Creates a selector for the block with NumAbbrevs abbreviations
+  /// (including the non-application abbreviations) and NumRecords
+  /// records.
+  BlockCandidateSelector(const CandidateAbbrevs &CandAbbrevs,
+                         unsigned NumAbbrevs,
+                         unsigned NumRecords)
+      : CandAbbrevs(CandAbbrevs),
+        NumAbbrevs(NumAbbrevs),
+        NumRecords(NumRecords) {}
+
+  /// Adds the given candidate abbreviation to the candidates to
+  /// select from.
+  void AddCandidate(CandidateAbbrevs::const_iterator Cand) {
+    Candidates.push_back(Cand);
+    DefinitionBits.push_back(AbbrevDefinitionBits(Cand->first.GetAbbrev()));
+  }
+
+  /// Selects candidates, and returns them in the order selected.
+  const std::vector<CandidateAbbrevs::const_iterator> &Select();
+
+  /// Returns the estimated number of bits saved by each selected
+  /// candidate, when selected.
+  const std::vector<double> &GetSelectedBitsSaved() const {
+    return SelectedBitsSaved;
+  }
+
+private:
+  const CandidateAbbrevs &CandAbbrevs;
+  // The number of abbreviations defined for the block.
+  unsigned NumAbbrevs;
+  // The number of records in the block.
+  unsigned NumRecords;
+  // The candidates to select from.
+  std::vector<CandidateAbbrevs::const_iterator> Candidates;
+  // The number of bits needed to define each candidate.
+  std::vector<uint64_t> DefinitionBits;
+  // The candidates selected so far.
+  std::vector<CandidateAbbrevs::const_iterator> Selected;
+  // The number of bits saved by each selected candidate.
+  std::vector<double> SelectedBitsSaved;
+  // The savings of the selected candidates on each group of records.
+  std::map<unsigned, GroupSavingsList> GroupSavings;
+
+  // Returns the number of bits saved by adding the candidate with the
+  // given index to the selected candidates, less the bits needed to
+  // define it.
+  double GetGain(size_t Index);
+
+  // Finds the unselected candidate with the largest gain. Returns
+  // false if no candidate has a positive gain.
+  bool FindBestCandidate(size_t &BestIndex, double &BestGain);
+
+  // Adds the candidate with the given index to the selected
+  // candidates.
+  void SelectCandidate(size_t Index, double Gain);
+};
+
+double BlockCandidateSelector::GetGain(size_t Index) {
+  const CandidateAbbrevs::CandUseList &Uses = Candidates[Index]->second;
+  double Gain = -static_cast<double>(DefinitionBits[Index]);
+  for (CandidateAbbrevs::CandUseList::const_iterator
+           Iter = Uses.begin(), IterEnd = Uses.end();
+       Iter != IterEnd; ++Iter) {
+    unsigned GroupSize = CandAbbrevs.GetGroupSize(Iter->GroupID);
+    GroupSavingsList &Savings = GroupSavings[Iter->GroupID];
+    double OldSavings = EstimateGroupSavings(GroupSize, Savings);
+    Savings.push_back(GroupSavingsType(Iter->BitsSaved, Iter->NumRecords));
+    Gain += EstimateGroupSavings(GroupSize, Savings) - OldSavings;
+    Savings.pop_back();
+  }
+  return Gain;
+}
+
+bool BlockCandidateSelector::FindBestCandidate(size_t &BestIndex,
+                                               double &BestGain) {
+  BestGain = 0;
+  bool Found = false;
+  for (size_t i = 0, e = Candidates.size(); i < e; ++i) {
+    if (std::find(Selected.begin(), Selected.end(), Candidates[i]) !=
+        Selected.end())
+      continue;
+    double Gain = GetGain(i);
+    if (Gain > BestGain) {
+      BestIndex = i;
+      BestGain = Gain;
+      Found = true;
+    }
+  }
+  return Found;
+}
+
+void BlockCandidateSelector::SelectCandidate(size_t Index, double Gain) {
+  const CandidateAbbrevs::CandUseList &Uses = Candidates[Index]->second;
+  for (CandidateAbbrevs::CandUseList::const_iterator
+           Iter = Uses.begin(), IterEnd = Uses.end();
+       Iter != IterEnd; ++Iter) {
+    GroupSavings[Iter->GroupID].push_back(
+        GroupSavingsType(Iter->BitsSaved, Iter->NumRecords));
+  }
+  Selected.push_back(Candidates[Index]);
+  SelectedBitsSaved.push_back(Gain);
+  ++NumAbbrevs;
+}
+
+const std::vector<CandidateAbbrevs::const_iterator> &
+BlockCandidateSelector::Select() {
+  while (true) {
+    unsigned Width = NaClBitsNeededForValue(NumAbbrevs - 1);
+    unsigned NewWidth = NaClBitsNeededForValue(NumAbbrevs);
+    size_t BestIndex;
+    double BestGain;
+    if (NewWidth == Width) {
+      if (!FindBestCandidate(BestIndex, BestGain)) break;
+      SelectCandidate(BestIndex, BestGain);
+      continue;
+    }
+
+    // The next abbreviation widens the abbreviation index of every
+    // record in the block. Only do this if the candidates that fit
+    // into the wider index save more bits than that costs.
+    size_t NumSelected = Selected.size();
+    std::map<unsigned, GroupSavingsList> OldGroupSavings(GroupSavings);
+    unsigned OldNumAbbrevs = NumAbbrevs;
+    unsigned NumSlots = (1u << NewWidth) - NumAbbrevs;
+    double TotalGain = 0;
+    for (; NumSlots > 0; --NumSlots) {
+      if (!FindBestCandidate(BestIndex, BestGain)) break;
+      SelectCandidate(BestIndex, BestGain);
+      TotalGain += BestGain;
+    }
+    if (TotalGain <= static_cast<double>(NumRecords) * (NewWidth - Width)) {
+      Selected.resize(NumSelected);
+      SelectedBitsSaved.resize(NumSelected);
+      GroupSavings.swap(OldGroupSavings);
+      NumAbbrevs = OldNumAbbrevs;
+      break;
+    }
+  }
+  return Selected;
+}
 
 // Look for new abbreviations in the given block distribution map
 // BlockDist.  BlockAbbrevsMap contains the set of read global
@@ -1154,55 +1740,48 @@ static void AddNewAbbreviations(NaClBitcodeBlockDist &BlockDist,
         ->GetAbbrevDist(),
         CandAbbrevs);
   }
-  // Install candidate abbreviations.
-  //
-  // Sort the candidate abbreviations by number of instances, so that
-  // if multiple abbreviations apply, the one with the largest number
-  // of instances will be chosen when compressing a file.
-  //
-  // For example, we may have just generated two abbreviations. The
-  // first has replaced the 3rd element with the constant 4 while the
-  // second replaced the 4th element with the constant 5. The first
-  // abbreviation can apply to 300 records while the second can apply
-  // to 1000 records.  Assuming that both abbreviations shrink the
-  // record by the same number of bits, we clearly want the tool to
-  // choose the second abbreviation when selecting the abbreviation
-  // index to choose (via method GetRecordAbbrevIndex).
-  //
-  // Selecting the second is important in that abbreviation are
-  // refined by successive calls to this tool. We do not want to
-  // restrict downstream refinements prematurely.  Hence, we want the
-  // tool to choose the abbreviation with the most candidates first.
-  //
-  // Since method GetRecordAbbrevIndex chooses the first abbreviation
-  // that generates the least number of bits, we clearly want to make
-  // sure that the second abbreviation occurs before the first.
-  std::vector<CountedAbbrevType> Candidates;
-  for (CandidateAbbrevs::const_iterator
-           Iter = CandAbbrevs.GetAbbrevsMap().begin(),
-           IterEnd = CandAbbrevs.GetAbbrevsMap().end();
-       Iter != IterEnd; ++Iter) {
-    Candidates.push_back(CountedAbbrevType(Iter->second,Iter->first));
-  }
-  std::sort(Candidates.begin(), Candidates.end());
-  std::vector<CountedAbbrevType>::const_reverse_iterator
-      Iter = Candidates.rbegin(), IterEnd = Candidates.rend();
-  if (Iter == IterEnd) return;
 
+  // Install candidate abbreviations, selecting the candidates of each
+  // block separately (since each block has its own abbreviation
+  // indices).
+  //
+  // Candidates are installed in the order selected, so that if
+  // multiple abbreviations apply, the one that saves the most bits
+  // overall will be chosen when compressing a file. Method
+  // GetRecordAbbrevIndex chooses the first abbreviation that
+  // generates the least number of bits. Choosing the most
+  // widely applicable abbreviation is important in that
+  // abbreviations are refined by successive calls to this tool, and
+  // we do not want to restrict downstream refinements prematurely.
   if (TraceGeneratedAbbreviations) {
     errs() << "-- New abbrevations:\n";
   }
-  unsigned Min = (Iter->first >> 2);
-  for (; Iter != IterEnd; ++Iter) {
-    if (Iter->first < Min) break;
-    unsigned BlockID = Iter->second.GetBlockID();
+  CandidateAbbrevs::const_iterator
+      CandIter = CandAbbrevs.GetAbbrevsMap().begin(),
+      CandIterEnd = CandAbbrevs.GetAbbrevsMap().end();
+  while (CandIter != CandIterEnd) {
+    // Note: Candidates are sorted by block ID.
+    unsigned BlockID = CandIter->first.GetBlockID();
     BlockAbbrevs *Abbrevs = BlockAbbrevsMap[BlockID];
-    NaClBitCodeAbbrev *Abbrev = Iter->second.GetAbbrev()->Copy();
-    if (TraceGeneratedAbbreviations) {
-      errs() <<format("%12u", Iter->first) << ": ";
-      PrintAbbrev(errs(), BlockID, Abbrev);
+    BlockCandidateSelector Selector(
+        CandAbbrevs, Abbrevs->GetNumberAbbreviations(),
+        cast<NaClCompressBlockDistElement>(BlockDist.at(BlockID))
+        ->GetAbbrevDist().GetTotal());
+    for (; CandIter != CandIterEnd &&
+             CandIter->first.GetBlockID() == BlockID; ++CandIter) {
+      Selector.AddCandidate(CandIter);
+    }
+    const std::vector<CandidateAbbrevs::const_iterator> &Selected =
+        Selector.Select();
+    for (size_t i = 0, e = Selected.size(); i < e; ++i) {
+      NaClBitCodeAbbrev *Abbrev = Selected[i]->first.GetAbbrev()->Copy();
+      if (TraceGeneratedAbbreviations) {
+        errs() << format("%12.0f", Selector.GetSelectedBitsSaved()[i])
+               << ": ";
+        PrintAbbrev(errs(), BlockID, Abbrev);
+      }
+      Abbrevs->AddAbbreviation(Abbrev);
     }
-    Abbrevs->AddAbbreviation(Abbrev);
   }
   if (TraceGeneratedAbbreviations) {
     errs() << "--\n";
@@ -1251,11 +1830,6 @@ static void DisplayAbbreviationFrequencies(
 // to use, from memory buffer MemBuf containing the input bitcode file.
 static bool AnalyzeBitcode(OwningPtr<MemoryBuffer> &MemBuf,
                            BlockAbbrevsMapType &BlockAbbrevsMap) {
-  // TODO(kschimpf): The current code only extracts abbreviations
-  // defined in the bitcode file. This code needs to be updated to
-  // collect data distributions and figure out better (global)
-  // abbreviations to use.
-
   const unsigned char *BufPtr = (const unsigned char *)MemBuf->getBufferStart();
   const unsigned char *EndBufPtr = BufPtr+MemBuf->getBufferSize();
 
@@ -1273,6 +1847,7 @@ static bool AnalyzeBitcode(OwningPtr<MemoryBuffer> &MemBuf,
   while (!Stream.AtEndOfStream()) {
     if (Parser.Parse()) return true;
   }
+  if (Parser.AnalyzeDeferredFunctionBlocks()) return true;
 
   if (ShowAbbreviationFrequencies || ShowValueDistributions) {
     std::string ErrorInfo;
@@ -1305,7 +1880,8 @@ public:
       : NaClBitcodeParser(Cursor),
         BlockAbbrevsMap(BlockAbbrevsMap),
         Writer(Writer),
-        FoundFirstBlockInfo(false)
+        FoundFirstBlockInfo(false),
+        DeferredCopyFailed(false)
   {}
 
   virtual ~NaClBitcodeCopyParser() {}
@@ -1317,6 +1893,24 @@ public:
 
   virtual bool ParseBlock(unsigned BlockID);
 
+  /// Returns the reader of the bitcode file.
+  const NaClBitstreamReader &GetReader() const {
+    return Record.GetReader();
+  }
+
+  /// Returns true if the function block about to be copied should be
+  /// deferred, and copied on several threads.
+  bool DefersFunctionBlock() const {
+    // Blocks copied on other threads can only be appended at a word
+    // boundary, which the writer is at after the first function block.
+    return NumThreads > 1 &&
+        (!DeferredFunctionBlocks.empty() || Writer.GetCurrentBitNo() % 32 == 0);
+  }
+
+  /// Copies the deferred function blocks (if any). Returns true if
+  /// unable to copy a deferred function block.
+  bool CopyDeferredFunctionBlocks();
+
   // The abbreviations to use for the copied bitcode.
   BlockAbbrevsMapType &BlockAbbrevsMap;
 
@@ -1327,6 +1921,12 @@ public:
   // Used to make sure we don't use abbreviations until we
   // have put them into the bitcode file.
   bool FoundFirstBlockInfo;
+
+  // True if the copying of a deferred function block failed.
+  bool DeferredCopyFailed;
+
+  // The function blocks whose copying has been deferred.
+  DeferredBlockList DeferredFunctionBlocks;
 };
 
 class NaClBlockCopyParser : public NaClBitcodeParser {
@@ -1375,10 +1975,27 @@ protected:
   }
 
   virtual bool ParseBlock(unsigned BlockID) {
+    if (GetBlockID() == naclbitc::MODULE_BLOCK_ID) {
+      if (BlockID == naclbitc::FUNCTION_BLOCK_ID &&
+          Context->DefersFunctionBlock()) {
+        Context->DeferredFunctionBlocks.push_back(
+            DeferredBlock(Record.GetStartBit(),
+                          Record.GetCursor().GetCurrentBitNo()));
+        return SkipBlock();
+      }
+      if (Context->CopyDeferredFunctionBlocks()) return true;
+    }
     NaClBlockCopyParser Parser(BlockID, this);
     return Parser.ParseThisBlock();
   }
 
+  /// Copies the function blocks deferred by the module block, before
+  /// the module block goes on to what follows them.
+  void CopyDeferredFunctionBlocks() {
+    if (GetBlockID() == naclbitc::MODULE_BLOCK_ID)
+      Context->CopyDeferredFunctionBlocks();
+  }
+
   virtual void EnterBlock(unsigned NumWords) {
     unsigned BlockID = GetBlockID();
     BlockAbbreviations = GetGlobalAbbrevs(BlockID);
@@ -1401,6 +2018,7 @@ protected:
   }
 
   virtual void ExitBlock() {
+    CopyDeferredFunctionBlocks();
     Context->Writer.ExitBlock();
   }
 
@@ -1434,6 +2052,7 @@ protected:
   }
 
   virtual void ProcessRecord() {
+    CopyDeferredFunctionBlocks();
     const NaClBitcodeRecord::RecordVector &Values = Record.GetValues();
     if (RemoveAbbreviations) {
       Context->Writer.EmitRecord(Record.GetCode(), Values, 0);
@@ -1456,6 +2075,73 @@ bool NaClBitcodeCopyParser::ParseBlock(unsigned BlockID) {
   return Parser.ParseThisBlock();
 }
 
+/// Copies deferred function blocks on several threads. Each block is
+/// written into a buffer of its own, and the buffers are appended to
+/// the module block in order, so the copy is the same as when the
+/// blocks are copied one after the other.
+class ParallelFunctionCopier : public ParallelFunctionBlocks {
+public:
+  ParallelFunctionCopier(NaClBitcodeCopyParser &Main)
+      : ParallelFunctionBlocks(Main.DeferredFunctionBlocks,
+                               Main.GetReader()),
+        Main(Main), Buffers(Blocks.size()), Failed(false) {}
+
+  virtual ~ParallelFunctionCopier() {}
+
+  /// Appends the copied blocks to the writer of the module.
+  void EmitBlocks();
+
+  // The parser of the module whose function blocks are copied.
+  NaClBitcodeCopyParser &Main;
+  // The copy of each block.
+  std::vector<SmallVector<char, 0> > Buffers;
+  // True if unable to copy a block.
+  bool Failed;
+
+protected:
+  virtual void ProcessBlocks(NaClBitstreamCursor &Cursor);
+
+private:
+  // Protects Failed while threads update it.
+  sys::Mutex FailedLock;
+};
+
+void ParallelFunctionCopier::ProcessBlocks(NaClBitstreamCursor &Cursor) {
+  bool BlockFailed = false;
+  size_t Index;
+  while (!BlockFailed && GetNextBlock(Index)) {
+    const DeferredBlock &Block = Blocks[Index];
+    NaClBitstreamWriter Writer(Buffers[Index], Main.Writer);
+    NaClBitcodeCopyParser Parser(Cursor, Main.BlockAbbrevsMap, Writer);
+    BlockFailed = Parser.ParseAt(naclbitc::FUNCTION_BLOCK_ID,
+                                 Block.EntryBit, Block.BodyBit);
+  }
+  if (BlockFailed) {
+    MutexGuard Lock(FailedLock);
+    Failed = true;
+  }
+}
+
+void ParallelFunctionCopier::EmitBlocks() {
+  for (size_t i = 0, e = Buffers.size(); i != e; ++i) {
+    Main.Writer.EmitWords(Buffers[i]);
+    SmallVector<char, 0>().swap(Buffers[i]);
+  }
+}
+
+bool NaClBitcodeCopyParser::CopyDeferredFunctionBlocks() {
+  if (DeferredFunctionBlocks.empty() || DeferredCopyFailed)
+    return DeferredCopyFailed;
+  ParallelFunctionCopier Copier(*this);
+  Copier.Run(GetNumThreads(DeferredFunctionBlocks));
+  if (Copier.Failed)
+    DeferredCopyFailed = true;
+  else
+    Copier.EmitBlocks();
+  DeferredFunctionBlocks.clear();
+  return DeferredCopyFailed;
+}
+
 // Read in bitcode, and write it back out using the abbreviations in
 // BlockAbbrevsMap, from memory buffer MemBuf containing the input
 // bitcode file.
@@ -1490,6 +2176,7 @@ static bool CopyBitcode(OwningPtr<MemoryBuffer> &MemBuf,
   while (!Stream.AtEndOfStream()) {
     if (Parser.Parse()) return true;
   }
+  if (Parser.CopyDeferredFunctionBlocks()) return true;
 
   // Write out the copied results.
   std::string ErrorInfo;
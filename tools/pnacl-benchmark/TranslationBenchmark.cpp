@@ -0,0 +1,607 @@
+//===-- TranslationBenchmark.cpp - Benchmark pexe translation -------------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// The translation is timed in phases: reading the bitcode header, parsing
+// the module-level blocks, materializing function bodies, PNaCl ABI
+// verification, instruction selection (including the IR lowering passes
+// that run before it), register allocation (from PHI elimination up to
+// prolog/epilog insertion), the remaining machine passes with MC emission,
+// and writing the object file. Machine-level phases are delimited by
+// marker passes inserted into the code generator's pass pipeline.
+//
+// With more than one thread, the module is split as with pnacl-llc
+// -split-module, and phase times are summed over the threads. The "total"
+// phase is the wall time of the whole translation.
+//
+// Streamed translations also report their latency: "first-function" is the
+// time until the first function is compiled, "last-byte-to-object" the time
+// from the arrival of the last byte of bitcode to the finished object, and
+// "stream-wait" the time spent waiting for bytes to arrive (summed over the
+// threads). With -stream-bandwidth, the bitcode arrives at the given rate,
+// as if it were downloaded. Each thread replays the download on its own
+// stream, which approximates a stream shared by all threads.
+//
+//===----------------------------------------------------------------------===//
+
+#include "TranslationBenchmark.h"
+#include "llvm/ADT/OwningPtr.h"
+#include "llvm/ADT/SmallString.h"
+#include "llvm/ADT/Triple.h"
+#include "llvm/Analysis/NaCl.h"
+#include "llvm/Bitcode/NaCl/NaClBitcodeHeader.h"
+#include "llvm/Bitcode/NaCl/NaClReaderWriter.h"
+#include "llvm/CodeGen/Passes.h"
+#include "llvm/IR/DataLayout.h"
+#include "llvm/IR/LLVMContext.h"
+#include "llvm/IR/Module.h"
+#include "llvm/InitializePasses.h"
+#include "llvm/Pass.h"
+#include "llvm/PassManager.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/DataStream.h"
+#include "llvm/Support/ErrorHandling.h"
+#include "llvm/Support/Format.h"
+#include "llvm/Support/FormattedStream.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/StreamableMemoryObject.h"
+#include "llvm/Support/TargetRegistry.h"
+#include "llvm/Support/TargetSelect.h"
+#include "llvm/Support/Threading.h"
+#include "llvm/Support/TimeValue.h"
+#include "llvm/Support/system_error.h"
+#include "llvm/Target/TargetLibraryInfo.h"
+#include "llvm/Target/TargetMachine.h"
+#include "llvm/Transforms/NaCl.h"
+#include <algorithm>
+#include <cstring>
+#include <pthread.h>
+#include <vector>
+
+using namespace llvm;
+
+static cl::opt<std::string>
+TargetTriple("mtriple", cl::desc("Target triple to translate for"),
+             cl::init("i686-none-nacl-gnu"));
+
+static cl::opt<std::string>
+MCPU("mcpu", cl::desc("Target a specific cpu type (-mcpu=help for details)"),
+     cl::value_desc("cpu-name"), cl::init(""));
+
+static cl::opt<char>
+OptLevel("O", cl::desc("Optimization level. [-O0, -O1, -O2, or -O3] "
+                       "(default = '-O2')"),
+         cl::Prefix, cl::ZeroOrMore, cl::init('2'));
+
+static cl::list<unsigned>
+ThreadCounts("split-module", cl::CommaSeparated,
+             cl::desc("Numbers of threads to translate with, splitting the "
+                      "module as pnacl-llc -split-module does (default 1)"));
+
+enum StreamingKind {
+  StreamingOff,
+  StreamingOn,
+  StreamingBoth
+};
+
+static cl::opt<StreamingKind>
+Streaming("bitcode-streaming",
+          cl::desc("Whether to read the bitcode through a stream"),
+          cl::values(
+              clEnumValN(StreamingOff, "off", "Read from a memory buffer"),
+              clEnumValN(StreamingOn, "on", "Read through a stream"),
+              clEnumValN(StreamingBoth, "both", "Benchmark both (default)"),
+              clEnumValEnd),
+          cl::init(StreamingBoth));
+
+enum OutputFormatKind {
+  OutputText,
+  OutputJSON,
+  OutputCSV
+};
+
+static cl::opt<OutputFormatKind>
+OutputFormat("output-format", cl::desc("Format of the benchmark results"),
+             cl::values(
+                 clEnumValN(OutputText, "text", "Human-readable (default)"),
+                 clEnumValN(OutputJSON, "json", "JSON"),
+                 clEnumValN(OutputCSV, "csv", "Comma-separated values"),
+                 clEnumValEnd),
+             cl::init(OutputText));
+
+static cl::opt<unsigned>
+StreamBandwidth("stream-bandwidth",
+                cl::desc("Stream the bitcode at this many bytes per second "
+                         "(default 0, for no limit)"),
+                cl::init(0U));
+
+static cl::opt<unsigned>
+StreamChunkSize("stream-chunk-size",
+                cl::desc("Size of the chunks the bitcode is streamed in"),
+                cl::init(64U * 1024U));
+
+static cl::opt<bool>
+VerifyPNaClABI("verify-pnaclabi",
+               cl::desc("Verify the PNaCl ABI while translating"),
+               cl::init(true));
+
+enum TranslationPhase {
+  PhaseHeaderRead,
+  PhaseModuleParse,
+  PhaseMaterialize,
+  PhaseABIVerify,
+  PhaseISel,
+  PhaseRegAlloc,
+  PhaseEmission,
+  PhaseObjectWrite,
+  PhaseTotal,
+  // Latency metrics of streamed translations; not timed by a PhaseClock.
+  PhaseFirstFunction,
+  PhaseLastByteToObject,
+  PhaseStreamWait,
+  NumPhases
+};
+
+static const char *PhaseNames[NumPhases] = {
+  "header-read",
+  "module-parse",
+  "materialize",
+  "abi-verify",
+  "isel",
+  "regalloc",
+  "mc-emission",
+  "object-write",
+  "total",
+  "first-function",
+  "last-byte-to-object",
+  "stream-wait"
+};
+
+static double toSeconds(sys::TimeValue T) {
+  return T.seconds() + T.nanoseconds() / 1e9;
+}
+
+static double getWallTime() {
+  return toSeconds(sys::TimeValue::now());
+}
+
+namespace {
+
+/// Accumulates the time spent in each translation phase by one thread.
+class PhaseClock {
+public:
+  PhaseClock() : Current(NumPhases), Last(0) {
+    std::fill(Times, Times + NumPhases, 0.0);
+  }
+
+  /// Ends the current phase, if any, and starts phase P. Passing
+  /// NumPhases just ends the current phase.
+  void enter(unsigned P) {
+    double Now = getWallTime();
+    if (Current != NumPhases)
+      Times[Current] += Now - Last;
+    Last = Now;
+    Current = P;
+  }
+
+  void stop() { enter(NumPhases); }
+
+  double Times[NumPhases];
+
+private:
+  unsigned Current;
+  double Last;
+};
+
+/// Starts a phase of the clock when run on a function.
+class PhaseMarker : public FunctionPass {
+public:
+  static char ID;
+  PhaseMarker(PhaseClock *Clock, unsigned Phase)
+      : FunctionPass(ID), Clock(Clock), Phase(Phase) {}
+
+  virtual void getAnalysisUsage(AnalysisUsage &AU) const {
+    AU.setPreservesAll();
+  }
+
+  virtual bool runOnFunction(Function &F) {
+    Clock->enter(Phase);
+    return false;
+  }
+
+  virtual const char *getPassName() const {
+    return "Translation benchmark phase marker";
+  }
+
+private:
+  PhaseClock *Clock;
+  unsigned Phase;
+};
+
+char PhaseMarker::ID = 0;
+
+/// A function pass manager that inserts phase markers in front of the
+/// first pass of register allocation and of the post-RA passes, as the
+/// code generator adds its passes.
+class TimingFunctionPassManager : public FunctionPassManager {
+public:
+  TimingFunctionPassManager(Module *M, PhaseClock *Clock)
+      : FunctionPassManager(M), Clock(Clock) {}
+
+  virtual void add(Pass *P) {
+    AnalysisID ID = P->getPassID();
+    if (ID == &PHIEliminationID)
+      FunctionPassManager::add(new PhaseMarker(Clock, PhaseRegAlloc));
+    else if (ID == &PrologEpilogCodeInserterID)
+      FunctionPassManager::add(new PhaseMarker(Clock, PhaseEmission));
+    FunctionPassManager::add(P);
+  }
+
+private:
+  PhaseClock *Clock;
+};
+
+/// Streams the bytes of a memory buffer, as fast as they are requested.
+class MemoryBufferStreamer : public DataStreamer {
+public:
+  explicit MemoryBufferStreamer(const MemoryBuffer *Buffer)
+      : Buffer(Buffer), Pos(0) {}
+
+  virtual size_t GetBytes(unsigned char *Buf, size_t Len) {
+    Len = std::min(Len, Buffer->getBufferSize() - Pos);
+    memcpy(Buf, Buffer->getBufferStart() + Pos, Len);
+    Pos += Len;
+    return Len;
+  }
+
+private:
+  const MemoryBuffer *Buffer;
+  size_t Pos;
+};
+
+/// One thread's share of a translation.
+struct TranslationThread {
+  const MemoryBuffer *Input;
+  const Target *TheTarget;
+  unsigned ModuleIndex;
+  unsigned NumModules;
+  bool UseStreaming;
+  PhaseClock Clock;
+  // Wall times at which the first function was compiled (zero if none
+  // was) and the last byte of bitcode arrived, and the time spent waiting
+  // for the bitcode to stream in.
+  double FirstFunctionTime;
+  double LastByteTime;
+  double StreamWaitTime;
+};
+
+} // end anonymous namespace
+
+static CodeGenOpt::Level getCodeGenOptLevel() {
+  switch (OptLevel) {
+  case '0': return CodeGenOpt::None;
+  case '1': return CodeGenOpt::Less;
+  case '2': return CodeGenOpt::Default;
+  case '3': return CodeGenOpt::Aggressive;
+  default:
+    report_fatal_error("Invalid optimization level");
+  }
+}
+
+static void translate(TranslationThread *T) {
+  PhaseClock &Clock = T->Clock;
+  // Use a new context for each module, as pnacl-llc does.
+  LLVMContext Context;
+
+  Clock.enter(PhaseHeaderRead);
+  NaClBitcodeHeader Header;
+  const unsigned char *BufPtr =
+      reinterpret_cast<const unsigned char *>(T->Input->getBufferStart());
+  const unsigned char *BufEnd =
+      reinterpret_cast<const unsigned char *>(T->Input->getBufferEnd());
+  if (Header.Read(BufPtr, BufEnd) || !Header.IsReadable())
+    report_fatal_error("Invalid PNaCl bitcode header");
+
+  Clock.enter(PhaseModuleParse);
+  std::string ErrMsg;
+  OwningPtr<Module> M;
+  // Owned by the module's bitcode reader.
+  ThrottledDataStreamer *Streamer = NULL;
+  if (T->UseStreaming) {
+    Streamer = new ThrottledDataStreamer(new MemoryBufferStreamer(T->Input),
+                                         StreamBandwidth, StreamChunkSize);
+    M.reset(getNaClStreamedBitcodeModule(
+        T->Input->getBufferIdentifier(),
+        new StreamingMemoryObjectImpl(Streamer), Context, &ErrMsg));
+  } else {
+    OwningPtr<MemoryBuffer> Buffer(MemoryBuffer::getMemBuffer(
+        T->Input->getBuffer(), T->Input->getBufferIdentifier(), false));
+    M.reset(getNaClLazyBitcodeModule(Buffer.get(), Context, &ErrMsg));
+    if (M)
+      Buffer.take();
+  }
+  if (!M)
+    report_fatal_error("Unable to parse module: " + ErrMsg);
+  OwningPtr<ModulePass> AddPNaClExternalDeclsPass(
+      createAddPNaClExternalDeclsPass());
+  AddPNaClExternalDeclsPass->runOnModule(*M);
+  M->setTargetTriple(Triple::normalize(TargetTriple));
+  // Make the module self-contained like pnacl-llc -split-module does.
+  if (T->NumModules > 1) {
+    PNaClExternalizeSplitModule(M.get());
+    if (T->ModuleIndex > 0)
+      PNaClRemoveGlobalInitializers(M.get());
+  }
+
+  PNaClABIErrorReporter ABIErrorReporter;
+  if (VerifyPNaClABI) {
+    Clock.enter(PhaseABIVerify);
+    OwningPtr<ModulePass> VerifyPass(
+        createPNaClABIVerifyModulePass(&ABIErrorReporter, true));
+    VerifyPass->runOnModule(*M);
+    ABIErrorReporter.checkForFatalErrors();
+  }
+  Clock.stop();
+
+  TargetOptions Options;
+  OwningPtr<TargetMachine> Target(T->TheTarget->createTargetMachine(
+      M->getTargetTriple(), MCPU, "", Options, Reloc::Default,
+      CodeModel::Default, getCodeGenOptLevel()));
+  if (!Target)
+    report_fatal_error("Could not allocate target machine");
+
+  SmallVector<char, 0> Object;
+  raw_svector_ostream ROS(Object);
+  formatted_raw_ostream FOS(ROS);
+  TimingFunctionPassManager PM(M.get(), &Clock);
+  if (const DataLayout *TD = Target->getDataLayout())
+    PM.add(new DataLayout(*TD));
+  else
+    PM.add(new DataLayout(M.get()));
+  if (VerifyPNaClABI)
+    PM.add(createPNaClABIVerifyFunctionsPass(&ABIErrorReporter));
+  PM.add(new PhaseMarker(&Clock, PhaseISel));
+  if (PNaClTranslationAddCodeGenPasses(
+          PM, *Target, new TargetLibraryInfo(Triple(M->getTargetTriple())),
+          FOS, TargetMachine::CGFT_ObjectFile))
+    report_fatal_error("Target does not support object emission");
+  PM.add(new PhaseMarker(&Clock, NumPhases));
+
+  PM.doInitialization();
+  // Functions are assigned round-robin to the modules, like pnacl-llc's
+  // static scheduling does.
+  unsigned FuncIndex = 0;
+  for (Module::iterator I = M->begin(), E = M->end(); I != E; ++I) {
+    if (!I->isMaterializable() && I->isDeclaration())
+      continue;
+    if (FuncIndex++ % T->NumModules != T->ModuleIndex)
+      continue;
+    Clock.enter(PhaseMaterialize);
+    if (I->Materialize(&ErrMsg))
+      report_fatal_error("Unable to materialize " + I->getName() + ": " +
+                         ErrMsg);
+    Clock.enter(PhaseABIVerify);
+    PM.run(*I);
+    Clock.stop();
+    if (T->FirstFunctionTime == 0)
+      T->FirstFunctionTime = getWallTime();
+    ABIErrorReporter.checkForFatalErrors();
+    I->Dematerialize();
+  }
+  Clock.enter(PhaseObjectWrite);
+  PM.doFinalization();
+  FOS.flush();
+  ROS.flush();
+  Clock.stop();
+  if (Streamer) {
+    if (Streamer->getLastByteTime() != sys::TimeValue::ZeroTime)
+      T->LastByteTime = toSeconds(Streamer->getLastByteTime());
+    T->StreamWaitTime = toSeconds(Streamer->getWaitTime());
+  }
+}
+
+static void *runTranslationThread(void *Arg) {
+  translate(static_cast<TranslationThread *>(Arg));
+  return NULL;
+}
+
+namespace {
+
+/// The time of each phase in each run of one configuration.
+struct ConfigurationResult {
+  unsigned NumThreads;
+  bool UseStreaming;
+  std::vector<double> Times[NumPhases];
+};
+
+struct Summary {
+  double Min, Median, Max;
+};
+
+} // end anonymous namespace
+
+static void runConfiguration(const MemoryBuffer *Input,
+                             const Target *TheTarget, unsigned NumRuns,
+                             ConfigurationResult &Result) {
+  unsigned NumThreads = Result.NumThreads;
+  for (unsigned Run = 0; Run < NumRuns; ++Run) {
+    std::vector<TranslationThread> Threads(NumThreads);
+    std::vector<pthread_t> Pthreads(NumThreads);
+    double Start = getWallTime();
+    for (unsigned i = 0; i < NumThreads; ++i) {
+      Threads[i].Input = Input;
+      Threads[i].TheTarget = TheTarget;
+      Threads[i].ModuleIndex = i;
+      Threads[i].NumModules = NumThreads;
+      Threads[i].UseStreaming = Result.UseStreaming;
+      // Without streaming, all of the bitcode is there from the start.
+      Threads[i].FirstFunctionTime = 0;
+      Threads[i].LastByteTime = Start;
+      Threads[i].StreamWaitTime = 0;
+      if (NumThreads == 1)
+        translate(&Threads[i]);
+      else if (pthread_create(&Pthreads[i], NULL, runTranslationThread,
+                              &Threads[i]))
+        report_fatal_error("Failed to create thread");
+    }
+    for (unsigned i = 0; NumThreads > 1 && i < NumThreads; ++i) {
+      if (pthread_join(Pthreads[i], NULL))
+        report_fatal_error("Failed to join thread");
+    }
+    double End = getWallTime();
+
+    for (unsigned P = 0; P < PhaseTotal; ++P) {
+      double Sum = 0;
+      for (unsigned i = 0; i < NumThreads; ++i)
+        Sum += Threads[i].Clock.Times[P];
+      Result.Times[P].push_back(Sum);
+    }
+    Result.Times[PhaseTotal].push_back(End - Start);
+
+    double FirstFunction = End;
+    double LastByte = Start;
+    double StreamWait = 0;
+    for (unsigned i = 0; i < NumThreads; ++i) {
+      if (Threads[i].FirstFunctionTime != 0)
+        FirstFunction = std::min(FirstFunction, Threads[i].FirstFunctionTime);
+      LastByte = std::max(LastByte, Threads[i].LastByteTime);
+      StreamWait += Threads[i].StreamWaitTime;
+    }
+    Result.Times[PhaseFirstFunction].push_back(FirstFunction - Start);
+    Result.Times[PhaseLastByteToObject].push_back(End - LastByte);
+    Result.Times[PhaseStreamWait].push_back(StreamWait);
+  }
+}
+
+static Summary summarize(std::vector<double> Times) {
+  std::sort(Times.begin(), Times.end());
+  Summary S;
+  size_t N = Times.size();
+  S.Min = Times.front();
+  S.Max = Times.back();
+  S.Median = N % 2 ? Times[N / 2] : (Times[N / 2 - 1] + Times[N / 2]) / 2;
+  return S;
+}
+
+static void printJSONString(raw_ostream &OS, StringRef Str) {
+  OS << '"';
+  for (size_t i = 0, e = Str.size(); i != e; ++i) {
+    unsigned char C = Str[i];
+    if (C == '"' || C == '\\')
+      OS << '\\' << C;
+    else if (C < 0x20)
+      OS << format("\\u%04x", C);
+    else
+      OS << C;
+  }
+  OS << '"';
+}
+
+static void printResults(const std::string &InputFilename, unsigned NumRuns,
+                         const std::vector<ConfigurationResult> &Results,
+                         raw_ostream &OS) {
+  switch (OutputFormat) {
+  case OutputText:
+    OS << "Translation benchmark: " << InputFilename << " for "
+       << TargetTriple << ", " << NumRuns << " runs\n"
+       << "Phase times are summed over threads; total is wall time.\n";
+    for (size_t i = 0, e = Results.size(); i != e; ++i) {
+      const ConfigurationResult &R = Results[i];
+      OS << "\nthreads=" << R.NumThreads << " streaming="
+         << (R.UseStreaming ? "on" : "off") << "\n"
+         << "  phase                        min       median          max\n";
+      for (unsigned P = 0; P < NumPhases; ++P) {
+        Summary S = summarize(R.Times[P]);
+        OS << format("  %-19s %12.6f %12.6f %12.6f\n", PhaseNames[P], S.Min,
+                     S.Median, S.Max);
+      }
+    }
+    break;
+  case OutputJSON:
+    OS << "{\n  \"input\": ";
+    printJSONString(OS, InputFilename);
+    OS << ",\n  \"triple\": ";
+    printJSONString(OS, TargetTriple);
+    OS << ",\n  \"num_runs\": " << NumRuns << ",\n  \"configurations\": [";
+    for (size_t i = 0, e = Results.size(); i != e; ++i) {
+      const ConfigurationResult &R = Results[i];
+      OS << (i ? "," : "") << "\n    {\n"
+         << "      \"threads\": " << R.NumThreads << ",\n"
+         << "      \"streaming\": " << (R.UseStreaming ? "true" : "false")
+         << ",\n      \"phases\": {";
+      for (unsigned P = 0; P < NumPhases; ++P) {
+        Summary S = summarize(R.Times[P]);
+        OS << (P ? "," : "") << "\n        \"" << PhaseNames[P] << "\": "
+           << format("{\"min\": %.6f, \"median\": %.6f, \"max\": %.6f}",
+                     S.Min, S.Median, S.Max);
+      }
+      OS << "\n      }\n    }";
+    }
+    OS << "\n  ]\n}\n";
+    break;
+  case OutputCSV:
+    OS << "threads,streaming,phase,min,median,max\n";
+    for (size_t i = 0, e = Results.size(); i != e; ++i) {
+      const ConfigurationResult &R = Results[i];
+      for (unsigned P = 0; P < NumPhases; ++P) {
+        Summary S = summarize(R.Times[P]);
+        OS << R.NumThreads << "," << (R.UseStreaming ? "on" : "off") << ","
+           << PhaseNames[P] << ","
+           << format("%.6f,%.6f,%.6f\n", S.Min, S.Median, S.Max);
+      }
+    }
+    break;
+  }
+}
+
+void BenchmarkTranslation(const std::string &InputFilename, unsigned NumRuns,
+                          raw_ostream &OS) {
+  if (NumRuns == 0)
+    report_fatal_error("-num-runs must be at least 1");
+  InitializeAllTargets();
+  InitializeAllTargetMCs();
+  InitializeAllAsmPrinters();
+  PassRegistry *Registry = PassRegistry::getPassRegistry();
+  initializeCore(*Registry);
+  initializeCodeGen(*Registry);
+  initializeLoopStrengthReducePass(*Registry);
+  initializeLowerIntrinsicsPass(*Registry);
+  initializeUnreachableBlockElimPass(*Registry);
+
+  std::string Error;
+  const Target *TheTarget =
+      TargetRegistry::lookupTarget(Triple::normalize(TargetTriple), Error);
+  if (!TheTarget)
+    report_fatal_error(Error);
+
+  OwningPtr<MemoryBuffer> Input;
+  if (error_code EC = MemoryBuffer::getFileOrSTDIN(InputFilename, Input))
+    report_fatal_error("Could not open input file: " + EC.message());
+
+  std::vector<unsigned> Counts(ThreadCounts.begin(), ThreadCounts.end());
+  if (Counts.empty())
+    Counts.push_back(1);
+  std::vector<ConfigurationResult> Results;
+  for (size_t i = 0, e = Counts.size(); i != e; ++i) {
+    if (Counts[i] == 0)
+      report_fatal_error("-split-module thread counts must be at least 1");
+    if (Counts[i] > 1)
+      llvm_start_multithreaded();
+    for (unsigned S = 0; S < 2; ++S) {
+      bool UseStreaming = S == 1;
+      if ((UseStreaming && Streaming == StreamingOff) ||
+          (!UseStreaming && Streaming == StreamingOn))
+        continue;
+      Results.push_back(ConfigurationResult());
+      Results.back().NumThreads = Counts[i];
+      Results.back().UseStreaming = UseStreaming;
+      runConfiguration(Input.get(), TheTarget, NumRuns, Results.back());
+    }
+  }
+  printResults(InputFilename, NumRuns, Results, OS);
+}
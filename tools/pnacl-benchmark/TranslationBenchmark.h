@@ -0,0 +1,30 @@
+//===-- TranslationBenchmark.h - Benchmark pexe translation -----*- C++ -*-===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// Benchmarks the translation of a pexe to a native object, phase by phase,
+// the way pnacl-llc translates it.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef TRANSLATIONBENCHMARK_H
+#define TRANSLATIONBENCHMARK_H
+
+#include <string>
+
+namespace llvm {
+class raw_ostream;
+}
+
+/// Translates the pexe in InputFilename NumRuns times for each of the
+/// configurations selected on the command line, and reports the min,
+/// median and max time of each translation phase to OS.
+void BenchmarkTranslation(const std::string &InputFilename, unsigned NumRuns,
+                          llvm::raw_ostream &OS);
+
+#endif // TRANSLATIONBENCHMARK_H
@@ -11,6 +11,7 @@
 //
 //===----------------------------------------------------------------------===//
 
+#include "TranslationBenchmark.h"
 #include "llvm/Bitcode/NaCl/NaClBitcodeAnalyzer.h"
 #include "llvm/Bitcode/NaCl/NaClBitcodeHeader.h"
 #include "llvm/Bitcode/NaCl/NaClBitcodeParser.h"
@@ -45,6 +46,21 @@ InputFilename(cl::Positional, cl::desc("<input bitcode>"), cl::init("-"));
 static cl::opt<unsigned>
 NumRuns("num-runs", cl::desc("Number of runs"), cl::init(1));
 
+enum BenchmarkKind {
+  ParsingBenchmark,
+  TranslationBenchmark
+};
+
+static cl::opt<BenchmarkKind>
+Benchmark("benchmark", cl::desc("What to benchmark"),
+          cl::values(
+              clEnumValN(ParsingBenchmark, "parsing",
+                         "Bitcode reading and IR parsing (default)"),
+              clEnumValN(TranslationBenchmark, "translation",
+                         "Translation to a native object, phase by phase"),
+              clEnumValEnd),
+          cl::init(ParsingBenchmark));
+
 /// Used in a lexical block to measure and report the block's execution time.
 ///
 /// \param N block name
@@ -218,6 +234,11 @@ int main(int argc, char **argv) {
   llvm_shutdown_obj Y;  // Call llvm_shutdown() on exit.
   cl::ParseCommandLineOptions(argc, argv, "pnacl-benchmark\n");
 
+  if (Benchmark == TranslationBenchmark) {
+    BenchmarkTranslation(InputFilename, NumRuns, outs());
+    return 0;
+  }
+
   for (unsigned i = 0; i < NumRuns; i++) {
     BenchmarkIRParsing();
   }
@@ -48,7 +48,8 @@ static void WriteOutputFile(const Module *M) {
     exit(1);
   }
 
-  NaClWriteBitcodeToFile(M, Out->os(), /* AcceptSupportedOnly = */ false);
+  NaClWriteBitcodeToSeekableFile(M, Out->os(),
+                                 /* AcceptSupportedOnly = */ false);
 
   // Declare success.
   Out->keep();
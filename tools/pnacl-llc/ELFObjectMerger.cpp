@@ -0,0 +1,852 @@
+//===-- ELFObjectMerger.cpp - Merge split-module objects ------------------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+
+#include "ELFObjectMerger.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/ADT/Twine.h"
+#include "llvm/Object/ELFTypes.h"
+#include "llvm/Support/ELF.h"
+#include "llvm/Support/ErrorHandling.h"
+#include "llvm/Support/MathExtras.h"
+#include <algorithm>
+#include <cstring>
+
+using namespace llvm;
+using namespace llvm::object;
+
+class ELFObjectMergerImpl {
+ public:
+  virtual ~ELFObjectMergerImpl() {}
+  virtual bool layout(const std::vector<StringRef> &Objects,
+                      std::string *ErrMsg) = 0;
+  virtual uint64_t getSize() const = 0;
+  virtual void write(uint8_t *Buf) const = 0;
+};
+
+namespace {
+
+template <class ELFT>
+class ELFMerger : public ELFObjectMergerImpl {
+  LLVM_ELF_IMPORT_TYPES_ELFT(ELFT)
+  typedef Elf_Ehdr_Impl<ELFT> Elf_Ehdr;
+  typedef Elf_Shdr_Impl<ELFT> Elf_Shdr;
+  typedef Elf_Sym_Impl<ELFT> Elf_Sym;
+  typedef Elf_Rel_Impl<ELFT, false> Elf_Rel;
+  typedef Elf_Rel_Impl<ELFT, true> Elf_Rela;
+
+  // Refers to a symbol of the merged object. Section symbols come first,
+  // one per merged section, then the other local symbols, then the global
+  // symbols, so the final index is only known once all objects are read.
+  struct SymbolRef {
+    enum KindTy { Null, Section, Local, Global } Kind;
+    unsigned Index;
+    SymbolRef() : Kind(Null), Index(0) {}
+    SymbolRef(KindTy K, unsigned I) : Kind(K), Index(I) {}
+  };
+
+  struct OutSymbol {
+    StringRef Name;
+    uint64_t Value;
+    uint64_t Size;
+    unsigned char Info;
+    unsigned char Other;
+    unsigned Shndx;
+    uint32_t NameOffset;
+  };
+
+  struct OutReloc {
+    uint64_t Offset;
+    SymbolRef Sym;
+    uint32_t Type;
+    int64_t Addend;
+  };
+
+  // The contents of one input section, placed at Offset in a merged
+  // section. Data is null for SHT_NOBITS sections.
+  struct Piece {
+    const uint8_t *Data;
+    uint64_t Offset;
+    uint64_t Size;
+  };
+
+  // A section of the merged object, and its relocation section if any.
+  struct OutSection {
+    StringRef Name;
+    uint32_t Type;
+    uint64_t Flags;
+    uint64_t Align;
+    uint64_t Size;
+    uint64_t EntSize;
+    unsigned Link;
+    std::vector<Piece> Pieces;
+    uint64_t FileOffset;
+    uint32_t NameOffset;
+
+    bool HasRelocs;
+    bool IsRela;
+    std::vector<OutReloc> Relocs;
+    std::string RelName;
+    uint64_t RelFileOffset;
+    uint32_t RelNameOffset;
+    unsigned RelIndex;
+
+    // For SHT_GROUP sections: the group flags, the merged sections that
+    // are members of the group, and the group's signature symbol.
+    uint32_t GroupFlags;
+    std::vector<unsigned> GroupMembers;
+    SymbolRef GroupSignature;
+  };
+
+  // The ELF header of the first object, which the merged object is
+  // based on.
+  const Elf_Ehdr *FirstHeader;
+  std::vector<OutSection> Sections;
+  StringMap<unsigned> SectionMap;
+  StringMap<bool> ComdatSignatures;
+  std::vector<OutSymbol> Locals;
+  std::vector<OutSymbol> Globals;
+  StringMap<unsigned> GlobalMap;
+  StringMap<bool> FileSymbols;
+  std::string StrTab;
+  std::string ShStrTab;
+  StringMap<uint32_t> StrTabMap;
+
+  unsigned NumSections;
+  unsigned SymTabIndex;
+  uint64_t SymTabOffset;
+  uint64_t StrTabOffset;
+  uint64_t ShStrTabOffset;
+  uint32_t SymTabName;
+  uint32_t StrTabName;
+  uint32_t ShStrTabName;
+  uint64_t SectionHeaderOffset;
+  uint64_t Size;
+
+  static const uint64_t WordSize = ELFT::Is64Bits ? 8 : 4;
+
+  static bool error(std::string *ErrMsg, const Twine &Msg) {
+    if (ErrMsg)
+      *ErrMsg = Msg.str();
+    return true;
+  }
+
+  static uint32_t addString(std::string &Table, StringRef Str) {
+    uint32_t Offset = Table.size();
+    Table.append(Str.begin(), Str.end());
+    Table.push_back('\0');
+    return Offset;
+  }
+
+  // Adds a merged section with the name and attributes of S, and returns
+  // its index.
+  unsigned addSection(StringRef Name, const Elf_Shdr &S) {
+    OutSection Out;
+    Out.Name = Name;
+    Out.Type = S.sh_type;
+    Out.Flags = S.sh_flags;
+    Out.Align = 1;
+    Out.Size = 0;
+    Out.EntSize = S.sh_entsize;
+    Out.Link = 0;
+    Out.FileOffset = 0;
+    Out.NameOffset = 0;
+    Out.HasRelocs = false;
+    Out.IsRela = false;
+    Out.RelFileOffset = 0;
+    Out.RelNameOffset = 0;
+    Out.RelIndex = 0;
+    Out.GroupFlags = 0;
+    Sections.push_back(Out);
+    return Sections.size() - 1;
+  }
+
+  uint32_t addSymbolName(StringRef Name) {
+    if (Name.empty())
+      return 0;
+    StringMap<uint32_t>::iterator I = StrTabMap.find(Name);
+    if (I != StrTabMap.end())
+      return I->getValue();
+    uint32_t Offset = addString(StrTab, Name);
+    StrTabMap[Name] = Offset;
+    return Offset;
+  }
+
+  // Returns the null-terminated string at Offset of the string table
+  // Table, or false if it isn't within the table.
+  static bool getString(StringRef Table, uint64_t Offset, StringRef &Str) {
+    if (Offset >= Table.size())
+      return false;
+    StringRef Rest = Table.substr(Offset);
+    size_t End = Rest.find('\0');
+    if (End == StringRef::npos)
+      return false;
+    Str = Rest.substr(0, End);
+    return true;
+  }
+
+  unsigned getSymbolIndex(SymbolRef Ref) const {
+    switch (Ref.Kind) {
+    case SymbolRef::Null:
+      return 0;
+    case SymbolRef::Section:
+      return 1 + Ref.Index;
+    case SymbolRef::Local:
+      return 1 + Sections.size() + Ref.Index;
+    case SymbolRef::Global:
+      return 1 + Sections.size() + Locals.size() + Ref.Index;
+    }
+    llvm_unreachable("Unknown symbol kind");
+  }
+
+  static bool isDefined(const OutSymbol &Sym) {
+    return Sym.Shndx != ELF::SHN_UNDEF;
+  }
+
+  static unsigned char getBinding(const OutSymbol &Sym) {
+    return Sym.Info >> 4;
+  }
+
+  // Resolves a global symbol of one object against the symbol of the same
+  // name merged so far.
+  static bool resolveGlobal(OutSymbol &Existing, const OutSymbol &Sym,
+                            std::string *ErrMsg) {
+    if (!isDefined(Sym)) {
+      // A reference is weak only if all references are.
+      if (!isDefined(Existing) && getBinding(Sym) == ELF::STB_GLOBAL)
+        Existing.Info = (ELF::STB_GLOBAL << 4) | (Existing.Info & 0xf);
+      return false;
+    }
+    if (!isDefined(Existing)) {
+      Existing = Sym;
+      return false;
+    }
+    bool ExistingCommon = Existing.Shndx == ELF::SHN_COMMON;
+    bool SymCommon = Sym.Shndx == ELF::SHN_COMMON;
+    if (ExistingCommon && SymCommon) {
+      // The value of a common symbol is its alignment.
+      Existing.Size = std::max(Existing.Size, Sym.Size);
+      Existing.Value = std::max(Existing.Value, Sym.Value);
+      return false;
+    }
+    if (SymCommon || getBinding(Sym) == ELF::STB_WEAK)
+      return false;
+    if (ExistingCommon || getBinding(Existing) == ELF::STB_WEAK) {
+      Existing = Sym;
+      return false;
+    }
+    return error(ErrMsg, "duplicate symbol: " + Sym.Name);
+  }
+
+  bool addObject(StringRef Bytes, bool IsFirst, std::string *ErrMsg);
+
+ public:
+  ELFMerger() : FirstHeader(0), NumSections(0), SymTabIndex(0),
+                SymTabOffset(0), StrTabOffset(0), ShStrTabOffset(0),
+                SymTabName(0), StrTabName(0), ShStrTabName(0),
+                SectionHeaderOffset(0), Size(0) {}
+
+  virtual bool layout(const std::vector<StringRef> &Objects,
+                      std::string *ErrMsg) LLVM_OVERRIDE;
+  virtual uint64_t getSize() const LLVM_OVERRIDE { return Size; }
+  virtual void write(uint8_t *Buf) const LLVM_OVERRIDE;
+};
+
+template <class ELFT>
+bool ELFMerger<ELFT>::addObject(StringRef Bytes, bool IsFirst,
+                                std::string *ErrMsg) {
+  const uint8_t *Base = reinterpret_cast<const uint8_t *>(Bytes.data());
+  if (Bytes.size() < sizeof(Elf_Ehdr))
+    return error(ErrMsg, "object too small");
+  const Elf_Ehdr *Header = reinterpret_cast<const Elf_Ehdr *>(Base);
+  if (IsFirst)
+    FirstHeader = Header;
+  if (!Header->checkMagic() ||
+      Header->getFileClass() != FirstHeader->getFileClass() ||
+      Header->getDataEncoding() != FirstHeader->getDataEncoding())
+    return error(ErrMsg, "not an ELF object of the expected class");
+  if (Header->e_type != ELF::ET_REL)
+    return error(ErrMsg, "not a relocatable ELF object");
+  if (Header->e_machine != FirstHeader->e_machine)
+    return error(ErrMsg, "objects have different machine types");
+  unsigned NumInSections = Header->e_shnum;
+  if (Header->e_shentsize != sizeof(Elf_Shdr) ||
+      Header->e_shoff > Bytes.size() ||
+      NumInSections > (Bytes.size() - Header->e_shoff) / sizeof(Elf_Shdr))
+    return error(ErrMsg, "invalid section header table");
+  const Elf_Shdr *InSections =
+      reinterpret_cast<const Elf_Shdr *>(Base + Header->e_shoff);
+  for (unsigned i = 0; i != NumInSections; ++i) {
+    const Elf_Shdr &S = InSections[i];
+    if (S.sh_type != ELF::SHT_NOBITS &&
+        (S.sh_offset > Bytes.size() ||
+         S.sh_size > Bytes.size() - S.sh_offset))
+      return error(ErrMsg, "section contents out of bounds");
+  }
+  if (Header->e_shstrndx >= NumInSections)
+    return error(ErrMsg, "invalid section name table");
+  const Elf_Shdr &ShStrTabHdr = InSections[Header->e_shstrndx];
+  StringRef InShStrTab(Bytes.data() + ShStrTabHdr.sh_offset,
+                       ShStrTabHdr.sh_size);
+
+  std::vector<int> SectionIndex(NumInSections, -1);
+  std::vector<uint64_t> SectionOffset(NumInSections, 0);
+
+  // Each split module has its own copy of the COMDAT groups (such as the
+  // NaCl ABI note), so only the first copy of a group is kept, and the
+  // sections of the other copies are discarded. A kept group and its
+  // members get merged sections of their own.
+  std::vector<int> SectionGroup(NumInSections, -1);
+  std::vector<bool> Discarded(NumInSections, false);
+  std::vector<std::pair<unsigned, unsigned> > GroupSignatures;
+  for (unsigned i = 1; i < NumInSections; ++i) {
+    const Elf_Shdr &S = InSections[i];
+    if (S.sh_type != ELF::SHT_GROUP)
+      continue;
+    if (S.sh_link >= NumInSections ||
+        InSections[S.sh_link].sh_type != ELF::SHT_SYMTAB)
+      return error(ErrMsg, "invalid group symbol table");
+    const Elf_Shdr &GroupSymTab = InSections[S.sh_link];
+    if (S.sh_info >= GroupSymTab.sh_size / sizeof(Elf_Sym) ||
+        GroupSymTab.sh_link >= NumInSections)
+      return error(ErrMsg, "invalid group signature");
+    const Elf_Sym &SigSym = reinterpret_cast<const Elf_Sym *>(
+        Base + GroupSymTab.sh_offset)[S.sh_info];
+    const Elf_Shdr &GroupStrTab = InSections[GroupSymTab.sh_link];
+    StringRef Signature;
+    bool ValidName;
+    if (SigSym.getType() == ELF::STT_SECTION)
+      ValidName = SigSym.st_shndx < NumInSections &&
+          getString(InShStrTab, InSections[SigSym.st_shndx].sh_name,
+                    Signature);
+    else
+      ValidName = getString(StringRef(Bytes.data() + GroupStrTab.sh_offset,
+                                      GroupStrTab.sh_size),
+                            SigSym.st_name, Signature);
+    if (!ValidName)
+      return error(ErrMsg, "invalid group signature");
+    StringRef Name;
+    if (!getString(InShStrTab, S.sh_name, Name))
+      return error(ErrMsg, "invalid section name");
+
+    unsigned NumWords = S.sh_size / sizeof(Elf_Word);
+    if (NumWords == 0)
+      return error(ErrMsg, "invalid group section");
+    const Elf_Word *Words =
+        reinterpret_cast<const Elf_Word *>(Base + S.sh_offset);
+    uint32_t Flags = Words[0];
+    bool Discard = false;
+    if (Flags & ELF::GRP_COMDAT) {
+      bool &Seen = ComdatSignatures.GetOrCreateValue(Signature).getValue();
+      Discard = Seen;
+      Seen = true;
+    }
+    if (Discard) {
+      Discarded[i] = true;
+    } else {
+      SectionIndex[i] = addSection(Name, S);
+      Sections[SectionIndex[i]].Align = 4;
+      Sections[SectionIndex[i]].GroupFlags = Flags;
+      GroupSignatures.push_back(std::make_pair(unsigned(SectionIndex[i]),
+                                               unsigned(S.sh_info)));
+    }
+    for (unsigned j = 1; j < NumWords; ++j) {
+      uint32_t Member = Words[j];
+      if (Member == 0 || Member >= NumInSections || SectionGroup[Member] >= 0 ||
+          Discarded[Member])
+        return error(ErrMsg, "invalid group member");
+      if (Discard)
+        Discarded[Member] = true;
+      else
+        SectionGroup[Member] = SectionIndex[i];
+    }
+  }
+
+  // Place the contents of each input section in a merged section.
+  const Elf_Shdr *SymTabHdr = 0;
+  for (unsigned i = 1; i < NumInSections; ++i) {
+    const Elf_Shdr &S = InSections[i];
+    switch (S.sh_type) {
+    case ELF::SHT_SYMTAB:
+      if (SymTabHdr)
+        return error(ErrMsg, "multiple symbol tables");
+      SymTabHdr = &S;
+      continue;
+    case ELF::SHT_STRTAB:
+    case ELF::SHT_REL:
+    case ELF::SHT_RELA:
+    case ELF::SHT_GROUP:
+      continue;
+    case ELF::SHT_SYMTAB_SHNDX:
+      return error(ErrMsg, "unsupported section type");
+    default:
+      break;
+    }
+    if (Discarded[i])
+      continue;
+    StringRef Name;
+    if (!getString(InShStrTab, S.sh_name, Name))
+      return error(ErrMsg, "invalid section name");
+    unsigned Index;
+    if (SectionGroup[i] >= 0) {
+      Index = addSection(Name, S);
+      Sections[SectionGroup[i]].GroupMembers.push_back(Index);
+    } else {
+      if (S.sh_flags & ELF::SHF_GROUP)
+        return error(ErrMsg, "section not in a group: " + Name);
+      StringMapEntry<unsigned> &Entry =
+          SectionMap.GetOrCreateValue(Name, ~0U);
+      if (Entry.getValue() == ~0U)
+        Entry.setValue(addSection(Name, S));
+      Index = Entry.getValue();
+    }
+    OutSection &Out = Sections[Index];
+    if (Out.Type != S.sh_type || Out.Flags != S.sh_flags)
+      return error(ErrMsg, "conflicting attributes for section " + Name);
+    // The attributes sections of the split modules are identical.
+    if (S.sh_type == ELF::SHT_ARM_ATTRIBUTES && !Out.Pieces.empty())
+      continue;
+    uint64_t Align = std::max<uint64_t>(S.sh_addralign, 1);
+    Piece P;
+    P.Data = S.sh_type == ELF::SHT_NOBITS ? 0 : Base + S.sh_offset;
+    P.Offset = RoundUpToAlignment(Out.Size, Align);
+    P.Size = S.sh_size;
+    Out.Pieces.push_back(P);
+    Out.Size = P.Offset + P.Size;
+    Out.Align = std::max(Out.Align, Align);
+    SectionIndex[i] = Index;
+    SectionOffset[i] = P.Offset;
+  }
+
+  // Sections ordered by SHF_LINK_ORDER (such as .ARM.exidx) link to the
+  // merged section that contains the section they are ordered by. The
+  // pieces of both are concatenated in the same order.
+  for (unsigned i = 1; i < NumInSections; ++i) {
+    const Elf_Shdr &S = InSections[i];
+    if (SectionIndex[i] < 0 || !(S.sh_flags & ELF::SHF_LINK_ORDER))
+      continue;
+    if (S.sh_link >= NumInSections || SectionIndex[S.sh_link] < 0)
+      return error(ErrMsg, "invalid section link");
+    unsigned Link = 1 + SectionIndex[S.sh_link];
+    OutSection &Out = Sections[SectionIndex[i]];
+    if (Out.Link && Out.Link != Link)
+      return error(ErrMsg, "conflicting links for section " + Out.Name);
+    Out.Link = Link;
+  }
+
+  if (!SymTabHdr) {
+    for (unsigned i = 1; i < NumInSections; ++i) {
+      if (InSections[i].sh_type == ELF::SHT_REL ||
+          InSections[i].sh_type == ELF::SHT_RELA)
+        return error(ErrMsg, "relocations without a symbol table");
+    }
+    return false;
+  }
+
+  // Merge the symbols.
+  if (SymTabHdr->sh_link >= NumInSections)
+    return error(ErrMsg, "invalid symbol table link");
+  const Elf_Shdr &StrTabHdr = InSections[SymTabHdr->sh_link];
+  StringRef InStrTab(Bytes.data() + StrTabHdr.sh_offset, StrTabHdr.sh_size);
+  const Elf_Sym *InSyms =
+      reinterpret_cast<const Elf_Sym *>(Base + SymTabHdr->sh_offset);
+  unsigned NumInSyms = SymTabHdr->sh_size / sizeof(Elf_Sym);
+  std::vector<SymbolRef> SymbolMap(NumInSyms);
+  // Local symbols standing in for the section symbols of sections that
+  // were not placed at the start of their merged section.
+  DenseMap<unsigned, unsigned> SectionStandIns;
+  for (unsigned i = 1; i < NumInSyms; ++i) {
+    const Elf_Sym &S = InSyms[i];
+    OutSymbol Sym;
+    if (!getString(InStrTab, S.st_name, Sym.Name))
+      return error(ErrMsg, "invalid symbol name");
+    Sym.Value = S.st_value;
+    Sym.Size = S.st_size;
+    Sym.Info = S.st_info;
+    Sym.Other = S.st_other;
+    Sym.Shndx = S.st_shndx;
+    Sym.NameOffset = 0;
+    if (Sym.Shndx == ELF::SHN_XINDEX)
+      return error(ErrMsg, "extended section indices are not supported");
+    bool InSection = Sym.Shndx != ELF::SHN_UNDEF &&
+        Sym.Shndx < ELF::SHN_LORESERVE;
+    if (InSection) {
+      if (Sym.Shndx >= NumInSections)
+        return error(ErrMsg, "invalid symbol section index");
+      if (SectionIndex[Sym.Shndx] >= 0) {
+        Sym.Value += SectionOffset[Sym.Shndx];
+        Sym.Shndx = 1 + SectionIndex[Sym.Shndx];
+      } else if (Discarded[Sym.Shndx] && S.getBinding() != ELF::STB_LOCAL) {
+        // A global symbol of a discarded group is defined by the copy of
+        // the group that was kept.
+        Sym.Value = 0;
+        Sym.Shndx = ELF::SHN_UNDEF;
+        InSection = false;
+      } else {
+        // Only local symbols may refer to sections that aren't merged,
+        // such as the ARM attributes of all but the first object.
+        if (S.getBinding() != ELF::STB_LOCAL)
+          return error(ErrMsg, "symbol in unsupported section: " + Sym.Name);
+        continue;
+      }
+    }
+
+    if (S.getType() == ELF::STT_SECTION) {
+      if (!InSection)
+        continue;
+      if (SectionOffset[S.st_shndx] == 0) {
+        SymbolMap[i] = SymbolRef(SymbolRef::Section, Sym.Shndx - 1);
+        continue;
+      }
+      // Relocations against the section symbol of a section that was
+      // moved refer to a local symbol at the start of the section instead,
+      // so that the addends stay the same.
+      DenseMap<unsigned, unsigned>::iterator I =
+          SectionStandIns.find(S.st_shndx);
+      if (I == SectionStandIns.end()) {
+        Sym.Name = StringRef();
+        Sym.Size = 0;
+        Sym.Info = (ELF::STB_LOCAL << 4) | ELF::STT_NOTYPE;
+        Sym.Other = ELF::STV_DEFAULT;
+        I = SectionStandIns.insert(
+            std::make_pair(unsigned(S.st_shndx), unsigned(Locals.size())))
+            .first;
+        Locals.push_back(Sym);
+      }
+      SymbolMap[i] = SymbolRef(SymbolRef::Local, I->second);
+      continue;
+    }
+    if (S.getType() == ELF::STT_FILE) {
+      // Each split module names the same file.
+      bool &Seen = FileSymbols.GetOrCreateValue(Sym.Name).getValue();
+      if (!Seen) {
+        Seen = true;
+        Locals.push_back(Sym);
+      }
+      continue;
+    }
+    if (S.getBinding() == ELF::STB_LOCAL) {
+      SymbolMap[i] = SymbolRef(SymbolRef::Local, Locals.size());
+      Locals.push_back(Sym);
+      continue;
+    }
+    if (S.getBinding() != ELF::STB_GLOBAL && S.getBinding() != ELF::STB_WEAK)
+      return error(ErrMsg, "unsupported symbol binding: " + Sym.Name);
+    StringMapEntry<unsigned> &Entry = GlobalMap.GetOrCreateValue(Sym.Name, ~0U);
+    if (Entry.getValue() == ~0U) {
+      Entry.setValue(Globals.size());
+      Globals.push_back(Sym);
+    } else if (resolveGlobal(Globals[Entry.getValue()], Sym, ErrMsg)) {
+      return true;
+    }
+    SymbolMap[i] = SymbolRef(SymbolRef::Global, Entry.getValue());
+  }
+  for (size_t i = 0, e = GroupSignatures.size(); i != e; ++i) {
+    SymbolRef Signature = SymbolMap[GroupSignatures[i].second];
+    if (Signature.Kind == SymbolRef::Null)
+      return error(ErrMsg, "unsupported group signature");
+    Sections[GroupSignatures[i].first].GroupSignature = Signature;
+  }
+
+  // Rewrite the relocations.
+  for (unsigned i = 1; i < NumInSections; ++i) {
+    const Elf_Shdr &S = InSections[i];
+    bool IsRela = S.sh_type == ELF::SHT_RELA;
+    if ((S.sh_type != ELF::SHT_REL && !IsRela) || Discarded[i])
+      continue;
+    if (&InSections[S.sh_link] != SymTabHdr || S.sh_info >= NumInSections ||
+        SectionIndex[S.sh_info] < 0)
+      return error(ErrMsg, "invalid relocation section");
+    OutSection &Out = Sections[SectionIndex[S.sh_info]];
+    if (Out.HasRelocs && Out.IsRela != IsRela)
+      return error(ErrMsg, "mixed relocation formats for section " +
+                   Out.Name);
+    Out.HasRelocs = true;
+    Out.IsRela = IsRela;
+    uint64_t Offset = SectionOffset[S.sh_info];
+    size_t EntSize = IsRela ? sizeof(Elf_Rela) : sizeof(Elf_Rel);
+    unsigned NumRelocs = S.sh_size / EntSize;
+    const uint8_t *Entries = Base + S.sh_offset;
+    for (unsigned j = 0; j != NumRelocs; ++j) {
+      const Elf_Rel *R = reinterpret_cast<const Elf_Rel *>(
+          Entries + j * EntSize);
+      uint32_t SymIndex = R->getSymbol(false);
+      if (SymIndex >= NumInSyms)
+        return error(ErrMsg, "invalid relocation symbol");
+      OutReloc Reloc;
+      Reloc.Offset = R->r_offset + Offset;
+      Reloc.Sym = SymbolMap[SymIndex];
+      Reloc.Type = R->getType(false);
+      Reloc.Addend =
+          IsRela ? int64_t(reinterpret_cast<const Elf_Rela *>(R)->r_addend)
+                 : 0;
+      if (SymIndex != 0 && Reloc.Sym.Kind == SymbolRef::Null)
+        return error(ErrMsg, "relocation against unsupported symbol");
+      Out.Relocs.push_back(Reloc);
+    }
+  }
+  return false;
+}
+
+template <class ELFT>
+bool ELFMerger<ELFT>::layout(const std::vector<StringRef> &Objects,
+                             std::string *ErrMsg) {
+  for (size_t i = 0, e = Objects.size(); i != e; ++i) {
+    if (addObject(Objects[i], i == 0, ErrMsg))
+      return true;
+  }
+
+  // Assign section indices and names: the merged sections, then their
+  // relocation sections, then the symbol and string tables.
+  addString(ShStrTab, "");
+  NumSections = 1 + Sections.size();
+  for (size_t i = 0, e = Sections.size(); i != e; ++i) {
+    OutSection &Out = Sections[i];
+    Out.NameOffset = addString(ShStrTab, Out.Name);
+    if (!Out.HasRelocs)
+      continue;
+    Out.RelName = (Out.IsRela ? ".rela" : ".rel") + Out.Name.str();
+    Out.RelNameOffset = addString(ShStrTab, Out.RelName);
+    Out.RelIndex = NumSections++;
+  }
+  // A group lists the relocation sections of its members as well.
+  for (size_t i = 0, e = Sections.size(); i != e; ++i) {
+    OutSection &Out = Sections[i];
+    if (Out.Type != ELF::SHT_GROUP)
+      continue;
+    Out.Size = 1 + Out.GroupMembers.size();
+    for (size_t j = 0, je = Out.GroupMembers.size(); j != je; ++j)
+      Out.Size += Sections[Out.GroupMembers[j]].HasRelocs;
+    Out.Size *= sizeof(Elf_Word);
+  }
+  SymTabIndex = NumSections;
+  NumSections += 3;
+  if (NumSections >= ELF::SHN_LORESERVE)
+    return error(ErrMsg, "too many sections");
+  SymTabName = addString(ShStrTab, ".symtab");
+  StrTabName = addString(ShStrTab, ".strtab");
+  ShStrTabName = addString(ShStrTab, ".shstrtab");
+
+  addString(StrTab, "");
+  for (size_t i = 0, e = Locals.size(); i != e; ++i)
+    Locals[i].NameOffset = addSymbolName(Locals[i].Name);
+  for (size_t i = 0, e = Globals.size(); i != e; ++i)
+    Globals[i].NameOffset = addSymbolName(Globals[i].Name);
+
+  // Lay out the file.
+  uint64_t Offset = sizeof(Elf_Ehdr);
+  for (size_t i = 0, e = Sections.size(); i != e; ++i) {
+    OutSection &Out = Sections[i];
+    Offset = RoundUpToAlignment(Offset, Out.Align);
+    Out.FileOffset = Offset;
+    if (Out.Type != ELF::SHT_NOBITS)
+      Offset += Out.Size;
+  }
+  for (size_t i = 0, e = Sections.size(); i != e; ++i) {
+    OutSection &Out = Sections[i];
+    if (!Out.HasRelocs)
+      continue;
+    Offset = RoundUpToAlignment(Offset, WordSize);
+    Out.RelFileOffset = Offset;
+    Offset += Out.Relocs.size() *
+        (Out.IsRela ? sizeof(Elf_Rela) : sizeof(Elf_Rel));
+  }
+  Offset = RoundUpToAlignment(Offset, WordSize);
+  SymTabOffset = Offset;
+  Offset += (1 + Sections.size() + Locals.size() + Globals.size()) *
+      sizeof(Elf_Sym);
+  StrTabOffset = Offset;
+  Offset += StrTab.size();
+  ShStrTabOffset = Offset;
+  Offset += ShStrTab.size();
+  SectionHeaderOffset = RoundUpToAlignment(Offset, WordSize);
+  Size = SectionHeaderOffset + NumSections * sizeof(Elf_Shdr);
+  return false;
+}
+
+// Fills the padding of executable sections with instructions that trap.
+static void fillTrap(uint8_t *Buf, uint64_t Size, unsigned Machine) {
+  switch (Machine) {
+  case ELF::EM_386:
+  case ELF::EM_X86_64:
+    // hlt
+    memset(Buf, 0xf4, Size);
+    break;
+  case ELF::EM_ARM:
+    // The NaCl trap instruction, 0xe7fedef0 (little-endian).
+    for (uint64_t i = 0; i + 4 <= Size; i += 4) {
+      Buf[i] = 0xf0;
+      Buf[i + 1] = 0xde;
+      Buf[i + 2] = 0xfe;
+      Buf[i + 3] = 0xe7;
+    }
+    break;
+  default:
+    break;
+  }
+}
+
+template <class ELFT>
+void ELFMerger<ELFT>::write(uint8_t *Buf) const {
+  memset(Buf, 0, Size);
+
+  Elf_Ehdr *Header = reinterpret_cast<Elf_Ehdr *>(Buf);
+  memcpy(Header->e_ident, FirstHeader->e_ident, ELF::EI_NIDENT);
+  Header->e_type = ELF::ET_REL;
+  Header->e_machine = FirstHeader->e_machine;
+  Header->e_version = FirstHeader->e_version;
+  Header->e_flags = FirstHeader->e_flags;
+  Header->e_ehsize = sizeof(Elf_Ehdr);
+  Header->e_shoff = SectionHeaderOffset;
+  Header->e_shentsize = sizeof(Elf_Shdr);
+  Header->e_shnum = NumSections;
+  Header->e_shstrndx = SymTabIndex + 2;
+
+  Elf_Shdr *Shdrs = reinterpret_cast<Elf_Shdr *>(Buf + SectionHeaderOffset);
+  for (size_t i = 0, e = Sections.size(); i != e; ++i) {
+    const OutSection &Out = Sections[i];
+    Elf_Shdr &S = Shdrs[1 + i];
+    S.sh_name = Out.NameOffset;
+    S.sh_type = Out.Type;
+    S.sh_flags = Out.Flags;
+    S.sh_offset = Out.FileOffset;
+    S.sh_size = Out.Size;
+    S.sh_link = Out.Link;
+    S.sh_addralign = Out.Align;
+    S.sh_entsize = Out.EntSize;
+    if (Out.Type == ELF::SHT_GROUP) {
+      S.sh_link = SymTabIndex;
+      S.sh_info = getSymbolIndex(Out.GroupSignature);
+      Elf_Word *Words = reinterpret_cast<Elf_Word *>(Buf + Out.FileOffset);
+      *Words++ = Out.GroupFlags;
+      for (size_t j = 0, je = Out.GroupMembers.size(); j != je; ++j) {
+        const OutSection &Member = Sections[Out.GroupMembers[j]];
+        *Words++ = 1 + Out.GroupMembers[j];
+        if (Member.HasRelocs)
+          *Words++ = Member.RelIndex;
+      }
+    } else if (Out.Type != ELF::SHT_NOBITS) {
+      uint8_t *Contents = Buf + Out.FileOffset;
+      if (Out.Flags & ELF::SHF_EXECINSTR)
+        fillTrap(Contents, Out.Size, FirstHeader->e_machine);
+      for (size_t j = 0, je = Out.Pieces.size(); j != je; ++j) {
+        const Piece &P = Out.Pieces[j];
+        memcpy(Contents + P.Offset, P.Data, P.Size);
+      }
+    }
+    if (!Out.HasRelocs)
+      continue;
+
+    Elf_Shdr &R = Shdrs[Out.RelIndex];
+    size_t EntSize = Out.IsRela ? sizeof(Elf_Rela) : sizeof(Elf_Rel);
+    R.sh_name = Out.RelNameOffset;
+    R.sh_type = Out.IsRela ? ELF::SHT_RELA : ELF::SHT_REL;
+    R.sh_offset = Out.RelFileOffset;
+    R.sh_size = Out.Relocs.size() * EntSize;
+    R.sh_link = SymTabIndex;
+    R.sh_info = 1 + i;
+    R.sh_addralign = WordSize;
+    R.sh_entsize = EntSize;
+    uint8_t *Entries = Buf + Out.RelFileOffset;
+    for (size_t j = 0, je = Out.Relocs.size(); j != je; ++j) {
+      const OutReloc &Reloc = Out.Relocs[j];
+      Elf_Rela *Entry = reinterpret_cast<Elf_Rela *>(Entries + j * EntSize);
+      Entry->r_offset = Reloc.Offset;
+      Entry->setSymbolAndType(getSymbolIndex(Reloc.Sym), Reloc.Type);
+      if (Out.IsRela)
+        Entry->r_addend = Reloc.Addend;
+    }
+  }
+
+  // The symbol table.
+  Elf_Sym *Syms = reinterpret_cast<Elf_Sym *>(Buf + SymTabOffset);
+  for (size_t i = 0, e = Sections.size(); i != e; ++i) {
+    Elf_Sym &S = Syms[1 + i];
+    S.setBindingAndType(ELF::STB_LOCAL, ELF::STT_SECTION);
+    S.st_shndx = 1 + i;
+  }
+  Elf_Sym *Sym = Syms + 1 + Sections.size();
+  for (size_t Pass = 0; Pass != 2; ++Pass) {
+    const std::vector<OutSymbol> &List = Pass == 0 ? Locals : Globals;
+    for (size_t i = 0, e = List.size(); i != e; ++i, ++Sym) {
+      Sym->st_name = List[i].NameOffset;
+      Sym->st_value = List[i].Value;
+      Sym->st_size = List[i].Size;
+      Sym->st_info = List[i].Info;
+      Sym->st_other = List[i].Other;
+      Sym->st_shndx = List[i].Shndx;
+    }
+  }
+  memcpy(Buf + StrTabOffset, StrTab.data(), StrTab.size());
+  memcpy(Buf + ShStrTabOffset, ShStrTab.data(), ShStrTab.size());
+
+  Elf_Shdr &SymTab = Shdrs[SymTabIndex];
+  SymTab.sh_name = SymTabName;
+  SymTab.sh_type = ELF::SHT_SYMTAB;
+  SymTab.sh_offset = SymTabOffset;
+  SymTab.sh_size = StrTabOffset - SymTabOffset;
+  SymTab.sh_link = SymTabIndex + 1;
+  SymTab.sh_info = 1 + Sections.size() + Locals.size();
+  SymTab.sh_addralign = WordSize;
+  SymTab.sh_entsize = sizeof(Elf_Sym);
+  Elf_Shdr &StrTabHdr = Shdrs[SymTabIndex + 1];
+  StrTabHdr.sh_name = StrTabName;
+  StrTabHdr.sh_type = ELF::SHT_STRTAB;
+  StrTabHdr.sh_offset = StrTabOffset;
+  StrTabHdr.sh_size = StrTab.size();
+  StrTabHdr.sh_addralign = 1;
+  Elf_Shdr &ShStrTabHdr = Shdrs[SymTabIndex + 2];
+  ShStrTabHdr.sh_name = ShStrTabName;
+  ShStrTabHdr.sh_type = ELF::SHT_STRTAB;
+  ShStrTabHdr.sh_offset = ShStrTabOffset;
+  ShStrTabHdr.sh_size = ShStrTab.size();
+  ShStrTabHdr.sh_addralign = 1;
+}
+
+} // end anonymous namespace
+
+ELFObjectMerger::ELFObjectMerger() {}
+
+ELFObjectMerger::~ELFObjectMerger() {}
+
+void ELFObjectMerger::addObject(StringRef Bytes) {
+  Objects.push_back(Bytes);
+}
+
+bool ELFObjectMerger::layout(std::string *ErrMsg) {
+  if (Objects.empty()) {
+    *ErrMsg = "no objects to merge";
+    return true;
+  }
+  StringRef First = Objects[0];
+  if (First.size() < ELF::EI_NIDENT ||
+      memcmp(First.data(), ELF::ElfMagic, strlen(ELF::ElfMagic)) != 0) {
+    *ErrMsg = "not an ELF object";
+    return true;
+  }
+  bool Is64Bits = First[ELF::EI_CLASS] == ELF::ELFCLASS64;
+  bool IsLittleEndian = First[ELF::EI_DATA] == ELF::ELFDATA2LSB;
+  if (!IsLittleEndian) {
+    *ErrMsg = "big-endian ELF objects are not supported";
+    return true;
+  }
+  if (Is64Bits)
+    Impl.reset(new ELFMerger<ELFType<support::little, 8, true> >());
+  else
+    Impl.reset(new ELFMerger<ELFType<support::little, 4, false> >());
+  return Impl->layout(Objects, ErrMsg);
+}
+
+uint64_t ELFObjectMerger::getSize() const {
+  return Impl->getSize();
+}
+
+void ELFObjectMerger::write(uint8_t *Buf) const {
+  Impl->write(Buf);
+}
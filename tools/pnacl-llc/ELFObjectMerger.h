@@ -0,0 +1,64 @@
+//===-- ELFObjectMerger.h - Merge split-module objects ----------*- C++ -*-===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// Merges the relocatable ELF objects produced for each split module into a
+// single relocatable ELF object, much like "ld -r" would, so that no extra
+// link step is needed to combine them.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef ELFOBJECTMERGER_H
+#define ELFOBJECTMERGER_H
+
+#include "llvm/ADT/OwningPtr.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Support/Compiler.h"
+#include "llvm/Support/DataTypes.h"
+#include <string>
+#include <vector>
+
+class ELFObjectMergerImpl;
+
+// Sections with the same name are concatenated in the order the objects
+// were added, padding executable sections with trap instructions. The
+// symbol tables are merged, resolving undefined symbols of one object
+// against the definitions of another, and relocations are rewritten to
+// refer to the merged sections and symbols. Each object has its own copy
+// of the COMDAT groups, such as the one holding the NaCl ABI note: the
+// first copy of a group is kept, with its members in sections of their
+// own, and the others are discarded. Only what MC emits for split modules
+// is supported.
+class ELFObjectMerger {
+ public:
+  ELFObjectMerger();
+  ~ELFObjectMerger();
+
+  // Adds an object to merge. Its bytes must stay valid while the merger
+  // is in use.
+  void addObject(llvm::StringRef Bytes);
+
+  // Lays out the merged object. Returns true and sets ErrMsg on error.
+  bool layout(std::string *ErrMsg);
+
+  // Returns the size of the merged object, once laid out.
+  uint64_t getSize() const;
+
+  // Writes the merged object, once laid out, to Buf, which must hold
+  // getSize() bytes.
+  void write(uint8_t *Buf) const;
+
+ private:
+  std::vector<llvm::StringRef> Objects;
+  llvm::OwningPtr<ELFObjectMergerImpl> Impl;
+
+  ELFObjectMerger(const ELFObjectMerger&) LLVM_DELETED_FUNCTION;
+  void operator=(const ELFObjectMerger&) LLVM_DELETED_FUNCTION;
+};
+
+#endif // ELFOBJECTMERGER_H
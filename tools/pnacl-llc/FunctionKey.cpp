@@ -0,0 +1,263 @@
+//===-- FunctionKey.cpp - Describe functions for the cache ----------------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// The description covers the same state of each instruction that
+// Instruction::isSameOperationAs compares, plus the flags, the alloca
+// alignment and the incoming blocks of phi nodes. It is written in a
+// compact form rather than with the assembly writer, since printing a
+// value with the assembly writer walks the whole module each time.
+//
+//===----------------------------------------------------------------------===//
+
+#include "FunctionKey.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/SmallPtrSet.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/GlobalAlias.h"
+#include "llvm/IR/GlobalVariable.h"
+#include "llvm/IR/InlineAsm.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/Support/raw_ostream.h"
+
+using namespace llvm;
+
+namespace {
+
+class FunctionDescriber {
+ public:
+  explicit FunctionDescriber(raw_ostream &OS) : OS(OS) {}
+
+  bool describe(const Function &F);
+
+ private:
+  void describeName(StringRef Name);
+  void describeType(const Type *Ty);
+  void describeAttributes(AttributeSet Attrs);
+  void describeGlobal(const GlobalValue *GV);
+  bool describeInstruction(const Instruction *I);
+  bool describeOperand(const Value *V);
+  bool describeConstant(const Constant *C);
+
+  raw_ostream &OS;
+  // The numbers of the arguments, basic blocks and instructions.
+  DenseMap<const Value *, unsigned> LocalNumbers;
+  // The global values referred to, in the order of their first use.
+  SmallVector<const GlobalValue *, 16> Globals;
+  SmallPtrSet<const GlobalValue *, 16> SeenGlobals;
+};
+
+} // end of anonymous namespace
+
+void FunctionDescriber::describeName(StringRef Name) {
+  OS << Name.size() << ':' << Name << ' ';
+}
+
+void FunctionDescriber::describeType(const Type *Ty) {
+  Ty->print(OS);
+  OS << ' ';
+}
+
+void FunctionDescriber::describeAttributes(AttributeSet Attrs) {
+  for (unsigned i = 0, e = Attrs.getNumSlots(); i != e; ++i) {
+    unsigned Index = Attrs.getSlotIndex(i);
+    OS << Index << '=';
+    describeName(Attrs.getAsString(Index));
+  }
+  OS << "; ";
+}
+
+// Describes what the code referring to GV may depend on: everything but
+// its initializer or body.
+void FunctionDescriber::describeGlobal(const GlobalValue *GV) {
+  describeName(GV->getName());
+  describeType(GV->getType());
+  OS << GV->getLinkage() << ' ' << GV->getVisibility() << ' '
+     << GV->getAlignment() << ' ' << GV->hasUnnamedAddr() << ' '
+     << GV->isDeclaration() << ' ';
+  describeName(GV->getSection());
+  if (const GlobalVariable *Var = dyn_cast<GlobalVariable>(GV)) {
+    OS << "variable " << Var->getThreadLocalMode() << ' '
+       << Var->isConstant() << ' ' << Var->isExternallyInitialized();
+  } else if (const Function *Func = dyn_cast<Function>(GV)) {
+    OS << "function " << Func->getCallingConv() << ' ';
+    describeName(Func->hasGC() ? Func->getGC() : "");
+    describeAttributes(Func->getAttributes());
+  }
+  OS << '\n';
+}
+
+bool FunctionDescriber::describe(const Function &F) {
+  if (F.hasPrefixData())
+    return false;
+
+  // Number all local values first, since phi nodes may use values that
+  // are defined later.
+  unsigned Next = 0;
+  for (Function::const_arg_iterator I = F.arg_begin(), E = F.arg_end();
+       I != E; ++I)
+    LocalNumbers[I] = Next++;
+  for (Function::const_iterator BB = F.begin(), E = F.end(); BB != E; ++BB) {
+    LocalNumbers[BB] = Next++;
+    for (BasicBlock::const_iterator I = BB->begin(), IE = BB->end();
+         I != IE; ++I)
+      LocalNumbers[I] = Next++;
+  }
+
+  OS << "define ";
+  describeGlobal(&F);
+  for (Function::const_iterator BB = F.begin(), E = F.end(); BB != E; ++BB) {
+    OS << "block\n";
+    for (BasicBlock::const_iterator I = BB->begin(), IE = BB->end();
+         I != IE; ++I) {
+      if (!describeInstruction(I))
+        return false;
+    }
+  }
+  for (unsigned i = 0, e = Globals.size(); i != e; ++i) {
+    OS << "declare ";
+    describeGlobal(Globals[i]);
+  }
+  return true;
+}
+
+bool FunctionDescriber::describeInstruction(const Instruction *I) {
+  // Metadata, including debug locations, is numbered module-wide.
+  if (I->hasMetadata())
+    return false;
+
+  OS << I->getOpcodeName() << ' ' << I->getRawSubclassOptionalData() << ' ';
+  describeType(I->getType());
+  if (const AllocaInst *AI = dyn_cast<AllocaInst>(I)) {
+    OS << AI->getAlignment() << ' ';
+  } else if (const LoadInst *LI = dyn_cast<LoadInst>(I)) {
+    OS << LI->isVolatile() << ' ' << LI->getAlignment() << ' '
+       << LI->getOrdering() << ' ' << LI->getSynchScope() << ' ';
+  } else if (const StoreInst *SI = dyn_cast<StoreInst>(I)) {
+    OS << SI->isVolatile() << ' ' << SI->getAlignment() << ' '
+       << SI->getOrdering() << ' ' << SI->getSynchScope() << ' ';
+  } else if (const CmpInst *CI = dyn_cast<CmpInst>(I)) {
+    OS << CI->getPredicate() << ' ';
+  } else if (const CallInst *CI = dyn_cast<CallInst>(I)) {
+    OS << CI->isTailCall() << ' ' << CI->getCallingConv() << ' ';
+    describeAttributes(CI->getAttributes());
+  } else if (const InvokeInst *II = dyn_cast<InvokeInst>(I)) {
+    OS << II->getCallingConv() << ' ';
+    describeAttributes(II->getAttributes());
+  } else if (const InsertValueInst *IVI = dyn_cast<InsertValueInst>(I)) {
+    for (unsigned i = 0, e = IVI->getNumIndices(); i != e; ++i)
+      OS << IVI->getIndices()[i] << ' ';
+  } else if (const ExtractValueInst *EVI = dyn_cast<ExtractValueInst>(I)) {
+    for (unsigned i = 0, e = EVI->getNumIndices(); i != e; ++i)
+      OS << EVI->getIndices()[i] << ' ';
+  } else if (const FenceInst *FI = dyn_cast<FenceInst>(I)) {
+    OS << FI->getOrdering() << ' ' << FI->getSynchScope() << ' ';
+  } else if (const AtomicCmpXchgInst *CXI = dyn_cast<AtomicCmpXchgInst>(I)) {
+    OS << CXI->isVolatile() << ' ' << CXI->getOrdering() << ' '
+       << CXI->getSynchScope() << ' ';
+  } else if (const AtomicRMWInst *RMWI = dyn_cast<AtomicRMWInst>(I)) {
+    OS << RMWI->getOperation() << ' ' << RMWI->isVolatile() << ' '
+       << RMWI->getOrdering() << ' ' << RMWI->getSynchScope() << ' ';
+  } else if (const LandingPadInst *LPI = dyn_cast<LandingPadInst>(I)) {
+    OS << LPI->isCleanup() << ' ';
+  } else if (const PHINode *PN = dyn_cast<PHINode>(I)) {
+    for (unsigned i = 0, e = PN->getNumIncomingValues(); i != e; ++i)
+      OS << '%' << LocalNumbers.lookup(PN->getIncomingBlock(i)) << ' ';
+  }
+  for (unsigned i = 0, e = I->getNumOperands(); i != e; ++i) {
+    if (!describeOperand(I->getOperand(i)))
+      return false;
+  }
+  OS << '\n';
+  return true;
+}
+
+bool FunctionDescriber::describeOperand(const Value *V) {
+  if (isa<Argument>(V) || isa<BasicBlock>(V) || isa<Instruction>(V)) {
+    DenseMap<const Value *, unsigned>::const_iterator I =
+        LocalNumbers.find(V);
+    if (I == LocalNumbers.end())
+      return false;
+    OS << '%' << I->second << ' ';
+    return true;
+  }
+  if (const Constant *C = dyn_cast<Constant>(V))
+    return describeConstant(C);
+  if (const InlineAsm *IA = dyn_cast<InlineAsm>(V)) {
+    OS << "asm ";
+    describeType(IA->getType());
+    describeName(IA->getAsmString());
+    describeName(IA->getConstraintString());
+    OS << IA->hasSideEffects() << ' ' << IA->isAlignStack() << ' '
+       << IA->getDialect() << ' ';
+    return true;
+  }
+  // Metadata operands, of intrinsic calls for instance.
+  return false;
+}
+
+bool FunctionDescriber::describeConstant(const Constant *C) {
+  if (const GlobalValue *GV = dyn_cast<GlobalValue>(C)) {
+    // The code refers to the aliasee, which may change under the alias.
+    if (isa<GlobalAlias>(GV))
+      return false;
+    OS << '@';
+    describeName(GV->getName());
+    if (SeenGlobals.insert(GV))
+      Globals.push_back(GV);
+    return true;
+  }
+
+  describeType(C->getType());
+  if (const ConstantInt *CI = dyn_cast<ConstantInt>(C)) {
+    OS << CI->getValue().toString(16, false) << ' ';
+  } else if (const ConstantFP *CFP = dyn_cast<ConstantFP>(C)) {
+    OS << CFP->getValueAPF().bitcastToAPInt().toString(16, false) << ' ';
+  } else if (isa<ConstantPointerNull>(C)) {
+    OS << "null ";
+  } else if (isa<UndefValue>(C)) {
+    OS << "undef ";
+  } else if (isa<ConstantAggregateZero>(C)) {
+    OS << "zeroinitializer ";
+  } else if (const ConstantDataSequential *CDS =
+                 dyn_cast<ConstantDataSequential>(C)) {
+    OS << "data ";
+    describeName(CDS->getRawDataValues());
+  } else if (const ConstantExpr *CE = dyn_cast<ConstantExpr>(C)) {
+    OS << CE->getOpcodeName() << ' ' << CE->getRawSubclassOptionalData()
+       << ' ';
+    if (CE->isCompare())
+      OS << CE->getPredicate() << ' ';
+    if (CE->hasIndices()) {
+      ArrayRef<unsigned> Indices = CE->getIndices();
+      for (unsigned i = 0, e = Indices.size(); i != e; ++i)
+        OS << Indices[i] << ' ';
+    }
+    for (unsigned i = 0, e = CE->getNumOperands(); i != e; ++i) {
+      if (!describeConstant(CE->getOperand(i)))
+        return false;
+    }
+  } else if (isa<ConstantArray>(C) || isa<ConstantStruct>(C) ||
+             isa<ConstantVector>(C)) {
+    OS << "aggregate ";
+    for (unsigned i = 0, e = C->getNumOperands(); i != e; ++i) {
+      if (!describeConstant(cast<Constant>(C->getOperand(i))))
+        return false;
+    }
+  } else {
+    // Block addresses refer to blocks of other functions.
+    return false;
+  }
+  return true;
+}
+
+bool describeFunction(const Function &F, raw_ostream &OS) {
+  return FunctionDescriber(OS).describe(F);
+}
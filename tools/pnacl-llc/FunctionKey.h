@@ -0,0 +1,34 @@
+//===-- FunctionKey.h - Describe functions for the cache --------*- C++ -*-===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// Describes everything that the object code of a single function depends
+// on, so that -function-cache-dir can key the function's cached object on
+// a hash of the description.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef FUNCTIONKEY_H
+#define FUNCTIONKEY_H
+
+namespace llvm {
+class Function;
+class raw_ostream;
+}
+
+// Writes a description of the materialized function F to OS: its own
+// declaration, its body, and the declarations of the global values it
+// refers to. Global values are referred to by name, which is also how
+// the function's object refers to them, so the description doesn't
+// change when unrelated global values are added to or removed from the
+// module. Local values and basic blocks are numbered in order. Returns
+// false if F uses a construct (such as metadata or block addresses) that
+// can't be described this way, in which case F mustn't be cached.
+bool describeFunction(const llvm::Function &F, llvm::raw_ostream &OS);
+
+#endif // FUNCTIONKEY_H
@@ -10,16 +10,22 @@
 #ifndef THREADEDFUNCTIONQUEUE_H
 #define THREADEDFUNCTIONQUEUE_H
 
+#include <algorithm>
+#include <deque>
 #include <limits>
+#include <vector>
 
 #include "llvm/IR/Module.h"
 #include "llvm/Support/ErrorHandling.h"
+#include "llvm/Support/Mutex.h"
 
 // A "queue" that keeps track of which functions have been assigned to
-// threads and which functions have not yet been assigned. It does not
-// actually use a queue data structure and instead uses a number which
-// tracks the minimum unassigned function ID, expecting each thread
-// to have the same view of function IDs.
+// threads and which functions have not yet been assigned. For static
+// and dynamic scheduling, it does not actually use a queue data structure
+// and instead uses a number which tracks the minimum unassigned function
+// ID, expecting each thread to have the same view of function IDs.
+// For cost-based scheduling, it keeps a deque of function IDs per thread
+// (see ScheduleByCost).
 class ThreadedFunctionQueue {
  public:
   ThreadedFunctionQueue(Module *mod, unsigned NumThreads)
@@ -40,7 +46,10 @@ class ThreadedFunctionQueue {
     NumFunctions = Size;
   }
 
-  ~ThreadedFunctionQueue() {}
+  ~ThreadedFunctionQueue() {
+    for (unsigned i = 0, e = Queues.size(); i != e; ++i)
+      delete Queues[i];
+  }
 
   // Assign functions in a static manner between threads.
   bool GrabFunctionStatic(unsigned FuncIndex, unsigned ThreadIndex) const {
@@ -95,15 +104,87 @@ class ThreadedFunctionQueue {
     return std::max(1, std::min(8, DynamicChunkSize));
   }
 
+  // Sets up cost-based scheduling, where Costs[i] is the estimated cost
+  // of compiling function i. Functions are distributed between the
+  // per-thread queues most expensive first, each going to the thread with
+  // the least total cost so far. Each queue is thus ordered by decreasing
+  // cost, so that large functions are compiled first and small ones are
+  // left to balance the load at the end.
+  void ScheduleByCost(const std::vector<uint64_t> &Costs) {
+    assert(Costs.size() == NumFunctions);
+    std::vector<std::pair<uint64_t, unsigned> > ByCost;
+    for (unsigned i = 0; i < NumFunctions; ++i)
+      ByCost.push_back(std::make_pair(Costs[i], i));
+    // Sort by decreasing cost, keeping bitcode order for equal costs.
+    std::stable_sort(ByCost.begin(), ByCost.end(), CompareCost);
+
+    std::vector<uint64_t> QueueCost(NumThreads);
+    for (unsigned i = 0; i < NumThreads; ++i)
+      Queues.push_back(new ThreadQueue());
+    for (unsigned i = 0; i < NumFunctions; ++i) {
+      unsigned Cheapest =
+          std::min_element(QueueCost.begin(), QueueCost.end()) -
+          QueueCost.begin();
+      Queues[Cheapest]->Funcs.push_back(ByCost[i].second);
+      QueueCost[Cheapest] += ByCost[i].first;
+    }
+  }
+
+  // Assign functions between threads using the per-thread queues set up
+  // by ScheduleByCost(). The calling thread takes the most expensive
+  // function from the front of its own queue. Once its queue is empty, it
+  // steals the cheapest function from the back of the queue of another
+  // thread. Returns false if no functions are left.
+  bool GrabFunctionStealing(unsigned ThreadIndex, unsigned &FuncIndex) {
+    assert(ThreadIndex < NumThreads && Queues.size() == NumThreads);
+    if (Queues[ThreadIndex]->popFront(FuncIndex))
+      return true;
+    for (unsigned i = 1; i < NumThreads; ++i) {
+      if (Queues[(ThreadIndex + i) % NumThreads]->popBack(FuncIndex))
+        return true;
+    }
+    return false;
+  }
+
   // Total number of functions with bodies that should be processed.
   unsigned Size() const {
     return NumFunctions;
   }
 
  private:
+  // The functions assigned to a thread for cost-based scheduling.
+  struct ThreadQueue {
+    llvm::sys::Mutex Lock;
+    std::deque<unsigned> Funcs;
+
+    bool popFront(unsigned &FuncIndex) {
+      llvm::sys::ScopedLock L(Lock);
+      if (Funcs.empty())
+        return false;
+      FuncIndex = Funcs.front();
+      Funcs.pop_front();
+      return true;
+    }
+
+    bool popBack(unsigned &FuncIndex) {
+      llvm::sys::ScopedLock L(Lock);
+      if (Funcs.empty())
+        return false;
+      FuncIndex = Funcs.back();
+      Funcs.pop_back();
+      return true;
+    }
+  };
+
+  static bool CompareCost(const std::pair<uint64_t, unsigned> &A,
+                          const std::pair<uint64_t, unsigned> &B) {
+    return A.first > B.first;
+  }
+
   const unsigned NumThreads;
   unsigned NumFunctions;
   volatile unsigned CurrentFunction;
+  std::vector<ThreadQueue*> Queues;
 
   ThreadedFunctionQueue(
       const ThreadedFunctionQueue&) LLVM_DELETED_FUNCTION;
@@ -8,103 +8,161 @@
 //===----------------------------------------------------------------------===//
 
 #include "ThreadedStreamingCache.h"
+#include "llvm/Support/Atomic.h"
 #include "llvm/Support/Compiler.h"
 #include "llvm/Support/Mutex.h"
+#include <algorithm>
 #include <cstring>
 
+using llvm::sys::MemoryFence;
 using llvm::sys::ScopedLock;
 
-ThreadedStreamingCache::ThreadedStreamingCache(
-    llvm::StreamingMemoryObject *S) : Streamer(S),
-                                      Cache(kCacheSize),
-                                      MinObjectSize(0),
-                                      CacheBase(-1) {
-  LLVM_STATIC_ASSERT((kCacheSize & (kCacheSize - 1)) == 0,
-                     "kCacheSize must be a power of 2")
-}
-
-int ThreadedStreamingCache::fetchCacheLine(uint64_t address) const {
-  uint64_t Base = address & kCacheSizeMask;
-  int Ret;
-  ScopedLock L(StreamerLock);
-  if (Streamer->isValidAddress(Base + kCacheSize - 1)) {
-    Ret = Streamer->readBytes(Base, kCacheSize, &Cache[0]);
-    assert(Ret == 0);
-    MinObjectSize = Base + kCacheSize;
-  } else {
-    uint64_t End = Streamer->getExtent();
-    assert(End > address && End <= Base + kCacheSize);
-    Ret = Streamer->readBytes(Base, End - Base, &Cache[0]);
-    assert(Ret == 0);
-    MinObjectSize = End;
+ThreadedStreamingStore::ThreadedStreamingStore(llvm::DataStreamer *S)
+    : Streamer(S), Chunks(kMaxChunks), BytesAvailable(0), EOFReached(false) {
+  LLVM_STATIC_ASSERT(kChunkSize % kFetchSize == 0,
+                     "kChunkSize must be a multiple of kFetchSize")
+}
+
+ThreadedStreamingStore::~ThreadedStreamingStore() {
+  for (size_t i = 0, e = Chunks.size(); i != e; ++i)
+    delete[] Chunks[i];
+}
+
+uint64_t ThreadedStreamingStore::fetchToPos(uint64_t Pos) {
+  // EOFReached is set after the final update of BytesAvailable, and
+  // BytesAvailable after the bytes it publishes are in place, so read
+  // them in the opposite order.
+  bool Done = EOFReached;
+  MemoryFence();
+  size_t Available = BytesAvailable;
+  MemoryFence();
+  if (Pos < Available || Done)
+    return Available;
+
+  llvm::sys::TimeValue Start = llvm::sys::TimeValue::now();
+  ScopedLock L(FetchLock);
+  while (BytesAvailable <= Pos && !EOFReached) {
+    uint64_t ChunkIndex = BytesAvailable / kChunkSize;
+    if (ChunkIndex >= kMaxChunks)
+      llvm::report_fatal_error("Bitcode stream too large");
+    if (Chunks[ChunkIndex] == 0)
+      Chunks[ChunkIndex] = new uint8_t[kChunkSize];
+    uint64_t Offset = BytesAvailable % kChunkSize;
+    size_t Len = std::min<uint64_t>(kFetchSize, kChunkSize - Offset);
+    size_t Bytes = Streamer->GetBytes(&Chunks[ChunkIndex][Offset], Len);
+    // Publish the new bytes only after they are in place.
+    MemoryFence();
+    BytesAvailable += Bytes;
+    if (Bytes == 0) {
+      MemoryFence();
+      EOFReached = true;
+    }
+  }
+  WaitTime += llvm::sys::TimeValue::now() - Start;
+  return BytesAvailable;
+}
+
+void ThreadedStreamingStore::copyBytes(uint64_t Address, uint64_t Size,
+                                       uint8_t *Buf) const {
+  while (Size) {
+    uint64_t Offset = Address % kChunkSize;
+    uint64_t Len = std::min(Size, kChunkSize - Offset);
+    memcpy(Buf, &Chunks[Address / kChunkSize][Offset], Len);
+    Buf += Len;
+    Address += Len;
+    Size -= Len;
   }
-  CacheBase = Base;
-  return Ret;
+}
+
+const uint8_t *ThreadedStreamingStore::getPointer(uint64_t Address,
+                                                  uint64_t Size) const {
+  uint64_t Offset = Address % kChunkSize;
+  if (Offset + Size > kChunkSize)
+    return 0;
+  return &Chunks[Address / kChunkSize][Offset];
+}
+
+uint64_t ThreadedStreamingStore::getObjectSize() const {
+  if (!EOFReached)
+    return 0;
+  MemoryFence();
+  return BytesAvailable;
+}
+
+llvm::sys::TimeValue ThreadedStreamingStore::getWaitTime() {
+  ScopedLock L(FetchLock);
+  return WaitTime;
+}
+
+ThreadedStreamingCache::ThreadedStreamingCache(ThreadedStreamingStore *S)
+    : Store(S), MinObjectSize(0), BytesSkipped(0) {}
+
+bool ThreadedStreamingCache::fetchToPos(uint64_t Pos) const {
+  if (Pos < MinObjectSize)
+    return true;
+  MinObjectSize = Store->fetchToPos(Pos);
+  return Pos < MinObjectSize;
 }
 
 int ThreadedStreamingCache::readByte(
     uint64_t address, uint8_t* ptr) const {
-  if (address < CacheBase || address >= CacheBase + kCacheSize) {
-    if(fetchCacheLine(address))
-      return -1;
-  }
-  *ptr = Cache[address - CacheBase];
-  return 0;
+  return readBytes(address, 1, ptr);
 }
 
 int ThreadedStreamingCache::readBytes(
     uint64_t address, uint64_t size, uint8_t* buf) const {
-  // To keep the cache fetch simple, we currently require that no request cross
-  // the cache line. This isn't a problem for the bitcode reader because it only
-  // fetches a byte or a word at a time.
-  if (address < CacheBase || (address + size) > CacheBase + kCacheSize) {
-    if ((address & kCacheSizeMask) != ((address + size - 1) & kCacheSizeMask))
-      llvm::report_fatal_error("readBytes request spans cache lines");
-    if(fetchCacheLine(address))
-      return -1;
-  }
-  memcpy(buf, &Cache[address - CacheBase], size);
+  if (size == 0)
+    return 0;
+  address += BytesSkipped;
+  if (!fetchToPos(address + size - 1))
+    return -1;
+  Store->copyBytes(address, size, buf);
   return 0;
 }
 
+const uint8_t *ThreadedStreamingCache::getPointer(
+    uint64_t address, uint64_t size) const {
+  address += BytesSkipped;
+  if (size && !fetchToPos(address + size - 1))
+    llvm::report_fatal_error("getPointer request past end of bitcode stream");
+  if (const uint8_t *Ptr = Store->getPointer(address, size))
+    return Ptr;
+  // The range spans chunks, so hand out a contiguous copy.
+  SpanCopy.resize(size);
+  Store->copyBytes(address, size, &SpanCopy[0]);
+  return &SpanCopy[0];
+}
+
 uint64_t ThreadedStreamingCache::getExtent() const {
-  llvm::report_fatal_error(
-      "getExtent should not be called for pnacl streaming bitcode");
-  return 0;
+  // Keep fetching until we run out of bytes.
+  while (fetchToPos(MinObjectSize)) {}
+  uint64_t Size = Store->getObjectSize();
+  return Size > BytesSkipped ? Size - BytesSkipped : 0;
 }
 
 bool ThreadedStreamingCache::isValidAddress(uint64_t address) const {
-  if (address < MinObjectSize)
-    return true;
-  ScopedLock L(StreamerLock);
-  bool Valid = Streamer->isValidAddress(address);
-  if (Valid)
-    MinObjectSize = address;
-  return Valid;
+  return fetchToPos(address + BytesSkipped);
 }
 
 bool ThreadedStreamingCache::isObjectEnd(uint64_t address) const {
-  if (address < MinObjectSize)
+  address += BytesSkipped;
+  if (fetchToPos(address))
     return false;
-  ScopedLock L(StreamerLock);
-  if (Streamer->isValidAddress(address)) {
-    MinObjectSize = address;
-    return false;
-  }
-  return Streamer->isObjectEnd(address);
+  return address == Store->getObjectSize() && address != 0;
 }
 
 bool ThreadedStreamingCache::dropLeadingBytes(size_t s) {
-  ScopedLock L(StreamerLock);
-  return Streamer->dropLeadingBytes(s);
+  if (s && !fetchToPos(BytesSkipped + s - 1))
+    return true;
+  BytesSkipped += s;
+  return false;
 }
 
 void ThreadedStreamingCache::setKnownObjectSize(size_t size) {
-  MinObjectSize = size;
-  ScopedLock L(StreamerLock);
-  Streamer->setKnownObjectSize(size);
+  // The store learns the size of the object when the stream ends, and
+  // never needs to reserve space for the whole object.
 }
 
-const uint64_t ThreadedStreamingCache::kCacheSize;
-const uint64_t ThreadedStreamingCache::kCacheSizeMask;
-llvm::sys::SmartMutex<false> ThreadedStreamingCache::StreamerLock;
+const uint64_t ThreadedStreamingStore::kChunkSize;
+const uint64_t ThreadedStreamingStore::kMaxChunks;
+const size_t ThreadedStreamingStore::kFetchSize;
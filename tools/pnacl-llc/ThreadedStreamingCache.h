@@ -10,19 +10,80 @@
 #ifndef THREADEDSTREAMINGCACHE_H
 #define THREADEDSTREAMINGCACHE_H
 
+#include "llvm/ADT/OwningPtr.h"
+#include "llvm/Support/DataStream.h"
 #include "llvm/Support/ErrorHandling.h"
 #include "llvm/Support/Mutex.h"
 #include "llvm/Support/StreamableMemoryObject.h"
+#include "llvm/Support/TimeValue.h"
+#include <vector>
 
-// An implementation of StreamingMemoryObject for use in multithreaded
-// translation. Each thread has one of these objects, each of which has a
-// pointer to a shared StreamingMemoryObject. This object is effectively
-// a thread-local cache for the bitcode streamer to avoid contention, since
-// bits are only read from the bitcode stream one word at a time.
+// A shared, append-only store of the bytes streamed from a DataStreamer,
+// for use in multithreaded translation. Bytes are kept in fixed-size
+// chunks that never move once allocated, so bytes that have already
+// arrived can be read by any number of threads without locking. A lock
+// is only taken by threads that need bytes which haven't streamed in yet;
+// one of them pulls more bytes from the DataStreamer while the others
+// wait.
+class ThreadedStreamingStore {
+ public:
+  // Takes ownership of S.
+  explicit ThreadedStreamingStore(llvm::DataStreamer *S);
+  ~ThreadedStreamingStore();
+
+  // Fetches bytes from the streamer until the byte at Pos has arrived, or
+  // the end of the stream is reached. Returns the number of bytes that
+  // have arrived (which is larger than Pos, unless the stream ended).
+  // Does not block if the byte at Pos has already arrived.
+  uint64_t fetchToPos(uint64_t Pos);
+
+  // Copies bytes [Address, Address + Size) into Buf. The bytes must have
+  // already arrived.
+  void copyBytes(uint64_t Address, uint64_t Size, uint8_t *Buf) const;
+
+  // Returns a pointer to bytes [Address, Address + Size), which must have
+  // already arrived, or null if they span chunks and are not contiguous.
+  // The pointer stays valid for the lifetime of the store.
+  const uint8_t *getPointer(uint64_t Address, uint64_t Size) const;
+
+  // Returns the size of the stream, if the end has been reached, and
+  // zero otherwise.
+  uint64_t getObjectSize() const;
+
+  // Returns the total time that threads have spent waiting for bytes to
+  // stream in.
+  llvm::sys::TimeValue getWaitTime();
 
+ private:
+  const static uint64_t kChunkSize = 16 * 4096;
+  const static uint64_t kMaxChunks = 32 * 1024;
+  // Number of bytes requested from the streamer at a time.
+  const static size_t kFetchSize = 4 * 4096;
+
+  llvm::OwningPtr<llvm::DataStreamer> Streamer;
+  // Chunk I holds bytes [I * kChunkSize, (I + 1) * kChunkSize).
+  std::vector<uint8_t*> Chunks;
+  // Number of bytes that have arrived. Only modified with FetchLock held,
+  // and only after the bytes are in place.
+  volatile size_t BytesAvailable;
+  volatile bool EOFReached;
+  llvm::sys::Mutex FetchLock;
+  // Only modified with FetchLock held.
+  llvm::sys::TimeValue WaitTime;
+
+  ThreadedStreamingStore(
+      const ThreadedStreamingStore&) LLVM_DELETED_FUNCTION;
+  void operator=(const ThreadedStreamingStore&) LLVM_DELETED_FUNCTION;
+};
+
+// An implementation of StreamingMemoryObject for use in multithreaded
+// translation. Each bitcode reader has one of these objects, each of which
+// has a pointer to the ThreadedStreamingStore shared by all readers. The
+// object remembers how many bytes it has seen arrive, so that reads of
+// those bytes need no synchronization at all.
 class ThreadedStreamingCache : public llvm::StreamingMemoryObject {
  public:
-  explicit ThreadedStreamingCache(llvm::StreamingMemoryObject *S);
+  explicit ThreadedStreamingCache(ThreadedStreamingStore *S);
   virtual uint64_t getBase() const LLVM_OVERRIDE { return 0; }
   virtual uint64_t getExtent() const LLVM_OVERRIDE;
   virtual int readByte(uint64_t address, uint8_t* ptr) const LLVM_OVERRIDE;
@@ -30,21 +91,15 @@ class ThreadedStreamingCache : public llvm::StreamingMemoryObject {
                         uint64_t size,
                         uint8_t* buf) const LLVM_OVERRIDE;
   virtual const uint8_t *getPointer(uint64_t address,
-                                    uint64_t size) const LLVM_OVERRIDE {
-    // This could be fixed by ensuring the bytes are fetched and making a copy,
-    // requiring that the bitcode size be known, or otherwise ensuring that
-    // the memory doesn't go away/get reallocated, but it's
-    // not currently necessary. Users that need the pointer don't stream.
-    llvm_unreachable("getPointer in streaming memory objects not allowed");
-    return NULL;
-  }
+                                    uint64_t size) const LLVM_OVERRIDE;
   virtual bool isValidAddress(uint64_t address) const LLVM_OVERRIDE;
   virtual bool isObjectEnd(uint64_t address) const LLVM_OVERRIDE;
 
   /// Drop s bytes from the front of the stream, pushing the positions of the
   /// remaining bytes down by s. This is used to skip past the bitcode header,
   /// since we don't know a priori if it's present, and we can't put bytes
-  /// back into the stream once we've read them.
+  /// back into the stream once we've read them. Only applies to this
+  /// reader's view of the shared stream.
   virtual bool dropLeadingBytes(size_t s) LLVM_OVERRIDE;
 
   /// If the data object size is known in advance, many of the operations can
@@ -52,20 +107,19 @@ class ThreadedStreamingCache : public llvm::StreamingMemoryObject {
   /// starts (although it can be called anytime).
   virtual void setKnownObjectSize(size_t size) LLVM_OVERRIDE;
  private:
-  const static uint64_t kCacheSize = 4 * 4096;
-  const static uint64_t kCacheSizeMask = ~(kCacheSize - 1);
-  static llvm::sys::SmartMutex<false> StreamerLock;
-
-  int fetchCacheLine(uint64_t address) const;
+  // Returns true if the (shared stream) address Pos has arrived, fetching
+  // it if necessary.
+  bool fetchToPos(uint64_t Pos) const;
 
-  llvm::StreamingMemoryObject *Streamer;
-  // Cached data for addresses [CacheBase, CacheBase + kCacheSize)
-  mutable std::vector<unsigned char> Cache;
-  // The MemoryObject is at least this size. Used as a cache for isObjectEnd and
-  // isValidAddress
+  ThreadedStreamingStore *Store;
+  // The number of bytes known to have arrived in the store.
   mutable uint64_t MinObjectSize;
-  // Current base address for the cache.
-  mutable uint64_t CacheBase;
+  // Bytes dropped from the front of the stream by dropLeadingBytes.
+  uint64_t BytesSkipped;
+  // A copy of the last range handed out by getPointer that spans chunks
+  // of the store. It is reused by the next such request, so the pointer
+  // stays valid until then.
+  mutable std::vector<uint8_t> SpanCopy;
 
   ThreadedStreamingCache(
       const ThreadedStreamingCache&) LLVM_DELETED_FUNCTION;
@@ -11,6 +11,8 @@
 //
 //===----------------------------------------------------------------------===//
 
+#define DEBUG_TYPE "pnacl-llc"
+#include "llvm/ADT/Statistic.h"
 #include "llvm/ADT/Triple.h"
 #include "llvm/Analysis/NaCl.h"
 #include "llvm/Analysis/Verifier.h"
@@ -18,6 +20,7 @@
 #include "llvm/Bitcode/ReaderWriter.h"
 #include "llvm/Bitcode/NaCl/NaClReaderWriter.h"
 #include "llvm/CodeGen/CommandFlags.h"
+#include "llvm/Config/config.h"
 #include "llvm/CodeGen/LinkAllAsmWriterComponents.h"
 #include "llvm/CodeGen/LinkAllCodegenComponents.h"
 #include "llvm/IR/DataLayout.h"
@@ -31,23 +34,34 @@
 #include "llvm/Support/DataStream.h"
 #include "llvm/Support/Debug.h"
 #include "llvm/Support/ErrorHandling.h"
+#include "llvm/Support/FileOutputBuffer.h"
+#include "llvm/Support/Format.h"
 #include "llvm/Support/FormattedStream.h"
 #include "llvm/Support/Host.h"
+#include "llvm/Support/LockFileManager.h"
+#include "llvm/Support/MD5.h"
 #include "llvm/Support/ManagedStatic.h"
+#include "llvm/Support/MemoryBuffer.h"
 #include "llvm/Support/Mutex.h"
+#include "llvm/Support/Path.h"
 #include "llvm/Support/PrettyStackTrace.h"
 #include "llvm/Support/Signals.h"
 #include "llvm/Support/SourceMgr.h"
 #include "llvm/Support/StreamableMemoryObject.h"
 #include "llvm/Support/TargetRegistry.h"
 #include "llvm/Support/TargetSelect.h"
+#include "llvm/Support/TimeValue.h"
 #include "llvm/Support/ToolOutputFile.h"
 #include "llvm/Target/TargetLibraryInfo.h"
 #include "llvm/Target/TargetMachine.h"
+#include "llvm/Target/TargetSubtargetInfo.h"
 #include "llvm/Transforms/NaCl.h"
+#include "ELFObjectMerger.h"
+#include "FunctionKey.h"
 #include "ThreadedFunctionQueue.h"
 #include "ThreadedStreamingCache.h"
 #include <pthread.h>
+#include <algorithm>
 #include <memory>
 
 using namespace llvm;
@@ -108,6 +122,14 @@ static cl::opt<bool>
 PNaClABIVerifyFatalErrors("pnaclabi-verify-fatal-errors",
   cl::desc("PNaCl ABI verification errors are fatal"),
   cl::init(false));
+// When streaming PNaCl bitcode, function bodies can be checked by the
+// bitcode reader while it constructs their instructions, rather than by
+// a separate pass walking every materialized function again.
+static cl::opt<bool>
+PNaClABIVerifyInReader("pnaclabi-verify-in-reader",
+  cl::desc("Verify the PNaCl ABI of streamed function bodies while "
+           "reading them"),
+  cl::init(true));
 
 // Determine optimization level.
 static cl::opt<char>
@@ -135,7 +157,8 @@ SplitModuleCount("split-module",
 
 enum SplitModuleSchedulerKind {
   SplitModuleDynamic,
-  SplitModuleStatic
+  SplitModuleStatic,
+  SplitModuleStealing
 };
 
 cl::opt<SplitModuleSchedulerKind>
@@ -147,14 +170,101 @@ SplitModuleSched(
                    "Dynamic thread scheduling (default)"),
         clEnumValN(SplitModuleStatic, "static",
                    "Static thread scheduling"),
+        clEnumValN(SplitModuleStealing, "stealing",
+                   "Cost-based thread scheduling with work stealing. Waits "
+                   "for all function bodies to be streamed in, to estimate "
+                   "their cost"),
         clEnumValEnd),
     cl::init(SplitModuleDynamic));
 
+// When streaming PNaCl bitcode with -split-module, the module-level blocks
+// are normally parsed by every thread. This option parses them once, and
+// gives each additional thread a copy of the resulting module, which only
+// reads function bodies from the stream.
+static cl::opt<bool>
+SplitModuleParseOnce(
+    "split-module-parse-once",
+    cl::desc("Parse module-level bitcode blocks once for all split modules"),
+    cl::init(false));
+
+// With -split-module, each module is normally written to an object file of
+// its own, to be linked together later. This option instead merges the
+// objects of all modules into a single object file before writing it.
+static cl::opt<bool>
+SplitModuleMergeObjects(
+    "split-module-merge-objects",
+    cl::desc("Merge the object files of split modules into one"),
+    cl::init(false));
+
+// Simulates streaming the input over a network, to measure how well
+// translation overlaps with the download: the input file is replayed in
+// chunks of -stream-chunk-size bytes at -stream-bandwidth bytes per second.
+static cl::opt<unsigned>
+StreamBandwidth(
+    "stream-bandwidth",
+    cl::desc("Stream the input at this many bytes per second with "
+             "-streaming-bitcode (0 for no limit)"),
+    cl::init(0U));
+static cl::opt<unsigned>
+StreamChunkSize(
+    "stream-chunk-size",
+    cl::desc("Size of the chunks streamed in with -stream-bandwidth"),
+    cl::init(64U * 1024U));
+static cl::opt<bool>
+StreamStats(
+    "stream-stats",
+    cl::desc("Report streaming latency statistics with -streaming-bitcode"),
+    cl::init(false));
+
+// Translations of the same input with the same options are cached in this
+// directory, keyed by a hash of the input and the command line, so that
+// translating the input again only copies the cached object.
+static cl::opt<std::string>
+TranslationCacheDir(
+    "translation-cache-dir",
+    cl::desc("Cache translated objects in this directory"),
+    cl::value_desc("directory"));
+
+// The object code of each function is cached in this directory, keyed by
+// a hash of the function, of the declarations it refers to and of the
+// command line, so that only the functions that changed since an earlier
+// translation of the module are compiled again.
+static cl::opt<std::string>
+FunctionCacheDir(
+    "function-cache-dir",
+    cl::desc("Cache the objects of individual functions in this directory"),
+    cl::value_desc("directory"));
+
 /// Compile the module provided to pnacl-llc. The file name for reading the
 /// module and other options are taken from globals populated by command-line
 /// option parsing.
 static int compileModule(StringRef ProgramName);
 
+#if !defined(__native_client__)
+/// Compile the module provided to pnacl-llc, or copy the object of an
+/// earlier compilation from -translation-cache-dir.
+static int compileModuleWithCache(int argc, char **argv);
+
+/// Returns a hash of the command line, leaving out the options that only
+/// name files.
+static std::string GetCommandLineKey(int argc, char **argv);
+
+/// Compile the module provided to pnacl-llc one function at a time,
+/// reusing the objects of functions from -function-cache-dir, and merge
+/// the objects. The functions missing from the cache are compiled on
+/// -split-module threads.
+static int compileWithFunctionCache(const TargetOptions &Options,
+                                    const Triple &TheTriple,
+                                    const Target *TheTarget,
+                                    const std::string &FeaturesStr,
+                                    CodeGenOpt::Level OLvl,
+                                    StringRef ProgramName, Module *mod,
+                                    ThreadedStreamingStore *StreamingObject);
+
+// The key of the command line, with -function-cache-dir.
+static std::string CommandLineKey;
+#endif
+
 #if !defined(__native_client__)
 // GetFileNameRoot - Helper function to get the basename of a filename.
 static std::string
@@ -293,6 +403,22 @@ int llc_main(int argc, char **argv) {
   if (SplitModuleCount > 1)
     LLVMStartMultithreaded();
 
+#if !defined(__native_client__)
+  if (!FunctionCacheDir.empty()) {
+    // Function bodies are compiled to objects to be merged, by threads
+    // that read them from copies of the streamed module.
+    if (InputFileFormat != PNaClFormat || !LazyBitcode ||
+        FileType != TargetMachine::CGFT_ObjectFile) {
+      errs() << argv[0] << ": warning: ignoring -function-cache-dir "
+             << "without a streamed PNaCl bitcode file and object output\n";
+      FunctionCacheDir = "";
+    } else {
+      CommandLineKey = GetCommandLineKey(argc, argv);
+    }
+  }
+  if (!TranslationCacheDir.empty())
+    return compileModuleWithCache(argc, argv);
+#endif
   return compileModule(argv[0]);
 }
 
@@ -313,7 +439,7 @@ static void CheckABIVerifyErrors(PNaClABIErrorReporter &Reporter,
 }
 
 static Module* getModule(StringRef ProgramName, LLVMContext &Context,
-                         StreamingMemoryObject *StreamingObject) {
+                         ThreadedStreamingStore *StreamingObject) {
   Module *M = 0;
   SMDiagnostic Err;
   if (LazyBitcode) {
@@ -352,48 +478,27 @@ static Module* getModule(StringRef ProgramName, LLVMContext &Context,
   return M;
 }
 
-static int runCompilePasses(Module *mod,
-                            unsigned ModuleIndex,
-                            ThreadedFunctionQueue *FuncQueue,
-                            const Triple &TheTriple,
-                            TargetMachine &Target,
-                            StringRef ProgramName,
-                            formatted_raw_ostream &FOS){
-  PNaClABIErrorReporter ABIErrorReporter;
-
-  if (SplitModuleCount > 1) {
-    // Add function and global names, and give them external linkage.
-    // This relies on LLVM's consistent auto-generation of names, we could
-    // maybe do our own in case something changes there.
-    for (Module::iterator I = mod->begin(), E = mod->end(); I != E; ++I) {
-      if (!I->hasName())
-        I->setName("Function");
-      if (I->hasInternalLinkage())
-        I->setLinkage(GlobalValue::ExternalLinkage);
-    }
-    for (Module::global_iterator GI = mod->global_begin(),
-         GE = mod->global_end();
-         GI != GE; ++GI) {
-      if (!GI->hasName())
-        GI->setName("Global");
-      if (GI->hasInternalLinkage())
-        GI->setLinkage(GlobalValue::ExternalLinkage);
-    }
-    if (ModuleIndex > 0) {
-      // Remove the initializers for all global variables, turning them into
-      // declarations.
-      for (Module::global_iterator GI = mod->global_begin(),
-          GE = mod->global_end();
-          GI != GE; ++GI) {
-        assert(GI->hasInitializer() && "Global variable missing initializer");
-        Constant *Init = GI->getInitializer();
-        GI->setInitializer(NULL);
-        if (Init->getNumUses() == 0)
-          Init->destroyConstant();
-      }
-    }
-  }
+// The time at which the first function finished compiling, for
+// -stream-stats. Guarded by StreamStatsLock.
+static sys::TimeValue FirstFunctionTime;
+static sys::Mutex StreamStatsLock;
+
+static void NoteFunctionCompiled() {
+  if (!StreamStats)
+    return;
+  sys::TimeValue Now = sys::TimeValue::now();
+  sys::ScopedLock L(StreamStatsLock);
+  if (FirstFunctionTime == sys::TimeValue::ZeroTime)
+    FirstFunctionTime = Now;
+}
 
+// Builds the passes that verify the functions of mod and compile them to
+// FOS. Returns null if the target can't generate the file type.
+static FunctionPassManager *
+createCompilePasses(Module *mod, const Triple &TheTriple,
+                    TargetMachine &Target, StringRef ProgramName,
+                    formatted_raw_ostream &FOS,
+                    PNaClABIErrorReporter &ABIErrorReporter) {
   // Build up all of the passes that we want to do to the module.
   OwningPtr<FunctionPassManager> PM(new FunctionPassManager(mod));
 
@@ -410,37 +515,50 @@ static int runCompilePasses(Module *mod,
     PM->add(createVerifierPass());
   }
 
-  // Add the ABI verifier pass before the analysis and code emission passes.
+  // Add the ABI verifier pass before the analysis and code emission passes,
+  // unless the bitcode reader checks function bodies as it reads them.
   if (PNaClABIVerify) {
-    PM->add(createPNaClABIVerifyFunctionsPass(&ABIErrorReporter));
+    if (PNaClABIVerifyInReader && LazyBitcode &&
+        InputFileFormat == PNaClFormat)
+      setNaClFunctionABIVerification(mod, &ABIErrorReporter);
+    else
+      PM->add(createPNaClABIVerifyFunctionsPass(&ABIErrorReporter));
   }
 
-  // Add the intrinsic resolution pass. It assumes ABI-conformant code.
-  PM->add(createResolvePNaClIntrinsicsPass());
-
   // Add an appropriate TargetLibraryInfo pass for the module's triple.
   TargetLibraryInfo *TLI = new TargetLibraryInfo(TheTriple);
   if (DisableSimplifyLibCalls)
     TLI->disableAllFunctions();
-  PM->add(TLI);
-
-  // Allow subsequent passes and the backend to better optimize instructions
-  // that were simplified for PNaCl's ABI. This pass uses the TargetLibraryInfo
-  // above.
-  PM->add(createBackendCanonicalizePass());
-
-  // Add intenal analysis passes from the target machine.
-  Target.addAnalysisPasses(*PM.get());
 
-  // Ask the target to add backend passes as necessary. We explicitly ask it
-  // not to add the verifier pass because we added it earlier.
-  if (Target.addPassesToEmitFile(*PM, FOS, FileType,
-                                 /* DisableVerify */ true)) {
+  if (PNaClTranslationAddCodeGenPasses(*PM, Target, TLI, FOS, FileType)) {
     errs() << ProgramName
     << ": target does not support generation of this file type!\n";
-    return 1;
+    return 0;
+  }
+  return PM.take();
+}
+
+static int runCompilePasses(Module *mod,
+                            unsigned ModuleIndex,
+                            ThreadedFunctionQueue *FuncQueue,
+                            const Triple &TheTriple,
+                            TargetMachine &Target,
+                            StringRef ProgramName,
+                            formatted_raw_ostream &FOS){
+  PNaClABIErrorReporter ABIErrorReporter;
+
+  if (SplitModuleCount > 1) {
+    PNaClExternalizeSplitModule(mod);
+    if (ModuleIndex > 0)
+      PNaClRemoveGlobalInitializers(mod);
   }
 
+  OwningPtr<FunctionPassManager> PM(
+      createCompilePasses(mod, TheTriple, Target, ProgramName, FOS,
+                          ABIErrorReporter));
+  if (!PM)
+    return 1;
+
   PM->doInitialization();
   if (LazyBitcode) {
     unsigned FuncIndex = 0;
@@ -450,11 +568,29 @@ static int runCompilePasses(Module *mod,
         if (FuncQueue->GrabFunctionStatic(FuncIndex, ModuleIndex)) {
           PM->run(*I);
           CheckABIVerifyErrors(ABIErrorReporter, "Function " + I->getName());
+          NoteFunctionCompiled();
           I->Dematerialize();
         }
         ++FuncIndex;
       }
       break;
+    case SplitModuleStealing: {
+      // Functions are handed out in any order, so index them first.
+      std::vector<Function *> Funcs;
+      for (Module::iterator I = mod->begin(), E = mod->end(); I != E; ++I) {
+        if (I->isMaterializable() || !I->isDeclaration())
+          Funcs.push_back(I);
+      }
+      assert(Funcs.size() == FuncQueue->Size());
+      while (FuncQueue->GrabFunctionStealing(ModuleIndex, FuncIndex)) {
+        Function *F = Funcs[FuncIndex];
+        PM->run(*F);
+        CheckABIVerifyErrors(ABIErrorReporter, "Function " + F->getName());
+        NoteFunctionCompiled();
+        F->Dematerialize();
+      }
+      break;
+    }
     case SplitModuleDynamic:
       unsigned ChunkSize = 0;
       unsigned NumFunctions = FuncQueue->Size();
@@ -472,6 +608,7 @@ static int runCompilePasses(Module *mod,
             }
             PM->run(*I);
             CheckABIVerifyErrors(ABIErrorReporter, "Function " + I->getName());
+            NoteFunctionCompiled();
             I->Dematerialize();
             ++FuncIndex;
             ++I;
@@ -494,6 +631,10 @@ static int runCompilePasses(Module *mod,
       PM->run(*I);
   }
   PM->doFinalization();
+  // The reader must not outlive ABIErrorReporter while reporting to it.
+  if (PNaClABIVerify && PNaClABIVerifyInReader && LazyBitcode &&
+      InputFileFormat == PNaClFormat)
+    setNaClFunctionABIVerification(mod, 0);
   return 0;
 }
 
@@ -504,9 +645,12 @@ static int compileSplitModule(const TargetOptions &Options,
                               CodeGenOpt::Level OLvl,
                               const StringRef &ProgramName,
                               Module *GlobalModule,
-                              StreamingMemoryObject *StreamingObject,
+                              ThreadedStreamingStore *StreamingObject,
+                              LLVMContext *CopyContext,
+                              Module *CopyModule,
                               unsigned ModuleIndex,
-                              ThreadedFunctionQueue *FuncQueue) {
+                              ThreadedFunctionQueue *FuncQueue,
+                              SmallVectorImpl<char> *ObjectBuffer) {
   std::auto_ptr<TargetMachine>
     target(TheTarget->createTargetMachine(TheTriple.getTriple(),
                                           MCPU, FeaturesStr, Options,
@@ -529,6 +673,12 @@ static int compileSplitModule(const TargetOptions &Options,
 
   if (ModuleIndex == 0) {
     mod = GlobalModule;
+  } else if (CopyModule) {
+    // The copy already contains the external declarations added to the
+    // global module.
+    C.reset(CopyContext);
+    mod = CopyModule;
+    M.reset(mod);
   } else {
     C.reset(new LLVMContext());
     mod = getModule(ProgramName, *C, StreamingObject);
@@ -545,6 +695,18 @@ static int compileSplitModule(const TargetOptions &Options,
   }
 
   mod->setTargetTriple(Triple::normalize(UserDefinedTriple));
+  if (ObjectBuffer) {
+    // The object is merged with those of the other modules once all of
+    // them are compiled.
+    raw_svector_ostream ROS(*ObjectBuffer);
+    formatted_raw_ostream FOS(ROS);
+    int ret = runCompilePasses(mod, ModuleIndex, FuncQueue,
+                               TheTriple, Target, ProgramName,
+                               FOS);
+    FOS.flush();
+    ROS.flush();
+    return ret;
+  }
   {
 #if !defined(__native_client__)
       // Figure out where we are going to send the output.
@@ -578,6 +740,58 @@ static int compileSplitModule(const TargetOptions &Options,
   return 0;
 }
 
+// Merges the objects of the split modules, and writes the result where
+// the object of the first module would have been written.
+static int writeMergedObject(StringRef ProgramName,
+                             const Target *TheTarget,
+                             const Triple &TheTriple,
+                             std::vector<SmallVector<char, 0> > &Objects) {
+  ELFObjectMerger Merger;
+  for (size_t i = 0, e = Objects.size(); i != e; ++i)
+    Merger.addObject(StringRef(Objects[i].data(), Objects[i].size()));
+  std::string Error;
+  if (Merger.layout(&Error)) {
+    errs() << ProgramName << ": unable to merge split module objects: "
+           << Error << "\n";
+    return 1;
+  }
+#if !defined(__native_client__)
+  std::string Filename(OutputFilename);
+  if (Filename.empty() && InputFilename != "-")
+    Filename = GetFileNameRoot(InputFilename) + ".o";
+  if (!Filename.empty() && Filename != "-") {
+    OwningPtr<FileOutputBuffer> Buffer;
+    if (error_code EC = FileOutputBuffer::create(Filename, Merger.getSize(),
+                                                 Buffer)) {
+      errs() << ProgramName << ": " << EC.message() << "\n";
+      return 1;
+    }
+    Merger.write(Buffer->getBufferStart());
+    if (error_code EC = Buffer->commit()) {
+      errs() << ProgramName << ": " << EC.message() << "\n";
+      return 1;
+    }
+    return 0;
+  }
+#endif
+  std::vector<uint8_t> Merged(Merger.getSize());
+  Merger.write(&Merged[0]);
+#if defined(__native_client__)
+  raw_fd_ostream ROS(getObjectFileFD(0), true);
+#else
+  OwningPtr<tool_output_file> Out(
+      GetOutputStream(TheTarget->getName(), TheTriple.getOS(), "-"));
+  if (!Out) return 1;
+  raw_ostream &ROS = Out->os();
+#endif
+  ROS.write(reinterpret_cast<const char *>(&Merged[0]), Merged.size());
+  ROS.flush();
+#if !defined(__native_client__)
+  Out->keep();
+#endif
+  return 0;
+}
+
 struct ThreadData {
   const TargetOptions *Options;
   const Triple *TheTriple;
@@ -586,9 +800,12 @@ struct ThreadData {
   CodeGenOpt::Level OLvl;
   std::string ProgramName;
   Module *GlobalModule;
-  StreamingMemoryObject *StreamingObject;
+  ThreadedStreamingStore *StreamingObject;
+  LLVMContext *CopyContext;
+  Module *CopyModule;
   unsigned ModuleIndex;
   ThreadedFunctionQueue *FuncQueue;
+  SmallVectorImpl<char> *ObjectBuffer;
 };
 
 
@@ -602,11 +819,77 @@ static void *runCompileThread(void *arg) {
                                Data->ProgramName,
                                Data->GlobalModule,
                                Data->StreamingObject,
+                               Data->CopyContext,
+                               Data->CopyModule,
                                Data->ModuleIndex,
-                               Data->FuncQueue);
+                               Data->FuncQueue,
+                               Data->ObjectBuffer);
   return reinterpret_cast<void *>(static_cast<intptr_t>(ret));
 }
 
+static double toSeconds(sys::TimeValue T) {
+  return T.seconds() + T.nanoseconds() / 1e9;
+}
+
+namespace {
+// Reports the streaming latency statistics of -stream-stats when
+// destroyed, which is once the object files have been written.
+class StreamStatsReporter {
+ public:
+  StreamStatsReporter() : Streamer(0), Store(0) {}
+  ~StreamStatsReporter();
+
+  ThrottledDataStreamer *Streamer;
+  ThreadedStreamingStore *Store;
+};
+}
+
+StreamStatsReporter::~StreamStatsReporter() {
+  if (!Streamer || !Store)
+    return;
+  sys::TimeValue End = sys::TimeValue::now();
+  sys::TimeValue Start = Streamer->getStartTime();
+  raw_ostream &OS = errs();
+  OS << "stream-stats: time to first function: ";
+  if (FirstFunctionTime == sys::TimeValue::ZeroTime)
+    OS << "n/a\n";
+  else
+    OS << format("%.6f", toSeconds(FirstFunctionTime - Start)) << " s\n";
+  OS << "stream-stats: time from last byte to object: ";
+  if (Streamer->getLastByteTime() == sys::TimeValue::ZeroTime)
+    OS << "n/a\n";
+  else
+    OS << format("%.6f", toSeconds(End - Streamer->getLastByteTime()))
+       << " s\n";
+  OS << "stream-stats: thread idle time waiting for bitcode: "
+     << format("%.6f", toSeconds(Store->getWaitTime())) << " s\n";
+}
+
+// Package up features to be passed to target/subtarget
+static std::string GetFeaturesStr() {
+  if (MAttrs.empty())
+    return std::string();
+  SubtargetFeatures Features;
+  for (unsigned i = 0; i != MAttrs.size(); ++i)
+    Features.AddFeature(MAttrs[i]);
+  return Features.getString();
+}
+
+// Returns false if -O doesn't name an optimization level.
+static bool GetOptLevel(CodeGenOpt::Level &OLvl) {
+  OLvl = CodeGenOpt::Default;
+  switch (OptLevel) {
+  default:
+    return false;
+  case ' ': break;
+  case '0': OLvl = CodeGenOpt::None; break;
+  case '1': OLvl = CodeGenOpt::Less; break;
+  case '2': OLvl = CodeGenOpt::Default; break;
+  case '3': OLvl = CodeGenOpt::Aggressive; break;
+  }
+  return true;
+}
+
 static int compileModule(StringRef ProgramName) {
   // Use a new context instead of the global context for the main module. It must
   // outlive the module object, declared below. We do this because
@@ -618,13 +901,15 @@ static int compileModule(StringRef ProgramName) {
   OwningPtr<Module> mod;
   Triple TheTriple;
   PNaClABIErrorReporter ABIErrorReporter;
-  OwningPtr<StreamingMemoryObject> StreamingObject;
+  // Bitcode bytes streamed so far, shared by the readers of all threads.
+  OwningPtr<ThreadedStreamingStore> StreamingObject;
+  // Declared after StreamingObject, so it reports before the store goes.
+  StreamStatsReporter StatsReporter;
 
   if (!MainContext) return 1;
 
 #if defined(__native_client__)
-  StreamingObject.reset(
-      new StreamingMemoryObjectImpl(getNaClBitcodeStreamer()));
+  StreamingObject.reset(new ThreadedStreamingStore(getNaClBitcodeStreamer()));
 #else
   if (LazyBitcode) {
     std::string StrError;
@@ -635,7 +920,16 @@ static int compileModule(StringRef ProgramName) {
     }
     if (!FileStreamer)
       return 1;
-    StreamingObject.reset(new StreamingMemoryObjectImpl(FileStreamer));
+    if (StreamBandwidth || StreamStats) {
+      ThrottledDataStreamer *Throttled =
+          new ThrottledDataStreamer(FileStreamer, StreamBandwidth,
+                                    StreamChunkSize);
+      FileStreamer = Throttled;
+      if (StreamStats)
+        StatsReporter.Streamer = Throttled;
+    }
+    StreamingObject.reset(new ThreadedStreamingStore(FileStreamer));
+    StatsReporter.Store = StreamingObject.get();
   }
 #endif
   mod.reset(getModule(ProgramName, *MainContext.get(), StreamingObject.get()));
@@ -699,39 +993,74 @@ static int compileModule(StringRef ProgramName) {
   if (GenerateSoftFloatCalls)
     FloatABIForCalls = FloatABI::Soft;
 
-  // Package up features to be passed to target/subtarget
-  std::string FeaturesStr;
-  if (MAttrs.size()) {
-    SubtargetFeatures Features;
-    for (unsigned i = 0; i != MAttrs.size(); ++i)
-      Features.AddFeature(MAttrs[i]);
-    FeaturesStr = Features.getString();
-  }
+  std::string FeaturesStr = GetFeaturesStr();
 
-  CodeGenOpt::Level OLvl = CodeGenOpt::Default;
-  switch (OptLevel) {
-  default:
+  CodeGenOpt::Level OLvl;
+  if (!GetOptLevel(OLvl)) {
     errs() << ProgramName << ": invalid optimization level.\n";
     return 1;
-  case ' ': break;
-  case '0': OLvl = CodeGenOpt::None; break;
-  case '1': OLvl = CodeGenOpt::Less; break;
-  case '2': OLvl = CodeGenOpt::Default; break;
-  case '3': OLvl = CodeGenOpt::Aggressive; break;
   }
 
+#if !defined(__native_client__)
+  if (!FunctionCacheDir.empty())
+    return compileWithFunctionCache(Options, TheTriple, TheTarget,
+                                    FeaturesStr, OLvl, ProgramName,
+                                    mod.get(), StreamingObject.get());
+#endif
+
   SmallVector<pthread_t, 4> Pthreads(SplitModuleCount);
   SmallVector<ThreadData, 4> ThreadDatas(SplitModuleCount);
   ThreadedFunctionQueue FuncQueue(mod.get(), SplitModuleCount);
 
+  if (SplitModuleCount > 1 && SplitModuleSched == SplitModuleStealing) {
+    // Estimate the cost of each function by the size of its bitcode, if
+    // known. This is done before any thread starts, since finding the
+    // function bodies moves the reader of the global module.
+    std::vector<uint64_t> Costs;
+    bool UseBitSizes = LazyBitcode && InputFileFormat == PNaClFormat;
+    for (Module::iterator I = mod->begin(), E = mod->end(); I != E; ++I) {
+      if (I->isMaterializable() || !I->isDeclaration())
+        Costs.push_back(UseBitSizes ? getNaClFunctionBodyBitSize(I) : 1);
+    }
+    FuncQueue.ScheduleByCost(Costs);
+  }
+
   if (SplitModuleCount == 1) {
     // No need for dynamic scheduling with one thread.
     SplitModuleSched = SplitModuleStatic;
     return compileSplitModule(Options, TheTriple, TheTarget, FeaturesStr,
-                              OLvl, ProgramName, mod.get(), NULL, 0,
-                              &FuncQueue);
+                              OLvl, ProgramName, mod.get(), NULL, NULL,
+                              NULL, 0, &FuncQueue, NULL);
   }
 
+  // Copy the parsed module-level blocks into a module per additional
+  // thread. This is done before any thread starts, since the copy reads
+  // the global module and its reader.
+  bool CopyModules = SplitModuleParseOnce && LazyBitcode &&
+      InputFileFormat == PNaClFormat;
+  for(unsigned ModuleIndex = 0; ModuleIndex < SplitModuleCount; ++ModuleIndex) {
+    ThreadDatas[ModuleIndex].CopyContext = NULL;
+    ThreadDatas[ModuleIndex].CopyModule = NULL;
+    if (!CopyModules || ModuleIndex == 0)
+      continue;
+    std::string StrError;
+    LLVMContext *CopyContext = new LLVMContext();
+    Module *CopyModule = getNaClStreamedBitcodeModuleCopy(
+        mod.get(), new ThreadedStreamingCache(StreamingObject.get()),
+        *CopyContext, &StrError);
+    if (!CopyModule) {
+      delete CopyContext;
+      report_fatal_error("Unable to copy module: " + StrError);
+    }
+    ThreadDatas[ModuleIndex].CopyContext = CopyContext;
+    ThreadDatas[ModuleIndex].CopyModule = CopyModule;
+  }
+
+  bool MergeObjects = SplitModuleMergeObjects &&
+      FileType == TargetMachine::CGFT_ObjectFile;
+  std::vector<SmallVector<char, 0> > ObjectBuffers(
+      MergeObjects ? SplitModuleCount : 0);
+
   for(unsigned ModuleIndex = 0; ModuleIndex < SplitModuleCount; ++ModuleIndex) {
     ThreadDatas[ModuleIndex].Options = &Options;
     ThreadDatas[ModuleIndex].TheTriple = &TheTriple;
@@ -743,6 +1072,8 @@ static int compileModule(StringRef ProgramName) {
     ThreadDatas[ModuleIndex].StreamingObject = StreamingObject.get();
     ThreadDatas[ModuleIndex].ModuleIndex = ModuleIndex;
     ThreadDatas[ModuleIndex].FuncQueue = &FuncQueue;
+    ThreadDatas[ModuleIndex].ObjectBuffer =
+        MergeObjects ? &ObjectBuffers[ModuleIndex] : NULL;
     if (pthread_create(&Pthreads[ModuleIndex], NULL, runCompileThread,
                         &ThreadDatas[ModuleIndex])) {
       report_fatal_error("Failed to create thread");
@@ -756,9 +1087,472 @@ static int compileModule(StringRef ProgramName) {
     if (ret != 0)
       report_fatal_error("Thread returned nonzero");
   }
+  if (MergeObjects)
+    return writeMergedObject(ProgramName, TheTarget, TheTriple,
+                             ObjectBuffers);
   return 0;
 }
 
+#if !defined(__native_client__)
+// Returns true if Arg is the option Name, or the option with its value
+// attached. Sets HasValue if the value is in the next argument instead.
+static bool IsOptionArg(StringRef Arg, StringRef Name, bool &HasValue) {
+  if (!Arg.startswith("-"))
+    return false;
+  Arg = Arg.substr(Arg.startswith("--") ? 2 : 1);
+  if (!Arg.startswith(Name))
+    return false;
+  StringRef Rest = Arg.substr(Name.size());
+  HasValue = Rest.empty();
+  return Rest.empty() || Rest.startswith("=");
+}
+
+// Returns true if Arg is -o, -o=<file> or -o<file>. Like the command line
+// parser, takes an argument naming another option that starts with "o"
+// (such as -optimize-regalloc) to be that option rather than -o<file>.
+static bool IsOutputArg(StringRef Arg, bool &HasValue) {
+  if (IsOptionArg(Arg, "o", HasValue))
+    return true;
+  if (!Arg.startswith("-"))
+    return false;
+  StringRef Name = Arg.substr(Arg.startswith("--") ? 2 : 1).split('=').first;
+  if (!Name.startswith("o"))
+    return false;
+  StringMap<cl::Option *> Options;
+  cl::getRegisteredOptions(Options);
+  return !Options.count(Name);
+}
+
+// Hashes the target that code is generated for, as the target machine
+// resolves it. Without -mcpu, some targets (such as x86) tune the code for
+// the host CPU and use the features that the host reports, none of which
+// the command line shows.
+static void HashTarget(MD5 &Hash) {
+  CodeGenOpt::Level OLvl;
+  if (UserDefinedTriple.empty() || !GetOptLevel(OLvl))
+    return; // compileModule reports the error.
+  Triple TheTriple(Triple::normalize(UserDefinedTriple));
+  std::string Error;
+  const Target *TheTarget = TargetRegistry::lookupTarget(MArch, TheTriple,
+                                                         Error);
+  if (!TheTarget)
+    return;
+  OwningPtr<TargetMachine> Target(
+      TheTarget->createTargetMachine(TheTriple.getTriple(), MCPU,
+                                     GetFeaturesStr(), TargetOptions(),
+                                     RelocModel, CMModel, OLvl));
+  if (!Target)
+    return;
+  std::string CPU = Target->getTargetCPU();
+  if (CPU.empty())
+    CPU = sys::getHostCPUName();
+  // The feature bits include the features detected on the host.
+  uint64_t FeatureBits = 0;
+  if (const TargetSubtargetInfo *STI = Target->getSubtargetImpl())
+    FeatureBits = STI->getFeatureBits();
+  std::string Desc;
+  raw_string_ostream OS(Desc);
+  OS << Target->getTargetTriple() << '\0' << CPU << '\0'
+     << Target->getTargetFeatureString() << '\0' << FeatureBits << '\0'
+     << Target->getRelocationModel() << '\0' << Target->getCodeModel()
+     << '\0' << Target->getOptLevel();
+  Hash.update(OS.str());
+}
+
+// Every option may change the generated code, so all of them are hashed
+// except those naming files, along with the target they resolve to.
+static std::string GetCommandLineKey(int argc, char **argv) {
+  MD5 Hash;
+  Hash.update(PACKAGE_VERSION);
+  HashTarget(Hash);
+  for (int i = 1; i < argc; ++i) {
+    StringRef Arg(argv[i]);
+    bool HasValue = false;
+    // Skip the input file name, but not options that happen to be spelled
+    // the same.
+    if (unsigned(i) == InputFilename.getPosition() && Arg == InputFilename)
+      continue;
+    if (IsOutputArg(Arg, HasValue) ||
+        IsOptionArg(Arg, "translation-cache-dir", HasValue) ||
+        IsOptionArg(Arg, "function-cache-dir", HasValue)) {
+      if (HasValue)
+        ++i;
+      continue;
+    }
+    // Separate the arguments, so that they hash differently when joined.
+    Hash.update(Arg);
+    Hash.update(StringRef("\0", 1));
+  }
+  MD5::MD5Result Result;
+  Hash.final(Result);
+  SmallString<32> Key;
+  MD5::stringifyResult(Result, Key);
+  return Key.str();
+}
+
+// Computes the name of the cache entry for the input, from a hash of the
+// input bytes and of the command line.
+static std::string GetTranslationCacheKey(StringRef Input, int argc,
+                                          char **argv) {
+  MD5 Hash;
+  Hash.update(GetCommandLineKey(argc, argv));
+  Hash.update(Input);
+  MD5::MD5Result Result;
+  Hash.final(Result);
+  SmallString<32> Key;
+  MD5::stringifyResult(Result, Key);
+  return Key.str();
+}
+
+// Copies the cached object to the output file. Returns false if there is
+// no cached object.
+static bool CopyCachedObject(StringRef CachePath, StringRef OutFilename) {
+  OwningPtr<MemoryBuffer> Cached;
+  if (MemoryBuffer::getFile(CachePath, Cached))
+    return false;
+  std::string Error;
+  tool_output_file Out(OutFilename.data(), Error, sys::fs::F_Binary);
+  if (!Error.empty()) {
+    errs() << Error << '\n';
+    return false;
+  }
+  Out.os().write(Cached->getBufferStart(), Cached->getBufferSize());
+  Out.os().close();
+  if (Out.os().has_error()) {
+    Out.os().clear_error();
+    return false;
+  }
+  Out.keep();
+  return true;
+}
+
+// Adds an object to a cache. The object is written to a temporary file
+// that is then renamed, so that other translators never see a partial
+// entry.
+static void WriteCacheEntry(StringRef ProgramName, StringRef CachePath,
+                            StringRef Object) {
+  int FD;
+  SmallString<128> TempPath;
+  if (error_code EC = sys::fs::createUniqueFile(CachePath + "-%%%%%%%%", FD,
+                                                TempPath)) {
+    errs() << ProgramName << ": warning: unable to write translation cache: "
+           << EC.message() << "\n";
+    return;
+  }
+  {
+    raw_fd_ostream OS(FD, /*shouldClose=*/true);
+    OS << Object;
+    OS.close();
+    if (OS.has_error()) {
+      OS.clear_error();
+      sys::fs::remove(TempPath.str());
+      return;
+    }
+  }
+  if (sys::fs::rename(TempPath.str(), CachePath))
+    sys::fs::remove(TempPath.str());
+}
+
+// Adds the translated object in the output file to the cache.
+static void AddCachedObject(StringRef ProgramName, StringRef CachePath,
+                            StringRef OutFilename) {
+  OwningPtr<MemoryBuffer> Object;
+  if (MemoryBuffer::getFile(OutFilename, Object))
+    return;
+  WriteCacheEntry(ProgramName, CachePath, Object->getBuffer());
+}
+
+static int compileModuleWithCache(int argc, char **argv) {
+  StringRef ProgramName(argv[0]);
+  // Only a single object file read from a file is cached.
+  bool SingleObject = SplitModuleCount == 1 || SplitModuleMergeObjects;
+  std::string OutFilename(OutputFilename);
+  if (OutFilename.empty() && InputFilename != "-")
+    OutFilename = GetFileNameRoot(InputFilename) + ".o";
+  if (FileType != TargetMachine::CGFT_ObjectFile || !SingleObject ||
+      InputFilename == "-" || OutFilename == "-") {
+    errs() << ProgramName << ": warning: ignoring -translation-cache-dir "
+           << "without a single object file as output\n";
+    return compileModule(ProgramName);
+  }
+
+  std::string Key;
+  {
+    OwningPtr<MemoryBuffer> Input;
+    if (error_code EC = MemoryBuffer::getFile(InputFilename, Input)) {
+      errs() << ProgramName << ": " << InputFilename << ": " << EC.message()
+             << "\n";
+      return 1;
+    }
+    Key = GetTranslationCacheKey(Input->getBuffer(), argc, argv);
+  }
+  if (error_code EC = sys::fs::create_directories(TranslationCacheDir)) {
+    errs() << ProgramName << ": warning: unable to create translation cache: "
+           << EC.message() << "\n";
+    return compileModule(ProgramName);
+  }
+  SmallString<128> CachePath(TranslationCacheDir);
+  sys::path::append(CachePath, Key + ".o");
+
+  if (CopyCachedObject(CachePath, OutFilename))
+    return 0;
+
+  // Only one translator compiles a missing entry; the others wait for it
+  // to be added instead of translating the same input.
+  while (true) {
+    LockFileManager Lock(CachePath);
+    switch (Lock) {
+    case LockFileManager::LFS_Error:
+      return compileModule(ProgramName);
+    case LockFileManager::LFS_Owned: {
+      // The entry may have been added since it was last looked up.
+      if (CopyCachedObject(CachePath, OutFilename))
+        return 0;
+      int ret = compileModule(ProgramName);
+      if (ret == 0)
+        AddCachedObject(ProgramName, CachePath, OutFilename);
+      return ret;
+    }
+    case LockFileManager::LFS_Shared:
+      Lock.waitForUnlock();
+      if (CopyCachedObject(CachePath, OutFilename))
+        return 0;
+      // The owner failed to add the entry, or gave up waiting; try again.
+      break;
+    }
+  }
+}
+
+STATISTIC(NumFunctionCacheHits, "Number of functions found in the cache");
+STATISTIC(NumFunctionCacheMisses, "Number of functions compiled and cached");
+
+// Compiles F, or only the global variables of mod if F is null, into
+// Object.
+static int compileToObject(Module *mod, Function *F, const Triple &TheTriple,
+                           TargetMachine &Target, StringRef ProgramName,
+                           SmallVectorImpl<char> &Object) {
+  PNaClABIErrorReporter ABIErrorReporter;
+  raw_svector_ostream ROS(Object);
+  formatted_raw_ostream FOS(ROS);
+  OwningPtr<FunctionPassManager> PM(
+      createCompilePasses(mod, TheTriple, Target, ProgramName, FOS,
+                          ABIErrorReporter));
+  if (!PM)
+    return 1;
+  PM->doInitialization();
+  if (F) {
+    PM->run(*F);
+    CheckABIVerifyErrors(ABIErrorReporter, "Function " + F->getName());
+    NoteFunctionCompiled();
+    F->Dematerialize();
+  }
+  PM->doFinalization();
+  PM.reset();
+  // The reader must not outlive ABIErrorReporter while reporting to it.
+  if (PNaClABIVerify && PNaClABIVerifyInReader)
+    setNaClFunctionABIVerification(mod, 0);
+  FOS.flush();
+  ROS.flush();
+  return 0;
+}
+
+struct FunctionCacheThreadData {
+  const TargetOptions *Options;
+  const Triple *TheTriple;
+  const Target *TheTarget;
+  std::string FeaturesStr;
+  CodeGenOpt::Level OLvl;
+  std::string ProgramName;
+  Module *M;
+  // Set if M is a copy of the module, which the thread then owns.
+  LLVMContext *CopyContext;
+  unsigned ThreadIndex;
+  unsigned NumThreads;
+  // The indices of the functions to compile, and where to cache their
+  // objects. Functions that can't be cached have no cache path.
+  const std::vector<unsigned> *Misses;
+  const std::vector<std::string> *CachePaths;
+  std::vector<SmallVector<char, 0> > *Objects;
+};
+
+// Compiles every NumThreads'th function that missed the cache, starting
+// with the ThreadIndex'th, and adds their objects to the cache.
+static int compileFunctionCacheMisses(const FunctionCacheThreadData &Data) {
+  OwningPtr<LLVMContext> C(Data.CopyContext);
+  OwningPtr<Module> M(Data.CopyContext ? Data.M : NULL);
+  OwningPtr<TargetMachine> Target(
+      Data.TheTarget->createTargetMachine(Data.TheTriple->getTriple(), MCPU,
+                                          Data.FeaturesStr, *Data.Options,
+                                          RelocModel, CMModel, Data.OLvl));
+  assert(Target && "Could not allocate target machine!");
+  Target->setAsmVerbosityDefault(true);
+  if (RelaxAll)
+    Target->setMCRelaxAll(true);
+
+  // Copies of the module have their functions in the same order.
+  std::vector<Function *> Funcs;
+  for (Module::iterator I = Data.M->begin(), E = Data.M->end(); I != E; ++I) {
+    if (I->isMaterializable())
+      Funcs.push_back(I);
+  }
+  const std::vector<unsigned> &Misses = *Data.Misses;
+  for (size_t j = Data.ThreadIndex; j < Misses.size(); j += Data.NumThreads) {
+    unsigned i = Misses[j];
+    SmallVectorImpl<char> &Object = (*Data.Objects)[i + 1];
+    if (int ret = compileToObject(Data.M, Funcs[i], *Data.TheTriple, *Target,
+                                  Data.ProgramName, Object))
+      return ret;
+    ++NumFunctionCacheMisses;
+    // Other translators may be adding the same entry. Whichever renames
+    // its entry last wins, with the same object.
+    const std::string &CachePath = (*Data.CachePaths)[i];
+    if (!CachePath.empty())
+      WriteCacheEntry(Data.ProgramName, CachePath,
+                      StringRef(Object.data(), Object.size()));
+  }
+  return 0;
+}
+
+static void *runFunctionCacheThread(void *arg) {
+  FunctionCacheThreadData *Data = static_cast<FunctionCacheThreadData *>(arg);
+  int ret = compileFunctionCacheMisses(*Data);
+  return reinterpret_cast<void *>(static_cast<intptr_t>(ret));
+}
+
+static int compileWithFunctionCache(const TargetOptions &Options,
+                                    const Triple &TheTriple,
+                                    const Target *TheTarget,
+                                    const std::string &FeaturesStr,
+                                    CodeGenOpt::Level OLvl,
+                                    StringRef ProgramName, Module *mod,
+                                    ThreadedStreamingStore *StreamingObject) {
+  if (error_code EC = sys::fs::create_directories(FunctionCacheDir)) {
+    errs() << ProgramName << ": unable to create function cache: "
+           << EC.message() << "\n";
+    return 1;
+  }
+
+  OwningPtr<TargetMachine> Target(
+      TheTarget->createTargetMachine(TheTriple.getTriple(), MCPU, FeaturesStr,
+                                     Options, RelocModel, CMModel, OLvl));
+  assert(Target && "Could not allocate target machine!");
+  Target->setAsmVerbosityDefault(true);
+  if (RelaxAll)
+    Target->setMCRelaxAll(true);
+
+  // Each function is compiled into an object of its own, and the global
+  // variables into the first object, as with -split-module.
+  PNaClExternalizeSplitModule(mod);
+  std::vector<Function *> Funcs;
+  for (Module::iterator I = mod->begin(), E = mod->end(); I != E; ++I) {
+    if (I->isMaterializable())
+      Funcs.push_back(I);
+  }
+  std::vector<SmallVector<char, 0> > Objects(Funcs.size() + 1);
+  if (int ret = compileToObject(mod, NULL, TheTriple, *Target, ProgramName,
+                                Objects[0]))
+    return ret;
+  PNaClRemoveGlobalInitializers(mod);
+
+  // The key of a function hashes its body and the declarations of the
+  // global values it refers to, by name. So functions keep their keys when
+  // other functions or global variables are added or changed, as long as
+  // the symbol names they refer to stay the same.
+  std::vector<std::string> CachePaths(Funcs.size());
+  std::vector<unsigned> Misses;
+  for (size_t i = 0, e = Funcs.size(); i != e; ++i) {
+    Function *F = Funcs[i];
+    std::string ErrInfo;
+    if (F->Materialize(&ErrInfo)) {
+      errs() << ProgramName << ": " << ErrInfo << "\n";
+      return 1;
+    }
+    std::string Desc;
+    raw_string_ostream OS(Desc);
+    bool Cacheable = describeFunction(*F, OS);
+    F->Dematerialize();
+    if (!Cacheable) {
+      Misses.push_back(i);
+      continue;
+    }
+    MD5 Hash;
+    Hash.update(CommandLineKey);
+    Hash.update(OS.str());
+    MD5::MD5Result Result;
+    Hash.final(Result);
+    SmallString<32> Key;
+    MD5::stringifyResult(Result, Key);
+    SmallString<128> CachePath(FunctionCacheDir);
+    sys::path::append(CachePath, Key.str() + ".o");
+    CachePaths[i] = CachePath.str();
+
+    OwningPtr<MemoryBuffer> Cached;
+    if (!MemoryBuffer::getFile(CachePath.str(), Cached)) {
+      // The function was verified when it was compiled.
+      Objects[i + 1].append(Cached->getBufferStart(), Cached->getBufferEnd());
+      ++NumFunctionCacheHits;
+      continue;
+    }
+    Misses.push_back(i);
+  }
+
+  // Each additional thread compiles in a copy of the module, made before
+  // any thread starts. The copies take the names and the external linkage
+  // of the global values from the module.
+  unsigned NumThreads = std::min<size_t>(SplitModuleCount, Misses.size());
+  SmallVector<FunctionCacheThreadData, 4> ThreadDatas(NumThreads);
+  for (unsigned ThreadIndex = 0; ThreadIndex < NumThreads; ++ThreadIndex) {
+    FunctionCacheThreadData &Data = ThreadDatas[ThreadIndex];
+    Data.Options = &Options;
+    Data.TheTriple = &TheTriple;
+    Data.TheTarget = TheTarget;
+    Data.FeaturesStr = FeaturesStr;
+    Data.OLvl = OLvl;
+    Data.ProgramName = ProgramName.str();
+    Data.M = mod;
+    Data.CopyContext = NULL;
+    Data.ThreadIndex = ThreadIndex;
+    Data.NumThreads = NumThreads;
+    Data.Misses = &Misses;
+    Data.CachePaths = &CachePaths;
+    Data.Objects = &Objects;
+    if (ThreadIndex == 0)
+      continue;
+    std::string StrError;
+    LLVMContext *CopyContext = new LLVMContext();
+    Module *CopyModule = getNaClStreamedBitcodeModuleCopy(
+        mod, new ThreadedStreamingCache(StreamingObject), *CopyContext,
+        &StrError);
+    if (!CopyModule) {
+      delete CopyContext;
+      report_fatal_error("Unable to copy module: " + StrError);
+    }
+    Data.M = CopyModule;
+    Data.CopyContext = CopyContext;
+  }
+
+  if (NumThreads == 1) {
+    if (int ret = compileFunctionCacheMisses(ThreadDatas[0]))
+      return ret;
+  } else if (NumThreads > 1) {
+    SmallVector<pthread_t, 4> Pthreads(NumThreads);
+    for (unsigned ThreadIndex = 0; ThreadIndex < NumThreads; ++ThreadIndex) {
+      if (pthread_create(&Pthreads[ThreadIndex], NULL, runFunctionCacheThread,
+                         &ThreadDatas[ThreadIndex]))
+        report_fatal_error("Failed to create thread");
+    }
+    for (unsigned ThreadIndex = 0; ThreadIndex < NumThreads; ++ThreadIndex) {
+      void *retval;
+      if (pthread_join(Pthreads[ThreadIndex], &retval))
+        report_fatal_error("Failed to join thread");
+      if (reinterpret_cast<intptr_t>(retval) != 0)
+        report_fatal_error("Thread returned nonzero");
+    }
+  }
+  return writeMergedObject(ProgramName, TheTarget, TheTriple, Objects);
+}
+#endif // !defined(__native_client__)
+
 int main(int argc, char **argv) {
 #if defined(__native_client__)
   return srpc_main(argc, argv);
@@ -10,6 +10,7 @@
 // Tests if we properly sort abbreviations when building an
 // abbreviation trie.
 
+#include "llvm/ADT/STLExtras.h"
 #include "llvm/Bitcode/NaCl/AbbrevTrieNode.h"
 #include "llvm/Bitcode/NaCl/NaClBitCodes.h"
 #include "llvm/Bitcode/NaCl/NaClBitcodeValueDist.h"
@@ -969,4 +970,101 @@ TEST(NaClAbbrevTrieTest, NonsimpleArray) {
   Clear(LookupMap);
 }
 
+// Returns the abbreviations of the given trie node, in order.
+static std::vector<AbbrevIndexPair>
+GetAbbrevPairs(const AbbrevTrieNode *Node) {
+  std::vector<AbbrevIndexPair> Pairs;
+  if (Node)
+    Pairs.assign(Node->GetAbbreviations().begin(),
+                 Node->GetAbbreviations().end());
+  return Pairs;
+}
+
+// Checks that the lookup table matches Record to the same
+// abbreviations as the tries in LookupMap, and then does the same for
+// all records that extend Record with up to NumMoreValues values.
+static void CheckLookupTable(AbbrevLookupSizeMap &LookupMap,
+                             const AbbrevLookupTable &Table,
+                             NaClBitcodeRecordData &Record,
+                             unsigned NumMoreValues) {
+  std::vector<AbbrevIndexPair> Expected;
+  size_t Size = Record.Values.size() + 1;
+  if (Size > NaClValueIndexCutoff) Size = MaxValueIndex;
+  if (AbbrevTrieNode *Node = LookupMap[Size])
+    Expected = GetAbbrevPairs(Node->MatchRecord(Record));
+  ArrayRef<AbbrevIndexPair> Found = Table.MatchRecord(Record);
+  EXPECT_EQ(Expected, std::vector<AbbrevIndexPair>(Found.begin(), Found.end()))
+      << DescribeRecord(Record);
+  if (NumMoreValues == 0) return;
+  static const uint64_t Values[] = { 0, 2, 5, 7 };
+  for (size_t i = 0; i < array_lengthof(Values); ++i) {
+    Record.Values.push_back(Values[i]);
+    CheckLookupTable(LookupMap, Table, Record, NumMoreValues - 1);
+    Record.Values.pop_back();
+  }
+}
+
+TEST(NaClAbbrevTrieTest, LookupTable) {
+  // Test that the flattened lookup table matches records the same way
+  // as the tries it is built from.
+  AbbrevVector Abbrevs;
+  // [1, VBR(6)]
+  NaClBitCodeAbbrev *Abbrev = new NaClBitCodeAbbrev();
+  Abbrev->Add(NaClBitCodeAbbrevOp(1));
+  Abbrev->Add(NaClBitCodeAbbrevOp(NaClBitCodeAbbrevOp::VBR, 6));
+  Abbrevs.push_back(Abbrev);
+  // [1, 2]
+  Abbrev = new NaClBitCodeAbbrev();
+  Abbrev->Add(NaClBitCodeAbbrevOp(1));
+  Abbrev->Add(NaClBitCodeAbbrevOp(2));
+  Abbrevs.push_back(Abbrev);
+  // [VBR(6), 0, 5]
+  Abbrev = new NaClBitCodeAbbrev();
+  Abbrev->Add(NaClBitCodeAbbrevOp(NaClBitCodeAbbrevOp::VBR, 6));
+  Abbrev->Add(NaClBitCodeAbbrevOp(0));
+  Abbrev->Add(NaClBitCodeAbbrevOp(5));
+  Abbrevs.push_back(Abbrev);
+  // [Fixed(3), VBR(8), 5, Array(Fixed(8))]
+  Abbrev = new NaClBitCodeAbbrev();
+  Abbrev->Add(NaClBitCodeAbbrevOp(NaClBitCodeAbbrevOp::Fixed, 3));
+  Abbrev->Add(NaClBitCodeAbbrevOp(NaClBitCodeAbbrevOp::VBR, 8));
+  Abbrev->Add(NaClBitCodeAbbrevOp(5));
+  Abbrev->Add(NaClBitCodeAbbrevOp(NaClBitCodeAbbrevOp::Array));
+  Abbrev->Add(NaClBitCodeAbbrevOp(NaClBitCodeAbbrevOp::Fixed, 8));
+  Abbrevs.push_back(Abbrev);
+  // [2, Array(VBR(8))]
+  Abbrev = new NaClBitCodeAbbrev();
+  Abbrev->Add(NaClBitCodeAbbrevOp(2));
+  Abbrev->Add(NaClBitCodeAbbrevOp(NaClBitCodeAbbrevOp::Array));
+  Abbrev->Add(NaClBitCodeAbbrevOp(NaClBitCodeAbbrevOp::VBR, 8));
+  Abbrevs.push_back(Abbrev);
+  // [2, 7, VBR(6), 0, 2, 5, 7, Array(VBR(6))]
+  Abbrev = new NaClBitCodeAbbrev();
+  Abbrev->Add(NaClBitCodeAbbrevOp(2));
+  Abbrev->Add(NaClBitCodeAbbrevOp(7));
+  Abbrev->Add(NaClBitCodeAbbrevOp(NaClBitCodeAbbrevOp::VBR, 6));
+  Abbrev->Add(NaClBitCodeAbbrevOp(0));
+  Abbrev->Add(NaClBitCodeAbbrevOp(2));
+  Abbrev->Add(NaClBitCodeAbbrevOp(5));
+  Abbrev->Add(NaClBitCodeAbbrevOp(7));
+  Abbrev->Add(NaClBitCodeAbbrevOp(NaClBitCodeAbbrevOp::Array));
+  Abbrev->Add(NaClBitCodeAbbrevOp(NaClBitCodeAbbrevOp::VBR, 6));
+  Abbrevs.push_back(Abbrev);
+
+  AbbrevLookupSizeMap LookupMap;
+  NaClBuildAbbrevLookupMap(LookupMap, Abbrevs);
+  AbbrevLookupTable Table;
+  Table.Build(LookupMap);
+
+  NaClBitcodeRecordData Record;
+  static const uint64_t Codes[] = { 1, 2, 4, 5 };
+  for (size_t i = 0; i < array_lengthof(Codes); ++i) {
+    Record.Code = Codes[i];
+    CheckLookupTable(LookupMap, Table, Record, MaxValueIndex);
+  }
+
+  Clear(Abbrevs);
+  Clear(LookupMap);
+}
+
 }
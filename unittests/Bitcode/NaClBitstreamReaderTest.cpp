@@ -0,0 +1,266 @@
+//===- llvm/unittest/Bitcode/NaClBitstreamReaderTest.cpp ------------------===//
+//     Tests for reading NaCl bitstreams.
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+
+// Tests that bitstream cursors read back what the bitstream writer wrote,
+// both from in-memory bitcode (which is read 64 bits at a time) and
+// through the streaming interface (which is read 32 bits at a time).
+
+#include "llvm/ADT/OwningPtr.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/Bitcode/NaCl/NaClBitstreamReader.h"
+#include "llvm/Bitcode/NaCl/NaClBitstreamWriter.h"
+#include "llvm/Support/StreamableMemoryObject.h"
+#include "gtest/gtest.h"
+
+using namespace llvm;
+
+namespace {
+
+// A deterministic pseudo-random number generator, for test values.
+class TestRNG {
+public:
+  TestRNG() : State(0x2545F4914F6CDD1DULL) {}
+  uint64_t next() {
+    State ^= State >> 12;
+    State ^= State << 25;
+    State ^= State >> 27;
+    return State * 0x2545F4914F6CDD1DULL;
+  }
+  // Returns a value of 1 to 64 significant bits, favoring small values.
+  uint64_t nextValue() {
+    unsigned NumBits = 1 + next() % 64;
+    if (next() % 2)
+      NumBits = 1 + NumBits % 12;
+    return next() & (~0ULL >> (64 - NumBits));
+  }
+private:
+  uint64_t State;
+};
+
+// A value written to the bitstream, and how it was written.
+struct Field {
+  bool IsVBR;
+  unsigned NumBits;
+  uint64_t Value;
+  uint64_t BitNo;
+};
+
+static void WriteFields(std::vector<Field> &Fields,
+                        SmallVectorImpl<char> &Buffer) {
+  NaClBitstreamWriter Writer(Buffer);
+  TestRNG RNG;
+  for (unsigned i = 0; i < 4000; ++i) {
+    Field F;
+    F.IsVBR = RNG.next() % 2;
+    F.BitNo = Writer.GetCurrentBitNo();
+    if (F.IsVBR) {
+      F.NumBits = 2 + RNG.next() % 31;
+      F.Value = RNG.nextValue();
+      Writer.EmitVBR64(F.Value, F.NumBits);
+    } else {
+      F.NumBits = 1 + RNG.next() % 32;
+      F.Value = RNG.nextValue() & (~0ULL >> (64 - F.NumBits));
+      Writer.Emit(uint32_t(F.Value), F.NumBits);
+    }
+    Fields.push_back(F);
+  }
+  Writer.FlushToWord();
+}
+
+static void CheckFields(NaClBitstreamReader &Reader,
+                        const std::vector<Field> &Fields) {
+  NaClBitstreamCursor Cursor(Reader);
+  for (size_t i = 0, e = Fields.size(); i != e; ++i) {
+    const Field &F = Fields[i];
+    ASSERT_EQ(F.BitNo, Cursor.GetCurrentBitNo());
+    if (F.IsVBR)
+      ASSERT_EQ(F.Value, Cursor.ReadVBR64(F.NumBits)) << "field " << i;
+    else
+      ASSERT_EQ(F.Value, Cursor.Read(F.NumBits)) << "field " << i;
+  }
+
+  // Jump back to fields, and read them again.
+  for (size_t i = 0, e = Fields.size(); i < e; i += 37) {
+    const Field &F = Fields[i];
+    Cursor.JumpToBit(F.BitNo);
+    ASSERT_EQ(F.BitNo, Cursor.GetCurrentBitNo());
+    if (F.IsVBR)
+      ASSERT_EQ(F.Value, Cursor.ReadVBR64(F.NumBits)) << "field " << i;
+    else
+      ASSERT_EQ(F.Value, Cursor.Read(F.NumBits)) << "field " << i;
+  }
+}
+
+TEST(NaClBitstreamReaderTest, ReadFieldsFromMemory) {
+  std::vector<Field> Fields;
+  SmallVector<char, 1024> Buffer;
+  WriteFields(Fields, Buffer);
+  const unsigned char *Start =
+      reinterpret_cast<const unsigned char *>(Buffer.data());
+  NaClBitstreamReader Reader(Start, Start + Buffer.size());
+  CheckFields(Reader, Fields);
+}
+
+TEST(NaClBitstreamReaderTest, ReadFieldsFromStream) {
+  std::vector<Field> Fields;
+  SmallVector<char, 1024> Buffer;
+  WriteFields(Fields, Buffer);
+  const unsigned char *Start =
+      reinterpret_cast<const unsigned char *>(Buffer.data());
+  NaClBitstreamReader Reader(
+      getNonStreamedMemoryObject(Start, Start + Buffer.size()));
+  CheckFields(Reader, Fields);
+}
+
+// Writes a block with a record for each kind of array abbreviation, plus
+// an unabbreviated record.
+static void WriteArrayRecords(SmallVectorImpl<char> &Buffer,
+                              SmallVectorImpl<uint64_t> &Values,
+                              SmallVectorImpl<uint64_t> &Chars) {
+  TestRNG RNG;
+  for (unsigned i = 0; i < 100; ++i)
+    Values.push_back(RNG.nextValue() & 0xffff);
+  const char *Char6 = "abcxyzABCXYZ0189._";
+  for (const char *C = Char6; *C; ++C)
+    Chars.push_back(*C);
+
+  NaClBitstreamWriter Writer(Buffer);
+  Writer.EnterSubblock(8, naclbitc::DEFAULT_MAX_ABBREV + 3);
+  NaClBitCodeAbbrevOp::Encoding Encodings[3] = {
+    NaClBitCodeAbbrevOp::Fixed, NaClBitCodeAbbrevOp::VBR,
+    NaClBitCodeAbbrevOp::Char6
+  };
+  for (unsigned i = 0; i < 3; ++i) {
+    NaClBitCodeAbbrev *Abbrev = new NaClBitCodeAbbrev();
+    Abbrev->Add(NaClBitCodeAbbrevOp(i + 1));
+    Abbrev->Add(NaClBitCodeAbbrevOp(NaClBitCodeAbbrevOp::Array));
+    if (Encodings[i] == NaClBitCodeAbbrevOp::Char6)
+      Abbrev->Add(NaClBitCodeAbbrevOp(Encodings[i]));
+    else
+      Abbrev->Add(NaClBitCodeAbbrevOp(Encodings[i], i == 0 ? 16 : 6));
+    Writer.EmitAbbrev(Abbrev);
+  }
+  Writer.EmitRecord(1, Values, naclbitc::FIRST_APPLICATION_ABBREV);
+  Writer.EmitRecord(2, Values, naclbitc::FIRST_APPLICATION_ABBREV + 1);
+  Writer.EmitRecord(3, Chars, naclbitc::FIRST_APPLICATION_ABBREV + 2);
+  Writer.EmitRecord(4, Values);
+  Writer.ExitBlock();
+}
+
+TEST(NaClBitstreamReaderTest, ReadAndSkipArrayRecords) {
+  SmallVector<char, 1024> Buffer;
+  SmallVector<uint64_t, 128> Values;
+  SmallVector<uint64_t, 128> Chars;
+  WriteArrayRecords(Buffer, Values, Chars);
+  const unsigned char *Start =
+      reinterpret_cast<const unsigned char *>(Buffer.data());
+  NaClBitstreamReader Reader(Start, Start + Buffer.size());
+
+  // Read the records with one cursor, and skip them with another.
+  NaClBitstreamCursor ReadCursor(Reader);
+  NaClBitstreamCursor SkipCursor(Reader);
+  NaClBitstreamCursor *Cursors[2] = { &ReadCursor, &SkipCursor };
+  for (unsigned i = 0; i < 2; ++i) {
+    NaClBitstreamEntry Entry = Cursors[i]->advance(0, 0);
+    ASSERT_EQ(NaClBitstreamEntry::SubBlock, Entry.Kind);
+    ASSERT_EQ(8u, Entry.ID);
+    ASSERT_FALSE(Cursors[i]->EnterSubBlock(Entry.ID));
+  }
+  for (unsigned Code = 1; Code <= 4; ++Code) {
+    NaClBitstreamEntry ReadEntry = ReadCursor.advance(0, 0);
+    NaClBitstreamEntry SkipEntry = SkipCursor.advance(0, 0);
+    ASSERT_EQ(NaClBitstreamEntry::Record, ReadEntry.Kind);
+    ASSERT_EQ(ReadEntry.ID, SkipEntry.ID);
+    SmallVector<uint64_t, 128> Record;
+    EXPECT_EQ(Code, ReadCursor.readRecord(ReadEntry.ID, Record));
+    SkipCursor.skipRecord(SkipEntry.ID);
+    EXPECT_EQ(ReadCursor.GetCurrentBitNo(), SkipCursor.GetCurrentBitNo());
+    const SmallVectorImpl<uint64_t> &Expected = Code == 3 ? Chars : Values;
+    ASSERT_EQ(Expected.size(), Record.size());
+    for (size_t i = 0, e = Record.size(); i != e; ++i)
+      EXPECT_EQ(Expected[i], Record[i]);
+  }
+  EXPECT_EQ(NaClBitstreamEntry::EndBlock, ReadCursor.advance(0, 0).Kind);
+  EXPECT_TRUE(ReadCursor.AtEndOfStream());
+}
+
+#ifdef GTEST_HAS_DEATH_TEST
+TEST(NaClBitstreamReaderTest, ArrayPastEndOfStream) {
+  // Write an array record whose element count is far larger than the
+  // elements that follow it.
+  SmallVector<char, 64> Buffer;
+  NaClBitstreamWriter Writer(Buffer);
+  Writer.EnterSubblock(8, naclbitc::DEFAULT_MAX_ABBREV + 1);
+  NaClBitCodeAbbrev *Abbrev = new NaClBitCodeAbbrev();
+  Abbrev->Add(NaClBitCodeAbbrevOp(1));
+  Abbrev->Add(NaClBitCodeAbbrevOp(NaClBitCodeAbbrevOp::Array));
+  Abbrev->Add(NaClBitCodeAbbrevOp(NaClBitCodeAbbrevOp::Fixed, 8));
+  Writer.EmitAbbrev(Abbrev);
+  Writer.EmitCode(naclbitc::FIRST_APPLICATION_ABBREV);
+  Writer.EmitVBR(1U << 30, 6);
+  Writer.Emit(0, 8);
+  Writer.ExitBlock();
+
+  const unsigned char *Start =
+      reinterpret_cast<const unsigned char *>(Buffer.data());
+  NaClBitstreamReader Reader(Start, Start + Buffer.size());
+  NaClBitstreamCursor Cursor(Reader);
+  NaClBitstreamEntry Entry = Cursor.advance(0, 0);
+  ASSERT_EQ(NaClBitstreamEntry::SubBlock, Entry.Kind);
+  ASSERT_FALSE(Cursor.EnterSubBlock(Entry.ID));
+  Entry = Cursor.advance(0, 0);
+  ASSERT_EQ(NaClBitstreamEntry::Record, Entry.Kind);
+  SmallVector<uint64_t, 8> Record;
+  EXPECT_DEATH(Cursor.readRecord(Entry.ID, Record),
+               "array runs past end of bitstream");
+}
+#endif // GTEST_HAS_DEATH_TEST
+
+TEST(NaClBitstreamReaderTest, CompileDecodeOps) {
+  // [7, Fixed(3), VBR(6), Array(Char6)]
+  NaClBitCodeAbbrev *Abbrev = new NaClBitCodeAbbrev();
+  Abbrev->Add(NaClBitCodeAbbrevOp(7));
+  Abbrev->Add(NaClBitCodeAbbrevOp(NaClBitCodeAbbrevOp::Fixed, 3));
+  Abbrev->Add(NaClBitCodeAbbrevOp(NaClBitCodeAbbrevOp::VBR, 6));
+  Abbrev->Add(NaClBitCodeAbbrevOp(NaClBitCodeAbbrevOp::Array));
+  Abbrev->Add(NaClBitCodeAbbrevOp(NaClBitCodeAbbrevOp::Char6));
+  EXPECT_FALSE(Abbrev->hasDecodeOps());
+  Abbrev->CompileDecodeOps();
+  ASSERT_TRUE(Abbrev->hasDecodeOps());
+  const SmallVectorImpl<NaClBitCodeAbbrevDecodeOp> &Ops =
+      Abbrev->getDecodeOps();
+  ASSERT_EQ(4u, Ops.size());
+  EXPECT_EQ(NaClBitCodeAbbrevDecodeOp::Literal, Ops[0].Kind);
+  EXPECT_EQ(7u, Ops[0].Value);
+  EXPECT_EQ(NaClBitCodeAbbrevDecodeOp::Fixed, Ops[1].Kind);
+  EXPECT_EQ(3u, Ops[1].NumBits);
+  EXPECT_EQ(NaClBitCodeAbbrevDecodeOp::VBR, Ops[2].Kind);
+  EXPECT_EQ(6u, Ops[2].NumBits);
+  EXPECT_EQ(NaClBitCodeAbbrevDecodeOp::Char6, Ops[3].Kind);
+  EXPECT_TRUE(Ops[3].IsArray);
+
+  // Copies keep the decode operations, and adding operands drops them.
+  NaClBitCodeAbbrev *Copy = Abbrev->Copy();
+  EXPECT_TRUE(Copy->hasDecodeOps());
+  Copy->Add(NaClBitCodeAbbrevOp(1));
+  EXPECT_FALSE(Copy->hasDecodeOps());
+  Copy->dropRef();
+  Abbrev->dropRef();
+
+  // Abbreviations whose record code is in an array aren't compiled.
+  Abbrev = new NaClBitCodeAbbrev();
+  Abbrev->Add(NaClBitCodeAbbrevOp(NaClBitCodeAbbrevOp::Array));
+  Abbrev->Add(NaClBitCodeAbbrevOp(NaClBitCodeAbbrevOp::Fixed, 8));
+  Abbrev->CompileDecodeOps();
+  EXPECT_FALSE(Abbrev->hasDecodeOps());
+  Abbrev->dropRef();
+}
+
+} // end of anonymous namespace